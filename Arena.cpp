@@ -0,0 +1,154 @@
+/**
+ * @file Arena.cpp - implementation of Arena and ArenaAllocated
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include "Arena.h"
+#include "SlottedPage.h"  // assertion_failure
+
+using namespace std;
+
+const size_t Arena::FIRST_CHUNK;
+const size_t Arena::MAX_CHUNK;
+const size_t ArenaAllocated::HEADER_SZ;
+
+thread_local Arena *Arena::current_arena = nullptr;
+
+Arena::~Arena() {
+    for (auto const &chunk: this->chunks)
+        delete[] chunk.bytes;
+}
+
+void *Arena::allocate(size_t size, size_t alignment) {
+    uintptr_t at = ((uintptr_t) this->next + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    if (this->next == nullptr || at + size > (uintptr_t) this->end) {
+        size_t chunk_size = this->chunks.empty() ? FIRST_CHUNK : min(2 * this->chunks.back().size, MAX_CHUNK);
+        if (chunk_size < size + alignment)
+            chunk_size = size + alignment;
+        this->chunks.push_back(Chunk(new char[chunk_size], chunk_size));
+        this->next = this->chunks.back().bytes;
+        this->end = this->next + chunk_size;
+        at = ((uintptr_t) this->next + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    }
+    this->next = (char *) (at + size);
+    this->used += size;
+    return (void *) at;
+}
+
+// Keep just the biggest chunk (the last one, unless an outsized allocation got one of its own)
+void Arena::reset() {
+    if (!this->chunks.empty()) {
+        size_t biggest = 0;
+        for (size_t i = 1; i < this->chunks.size(); i++)
+            if (this->chunks[i].size > this->chunks[biggest].size)
+                biggest = i;
+        for (size_t i = 0; i < this->chunks.size(); i++)
+            if (i != biggest)
+                delete[] this->chunks[i].bytes;
+        Chunk kept = this->chunks[biggest];
+        this->chunks.assign(1, kept);
+        this->next = kept.bytes;
+        this->end = kept.bytes + kept.size;
+    }
+    this->used = 0;
+}
+
+size_t Arena::get_bytes_reserved() const {
+    size_t total = 0;
+    for (auto const &chunk: this->chunks)
+        total += chunk.size;
+    return total;
+}
+
+void *ArenaAllocated::operator new(size_t size) {
+    Arena *arena = Arena::current();
+    char *bytes = arena != nullptr ? (char *) arena->allocate(HEADER_SZ + size)
+                                   : (char *) ::operator new(HEADER_SZ + size);
+    memcpy(bytes, &arena, sizeof(arena));
+    return bytes + HEADER_SZ;
+}
+
+void ArenaAllocated::operator delete(void *p) noexcept {
+    if (p == nullptr)
+        return;
+    char *bytes = (char *) p - HEADER_SZ;
+    Arena *arena;
+    memcpy(&arena, bytes, sizeof(arena));
+    if (arena == nullptr)
+        ::operator delete(bytes);  // else the arena's reset() gives it back
+}
+
+/**
+ * Testing function for Arena: alignment, growing past a chunk, an outsized allocation, reset() keeping a chunk for
+ * reuse, and ArenaAllocated objects from an arena and from the heap.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_arena() {
+    Arena arena;
+    arena.allocate(1, 1);
+    for (size_t alignment: {2, 4, 8, 16}) {
+        void *p = arena.allocate(3, alignment);
+        if ((uintptr_t) p % alignment != 0)
+            return assertion_failure("alignment", (double) alignment);
+    }
+    // fill several chunks with numbered ints and check none of them got overwritten
+    vector<int32_t *> ints;
+    for (int i = 0; i < 10000; i++) {
+        ints.push_back((int32_t *) arena.allocate(sizeof(int32_t), alignof(int32_t)));
+        *ints.back() = i;
+    }
+    char *outsized = (char *) arena.allocate(3 * Arena::MAX_CHUNK);
+    memset(outsized, 'x', 3 * Arena::MAX_CHUNK);
+    for (int i = 0; i < 10000; i++)
+        if (*ints[i] != i)
+            return assertion_failure("arena values", i, *ints[i]);
+    if (arena.get_bytes_used() < 10000 * sizeof(int32_t) + 3 * Arena::MAX_CHUNK)
+        return assertion_failure("bytes used", (double) arena.get_bytes_used());
+
+    arena.reset();
+    if (arena.get_bytes_used() != 0 || arena.get_bytes_reserved() < 3 * Arena::MAX_CHUNK ||
+        arena.get_bytes_reserved() > 4 * Arena::MAX_CHUNK)
+        return assertion_failure("reset", (double) arena.get_bytes_reserved());
+    if ((char *) arena.allocate(1, 1) != outsized)
+        return assertion_failure("biggest chunk reused after reset");
+
+    class Counted : public ArenaAllocated {
+    public:
+        Counted(int &live) : live(live), bytes(100, 'c') { live++; }
+
+        ~Counted() { live--; }
+
+        int &live;
+        vector<char> bytes;  // owned as usual
+    };
+    int live = 0;
+    Counted *on_heap = new Counted(live);
+    size_t used = arena.get_bytes_used();
+    {
+        ArenaScope scope(&arena);
+        Counted *in_arena = new Counted(live);
+        if (arena.get_bytes_used() < used + sizeof(Counted))
+            return assertion_failure("ArenaAllocated in the arena");
+        {
+            ArenaScope heap(nullptr);
+            Counted *off_arena = new Counted(live);
+            delete off_arena;
+            if (Arena::current() != nullptr)
+                return assertion_failure("nested scope");
+        }
+        if (Arena::current() != &arena)
+            return assertion_failure("scope restored");
+        delete in_arena;
+    }
+    if (Arena::current() != nullptr)
+        return assertion_failure("scope ended");
+    delete on_heap;
+    if (live != 0)
+        return assertion_failure("destructors", live);
+    arena.reset();
+    return true;
+}
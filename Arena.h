@@ -0,0 +1,122 @@
+/**
+ * @file Arena.h - memory that is given back all at once rather than piece by piece
+ * Arena
+ * ArenaScope
+ * ArenaAllocated
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @class Arena - a monotonic allocator: memory is handed out from big chunks by moving a pointer along, and is
+ * never given back one allocation at a time, only all of it at once by reset()
+ *
+ *      The chunks start at FIRST_CHUNK bytes and each new one is twice as big as the last (up to MAX_CHUNK, except
+ *      for an allocation bigger than that, which gets a chunk of its own). reset() keeps the biggest chunk for
+ *      next time, so an arena that is reset for each statement settles down to not allocating at all.
+ *
+ *      An arena isn't latched; it is for one thread at a time (see ArenaScope).
+ */
+class Arena {
+public:
+    static const size_t FIRST_CHUNK = 4096;
+    static const size_t MAX_CHUNK = 1 << 20;
+
+    Arena() : chunks(), next(nullptr), end(nullptr), used(0) {}
+
+    virtual ~Arena();
+
+    Arena(const Arena &other) = delete;
+
+    Arena &operator=(const Arena &other) = delete;
+
+    /**
+     * Get some memory, good until the next reset() (or until the arena is freed).
+     * @param size       bytes wanted
+     * @param alignment  a power of two, no bigger than alignof(std::max_align_t)
+     * @return           the memory
+     */
+    virtual void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    /**
+     * Give back everything that has been allocated (without running any destructors).
+     */
+    virtual void reset();
+
+    // Bytes handed out since the last reset()
+    size_t get_bytes_used() const { return used; }
+
+    // Bytes of chunks held
+    size_t get_bytes_reserved() const;
+
+    /**
+     * The arena that ArenaAllocated objects created on this thread come out of.
+     * @return  the arena, or nullptr if they are to come off the heap
+     */
+    static Arena *current() { return current_arena; }
+
+protected:
+    class Chunk {
+    public:
+        Chunk(char *bytes, size_t size) : bytes(bytes), size(size) {}
+
+        char *bytes;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;  // the last one is being handed out
+    char *next;
+    char *end;
+    size_t used;
+
+    static thread_local Arena *current_arena;
+
+    friend class ArenaScope;
+};
+
+/**
+ * @class ArenaScope - makes an arena the current one for this thread for as long as the scope lasts
+ * (and puts back whatever was current before)
+ *
+ *      A scope with nullptr for the arena sends ArenaAllocated objects back to the heap, e.g., for ones that have
+ *      to outlive the arena that is current.
+ */
+class ArenaScope {
+public:
+    ArenaScope(Arena *arena) : previous(Arena::current_arena) { Arena::current_arena = arena; }
+
+    virtual ~ArenaScope() { Arena::current_arena = previous; }
+
+    ArenaScope(const ArenaScope &other) = delete;
+
+    ArenaScope &operator=(const ArenaScope &other) = delete;
+
+protected:
+    Arena *previous;
+};
+
+/**
+ * @class ArenaAllocated - base class for objects that come out of the current arena, if there is one
+ *
+ *      Deleting one still runs its destructor (so whatever it owns is freed as usual), but its own memory is only
+ *      given back when its arena is reset. One made with no arena current comes off the heap and goes back to it
+ *      when it is deleted, as usual. Each object has a small header saying which it is.
+ */
+class ArenaAllocated {
+public:
+    static void *operator new(size_t size);
+
+    static void operator delete(void *p) noexcept;
+
+protected:
+    // room before each object for the arena it came out of (nullptr for the heap), keeping the object aligned
+    static const size_t HEADER_SZ = alignof(std::max_align_t) > sizeof(Arena *) ? alignof(std::max_align_t)
+                                                                                 : sizeof(Arena *);
+};
+
+bool test_arena();
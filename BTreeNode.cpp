@@ -4,6 +4,7 @@
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
 
+#include <algorithm>
 #include <cstring>
 #include "BTreeNode.h"
 
@@ -18,7 +19,10 @@ BTreeNode::BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
                                                                                                      id(block_id),
                                                                                                      key_profile(
                                                                                                              key_profile) {
-    if (create) {
+    if (create && block_id != 0) {
+        this->block = file.get(block_id);  // a block given back to be reused
+        this->block->clear();
+    } else if (create) {
         this->block = file.get_new();
         this->id = this->block->get_block_id();
     } else {
@@ -27,7 +31,7 @@ BTreeNode::BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
 }
 
 BTreeNode::~BTreeNode() {
-    delete this->block;
+    this->file.unpin(this->block);
     this->block = nullptr;
 }
 
@@ -37,25 +41,29 @@ void BTreeNode::save() {
 
 // Get the record and turn it into a block ID.
 BlockID BTreeNode::get_block_id(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    BlockID block_id = *(BlockID *) dbt->get_data();
-    delete dbt;
-    return block_id;
+    Dbt dbt;
+    this->block->get(record_id, dbt);
+    return *(BlockID *) dbt.get_data();
 }
 
 // Get the record and turn it into a Handle.
 Handle BTreeNode::get_handle(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    BlockID handle_block_id = *(BlockID *) dbt->get_data();
-    RecordID handle_record_id = *(RecordID *) ((char *) dbt->get_data() + sizeof(BlockID));
-    delete dbt;
+    Dbt dbt;
+    this->block->get(record_id, dbt);
+    BlockID handle_block_id = *(BlockID *) dbt.get_data();
+    RecordID handle_record_id = *(RecordID *) ((char *) dbt.get_data() + sizeof(BlockID));
     return Handle(handle_block_id, handle_record_id);
 }
 
 // Get the record and turn it into a KeyValue.
 KeyValue *BTreeNode::get_key(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char *) dbt->get_data();
+    Dbt dbt;
+    this->block->get(record_id, dbt);
+    return unmarshal_key((char *) dbt.get_data());
+}
+
+// Turn marshaled bytes back into a KeyValue.
+KeyValue *BTreeNode::unmarshal_key(const char *bytes) const {
     KeyValue *key_value = new KeyValue();
     Value value;
     uint offset = 0;
@@ -67,10 +75,7 @@ KeyValue *BTreeNode::get_key(RecordID record_id) const {
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
             uint16_t size = *(uint16_t *) (bytes + offset);
             offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
+            value.s.assign(bytes + offset, size);  // assume ascii for now
             offset += size;
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
             value.n = *(uint8_t *) (bytes + offset);
@@ -80,10 +85,54 @@ KeyValue *BTreeNode::get_key(RecordID record_id) const {
         }
         key_value->push_back(value);
     }
-    delete dbt;
     return key_value;
 }
 
+/**
+ * Compare a marshaled key to a KeyValue without unmarshaling it. Only the columns in key are compared, so a key
+ * with fewer columns than the profile matches every marshaled key that starts with it.
+ * @param bytes  marshaled key
+ * @param key    key (or leading part of a key) to compare against
+ * @return       -1 if the marshaled key is below key, 0 if equal, 1 if above (same order as Value::operator<)
+ */
+int BTreeNode::compare_key(const char *bytes, const KeyValue *key) const {
+    uint offset = 0;
+    for (uint col_num = 0; col_num < key->size(); col_num++) {
+        ColumnAttribute::DataType data_type = this->key_profile[col_num];
+        const Value &value = (*key)[col_num];
+        int cmp;
+        if (value.data_type != data_type) {
+            // the types order the values, whatever is in them
+            Value other;
+            other.data_type = data_type;
+            return other < value ? -1 : 1;
+        } else if (data_type == ColumnAttribute::DataType::INT) {
+            int32_t n = *(int32_t *) (bytes + offset);
+            offset += sizeof(int32_t);
+            cmp = n < value.n ? -1 : (value.n < n ? 1 : 0);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            uint16_t size = *(uint16_t *) (bytes + offset);
+            offset += sizeof(uint16_t);
+            size_t length = value.s.size();
+            cmp = memcmp(bytes + offset, value.s.data(), std::min((size_t) size, length));
+            if (cmp == 0)
+                cmp = size < length ? -1 : (length < size ? 1 : 0);
+            else
+                cmp = cmp < 0 ? -1 : 1;
+            offset += size;
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            int32_t n = *(uint8_t *) (bytes + offset);
+            offset += sizeof(uint8_t);
+            cmp = n < value.n ? -1 : (value.n < n ? 1 : 0);
+        } else {
+            throw DbRelationError("Only know how to compare INT, TEXT, or BOOLEAN");
+        }
+        if (cmp != 0)
+            return cmp;
+    }
+    return 0;
+}
+
 // Convert block_id into bytes.
 Dbt *BTreeNode::marshal_block_id(BlockID block_id) {
     char *bytes = new char[sizeof(BlockID)];
@@ -103,14 +152,25 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
 
 // Convert KeyValue into bytes.
 Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
+    char *bytes = new char[this->file.get_block_size()]; // more than we need
+    uint size = marshal_key(key, bytes);
+    char *right_size_bytes = new char[size];
+    memcpy(right_size_bytes, bytes, size);
+    delete[] bytes;
+    Dbt *data = new Dbt(right_size_bytes, size);
+    return data;
+}
+
+// Convert KeyValue into bytes at the given place, returning how many bytes it took.
+uint BTreeNode::marshal_key(const KeyValue *key, char *bytes) const {
+    const uint block_size = this->file.get_block_size();
     uint offset = 0;
     uint col_num = 0;
     for (auto const &data_type: this->key_profile) {
-        Value value = (*key)[col_num];
+        const Value &value = (*key)[col_num++];
 
         if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
+            if (offset + 4 > block_size - 4)
                 throw DbRelationError("index key too big to marshal");
 
             *(int32_t *) (bytes + offset) = value.n;
@@ -120,7 +180,7 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
             u_long size = (uint16_t) value.s.length();
             if (size > UINT16_MAX)
                 throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
+            if (offset + 2 + size > block_size)
                 throw DbRelationError("index key too big to marshal");
 
             *(uint16_t *) (bytes + offset) = (uint16_t) size;
@@ -129,7 +189,7 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
             offset += size;
 
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
+            if (offset + 1 > block_size - 1)
                 throw DbRelationError("index key too big to marshal");
 
             *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
@@ -139,11 +199,7 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
             throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
         }
     }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+    return offset;
 }
 
 
@@ -156,35 +212,63 @@ BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const Ke
                                                                                                                    key_profile,
                                                                                                                    false),
                                                                                                          root_id(new_root),
-                                                                                                         height(1) {
+                                                                                                         height(1),
+                                                                                                         layout(LAYOUT_VERSION),
+                                                                                                         free_head(0) {
     save();
 }
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile &key_profile) : BTreeNode(file, stat_id,
                                                                                                  key_profile, false),
                                                                                        root_id(get_block_id(ROOT)),
-                                                                                       height(get_block_id(HEIGHT)) {
+                                                                                       height(get_block_id(HEIGHT)),
+                                                                                       layout(1),
+                                                                                       free_head(0) {
+    if (this->block->size() >= LAYOUT)
+        this->layout = get_block_id(LAYOUT);
+    if (this->block->size() >= FREE)
+        this->free_head = get_block_id(FREE);
 }
 
+// Write out the stat block's records anew (which also brings the block of an older index up to date)
 void BTreeStat::save() {
-    Dbt *dbt = marshal_block_id(this->root_id);
-    bool is_new = (this->block->size() == 0);
-    if (is_new)
+    this->block->clear();
+    BlockID values[] = {this->root_id, this->height, this->layout, this->free_head};  // height, layout aren't block ids
+    for (BlockID value: values) {
+        Dbt *dbt = marshal_block_id(value);
         this->block->add(dbt);
-    else
-        this->block->put(ROOT, *dbt);
-    delete[] (char *) dbt->get_data();
-    delete dbt;
+        delete[] (char *) dbt->get_data();
+        delete dbt;
+    }
+    BTreeNode::save();
+}
 
-    dbt = marshal_block_id(this->height);  // not really a block ID but it fits
-    if (is_new)
-        this->block->add(dbt);
-    else
-        this->block->put(HEIGHT, *dbt);
+// Take the first block off the free list, for a new node to be built in (0 if there are none, so use a new block).
+BlockID BTreeStat::reuse_block() {
+    BlockID block_id = this->free_head;
+    if (block_id != 0) {
+        SlottedPage *free = this->file.get(block_id);
+        Dbt dbt;
+        free->get(1, dbt);
+        this->free_head = *(BlockID *) dbt.get_data();
+        this->file.unpin(free);
+        save();
+    }
+    return block_id;
+}
+
+// Put a block that is no longer in the tree on the front of the free list (whatever was in it is gone).
+void BTreeStat::free_block(BlockID block_id) {
+    SlottedPage *free = this->file.get(block_id);
+    free->clear();
+    Dbt *dbt = marshal_block_id(this->free_head);
+    free->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
-
-    BTreeNode::save();
+    this->file.put(free);
+    this->file.unpin(free);
+    this->free_head = block_id;
+    save();
 }
 
 
@@ -192,71 +276,56 @@ void BTreeStat::save() {
  * BTreeInterior *
  *****************/
 
+// The last child whose boundary is at or below the key (or first if they're all above it).
+BlockID BTreeRouting::child(const KeyValue *key) const {
+    auto above = std::upper_bound(this->boundaries.begin(), this->boundaries.end(), *key);
+    if (above == this->boundaries.begin())
+        return this->first;
+    return this->pointers[above - this->boundaries.begin() - 1];
+}
+
 BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(
-        file, block_id, key_profile, create), first(0), pointers(), boundaries() {
+        file, block_id, key_profile, create), routing() {
     if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
+        RecordID n = this->block->size();
         RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
+        this->routing.boundaries.reserve(n / 2);
+        this->routing.pointers.reserve(n / 2);
+        for (auto j = n; j > 0; j--) {
             if (i == 1) {
                 // first pointer
-                this->first = get_block_id(i);
+                this->routing.first = get_block_id(i);
             } else if (i % 2 != 0) {
                 // pointer
-                this->pointers.push_back(get_block_id(i));
+                this->routing.pointers.push_back(get_block_id(i));
             } else {
                 // key
                 KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
+                this->routing.boundaries.push_back(std::move(*key_value));
+                delete key_value;
             }
             i++;
         }
-        delete record_id_list;
-    }
-}
-
-BTreeInterior::~BTreeInterior() {
-    for (auto key_value: this->boundaries)
-        delete key_value;
-    this->boundaries.clear();
-}
-
-// Get next block down in tree where key must be.
-BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
-            else
-                down = this->first;
-            break;
-        }
     }
-    if (depth == 2)
-        return new BTreeLeaf(this->file, down, this->key_profile, false);
-    else
-        return new BTreeInterior(this->file, down, this->key_profile, false);
 }
 
 // Save the pointers and boundaries in the correct order
 void BTreeInterior::save() {
     Dbt *dbt;
     this->block->clear();
-    dbt = marshal_block_id(this->first);
+    dbt = marshal_block_id(this->routing.first);
     this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
-    for (uint i = 0; i < this->boundaries.size(); i++) {
+    for (uint i = 0; i < this->routing.boundaries.size(); i++) {
         // key
-        dbt = marshal_key(this->boundaries[i]);
+        dbt = marshal_key(&this->routing.boundaries[i]);
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
 
         // boundary
-        dbt = marshal_block_id(this->pointers[i]);
+        dbt = marshal_block_id(this->routing.pointers[i]);
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
@@ -265,27 +334,15 @@ void BTreeInterior::save() {
 }
 
 // Insert boundary, block_id pair into block.
-Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
-    // cout << "inserting (" << block_id << ", " << (*boundary)[0] << ") into interior node " << id; // DEBUG
-    // cout << " (pointers:" << boundaries.size() << ", unused:" << block->unused_bytes() << ") " << endl; // DEBUG
-
+Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id, BTreeStat &stat) {
     Dbt *dbt;
 
-    bool inserted = false;
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
-            this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
-            this->pointers.insert(this->pointers.begin() + i, block_id);
-            inserted = true;
-            break;
-        }
-    }
-    if (!inserted) {
-        // must go at the end
-        this->boundaries.push_back(new KeyValue(*boundary));
-        this->pointers.push_back(block_id);
-    }
+    std::vector<KeyValue> &boundaries = this->routing.boundaries;
+    BlockPointers &pointers = this->routing.pointers;
+    auto at = std::upper_bound(boundaries.begin(), boundaries.end(), *boundary) - boundaries.begin();
+    boundaries.insert(boundaries.begin() + at, *boundary);
+    pointers.insert(pointers.begin() + at, block_id);
+
     dbt = marshal_block_id(block_id);
     try {
         // following is just a check for size (the save method will redo this in the right order)
@@ -302,48 +359,68 @@ Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
         return BTreeNode::insertion_none();
 
     } catch (DbBlockNoRoomError &e) {
-        cout << "splitting " << *this << endl; // DEBUG
         delete[] (char *) dbt->get_data();
         delete dbt;
 
         // too big, so split
 
         // create the sister
-        BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
+        BTreeInterior *nnode = new BTreeInterior(this->file, stat.reuse_block(), this->key_profile, true);
 
         // only the pointer of the middle entry goes into the sister (as it's first pointer)
         // the corresponding boundary is moved up to be inserted into the parent node
-        u_long split = this->boundaries.size() / 2;
-        nnode->first = this->pointers[split];
-        KeyValue *nboundary = this->boundaries[split];
-        Insertion ret(nnode->id, *nboundary);
-        delete nboundary;
+        u_long split = boundaries.size() / 2;
+        nnode->routing.first = pointers[split];
+        Insertion ret(nnode->id, boundaries[split]);
 
         // move half of the entries to the sister
-        for (u_long i = split + 1; i < this->boundaries.size(); i++) {
-            nnode->boundaries.push_back(this->boundaries[i]);
-            nnode->pointers.push_back(this->pointers[i]);
-        }
-        this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
-        this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
-        // cout << "after split " << *this << endl; // DEBUG
-        // cout << "new sibling " << *nnode << endl; // DEBUG
+        nnode->routing.boundaries.assign(std::make_move_iterator(boundaries.begin() + split + 1),
+                                         std::make_move_iterator(boundaries.end()));
+        nnode->routing.pointers.assign(pointers.begin() + split + 1, pointers.end());
+        boundaries.erase(boundaries.begin() + split, boundaries.end());
+        pointers.erase(pointers.begin() + split, pointers.end());
 
         // save everything
         nnode->save();
         this->save();
+        delete nnode;
         return ret;
     }
 }
 
+// Add a boundary, block_id pair after all the others (for loading in order). Not saved until save().
+void BTreeInterior::append(const KeyValue *boundary, BlockID block_id) {
+    this->routing.boundaries.push_back(*boundary);
+    this->routing.pointers.push_back(block_id);
+}
+
+// Take out the given child and the boundary in front of it.
+void BTreeInterior::remove(BlockID block_id) {
+    BlockPointers &pointers = this->routing.pointers;
+    auto at = std::find(pointers.begin(), pointers.end(), block_id) - pointers.begin();
+    if (at == (long) pointers.size())
+        throw DbRelationError("no such child to remove from interior block " + to_string(this->id));
+    pointers.erase(pointers.begin() + at);
+    this->routing.boundaries.erase(this->routing.boundaries.begin() + at);
+}
+
+// Change the boundary in front of the given child (which must still be in order with its neighbors).
+void BTreeInterior::set_boundary(BlockID block_id, const KeyValue &boundary) {
+    BlockPointers &pointers = this->routing.pointers;
+    auto at = std::find(pointers.begin(), pointers.end(), block_id) - pointers.begin();
+    if (at == (long) pointers.size())
+        throw DbRelationError("no such child in interior block " + to_string(this->id));
+    this->routing.boundaries[at] = boundary;
+}
 
 ostream &operator<<(ostream &out, const BTreeInterior &node) {
-    out << "(interior block " << node.id << "): " << node.first;
-    if (node.boundaries.size() != node.pointers.size()) {
-        out << " MISMATCH boundaries: " << node.boundaries.size() << ", pointers: " << node.pointers.size();
+    const BTreeRouting &routing = node.routing;
+    out << "(interior block " << node.id << "): " << routing.first;
+    if (routing.boundaries.size() != routing.pointers.size()) {
+        out << " MISMATCH boundaries: " << routing.boundaries.size() << ", pointers: " << routing.pointers.size();
     } else {
-        for (unsigned int i = 0; i < node.boundaries.size(); i++)
-            out << '|' << (*node.boundaries[i])[0] << '|' << node.pointers[i];
+        for (unsigned int i = 0; i < routing.boundaries.size(); i++)
+            out << '|' << routing.boundaries[i][0] << '|' << routing.pointers[i];
     }
     return out;
 }
@@ -356,25 +433,9 @@ ostream &operator<<(ostream &out, const BTreeInterior &node) {
 BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create) : BTreeNode(file,
                                                                                                                block_id,
                                                                                                                key_profile,
-                                                                                                               create),
-                                                                                                     next_leaf(0),
-                                                                                                     key_map() {
-    if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == record_id_list->size()) {
-                // next leaf block
-                this->next_leaf = get_block_id(i);
-            } else if (i % 2 == 0) {
-                // record i-1: handle, record i: key
-                KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i - 1);
-            }
-            i++;
-        }
-        delete record_id_list;
-    }
+                                                                                                               create) {
+    if (create)
+        reset(0);
 }
 
 BTreeLeaf::~BTreeLeaf() {
@@ -382,94 +443,212 @@ BTreeLeaf::~BTreeLeaf() {
 
 // Find the handle for a given key
 Handle BTreeLeaf::find_eq(const KeyValue *key) const {
-    return this->key_map.at(*key);
+    size_t i = lower_bound(key);
+    if (i == size() || compare_entry(i, key) != 0)
+        throw std::out_of_range("key not in leaf");
+    return get_entry_handle(i);
 }
 
-// Save the key_map and next_leaf data in the correct order
-void BTreeLeaf::save() {
-    Dbt *dbt;
+// Follow the chain of leaves.
+BTreeLeaf *BTreeLeaf::next() const {
+    BlockID next_leaf = get_next_leaf();
+    if (next_leaf == 0)
+        return nullptr;
+    return new BTreeLeaf(this->file, next_leaf, this->key_profile, false);
+}
+
+// Point this leaf at a different one to the right.
+void BTreeLeaf::set_next_leaf(BlockID next_leaf) {
+    Dbt *dbt = marshal_block_id(next_leaf);
+    this->block->put(NEXT_LEAF, *dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+}
+
+// Binary search of the entries.
+size_t BTreeLeaf::lower_bound(const KeyValue *key) const {
+    size_t low = 0, high = size();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (compare_entry(mid, key) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Compare entry i's key to the given one, in place in the block.
+int BTreeLeaf::compare_entry(size_t i, const KeyValue *key) const {
+    Dbt dbt;
+    this->block->get(entry_id(i), dbt);
+    return compare_key((char *) dbt.get_data() + HANDLE_SZ, key);
+}
+
+// Unmarshal entry i's key.
+KeyValue *BTreeLeaf::get_entry_key(size_t i) const {
+    Dbt dbt;
+    this->block->get(entry_id(i), dbt);
+    return unmarshal_key((char *) dbt.get_data() + HANDLE_SZ);
+}
+
+// Convert a handle followed by a key into the bytes of one entry.
+Dbt *BTreeLeaf::marshal_entry(const KeyValue *key, Handle handle) const {
+    char *bytes = new char[HANDLE_SZ + this->file.get_block_size()]; // more than we need
+    *(BlockID *) bytes = handle.first;
+    *(RecordID *) (bytes + sizeof(BlockID)) = handle.second;
+    uint size = HANDLE_SZ + marshal_key(key, bytes + HANDLE_SZ);
+    return new Dbt(bytes, size);
+}
+
+// Point entry i at a different row (for when the row moves but its key stays the same).
+void BTreeLeaf::set_entry_handle(size_t i, Handle handle) {
+    Dbt dbt;
+    this->block->get(entry_id(i), dbt);
+    std::string entry((char *) dbt.get_data(), dbt.get_size());
+    *(BlockID *) &entry[0] = handle.first;
+    *(RecordID *) &entry[sizeof(BlockID)] = handle.second;
+    Dbt changed(&entry[0], (u_int32_t) entry.size());
+    this->block->put(entry_id(i), changed);
+}
+
+// Add the raw bytes of each of the entries, in order.
+void BTreeLeaf::copy_entries(std::vector<std::string> &entries) const {
+    for (size_t i = 0; i < size(); i++) {
+        Dbt entry;
+        this->block->get(entry_id(i), entry);
+        entries.push_back(std::string((char *) entry.get_data(), entry.get_size()));
+    }
+}
+
+// Empty the block out, leaving just the next leaf pointer.
+void BTreeLeaf::reset(BlockID next_leaf) {
     this->block->clear();
-    for (auto const &item: this->key_map) {
-        // handle
-        dbt = marshal_handle(item.second);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+    Dbt *dbt = marshal_block_id(next_leaf);
+    this->block->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+}
 
-        // key
-        dbt = marshal_key(&item.first);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+/**
+ * After deletes, combine this leaf with the one to its right if all their entries fit in one block; otherwise
+ * share the entries out evenly (by bytes) between the two. Both are saved.
+ * @param right     the next leaf along the chain (under the same parent)
+ * @param boundary  set to the new lowest key in right when the two aren't combined
+ * @return          true if everything was moved here (right is then out of the chain and can be dropped)
+ */
+bool BTreeLeaf::rebalance(BTreeLeaf &right, KeyValue &boundary) {
+    std::vector<std::string> entries;
+    entries.reserve(size() + right.size());
+    copy_entries(entries);
+    right.copy_entries(entries);
+    uint total = 0;
+    for (auto const &entry: entries)
+        total += (uint) entry.size() + 4;  // each record also takes a header
+
+    BlockID right_next = right.get_next_leaf();
+    reset(right.id);
+    bool combined = total <= this->block->unused_bytes();
+    size_t split = entries.size();
+    if (combined) {
+        set_next_leaf(right_next);
+    } else {
+        split = 1;
+        uint kept = (uint) entries[0].size() + 4;
+        while (split + 1 < entries.size() && kept + entries[split].size() + 4 <= total / 2)
+            kept += (uint) entries[split++].size() + 4;
+    }
+    right.reset(combined ? 0 : right_next);
+    for (size_t i = 0; i < entries.size(); i++) {
+        Dbt entry((void *) entries[i].data(), (u_int32_t) entries[i].size());
+        if (i < split)
+            this->block->add(&entry);
+        else
+            right.block->add(&entry);
+    }
+    if (!combined) {
+        KeyValue *lowest = unmarshal_key(entries[split].data() + HANDLE_SZ);
+        boundary = *lowest;
+        delete lowest;
     }
-    // next leaf pointer is final record
-    dbt = marshal_block_id(this->next_leaf);
+    save();
+    right.save();
+    return combined;
+}
+
+// Add a key, handle pair after all the others (for loading in order). Not saved until save().
+void BTreeLeaf::append(const KeyValue &key, Handle handle) {
+    Dbt *dbt = marshal_entry(&key, handle);
     this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
+}
 
-    BTreeNode::save();
+// Insert key, handle pair in order if it fits, saving the block.
+bool BTreeLeaf::add(const KeyValue *key, Handle handle) {
+    Dbt *dbt = marshal_entry(key, handle);
+    bool added = true;
+    try {
+        this->block->insert(entry_id(lower_bound(key)), dbt);
+    } catch (DbBlockNoRoomError &e) {
+        added = false;
+    }
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+    if (added)
+        save();
+    return added;
 }
 
 // Insert key, handle pair into block.
-Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
-    // cout << "inserting " << (*key)[0] << " into leaf " << id << endl; // DEBUG
+Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle, BTreeStat &stat) {
     // check unique
-    if (this->key_map.find(*key) != this->key_map.end())
+    size_t at = lower_bound(key);
+    if (at < size() && compare_entry(at, key) == 0)
         throw DbRelationError("Duplicate keys are not allowed in unique index");
 
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
+    Dbt *dbt = marshal_entry(key, handle);
     try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
+        this->block->insert(entry_id(at), dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
 
         // that worked, so no need to split
-        this->key_map[*key] = handle;
         save();
         return BTreeNode::insertion_none();
 
     } catch (DbBlockNoRoomError &e) {
+        // too big, so split
+
+        // copy out the entries with the new one in its place
+        std::vector<std::string> entries;
+        entries.reserve(size() + 1);
+        copy_entries(entries);
+        entries.insert(entries.begin() + at, std::string((char *) dbt->get_data(), dbt->get_size()));
         delete[] (char *) dbt->get_data();
         delete dbt;
 
-        // too big, so split
-
         // create the sister and put her to the right
-        BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
-        nleaf->next_leaf = this->next_leaf;
-        this->next_leaf = nleaf->id;
-
-        // move half of the entries to the sister
-        auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
-        u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
-        this->key_map.clear();               // empty my list
-        u_long i = 0;
-        KeyValue boundary;
-        for (auto const &item: key_list) {
-            if (i < split) {
-                this->key_map[item.first] = item.second;
-            } else if (i == split) {
-                boundary = item.first;
-                nleaf->key_map[boundary] = item.second;
-            } else {
-                nleaf->key_map[item.first] = item.second;
-            }
-            i++;
+        BTreeLeaf *nleaf = new BTreeLeaf(this->file, stat.reuse_block(), this->key_profile, true);
+        nleaf->set_next_leaf(get_next_leaf());
+        BlockID nleaf_id = nleaf->id;
+
+        // move half of the entries to the sister (the first of hers is the new boundary)
+        u_long split = entries.size() / 2;
+        reset(nleaf_id);
+        for (u_long i = 0; i < entries.size(); i++) {
+            Dbt entry((void *) entries[i].data(), (u_int32_t) entries[i].size());
+            if (i < split)
+                this->block->add(&entry);
+            else
+                nleaf->block->add(&entry);
         }
-        cout << "splitting leaf " << id << ", new sibling " << nleaf->id; // DEBUG
-        cout << " starting at value " << boundary[0] << endl; // DEBUG
-
+        KeyValue *boundary = unmarshal_key(entries[split].data() + HANDLE_SZ);
+        Insertion ret(nleaf_id, *boundary);
+        delete boundary;
         nleaf->save();
         this->save();
-        return Insertion(nleaf->id, boundary);
+        delete nleaf;
+        return ret;
     }
 }
-
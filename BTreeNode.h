@@ -11,13 +11,13 @@
 
 typedef std::vector<ColumnAttribute::DataType> KeyProfile;
 typedef std::vector<Value> KeyValue;
-typedef std::vector<KeyValue *> KeyValues;
 typedef std::vector<BlockID> BlockPointers;
 typedef std::pair<BlockID, KeyValue> Insertion;
+typedef std::vector<std::pair<KeyValue, Handle>> KeyEntries;
 
 class BTreeNode {
 public:
-    BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
+    BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);  // create: in block_id if not 0
 
     virtual ~BTreeNode();
 
@@ -29,6 +29,8 @@ public:
 
     BlockID get_id() const { return this->id; }
 
+    u_int16_t unused_bytes() const { return this->block->unused_bytes(); }
+
 protected:
     SlottedPage *block;
     HeapFile &file;
@@ -41,6 +43,12 @@ protected:
 
     virtual Dbt *marshal_key(const KeyValue *key);
 
+    uint marshal_key(const KeyValue *key, char *bytes) const;  // bytes must have room for a block
+
+    KeyValue *unmarshal_key(const char *bytes) const;  // freed by caller
+
+    int compare_key(const char *bytes, const KeyValue *key) const;  // on just key's columns: -1, 0, or 1
+
     virtual BlockID get_block_id(RecordID record_id) const;
 
     virtual Handle get_handle(RecordID record_id) const;
@@ -48,10 +56,18 @@ protected:
     virtual KeyValue *get_key(RecordID record_id) const;
 };
 
+/**
+ * @class BTreeStat - the first block of an index: where its root is, how tall it is, and which layout its nodes
+ * have (an index from before the layout was recorded has no LAYOUT record, and counts as layout 1), and the head of
+ * the list of blocks given back by merges for new nodes to reuse (each free block's one record is the next one's id)
+ */
 class BTreeStat : public BTreeNode {
 public:
     static const RecordID ROOT = 1;  // where we store the root id in the stat block
     static const RecordID HEIGHT = ROOT + 1;  // where we store the height in the stat block
+    static const RecordID LAYOUT = HEIGHT + 1;  // where we store the layout version in the stat block
+    static const uint32_t LAYOUT_VERSION = 2;  // leaf entries sorted in the page (1: unsorted, decoded into a map)
+    static const RecordID FREE = LAYOUT + 1;  // where we store the first free block's id in the stat block
 
     BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile &key_profile);
 
@@ -69,47 +85,118 @@ public:
 
     void set_height(uint height) { this->height = height; }
 
+    uint32_t get_layout() const { return this->layout; }
+
+    BlockID get_free_head() const { return this->free_head; }
+
+    BlockID reuse_block();
+
+    void free_block(BlockID block_id);
+
 protected:
     BlockID root_id;
     uint height;
+    uint32_t layout;
+    BlockID free_head;
 
 };
 
+/**
+ * @class BTreeRouting - the decoded contents of an interior node: which child to go down to for any key
+ */
+class BTreeRouting {
+public:
+    BTreeRouting() : first(0), boundaries(), pointers() {}
+
+    BlockID first;  // child for keys below all the boundaries
+    std::vector<KeyValue> boundaries;  // in order
+    BlockPointers pointers;  // pointers[i] is the child for keys from boundaries[i] up to the next boundary
+
+    BlockID child(const KeyValue *key) const;  // binary search of the boundaries
+};
+
 class BTreeInterior : public BTreeNode {
 public:
     BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
-    virtual ~BTreeInterior();
+    virtual ~BTreeInterior() {}
 
-    BTreeNode *find(const KeyValue *key, uint depth) const;
+    const BTreeRouting &get_routing() const { return this->routing; }
 
-    Insertion insert(const KeyValue *boundary, BlockID block_id);
+    Insertion insert(const KeyValue *boundary, BlockID block_id, BTreeStat &stat);  // a sister comes from stat
 
     virtual void save();
 
-    void set_first(BlockID first) { this->first = first; }
+    void set_first(BlockID first) { this->routing.first = first; }
+
+    BlockID get_first() const { return this->routing.first; }
+
+    void append(const KeyValue *boundary, BlockID block_id);  // boundary must be above all the others
+
+    void remove(BlockID block_id);  // drop a child (not the first) and its boundary; not saved until save()
+
+    void set_boundary(BlockID block_id, const KeyValue &boundary);  // for a child (not the first); not saved yet
 
     friend std::ostream &operator<<(std::ostream &out, const BTreeInterior &node);
 
 protected:
-    BlockID first;
-    BlockPointers pointers;
-    KeyValues boundaries;
+    BTreeRouting routing;
 };
 
+/**
+ * @class BTreeLeaf - entries kept in key order right in the block, so a search is a binary search of the marshaled
+ * keys and an insert just slots one record in; nothing is decoded except to split. (HashIndex uses the same layout
+ * for its bucket blocks, with the next leaf pointer chaining the overflow blocks.)
+ *
+ *      Record 1: block id of the next leaf to the right (0 if none)
+ *      Record 2 on: one entry each, handle (block id, record id) followed by the marshaled key
+ */
 class BTreeLeaf : public BTreeNode {
 public:
+    static const RecordID NEXT_LEAF = 1;  // where the next leaf pointer is; the entries come after it
+
     BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile &key_profile, bool create);
 
     virtual ~BTreeLeaf();
 
-    Handle find_eq(const KeyValue *key) const;  // throws if not found
-    Insertion insert(const KeyValue *key, Handle handle);
+    Handle find_eq(const KeyValue *key) const;  // throws std::out_of_range if not found
+    Insertion insert(const KeyValue *key, Handle handle, BTreeStat &stat);  // a sister comes from stat
 
-    virtual void save();
+    bool add(const KeyValue *key, Handle handle);  // insert without splitting; false if no room (no check for dups)
+
+    void append(const KeyValue &key, Handle handle);  // key must be above all the others; not saved until save()
+
+    void del(size_t i) { this->block->remove(entry_id(i)); }  // not saved until save()
+
+    void set_entry_handle(size_t i, Handle handle);  // not saved until save()
+
+    bool rebalance(BTreeLeaf &right, KeyValue &boundary);
+
+    void reset(BlockID next_leaf);  // take out all the entries; not saved until save()
+
+    BlockID get_next_leaf() const { return get_block_id(NEXT_LEAF); }
+
+    BTreeLeaf *next() const;  // the leaf to the right, or nullptr at the end (freed by caller)
+
+    void set_next_leaf(BlockID next_leaf);  // not saved until save()
+
+    size_t size() const { return this->block->size() - 1U; }
+
+    size_t lower_bound(const KeyValue *key) const;  // first entry at or above key (on just key's columns)
+
+    int compare_entry(size_t i, const KeyValue *key) const;  // compare_key of entry i
+
+    KeyValue *get_entry_key(size_t i) const;  // freed by caller
+
+    Handle get_entry_handle(size_t i) const { return get_handle(entry_id(i)); }
 
 protected:
-    BlockID next_leaf;
-    std::map<KeyValue, Handle> key_map;
+    static const uint HANDLE_SZ = sizeof(BlockID) + sizeof(RecordID);  // bytes before the key in an entry
+
+    static RecordID entry_id(size_t i) { return (RecordID) (i + NEXT_LEAF + 1); }
+
+    Dbt *marshal_entry(const KeyValue *key, Handle handle) const;
+
+    void copy_entries(std::vector<std::string> &entries) const;
 };
 
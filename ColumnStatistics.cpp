@@ -0,0 +1,198 @@
+/**
+ * @file ColumnStatistics.cpp - implementation of HyperLogLog, ColumnStatistics, and TableStatistics
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include "ColumnStatistics.h"
+
+const double TableStatistics::DEFAULT_SELECTIVITY = 0.1;
+
+// Note the hash's register and the leading zeros of the rest of it
+void HyperLogLog::add(uint64_t hash) {
+    uint register_no = (uint) (hash >> (64 - PRECISION));
+    uint64_t rest = hash << PRECISION;
+    uint8_t rank = 1;
+    while (rank <= 64 - PRECISION && (rest & (1ULL << 63)) == 0) {
+        rank++;
+        rest <<= 1;
+    }
+    if (rank > this->registers[register_no])
+        this->registers[register_no] = rank;
+}
+
+double HyperLogLog::estimate() const {
+    double m = (double) this->registers.size();
+    double sum = 0.0;
+    uint empty = 0;
+    for (auto rank: this->registers) {
+        sum += std::ldexp(1.0, -rank);
+        if (rank == 0)
+            empty++;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && empty > 0)
+        estimate = m * std::log(m / empty);  // linear counting is better for small counts
+    return estimate;
+}
+
+// The splitmix64 finalizer, so that nearby numbers get unrelated hashes
+uint64_t HyperLogLog::hash(int32_t n) {
+    uint64_t h = (uint64_t) (uint32_t) n + 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+// FNV-1a over the characters, then mixed like an INT
+uint64_t HyperLogLog::hash(const char *s, uint size) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (uint i = 0; i < size; i++) {
+        h ^= (uint8_t) s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return hash((int32_t) (h ^ (h >> 32)));
+}
+
+/**
+ * A value outside the sample's range is taken not to be there at all. One that is at least two of the histogram's
+ * bounds fills the buckets between them. Anything else is as common as the average value.
+ */
+double ColumnStatistics::selectivity(const Value &value) const {
+    if (this->distinct < 1)
+        return 0.0;  // no rows
+    Value key = summary(value);
+    if (key < this->min || this->max < key)
+        return 0.0;
+    size_t equal = (size_t) std::count(this->bounds.begin(), this->bounds.end(), key);
+    if (equal >= 2)
+        return (double) (equal - 1) / (double) (this->bounds.size() - 1);
+    return 1.0 / this->distinct;
+}
+
+Value ColumnStatistics::summary(const Value &value) const {
+    if (this->data_type == ColumnAttribute::TEXT)
+        return Value(value.s.substr(0, PREFIX_SIZE));
+    return Value(value.n);
+}
+
+std::string ColumnStatistics::encode(const Value &value) const {
+    if (this->data_type == ColumnAttribute::TEXT)
+        return value.s;
+    return std::to_string(value.n);
+}
+
+Value ColumnStatistics::decode(const std::string &text) const {
+    if (this->data_type == ColumnAttribute::TEXT)
+        return Value(text);
+    return Value((int32_t) std::strtol(text.c_str(), nullptr, 10));
+}
+
+// INT bounds are separated by spaces; each TEXT bound is its length, a colon, and its characters
+std::string ColumnStatistics::encode_histogram() const {
+    std::ostringstream out;
+    for (size_t i = 0; i < this->bounds.size(); i++) {
+        if (this->data_type == ColumnAttribute::TEXT)
+            out << this->bounds[i].s.size() << ':' << this->bounds[i].s;
+        else
+            out << (i == 0 ? "" : " ") << this->bounds[i].n;
+    }
+    return out.str();
+}
+
+void ColumnStatistics::decode_histogram(const std::string &text) {
+    this->bounds.clear();
+    std::istringstream in(text);
+    if (this->data_type != ColumnAttribute::TEXT) {
+        int32_t n;
+        while (in >> n)
+            this->bounds.push_back(Value(n));
+        return;
+    }
+    size_t size;
+    char colon;
+    while (in >> size >> colon && colon == ':') {
+        std::string bound(size, ' ');
+        if (!in.read(&bound[0], (std::streamsize) size))
+            break;
+        this->bounds.push_back(Value(bound));
+    }
+}
+
+/**
+ * The row count is the sample's rows per block times the table's blocks. The sample's distinct values are counted
+ * with a HyperLogLog for each column; if nearly every sampled value was different the column is taken to be
+ * mostly unique, so that the rest of the table has its own share of new values, otherwise the sample is taken to
+ * have seen them all. The histograms are built from the sorted sample.
+ */
+TableStatistics *TableStatistics::sample(DbRelation &table) {
+    const ColumnNames &column_names = table.get_column_names();
+    const ColumnAttributes column_attributes = table.get_column_attributes();
+    uint32_t blocks = table.get_block_count();
+    uint sample_blocks = blocks < SAMPLE_BLOCKS ? blocks : SAMPLE_BLOCKS;
+    std::vector<HyperLogLog> sketches(column_names.size());
+    std::vector<std::vector<Value>> values(column_names.size());
+    u_long rows = 0;
+    for (uint i = 0; i < sample_blocks; i++) {
+        BlockID block_id = (BlockID) (1 + (uint64_t) i * blocks / sample_blocks);
+        DbCursor *cursor = table.cursor(nullptr, block_id, block_id);
+        try {
+            Row row;
+            while (cursor->next()) {
+                cursor->project_row(nullptr, row);
+                rows++;
+                for (uint c = 0; c < row.size(); c++) {
+                    if (row.get_data_type(c) == ColumnAttribute::TEXT) {
+                        sketches[c].add(HyperLogLog::hash(row.get_s(c), row.get_size(c)));
+                        uint size = std::min((uint) row.get_size(c), ColumnStatistics::PREFIX_SIZE);
+                        values[c].push_back(Value(std::string(row.get_s(c), size)));
+                    } else {
+                        sketches[c].add(HyperLogLog::hash(row.get_n(c)));
+                        values[c].push_back(Value(row.get_n(c)));
+                    }
+                }
+            }
+        } catch (...) {
+            delete cursor;
+            throw;
+        }
+        delete cursor;
+    }
+
+    TableStatistics *statistics = new TableStatistics();
+    statistics->sampled_blocks = sample_blocks;
+    statistics->row_count = sample_blocks == 0 ? 0.0 : rows * (double) blocks / sample_blocks;
+    for (uint c = 0; c < column_names.size(); c++) {
+        ColumnStatistics &column = statistics->columns[column_names[c]];
+        column.data_type = column_attributes[c].get_data_type();
+        double seen = std::min(sketches[c].estimate(), (double) rows);
+        if (sample_blocks < blocks && seen > 0.9 * rows)
+            seen *= (double) blocks / sample_blocks;
+        column.distinct = rows == 0 ? 0.0 : std::max(1.0, std::min(seen, statistics->row_count));
+
+        std::vector<Value> &sorted = values[c];
+        std::sort(sorted.begin(), sorted.end());
+        if (sorted.empty())
+            continue;
+        column.min = sorted.front();
+        column.max = sorted.back();
+        if (sorted.size() < 2)
+            continue;
+        size_t buckets = std::min((size_t) ColumnStatistics::BUCKETS, sorted.size() - 1);
+        for (size_t b = 0; b <= buckets; b++)
+            column.bounds.push_back(sorted[b * (sorted.size() - 1) / buckets]);
+    }
+    return statistics;
+}
+
+double TableStatistics::matching_rows(const ValueDict &values) const {
+    double rows = this->row_count;
+    for (auto const &item: values) {
+        auto found = this->columns.find(item.first);
+        rows *= found == this->columns.end() ? DEFAULT_SELECTIVITY : found->second.selectivity(item.second);
+    }
+    return rows;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file ColumnStatistics.h - what ANALYZE finds out about a table's values, for costing evaluation plans
+ * HyperLogLog
+ * ColumnStatistics
+ * TableStatistics
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include "storage_engine.h"
+
+/**
+ * @class HyperLogLog - estimates how many distinct values it has been shown, in a fixed 2^PRECISION bytes
+ *
+ *      Each value's hash picks a register (its top PRECISION bits) and the register keeps the longest run of
+ *      leading zeros seen in the rest of the hashes that picked it. The estimate is the harmonic mean of 2^register
+ *      over the registers, scaled; small counts are estimated from the number of registers still empty instead.
+ */
+class HyperLogLog {
+public:
+    static const uint PRECISION = 10;  // 1024 registers, for about 3% error
+
+    HyperLogLog() : registers(1U << PRECISION, 0) {}
+
+    void add(uint64_t hash);
+
+    double estimate() const;
+
+    static uint64_t hash(int32_t n);
+
+    static uint64_t hash(const char *s, uint size);
+
+protected:
+    std::vector<uint8_t> registers;
+};
+
+/**
+ * @class ColumnStatistics - number of distinct values, range, and equi-depth histogram of one column
+ *
+ *      INT (and BOOLEAN) columns are summarized by their values; TEXT columns by the first PREFIX_SIZE characters
+ *      of their values (so min, max, and the histogram's bounds are prefixes). The histogram's bounds split the
+ *      sampled values into equal numbers of rows, so a value that turns up as several bounds is common enough to
+ *      fill the buckets between them.
+ */
+class ColumnStatistics {
+public:
+    static const uint BUCKETS = 16;
+    static const uint PREFIX_SIZE = 16;
+
+    ColumnStatistics() : data_type(ColumnAttribute::INT), distinct(0), min(), max(), bounds() {}
+
+    ColumnAttribute::DataType data_type;
+    double distinct;            // estimated number of distinct values in the whole table
+    Value min;                  // smallest value (prefix, for TEXT) in the sample
+    Value max;                  // largest
+    std::vector<Value> bounds;  // BUCKETS + 1 bounds, smallest first (fewer if there were few rows)
+
+    /**
+     * Estimated fraction of the table's rows having a given value in this column.
+     * @param value  the value
+     * @returns      fraction, from 0 to 1
+     */
+    double selectivity(const Value &value) const;
+
+    /**
+     * What a value is summarized by: itself, or for TEXT its prefix.
+     * @param value  a value of this column
+     * @returns      the value to compare to min, max, or the bounds
+     */
+    Value summary(const Value &value) const;
+
+    // A value (as summarized) written out as TEXT for the _statistics table, and read back
+    std::string encode(const Value &value) const;
+
+    Value decode(const std::string &text) const;
+
+    // The histogram's bounds written out as TEXT for the _statistics table, and read back
+    std::string encode_histogram() const;
+
+    void decode_histogram(const std::string &text);
+};
+
+/**
+ * @class TableStatistics - estimated row count of a table, and statistics on each of its columns
+ */
+class TableStatistics {
+public:
+    static const uint SAMPLE_BLOCKS = 128;  // most blocks ANALYZE reads
+    static const double DEFAULT_SELECTIVITY;  // guess for a column with no statistics
+
+    TableStatistics() : row_count(0), sampled_blocks(0), columns() {}
+
+    double row_count;
+    uint sampled_blocks;
+    std::map<Identifier, ColumnStatistics> columns;
+
+    /**
+     * Work out a table's statistics from a sample of its blocks, spread evenly through the table (all of them,
+     * for a table of no more than SAMPLE_BLOCKS blocks).
+     * @param table  the table
+     * @returns      its statistics (freed by caller)
+     */
+    static TableStatistics *sample(DbRelation &table);
+
+    /**
+     * Estimated number of rows having all the given values (taking the columns to be independent).
+     * @param values  column values
+     * @returns       number of rows
+     */
+    double matching_rows(const ValueDict &values) const;
+};
@@ -0,0 +1,883 @@
+/**
+ * @file ColumnTable.cpp - implementation of ColumnSegment, ColumnTable, and ColumnTableCursor
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ColumnTable.h"
+
+using namespace std;
+typedef u_int16_t u16;
+
+/**
+ * The selection kernel for INT and BOOLEAN columns: set bit i of bitmap for each values[i] that equals key. Four
+ * values are compared at once with SSE2 (which every x86-64 has), the rest one at a time.
+ * @param values  the values
+ * @param n       how many
+ * @param key     value to look for
+ * @param bitmap  n bits, which are set (but never cleared)
+ */
+static void select_equal(const int32_t *values, uint n, int32_t key, uint64_t *bitmap) {
+    uint i = 0;
+#ifdef __SSE2__
+    __m128i keys = _mm_set1_epi32(key);
+    for (; i + 4 <= n; i += 4) {
+        __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (values + i)), keys);
+        uint64_t mask = (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(equal));
+        bitmap[i / 64] |= mask << (i % 64);  // i is a multiple of 4, so the 4 bits are all in one word
+    }
+#endif
+    for (; i < n; i++)
+        if (values[i] == key)
+            bitmap[i / 64] |= 1ULL << (i % 64);
+}
+
+// Number of values in the chunk of a block (0 if it doesn't have one yet)
+static uint chunk_count(SlottedPage *block) {
+    if (block->next_id(0) == 0)
+        return 0;
+    Dbt *data = block->get(1);
+    uint count = *(u16 *) data->get_data();
+    delete data;
+    return count;
+}
+
+
+/*
+ * =============== ColumnSegment ===============
+ */
+
+ColumnSegment::ColumnSegment(string name, ColumnAttribute::DataType data_type) : file(name), data_type(data_type),
+                                                                               width(0), capacity(0), is_open(false),
+                                                                               count(0), first_rows(), tail(nullptr),
+                                                                               tail_count(0), tail_values(),
+                                                                               tail_ends() {
+    if (data_type == ColumnAttribute::INT)
+        this->width = sizeof(int32_t);
+    else if (data_type == ColumnAttribute::BOOLEAN)
+        this->width = sizeof(uint8_t);
+    else if (data_type != ColumnAttribute::TEXT)
+        throw DbRelationError("Only know how to store INT, TEXT, and BOOLEAN");
+}
+
+// Work out how many INT or BOOLEAN values a chunk holds, from the file's block size
+void ColumnSegment::size_chunks() {
+    if (this->width != 0)
+        this->capacity = (chunk_size() - sizeof(u16)) / this->width;
+}
+
+void ColumnSegment::create() {
+    this->file.create();
+    size_chunks();
+    this->is_open = true;
+    this->count = 0;
+    this->first_rows.assign(1, 0);
+}
+
+void ColumnSegment::drop() {
+    this->file.drop();
+    this->is_open = false;
+}
+
+/**
+ * Open the file and work out how many values there are (and, for TEXT, where each block's values start).
+ */
+void ColumnSegment::open() {
+    std::lock_guard<std::mutex> guard(this->latch);
+    if (this->is_open)
+        return;
+    this->file.open();
+    size_chunks();
+    BlockID last = this->file.get_last_block_id();
+    this->count = 0;
+    this->first_rows.clear();
+    if (this->width != 0) {
+        SlottedPage *block = this->file.get(last);
+        this->count = (u_long) (last - 1) * this->capacity + chunk_count(block);
+        this->file.unpin(block);
+    } else {
+        for (BlockID block_id = 1; block_id <= last; block_id++) {
+            this->first_rows.push_back(this->count);
+            SlottedPage *block = this->file.get(block_id);
+            this->count += chunk_count(block);
+            this->file.unpin(block);
+        }
+    }
+    this->is_open = true;
+}
+
+void ColumnSegment::close() {
+    std::lock_guard<std::mutex> guard(this->latch);
+    this->file.close();
+    this->is_open = false;
+}
+
+void ColumnSegment::append(const Rows &rows, uint position) {
+    begin_append();
+    try {
+        for (auto const &row: rows) {
+            if (this->width == 0) {
+                u16 size = row.get_size(position);
+                make_room(size);
+                this->tail_values.insert(this->tail_values.end(), row.get_s(position), row.get_s(position) + size);
+                this->tail_ends.push_back((u16) this->tail_values.size());
+            } else {
+                make_room(this->width);
+                int32_t n = row.get_n(position);
+                this->tail_values.insert(this->tail_values.end(), (char *) &n, (char *) &n + this->width);
+            }
+            this->tail_count++;
+            this->count++;
+        }
+    } catch (...) {
+        end_append();  // keep the values that made it in
+        throw;
+    }
+    end_append();
+}
+
+void ColumnSegment::append(int32_t n, u_long copies) {
+    if (this->width == 0)
+        throw DbRelationError("can only repeat INT or BOOLEAN values");
+    begin_append();
+    for (u_long i = 0; i < copies; i++) {
+        make_room(this->width);
+        this->tail_values.insert(this->tail_values.end(), (char *) &n, (char *) &n + this->width);
+        this->tail_count++;
+        this->count++;
+    }
+    end_append();
+}
+
+// (Little-endian: the first width bytes of an int32_t are the value of a BOOLEAN, too.)
+void ColumnSegment::put(u_long row, int32_t n) {
+    if (this->width == 0)
+        throw DbRelationError("can only change INT or BOOLEAN values in place");
+    uint i;
+    SlottedPage *block = this->file.get(find_block(row, i));
+    Dbt *data = block->get(1);
+    vector<char> chunk((char *) data->get_data(), (char *) data->get_data() + data->get_size());
+    delete data;
+    memcpy(&chunk[sizeof(u16) + i * this->width], &n, this->width);
+    block->put(1, Dbt(&chunk[0], (u_int32_t) chunk.size()));
+    this->file.put(block);
+    this->file.unpin(block);
+}
+
+void ColumnSegment::read(u_long first, uint n, int32_t *values) {
+    if (this->width == 0)
+        throw DbRelationError("can only read INT or BOOLEAN values into an array");
+    while (n > 0) {
+        uint i;
+        SlottedPage *block = this->file.get(find_block(first, i));
+        Dbt *data = block->get(1);
+        const char *chunk = (const char *) data->get_data() + sizeof(u16);
+        uint take = min(n, this->capacity - i);
+        if (this->width == sizeof(int32_t)) {
+            memcpy(values, chunk + i * sizeof(int32_t), take * sizeof(int32_t));
+        } else {
+            for (uint k = 0; k < take; k++)
+                values[k] = (uint8_t) chunk[i + k];
+        }
+        delete data;
+        this->file.unpin(block);
+        values += take;
+        first += take;
+        n -= take;
+    }
+}
+
+/**
+ * INT and BOOLEAN values are copied out a batch at a time for select_equal; TEXT values are compared where they
+ * are, lengths first.
+ */
+u_long ColumnSegment::match(u_long first, uint n, const Value &value, uint64_t *bitmap) {
+    static const uint BATCH = 1024;  // a multiple of 64, so each batch starts a new word of the bitmap
+    if (this->width != 0) {
+        int32_t values[BATCH];
+        for (uint done = 0; done < n; done += BATCH) {
+            uint batch = min(n - done, BATCH);
+            read(first + done, batch, values);
+            select_equal(values, batch, value.n, bitmap + done / 64);
+        }
+        return (u_long) n * this->width;
+    }
+
+    u_long bytes = 0;
+    uint done = 0;
+    while (done < n) {
+        uint i;
+        SlottedPage *block = this->file.get(find_block(first + done, i));
+        Dbt *data = block->get(1);
+        const char *chunk = (const char *) data->get_data();
+        uint chunk_values = *(const u16 *) chunk;
+        const u16 *ends = (const u16 *) (chunk + sizeof(u16));
+        const char *text = chunk + sizeof(u16) * (1 + chunk_values);
+        for (; i < chunk_values && done < n; i++, done++) {
+            u16 start = i == 0 ? 0 : ends[i - 1];
+            u16 size = ends[i] - start;
+            bytes += size;
+            if (size == value.s.size() && memcmp(text + start, value.s.data(), size) == 0)
+                bitmap[done / 64] |= 1ULL << (done % 64);
+        }
+        delete data;
+        this->file.unpin(block);
+    }
+    return bytes;
+}
+
+u_long ColumnSegment::fetch(u_long row, Row &out) {
+    if (this->width != 0) {
+        int32_t n;
+        read(row, 1, &n);
+        if (this->data_type == ColumnAttribute::BOOLEAN)
+            out.append_boolean(n);
+        else
+            out.append_int(n);
+        return this->width;
+    }
+    uint i;
+    SlottedPage *block = this->file.get(find_block(row, i));
+    Dbt *data = block->get(1);
+    const char *chunk = (const char *) data->get_data();
+    const u16 *ends = (const u16 *) (chunk + sizeof(u16));
+    u16 start = i == 0 ? 0 : ends[i - 1];
+    u16 size = ends[i] - start;
+    out.append_text(chunk + sizeof(u16) * (1 + *(const u16 *) chunk) + start, size);
+    delete data;
+    this->file.unpin(block);
+    return size;
+}
+
+// Pin the last block and pick up its chunk where it left off
+void ColumnSegment::begin_append() {
+    open();
+    this->tail = this->file.get(this->file.get_last_block_id());
+    this->tail_count = 0;
+    this->tail_values.clear();
+    this->tail_ends.clear();
+    if (this->tail->next_id(0) == 0)
+        return;
+    Dbt *data = this->tail->get(1);
+    const char *chunk = (const char *) data->get_data();
+    const char *end = chunk + data->get_size();
+    this->tail_count = *(const u16 *) chunk;
+    if (this->width == 0) {
+        const u16 *ends = (const u16 *) (chunk + sizeof(u16));
+        this->tail_ends.assign(ends, ends + this->tail_count);
+        this->tail_values.assign(chunk + sizeof(u16) * (1 + this->tail_count), end);
+    } else {
+        this->tail_values.assign(chunk + sizeof(u16), end);
+    }
+    delete data;
+}
+
+void ColumnSegment::end_append() {
+    write_tail();
+    this->file.put(this->tail);
+    this->file.unpin(this->tail);
+    this->tail = nullptr;
+}
+
+/**
+ * Start a new chunk (in a new block) if the last one has no room for another value.
+ * @param size  bytes the value takes (not counting its end offset, for TEXT)
+ * @throws      DbRelationError if it won't fit even in an empty chunk
+ */
+void ColumnSegment::make_room(uint size) {
+    if (this->width != 0 ? this->tail_count < this->capacity
+                         : sizeof(u16) * (this->tail_count + 2) + this->tail_values.size() + size <= chunk_size())
+        return;
+    if (this->width == 0 && sizeof(u16) * 2 + size > chunk_size())
+        throw DbRelationError("text field too long to store in a column");
+    write_tail();
+    this->file.put(this->tail);
+    this->file.unpin(this->tail);
+    this->tail = this->file.get_new();
+    this->tail_count = 0;
+    this->tail_values.clear();
+    this->tail_ends.clear();
+    if (this->width == 0)
+        this->first_rows.push_back(this->count);
+}
+
+// Marshal the last chunk into its block
+void ColumnSegment::write_tail() {
+    vector<char> chunk;
+    chunk.reserve(sizeof(u16) * (1 + this->tail_ends.size()) + this->tail_values.size());
+    u16 n = (u16) this->tail_count;
+    chunk.insert(chunk.end(), (char *) &n, (char *) &n + sizeof(n));
+    chunk.insert(chunk.end(), (char *) this->tail_ends.data(), (char *) (this->tail_ends.data() + this->tail_ends.size()));
+    chunk.insert(chunk.end(), this->tail_values.begin(), this->tail_values.end());
+    Dbt data(&chunk[0], (u_int32_t) chunk.size());
+    if (this->tail->next_id(0) == 0)
+        this->tail->add(&data);
+    else
+        this->tail->put(1, data);
+}
+
+/**
+ * Which block a value is in.
+ * @param row  row number of the value
+ * @param i    returned by reference: its position in the block's chunk
+ * @return     the block
+ */
+BlockID ColumnSegment::find_block(u_long row, uint &i) const {
+    if (this->width != 0) {
+        i = (uint) (row % this->capacity);
+        return (BlockID) (row / this->capacity + 1);
+    }
+    auto after = upper_bound(this->first_rows.begin(), this->first_rows.end(), row);
+    i = (uint) (row - *(after - 1));
+    return (BlockID) (after - this->first_rows.begin());
+}
+
+
+/*
+ * =============== ColumnTable ===============
+ */
+
+/**
+ * Constructor
+ * @param table_name
+ * @param column_names
+ * @param column_attributes
+ */
+ColumnTable::ColumnTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes)
+        : DbRelation(table_name, column_names, column_attributes), live(table_name, ColumnAttribute::BOOLEAN),
+          segments() {
+    ExecCounters *counters = ExecStats::for_table(table_name);
+    this->live.set_counters(counters);
+    for (uint i = 0; i < this->column_names.size(); i++) {
+        ColumnSegment *segment = new ColumnSegment(table_name + "." + this->column_names[i] + ".col",
+                                                   this->column_attributes[i].get_data_type());
+        segment->set_counters(counters);
+        this->segments.push_back(segment);
+    }
+}
+
+ColumnTable::~ColumnTable() {
+    for (auto segment: this->segments)
+        delete segment;
+}
+
+/**
+ * Execute: CREATE TABLE <table_name> ( <columns> ) WITH (storage=column)
+ * Is not responsible for metadata storage or validation.
+ */
+void ColumnTable::create() {
+    this->live.create();
+    for (auto segment: this->segments)
+        segment->create();
+}
+
+/**
+ * Execute: CREATE TABLE IF NOT EXISTS <table_name> ( <columns> ) WITH (storage=column)
+ * Is not responsible for metadata storage or validation.
+ */
+void ColumnTable::create_if_not_exists() {
+    try {
+        open();
+    } catch (DbException &e) {
+        create();
+    }
+}
+
+/**
+ * Execute: DROP TABLE <table_name>
+ */
+void ColumnTable::drop() {
+    this->live.drop();
+    for (auto segment: this->segments)
+        segment->drop();
+}
+
+/**
+ * Open existing table. Enables: insert, delete, select, project
+ */
+void ColumnTable::open() {
+    this->live.open();
+    for (auto segment: this->segments)
+        segment->open();
+}
+
+/**
+ * Closes the table. Disables: insert, delete, select, project
+ */
+void ColumnTable::close() {
+    this->live.close();
+    for (auto segment: this->segments)
+        segment->close();
+}
+
+/**
+ * Execute: INSERT INTO <table_name> (<row_keys>) VALUES (<row_values>)
+ * @param row a dictionary with column name keys
+ * @return the handle of the inserted row
+ */
+Handle ColumnTable::insert(const ValueDict *row) {
+    for (auto const &column_name: this->column_names)
+        if (row->find(column_name) == row->end())
+            throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+    Rows rows(1);
+    rows[0].assign(*row, this->column_names);
+    Handles *handles = insert_batch(&this->column_names, &rows);
+    Handle handle = handles->at(0);
+    delete handles;
+    return handle;
+}
+
+/**
+ * Execute: INSERT INTO <table_name> (<column_names>) VALUES (<row>), (<row>), ...
+ * All the rows are checked up front, so that every segment gets all of them, then each column's values are
+ * appended to its segment in one go.
+ * @param column_names  which column each position of the rows is for
+ * @param rows          values for the new rows
+ * @return              handle of each inserted row, in order (freed by caller)
+ */
+Handles *ColumnTable::insert_batch(const ColumnNames *column_names, const Rows *rows) {
+    open();
+    vector<uint> positions = bind_row(column_names);
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++) {
+        bool is_text = this->column_attributes[col_num].get_data_type() == ColumnAttribute::TEXT;
+        for (auto const &row: *rows) {
+            uint position = positions[col_num];
+            if (is_text != (row.get_data_type(position) == ColumnAttribute::TEXT))
+                throw DbRelationError("column " + this->column_names[col_num] + (is_text ? " is TEXT" : " is not TEXT"));
+            if (is_text && row.get_size(position) > this->segments[col_num]->chunk_size() - 2 * sizeof(u16))
+                throw DbRelationError("text field too long to store in a column");
+        }
+    }
+
+    u_long first = this->live.size();
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++)
+        this->segments[col_num]->append(*rows, positions[col_num]);
+    this->live.append(1, rows->size());
+
+    Handles *handles = new Handles();
+    handles->reserve(rows->size());
+    for (u_long row = first; row < this->live.size(); row++)
+        handles->push_back(handle_of(row));
+    return handles;
+}
+
+/**
+ * Conceptually, execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
+ * @param handle the row to be updated
+ * @param new_values a dictionary with column name keys
+ */
+void ColumnTable::update(const Handle handle, const ValueDict *new_values) {
+    throw DbRelationError("Not implemented");
+}
+
+/**
+ * Conceptually, execute: DELETE FROM <table_name> WHERE <handle>
+ * The row's values stay where they are; it is just marked as no longer there.
+ * @param handle the row to be deleted
+ */
+void ColumnTable::del(const Handle handle) {
+    open();
+    this->live.put(check_row(handle), 0);
+}
+
+/**
+ * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE 1
+ * @return a list of handles for qualifying rows
+ */
+Handles *ColumnTable::select() {
+    return select(nullptr);
+}
+
+/**
+ * The select command
+ * @param where predicates to match
+ * @return list of handles of the selected rows
+ */
+Handles *ColumnTable::select(const ValueDict *where) {
+    Handles *handles = new Handles();
+    ColumnTableCursor cursor(*this, where);
+    while (cursor.next())
+        handles->push_back(cursor.get_handle());
+    return handles;
+}
+
+/**
+ * Refine another selection
+ * @param current_selection range of handles to filter
+ * @param where             predicates to match
+ * @return                  list of handles of the selected rows
+ */
+Handles *ColumnTable::select(Handles *current_selection, const ValueDict *where) {
+    open();
+    Handles *handles = new Handles();
+    for (auto const &handle: *current_selection)
+        if (selected(check_row(handle), where))
+            handles->push_back(handle);
+    return handles;
+}
+
+/**
+ * Project all columns from a given row.
+ * @param handle row to be projected
+ * @return a sequence of all values for handle
+ */
+ValueDict *ColumnTable::project(Handle handle) {
+    return project(handle, &this->column_names);
+}
+
+/**
+ * Project given columns from a given row (reading only those columns' segments).
+ * @param handle row to be projected
+ * @param column_names of columns to be included in the result
+ * @return a sequence of values for handle given by column_names
+ */
+ValueDict *ColumnTable::project(Handle handle, const ColumnNames *column_names) {
+    open();
+    u_long row_number = check_row(handle);
+    vector<uint> positions = bind_columns(column_names);
+    Row row;
+    ExecCounters tally;
+    tally.rows_examined = 1;
+    if (positions.empty()) {
+        for (auto segment: this->segments)
+            tally.bytes_marshalled += segment->fetch(row_number, row);
+    } else {
+        for (auto position: positions)
+            tally.bytes_marshalled += this->segments[position]->fetch(row_number, row);
+    }
+    ExecStats::add(this->live.get_counters(), tally);
+    return row.to_dict(positions.empty() ? this->column_names : *column_names);
+}
+
+/**
+ * Select and project in one pass, copying out only the wanted columns of the qualifying rows.
+ * @param where         predicates to match (nullptr for all rows)
+ * @param column_names  columns to be included in the result (nullptr or empty for all columns)
+ * @return              list of the projected rows
+ */
+ValueDicts *ColumnTable::select_project(const ValueDict *where, const ColumnNames *column_names) {
+    ValueDicts *rows = new ValueDicts();
+    ColumnTableCursor cursor(*this, where);
+    while (cursor.next())
+        rows->push_back(cursor.project(column_names));
+    return rows;
+}
+
+/**
+ * Stream the rows that satisfy the where clause.
+ * @param where  predicates to match (nullptr for all rows)
+ * @return       cursor over the selected rows (freed by caller)
+ */
+DbCursor *ColumnTable::cursor(const ValueDict *where) {
+    return new ColumnTableCursor(*this, where);
+}
+
+/**
+ * Stream the rows in some of the row groups that satisfy the where clause.
+ * @param where  predicates to match (nullptr for all rows)
+ * @param first  first row group to scan
+ * @param last   last row group to scan
+ * @return       cursor over the selected rows in those groups (freed by caller)
+ */
+DbCursor *ColumnTable::cursor(const ValueDict *where, BlockID first, BlockID last) {
+    return new ColumnTableCursor(*this, where, first, last);
+}
+
+// How many row groups a scan goes through
+uint32_t ColumnTable::get_block_count() {
+    open();
+    u_long groups = (this->live.size() + GROUP_ROWS - 1) / GROUP_ROWS;
+    return groups == 0 ? 1 : (uint32_t) groups;
+}
+
+// Every segment's file gets the same block size
+void ColumnTable::set_block_size(uint block_size) {
+    this->live.set_block_size(block_size);
+    for (auto segment: this->segments)
+        segment->set_block_size(block_size);
+}
+
+uint ColumnTable::get_block_size() {
+    open();
+    return this->live.get_block_size();
+}
+
+/**
+ * Row number of a handle.
+ * @param handle  a row's handle
+ * @return        its row number
+ * @throws        DbRelationError if it isn't the handle of one of the table's rows
+ */
+u_long ColumnTable::check_row(Handle handle) {
+    u_long row = row_of(handle);
+    if (handle.first == 0 || handle.second == 0 || handle.second > GROUP_ROWS || row >= this->live.size())
+        throw DbRelationError("no such row");
+    return row;
+}
+
+/**
+ * See if the given row is still there and satisfies the given where clause
+ * @param row    row number to check
+ * @param where  conditions to check
+ * @return       true if conditions met, false otherwise
+ */
+bool ColumnTable::selected(u_long row, const ValueDict *where) {
+    int32_t is_live;
+    this->live.read(row, 1, &is_live);
+    if (!is_live)
+        return false;
+    if (where == nullptr)
+        return true;
+    for (auto const &predicate: *where) {
+        auto it = find(this->column_names.begin(), this->column_names.end(), predicate.first);
+        if (it == this->column_names.end())
+            throw DbRelationError("table does not have column named '" + predicate.first + "'");
+        Row value;
+        this->segments[it - this->column_names.begin()]->fetch(row, value);
+        if (value.get_value(0) != predicate.second)
+            return false;
+    }
+    return true;
+}
+
+
+/*
+ * =============== ColumnTableCursor ===============
+ */
+
+/**
+ * Constructor -- opens the table and lines up the where clause with the columns (copying its values).
+ * @param table  table to scan
+ * @param where  predicates to match (nullptr for all rows)
+ * @param first  first row group to scan
+ * @param last   last row group to scan (0 for through the end of the table)
+ */
+ColumnTableCursor::ColumnTableCursor(ColumnTable &table, const ValueDict *where, BlockID first, BlockID last)
+        : table(table), predicates(), is_empty(false), group(first - 1), last_group(last), selection(), matches(),
+          position((int) ColumnTable::GROUP_ROWS - 1), bound_columns(nullptr), positions(), tally() {
+    table.open();
+    if (last == 0)
+        this->last_group = table.get_block_count();
+    if (where == nullptr)
+        return;
+    for (auto const &predicate: *where) {
+        auto it = find(table.column_names.begin(), table.column_names.end(), predicate.first);
+        if (it == table.column_names.end())
+            throw DbRelationError("table does not have column named '" + predicate.first + "'");
+        uint col_num = (uint) (it - table.column_names.begin());
+        if (predicate.second.data_type != table.column_attributes[col_num].get_data_type())
+            this->is_empty = true;
+        this->predicates.push_back(make_pair(col_num, predicate.second));
+    }
+}
+
+// Add what the scan did into the table's counters
+ColumnTableCursor::~ColumnTableCursor() {
+    ExecStats::add(this->table.live.get_counters(), this->tally);
+}
+
+/**
+ * Advance to the next row set in the selection bitmap, moving on to the next row group when this one is used up.
+ * @return false if there are no more qualifying rows
+ */
+bool ColumnTableCursor::next() {
+    while (true) {
+        uint p = (uint) (this->position + 1);
+        while (p < ColumnTable::GROUP_ROWS) {
+            uint64_t word = this->selection[p / 64] >> (p % 64);
+            if (word != 0) {
+                this->position = (int) (p + __builtin_ctzll(word));
+                return true;
+            }
+            p = (p / 64 + 1) * 64;
+        }
+        if (this->group >= this->last_group)
+            return false;
+        this->group++;
+        select_group();
+        this->position = -1;
+    }
+}
+
+/**
+ * Handle of the current row.
+ * @return handle
+ */
+Handle ColumnTableCursor::get_handle() const {
+    return ColumnTable::handle_of((u_long) (this->group - 1) * ColumnTable::GROUP_ROWS + this->position);
+}
+
+/**
+ * Copy out the current row's values.
+ * @param column_names  columns to be included in the result (nullptr or empty for all)
+ * @return              the projected row (freed by caller)
+ */
+ValueDict *ColumnTableCursor::project(const ColumnNames *column_names) {
+    Row row;
+    project_row(column_names, row);
+    return row.to_dict(this->positions.empty() ? this->table.column_names : *column_names);
+}
+
+/**
+ * Lay out the current row by position, reading only the segments of the wanted columns (the TEXT fields are
+ * copies, so the row stays good after next()).
+ * @param column_names  columns to be included in the result, in order (nullptr or empty for all)
+ * @param row           filled in with the projected values
+ */
+void ColumnTableCursor::project_row(const ColumnNames *column_names, Row &row) {
+    if (column_names != this->bound_columns) {
+        this->positions = this->table.bind_columns(column_names);
+        this->bound_columns = column_names;
+    }
+    u_long row_number = (u_long) (this->group - 1) * ColumnTable::GROUP_ROWS + this->position;
+    row.clear();
+    if (this->positions.empty()) {
+        row.reserve((uint) this->table.segments.size());
+        for (auto segment: this->table.segments)
+            this->tally.bytes_marshalled += segment->fetch(row_number, row);
+    } else {
+        row.reserve((uint) this->positions.size());
+        for (auto position: this->positions)
+            this->tally.bytes_marshalled += this->table.segments[position]->fetch(row_number, row);
+    }
+}
+
+/**
+ * Work out the current row group's selection bitmap: the rows still there, and-ed with the rows matching each
+ * predicate in turn (stopping early if none are left).
+ */
+void ColumnTableCursor::select_group() {
+    memset(this->selection, 0, sizeof(this->selection));
+    u_long first = (u_long) (this->group - 1) * ColumnTable::GROUP_ROWS;
+    u_long rows = this->table.live.size();
+    if (this->is_empty || first >= rows)
+        return;
+    uint n = (uint) min((u_long) ColumnTable::GROUP_ROWS, rows - first);
+    this->tally.rows_examined += n;
+    this->tally.bytes_marshalled += this->table.live.match(first, n, Value(1), this->selection);
+    for (auto const &predicate: this->predicates) {
+        memset(this->matches, 0, sizeof(this->matches));
+        this->tally.bytes_marshalled += this->table.segments[predicate.first]->match(first, n, predicate.second,
+                                                                                      this->matches);
+        uint64_t any = 0;
+        for (uint w = 0; w < WORDS; w++) {
+            this->selection[w] &= this->matches[w];
+            any |= this->selection[w];
+        }
+        if (any == 0)
+            return;
+    }
+}
+
+/**
+ * Testing function for the column storage engine.
+ * @return true if the tests all succeeded
+ */
+bool test_column_table() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    column_names.push_back("c");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+    ColumnTable table("__test_column_table", column_names, column_attributes);
+    table.create();
+
+    // enough rows for several row groups, and several blocks of every segment
+    const int ROWS = 3000;
+    Rows rows(ROWS);
+    for (int i = 0; i < ROWS; i++) {
+        string b = "row " + to_string(i) + (i % 10 == 0 ? string(200, '*') : "");
+        rows[i].append_int(i);
+        rows[i].append_text(b.c_str(), (u16) b.size());
+        rows[i].append_boolean(i % 3 == 0);
+    }
+    Handles *handles = table.insert_batch(&column_names, &rows);
+    bool inserted = handles->size() == ROWS && ColumnTable::row_of(handles->at(ROWS - 1)) == ROWS - 1;
+    delete handles;
+    if (!inserted || table.get_block_count() != (ROWS + ColumnTable::GROUP_ROWS - 1) / ColumnTable::GROUP_ROWS)
+        return assertion_failure("insert_batch", table.get_block_count());
+    if (table.segments[1]->first_rows.size() < 2)
+        return assertion_failure("text segment should run to more than one block");
+    ValueDict row;
+    row["a"] = Value(-7);
+    row["b"] = Value("minus seven");
+    row["c"] = Value(1);
+    Handle extra = table.insert(&row);
+
+    // equality on each type, and on two columns at once
+    ValueDict where;
+    where["a"] = Value(2010);
+    handles = table.select(&where);
+    bool found = handles->size() == 1 && handles->at(0) == ColumnTable::handle_of(2010);
+    delete handles;
+    if (!found)
+        return assertion_failure("select on INT");
+    where.clear();
+    where["b"] = Value("row 1234");
+    ColumnNames a_only(1, "a");
+    ValueDicts *projected = table.select_project(&where, &a_only);
+    found = projected->size() == 1 && projected->at(0)->size() == 1 && projected->at(0)->at("a").n == 1234;
+    for (auto dict: *projected)
+        delete dict;
+    delete projected;
+    if (!found)
+        return assertion_failure("select_project on TEXT");
+    Value yes(1);
+    yes.data_type = ColumnAttribute::BOOLEAN;
+    where["c"] = yes;
+    where["b"] = Value("row 2040" + string(200, '*'));
+    handles = table.select(&where);
+    found = handles->size() == 1;
+    delete handles;
+    where.erase("b");
+    handles = table.select(&where);
+    found = found && handles->size() == ROWS / 3 + 1;
+    delete handles;
+    if (!found)
+        return assertion_failure("select on BOOLEAN");
+
+    // deletes, projection, and refining a selection
+    for (int i = 0; i < ROWS; i += 2)
+        table.del(ColumnTable::handle_of(i));
+    handles = table.select();
+    size_t remaining = handles->size();
+    Handles *refined = table.select(handles, &where);
+    size_t refined_size = refined->size();
+    delete refined;
+    delete handles;
+    if (remaining != ROWS / 2 + 1 || refined_size != ROWS / 6 + 1)
+        return assertion_failure("del", (double) remaining, (double) refined_size);
+    ValueDict *result = table.project(extra);
+    found = result->at("a").n == -7 && result->at("b").s == "minus seven" && result->at("c").n == 1;
+    delete result;
+    if (!found)
+        return assertion_failure("project");
+
+    // one row group at a time, as a parallel scan would, with the segments' sizes worked out again from the files
+    table.close();
+    ColumnTable reopened("__test_column_table", column_names, column_attributes);
+    long count = 0;
+    for (BlockID group = 1; group <= reopened.get_block_count(); group++) {
+        DbCursor *cursor = reopened.cursor(nullptr, group, group);
+        Row positional;
+        while (cursor->next()) {
+            cursor->project_row(&column_names, positional);
+            if (positional.get_n(0) % 2 == 0 && positional.get_n(0) != -7)
+                return assertion_failure("deleted row came back", positional.get_n(0));
+            count++;
+        }
+        delete cursor;
+    }
+    if (count != ROWS / 2 + 1)
+        return assertion_failure("cursor by row group", (double) count);
+    reopened.drop();
+    return true;
+}
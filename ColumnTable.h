@@ -0,0 +1,266 @@
+/**
+ * @file ColumnTable.h - Implementation of storage_engine with a file for each column.
+ * ColumnSegment
+ * ColumnTable: DbRelation
+ * ColumnTableCursor: DbCursor
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <mutex>
+#include "storage_engine.h"
+#include "HeapFile.h"
+
+/**
+ * @class ColumnSegment - the values of one column, in row order, in a HeapFile of their own
+ *
+ *      Each block of the file holds one record, a chunk of consecutive values. For INT and BOOLEAN columns a chunk
+ *      is a count followed by an array of the values (4 bytes or 1 byte each), so every full chunk holds the same
+ *      number of them and a value's block is a division away. For TEXT columns a chunk is a count, then the end
+ *      offset of each value, then the values' bytes; chunks are filled as far as they go, so the first row number
+ *      of each block is kept in memory (worked out from the chunks' counts when the segment is opened).
+ *
+ *      Values are only ever appended (or, for INT and BOOLEAN, changed in place).
+ */
+class ColumnSegment {
+public:
+    static const uint CHUNK_OVERHEAD = 8;  // an empty SlottedPage's header and the chunk's slot header
+
+    ColumnSegment(std::string name, ColumnAttribute::DataType data_type);
+
+    virtual ~ColumnSegment() {}
+
+    ColumnSegment(const ColumnSegment &other) = delete;
+
+    ColumnSegment &operator=(const ColumnSegment &other) = delete;
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    // Number of values in the segment
+    u_long size() const { return count; }
+
+    // Biggest chunk a block of the file has room for
+    uint chunk_size() const { return file.get_block_size() - CHUNK_OVERHEAD; }
+
+    // Choose the file's block size (before create)
+    void set_block_size(uint block_size) { file.set_block_size(block_size); }
+
+    uint get_block_size() const { return file.get_block_size(); }
+
+    /**
+     * Add one field of each of some rows to the end of the segment.
+     * @param rows      the rows
+     * @param position  which of their fields is this column's
+     */
+    virtual void append(const Rows &rows, uint position);
+
+    /**
+     * Add the same INT or BOOLEAN value to the end of the segment, a number of times.
+     * @param n       the value
+     * @param copies  how many times
+     */
+    virtual void append(int32_t n, u_long copies);
+
+    /**
+     * Change an INT or BOOLEAN value.
+     * @param row  row number of the value
+     * @param n    new value
+     */
+    virtual void put(u_long row, int32_t n);
+
+    /**
+     * Copy out consecutive INT or BOOLEAN values (BOOLEANs widened to INTs).
+     * @param first   row number of the first value wanted
+     * @param n       how many values
+     * @param values  filled in with them
+     */
+    virtual void read(u_long first, uint n, int32_t *values);
+
+    /**
+     * Set the bits of a selection bitmap for the values from a run of rows that equal a given value.
+     * @param first   row number of the first value to look at (bit 0 of bitmap)
+     * @param n       how many values
+     * @param value   the value they have to equal
+     * @param bitmap  where to set the bits (the rest are left alone)
+     * @return        number of bytes of values looked at
+     */
+    virtual u_long match(u_long first, uint n, const Value &value, uint64_t *bitmap);
+
+    /**
+     * Add a copy of one value onto the end of a row.
+     * @param row  row number of the value
+     * @param out  the row to add it to
+     * @return     number of bytes of the value
+     */
+    virtual u_long fetch(u_long row, Row &out);
+
+    void set_counters(ExecCounters *counters) { file.set_counters(counters); }
+
+    ExecCounters *get_counters() const { return file.get_counters(); }
+
+protected:
+    HeapFile file;
+    ColumnAttribute::DataType data_type;
+    uint width;                        // bytes per value (0 for TEXT)
+    uint capacity;                     // values per chunk (for INT and BOOLEAN, once the file is open)
+    bool is_open;
+    std::mutex latch;                  // held while opening or closing (reads may run at once)
+    u_long count;
+    std::vector<u_long> first_rows;    // for TEXT, row number of the first value in each block
+
+    // the last chunk, while appending to it
+    SlottedPage *tail;
+    uint tail_count;
+    std::vector<char> tail_values;     // INT or BOOLEAN values, or the bytes of TEXT ones
+    std::vector<u_int16_t> tail_ends;  // end offset of each TEXT value in tail_values
+
+    virtual void size_chunks();
+
+    virtual void begin_append();
+
+    virtual void end_append();
+
+    virtual void make_room(uint size);
+
+    virtual void write_tail();
+
+    virtual BlockID find_block(u_long row, uint &i) const;
+
+    friend bool test_column_table();
+};
+
+/**
+ * @class ColumnTable - Column storage engine (implementation of DbRelation)
+ *
+ *      Each column is a ColumnSegment, in its own file (<table>.<column>.col.db), so that a scan only reads the
+ *      columns it needs; the table's file itself is a BOOLEAN segment with a 1 for each row that is still there (0
+ *      once it has been deleted). A row's handle is made from its row number: the row group is the block ID and
+ *      the position in the group, plus one, is the record ID.
+ *
+ *      Scans go GROUP_ROWS rows at a time, so a table's "blocks" (for costing plans and for the morsels of a
+ *      parallel scan) are its row groups. Each predicate is checked over the whole group at once, turning the
+ *      column's values into a selection bitmap (INT and BOOLEAN comparisons four at a time with SSE2), and only
+ *      the rows left in the bitmaps after they are all and-ed together have any of their values copied out.
+ */
+class ColumnTable : public DbRelation {
+public:
+    static const uint GROUP_ROWS = 1024;
+
+    ColumnTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
+
+    virtual ~ColumnTable();
+
+    ColumnTable(const ColumnTable &other) = delete;
+
+    ColumnTable &operator=(const ColumnTable &other) = delete;
+
+    virtual void create();
+
+    virtual void create_if_not_exists();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handle insert(const ValueDict *row);
+
+    virtual Handles *insert_batch(const ColumnNames *column_names, const Rows *rows);
+
+    virtual void update(const Handle handle, const ValueDict *new_values);
+
+    virtual void del(const Handle handle);
+
+    virtual Handles *select();
+
+    virtual Handles *select(const ValueDict *where);
+
+    virtual Handles *select(Handles *current_selection, const ValueDict *where);
+
+    virtual ValueDict *project(Handle handle);
+
+    virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
+
+    using DbRelation::project;
+
+    virtual ValueDicts *select_project(const ValueDict *where, const ColumnNames *column_names);
+
+    virtual DbCursor *cursor(const ValueDict *where);
+
+    virtual DbCursor *cursor(const ValueDict *where, BlockID first, BlockID last);
+
+    virtual uint32_t get_block_count();
+
+    virtual void set_block_size(uint block_size);
+
+    virtual uint get_block_size();
+
+    // Translation between row numbers and handles
+    static Handle handle_of(u_long row) {
+        return Handle((BlockID) (row / GROUP_ROWS + 1), (RecordID) (row % GROUP_ROWS + 1));
+    }
+
+    static u_long row_of(Handle handle) { return (u_long) (handle.first - 1) * GROUP_ROWS + handle.second - 1; }
+
+protected:
+    ColumnSegment live;
+    std::vector<ColumnSegment *> segments;  // one for each column, in table order
+
+    virtual u_long check_row(Handle handle);
+
+    virtual bool selected(u_long row, const ValueDict *where);
+
+    friend class ColumnTableCursor;
+
+    friend bool test_column_table();
+};
+
+/**
+ * @class ColumnTableCursor - streams the qualifying rows of a ColumnTable, one row group's bitmap at a time
+ */
+class ColumnTableCursor : public DbCursor {
+public:
+    ColumnTableCursor(ColumnTable &table, const ValueDict *where, BlockID first = 1, BlockID last = 0);
+
+    virtual ~ColumnTableCursor();
+
+    ColumnTableCursor(const ColumnTableCursor &other) = delete;
+
+    ColumnTableCursor &operator=(const ColumnTableCursor &other) = delete;
+
+    virtual bool next();
+
+    virtual Handle get_handle() const;
+
+    virtual ValueDict *project(const ColumnNames *column_names);
+
+    virtual void project_row(const ColumnNames *column_names, Row &row);
+
+protected:
+    static const uint WORDS = ColumnTable::GROUP_ROWS / 64;
+
+    ColumnTable &table;
+    std::vector<std::pair<uint, Value>> predicates;  // column number and the value it has to equal
+    bool is_empty;                                   // some predicate can't be met (its value is the wrong type)
+    BlockID group;                                   // current row group (0 before the first)
+    BlockID last_group;
+    uint64_t selection[WORDS];                       // which rows of the group qualify
+    uint64_t matches[WORDS];                         // one predicate's bitmap, while the group is checked
+    int position;                                    // of the current row in the group (-1 before the first)
+    const ColumnNames *bound_columns;                // the projection that positions was computed for
+    std::vector<uint> positions;
+    ExecCounters tally;                              // added into the table's counters at the end
+
+    virtual void select_group();
+};
+
+bool test_column_table();
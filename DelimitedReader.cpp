@@ -0,0 +1,198 @@
+/**
+ * @file DelimitedReader.cpp - implementation of DelimitedReader
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <strings.h>
+#include "DelimitedReader.h"
+
+using namespace std;
+
+DelimitedReader::DelimitedReader(string path, const vector<ColumnAttribute::DataType> &column_types, char delimiter,
+                                 bool quoting)
+        : path(path), file(nullptr), column_types(column_types), delimiter(delimiter), quoting(quoting),
+          buffer(BUFFER_SIZE), begin(0), end(0), at_eof(false), line_number(0), record_line(0) {
+    this->file = fopen(path.c_str(), "rb");
+    if (this->file == nullptr)
+        throw DbRelationError("cannot open " + path + ": " + strerror(errno));
+}
+
+DelimitedReader::~DelimitedReader() {
+    fclose(this->file);
+}
+
+void DelimitedReader::skip_line() {
+    size_t line_end, next;
+    u_long newlines;
+    while (!find_line(line_end, next, newlines))
+        if (!fill())
+            return;
+    this->begin = next;
+    this->line_number += newlines;
+}
+
+bool DelimitedReader::next_batch(Rows &rows) {
+    size_t n = 0;
+    size_t line_end, next;
+    u_long newlines;
+    do {
+        while (find_line(line_end, next, newlines)) {
+            size_t start = this->begin;
+            this->begin = next;
+            this->record_line = this->line_number + 1;
+            this->line_number += newlines;
+            if (line_end > start && this->buffer[line_end - 1] == '\r')
+                line_end--;
+            if (line_end == start)
+                continue;  // empty line
+            if (n == rows.size())
+                rows.emplace_back();
+            parse_line(start, line_end, rows[n++]);
+        }
+    } while (n == 0 && fill());  // moving the bytes along is only safe while there are no views of them
+    rows.resize(n);
+    return n > 0;
+}
+
+/**
+ * Move the partial line at the end of the buffer to the front (making the buffer bigger if it already fills it) and
+ * read in as much more of the file as fits after it.
+ * @return  false if the end of the file had already been reached
+ */
+bool DelimitedReader::fill() {
+    if (this->at_eof)
+        return false;
+    if (this->begin > 0) {
+        memmove(this->buffer.data(), this->buffer.data() + this->begin, this->end - this->begin);
+        this->end -= this->begin;
+        this->begin = 0;
+    }
+    if (this->end == this->buffer.size())
+        this->buffer.resize(2 * this->buffer.size());
+    size_t n = fread(this->buffer.data() + this->end, 1, this->buffer.size() - this->end, this->file);
+    if (n == 0) {
+        if (ferror(this->file))
+            throw DbRelationError("cannot read " + this->path + ": " + strerror(errno));
+        this->at_eof = true;
+    }
+    this->end += n;
+    return true;
+}
+
+/**
+ * Find the end of the line that starts at begin, if it is all in the buffer (the last line of the file needn't end
+ * in a newline).
+ * @param line_end  where the line's newline is (or the end of the file)
+ * @param next      where the line after it starts
+ * @param newlines  how many lines of the file it takes up (more than one if a quoted field has line breaks)
+ * @return          false if the rest of the line hasn't been read in yet (or there are no more lines)
+ */
+bool DelimitedReader::find_line(size_t &line_end, size_t &next, u_long &newlines) const {
+    const char *bytes = this->buffer.data();
+    newlines = 1;
+    if (!this->quoting) {
+        const char *found = (const char *) memchr(bytes + this->begin, '\n', this->end - this->begin);
+        if (found != nullptr) {
+            line_end = (size_t) (found - bytes);
+            next = line_end + 1;
+            return true;
+        }
+    } else {
+        bool in_quotes = false;  // a "" inside quotes leaves them and goes right back in
+        for (size_t i = this->begin; i < this->end; i++) {
+            if (bytes[i] == '"') {
+                in_quotes = !in_quotes;
+            } else if (bytes[i] == '\n') {
+                if (!in_quotes) {
+                    line_end = i;
+                    next = i + 1;
+                    return true;
+                }
+                newlines++;
+            }
+        }
+    }
+    if (!this->at_eof || this->begin == this->end)
+        return false;
+    line_end = next = this->end;
+    return true;
+}
+
+void DelimitedReader::parse_line(size_t start, size_t line_end, Row &row) {
+    char *bytes = this->buffer.data();
+    const uint n = (uint) this->column_types.size();
+    row.clear();
+    row.reserve(n);
+    size_t pos = start;
+    for (uint col_num = 0; col_num < n; col_num++) {
+        if (col_num > 0) {
+            if (pos == line_end)
+                throw error("expected " + to_string(n) + " fields but found " + to_string(col_num));
+            pos++;  // past the delimiter
+        }
+        if (this->quoting && pos < line_end && bytes[pos] == '"') {
+            // unescape it where it is
+            size_t field = pos, to = pos;
+            for (pos++;; pos++) {
+                if (pos == line_end)
+                    throw error("no closing quote");
+                if (bytes[pos] == '"') {
+                    if (pos + 1 == line_end || bytes[pos + 1] != '"')
+                        break;
+                    pos++;
+                }
+                bytes[to++] = bytes[pos];
+            }
+            pos++;  // past the closing quote
+            if (pos != line_end && bytes[pos] != this->delimiter)
+                throw error("expected a delimiter after the closing quote");
+            parse_field(bytes + field, to - field, col_num, row);
+        } else {
+            size_t field = pos;
+            const char *found = (const char *) memchr(bytes + pos, this->delimiter, line_end - pos);
+            pos = found == nullptr ? line_end : (size_t) (found - bytes);
+            parse_field(bytes + field, pos - field, col_num, row);
+        }
+    }
+    if (pos != line_end)
+        throw error("expected " + to_string(n) + " fields but found more");
+}
+
+// Convert one field to its column's type and add it to the row (a TEXT field as a view of the buffer).
+void DelimitedReader::parse_field(const char *s, size_t size, uint col_num, Row &row) const {
+    switch (this->column_types[col_num]) {
+        case ColumnAttribute::INT: {
+            size_t i = 0, digits = 0;
+            bool negative = false;
+            if (size > 0 && (s[0] == '-' || s[0] == '+'))
+                negative = s[i++] == '-';
+            int64_t n = 0;
+            for (; i < size && s[i] >= '0' && s[i] <= '9' && n <= (int64_t) INT32_MAX + 1; i++, digits++)
+                n = 10 * n + (s[i] - '0');
+            if (digits == 0 || i != size || n > (int64_t) INT32_MAX + (negative ? 1 : 0))
+                throw error("'" + string(s, size) + "' is not an INT");
+            row.append_int((int32_t) (negative ? -n : n));
+            break;
+        }
+        case ColumnAttribute::BOOLEAN:
+            if ((size == 4 && strncasecmp(s, "true", 4) == 0) || (size == 1 && s[0] == '1'))
+                row.append_boolean(1);
+            else if ((size == 5 && strncasecmp(s, "false", 5) == 0) || (size == 1 && s[0] == '0'))
+                row.append_boolean(0);
+            else
+                throw error("'" + string(s, size) + "' is not a BOOLEAN");
+            break;
+        default:
+            if (size > USHRT_MAX)
+                throw error("field is longer than " + to_string(USHRT_MAX) + " bytes");
+            row.append_text_view(s, (u_int16_t) size);
+    }
+}
+
+DbRelationError DelimitedReader::error(const string &message) const {
+    return DbRelationError(this->path + " line " + to_string(this->record_line) + ": " + message);
+}
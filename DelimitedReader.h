@@ -0,0 +1,80 @@
+/**
+ * @file DelimitedReader.h - reads the rows of a CSV or TSV file, for COPY
+ * DelimitedReader
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <cstdio>
+#include "storage_engine.h"
+
+/**
+ * @class DelimitedReader - turns the lines of a delimited text file into Rows, a buffer at a time
+ *
+ *      The file is read BUFFER_SIZE bytes at a time (more, if one line is longer than that) and each batch of rows
+ *      comes from the complete lines in the buffer: INT and BOOLEAN fields are converted where they stand and TEXT
+ *      fields are views of the buffer's bytes, so nothing is allocated for each field. A batch is only good until
+ *      the next call to next_batch() or skip_line().
+ *
+ *      With quoting (CSV), a field can be in double quotes, with "" for each quote inside it, and then it can also
+ *      have delimiters and line breaks in it; such a field is unescaped in place in the buffer. Without quoting
+ *      (TSV), every delimiter and newline counts. A carriage return before the newline is dropped and empty lines
+ *      are skipped. BOOLEANs are true or false (or 1 or 0).
+ */
+class DelimitedReader {
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    /**
+     * Open the file.
+     * @param path          the file
+     * @param column_types  data type of each field of a line, in order
+     * @param delimiter     what is between the fields
+     * @param quoting       whether fields can be in double quotes
+     */
+    DelimitedReader(std::string path, const std::vector<ColumnAttribute::DataType> &column_types, char delimiter = ',',
+                    bool quoting = true);
+
+    virtual ~DelimitedReader();
+
+    DelimitedReader(const DelimitedReader &other) = delete;
+
+    DelimitedReader &operator=(const DelimitedReader &other) = delete;
+
+    /**
+     * Pass over the next line (e.g., the column headings) without parsing it.
+     */
+    virtual void skip_line();
+
+    /**
+     * Parse the next batch of rows.
+     * @param rows  replaced with a row for each of the complete lines in the buffer (with views into it)
+     * @return      false once there are no more lines (rows is then empty)
+     */
+    virtual bool next_batch(Rows &rows);
+
+protected:
+    std::string path;
+    FILE *file;
+    std::vector<ColumnAttribute::DataType> column_types;
+    char delimiter;
+    bool quoting;
+    std::vector<char> buffer;
+    size_t begin;          // start of the first line not yet read
+    size_t end;            // end of the bytes read into the buffer
+    bool at_eof;
+    u_long line_number;    // lines read so far
+    u_long record_line;    // where the line being parsed starts (for error messages)
+
+    virtual bool fill();
+
+    virtual bool find_line(size_t &line_end, size_t &next, u_long &newlines) const;
+
+    virtual void parse_line(size_t start, size_t line_end, Row &row);
+
+    virtual void parse_field(const char *s, size_t size, uint col_num, Row &row) const;
+
+    virtual DbRelationError error(const std::string &message) const;
+};
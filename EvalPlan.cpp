@@ -4,7 +4,15 @@
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
 
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <system_error>
+#include <thread>
 #include "EvalPlan.h"
+#include "heap_storage.h"
+#include "Transaction.h"
 
 
 class Dummy : public DbRelation {
@@ -43,28 +51,80 @@ public:
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) { return nullptr; }
 };
 
-EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), projection(nullptr),
-                                                        select_conjunction(nullptr), table(Dummy::one()) {
+EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), right(nullptr), left_key(),
+                                                        right_key(), projection(nullptr), select_conjunction(nullptr),
+                                                        group_by(nullptr), aggregates(nullptr), input_columns(),
+                                                        table(Dummy::one()), index(nullptr), min_key(), max_key(),
+                                                        limit(0), offset(0), cost(-1.0) {
 }
 
-EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation),
-                                                                  projection(projection), select_conjunction(nullptr),
-                                                                  table(Dummy::one()) {
+EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation), right(nullptr),
+                                                                  left_key(), right_key(), projection(projection),
+                                                                  select_conjunction(nullptr), group_by(nullptr),
+                                                                  aggregates(nullptr), input_columns(),
+                                                                  table(Dummy::one()), index(nullptr), min_key(),
+                                                                  max_key(), limit(0), offset(0), cost(-1.0) {
 }
 
-EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), projection(nullptr),
-                                                                 select_conjunction(conjunction), table(Dummy::one()) {
+EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), right(nullptr),
+                                                                 left_key(), right_key(), projection(nullptr),
+                                                                 select_conjunction(conjunction), group_by(nullptr),
+                                                                 aggregates(nullptr), input_columns(),
+                                                                 table(Dummy::one()), index(nullptr), min_key(),
+                                                                 max_key(), limit(0), offset(0), cost(-1.0) {
 }
 
-EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), projection(nullptr),
-                                        select_conjunction(nullptr), table(table) {
+EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), right(nullptr), left_key(), right_key(),
+                                        projection(nullptr), select_conjunction(nullptr), group_by(nullptr),
+                                        aggregates(nullptr), input_columns(), table(table), index(nullptr), min_key(),
+                                        max_key(), limit(0), offset(0), cost(-1.0) {
 }
 
-EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table) {
+EvalPlan::EvalPlan(PlanType type, DbRelation &table, DbIndex &index, const KeyBound &min, const KeyBound &max)
+        : type(type), relation(nullptr), right(nullptr), left_key(), right_key(), projection(nullptr),
+          select_conjunction(nullptr), group_by(nullptr), aggregates(nullptr), input_columns(), table(table),
+          index(&index), min_key(min), max_key(max), limit(0), offset(0), cost(-1.0) {
+}
+
+// The rows under the aggregation only need the group by columns and the aggregates' columns
+EvalPlan::EvalPlan(ColumnNames *group_by, AggregateFunctions *aggregates, EvalPlan *relation)
+        : type(group_by == nullptr ? Aggregate : GroupBy), relation(relation), right(nullptr), left_key(), right_key(),
+          projection(nullptr), select_conjunction(nullptr), group_by(group_by), aggregates(aggregates),
+          input_columns(), table(Dummy::one()), index(nullptr), min_key(), max_key(), limit(0), offset(0),
+          cost(-1.0) {
+    if (group_by != nullptr)
+        input_columns = *group_by;
+    for (auto const &aggregate: *aggregates)
+        if (!aggregate.column_name.empty() &&
+            std::find(input_columns.begin(), input_columns.end(), aggregate.column_name) == input_columns.end())
+            input_columns.push_back(aggregate.column_name);
+}
+
+EvalPlan::EvalPlan(EvalPlan *left, const JoinKey &left_key, EvalPlan *right, const JoinKey &right_key)
+        : type(HashJoin), relation(left), right(right), left_key(left_key), right_key(right_key), projection(nullptr),
+          select_conjunction(nullptr), group_by(nullptr), aggregates(nullptr), input_columns(), table(Dummy::one()),
+          index(nullptr), min_key(), max_key(), limit(0), offset(0), cost(-1.0) {
+}
+
+EvalPlan::EvalPlan(u_long limit, u_long offset, EvalPlan *relation)
+        : type(Limit), relation(relation), right(nullptr), left_key(), right_key(), projection(nullptr),
+          select_conjunction(nullptr), group_by(nullptr), aggregates(nullptr), input_columns(), table(Dummy::one()),
+          index(nullptr), min_key(), max_key(), limit(limit), offset(offset), cost(-1.0) {
+}
+
+EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), left_key(other->left_key),
+                                            right_key(other->right_key), input_columns(other->input_columns),
+                                            table(other->table), index(other->index), min_key(other->min_key),
+                                            max_key(other->max_key), limit(other->limit), offset(other->offset),
+                                            cost(other->cost) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
         relation = nullptr;
+    if (other->right != nullptr)
+        right = new EvalPlan(other->right);
+    else
+        right = nullptr;
     if (other->projection != nullptr)
         projection = new ColumnNames(*other->projection);
     else
@@ -73,52 +133,1575 @@ EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->tabl
         select_conjunction = new ValueDict(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    if (other->group_by != nullptr)
+        group_by = new ColumnNames(*other->group_by);
+    else
+        group_by = nullptr;
+    if (other->aggregates != nullptr)
+        aggregates = new AggregateFunctions(*other->aggregates);
+    else
+        aggregates = nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
+    delete right;
     delete projection;
     delete select_conjunction;
+    delete group_by;
+    delete aggregates;
+}
+
+const double EvalPlan::ROWS_PER_BLOCK = 50.0;
+
+EvalPlan *EvalPlan::optimize(const IndexList *indices, const TableStatistics *statistics, PlanCatalog *catalog) {
+    EvalPlan *plan = new EvalPlan(this);
+
+    // the selection (or join) is either the whole plan (e.g., for a delete) or under the projection (and any
+    // aggregation and limit)
+    EvalPlan **spot = &plan;
+    while ((*spot)->type == Project || (*spot)->type == ProjectAll || (*spot)->type == Aggregate ||
+           (*spot)->type == GroupBy || (*spot)->type == Limit)
+        spot = &(*spot)->relation;
+    if ((*spot)->type == HashJoin)
+        *spot = optimize_join(*spot, catalog);
+    else
+        *spot = optimize_select(*spot, indices, statistics);
+    return plan;
+}
+
+/**
+ * Replace a selection over a table scan with a lookup in the cheapest index whose leading key columns all have
+ * values in the conjunction, keeping a selection on top for whatever is left of the conjunction. Stays with the
+ * table scan if that's cheaper (or there's nothing to use). With statistics, an index that would find a good share
+ * of the table's rows (e.g., on a column with few distinct values) costs more than the scan.
+ * @param select      the selection (or any other node, which is left alone); taken over by this method
+ * @param indices     indices on the table (or nullptr)
+ * @param statistics  the table's statistics (or nullptr)
+ * @return            the equivalent plan
+ */
+EvalPlan *EvalPlan::optimize_select(EvalPlan *select, const IndexList *indices, const TableStatistics *statistics) {
+    if (select->type == TableScan)
+        select->cost = select->table.get_block_count();
+    if (select->type != Select || select->relation->type != TableScan)
+        return select;
+    EvalPlan *scan = select->relation;
+    DbRelation &table = scan->table;
+    uint32_t table_blocks = table.get_block_count();
+    scan->cost = table_blocks;
+    if (indices == nullptr)
+        return select;
+
+    const ColumnNames &column_names = table.get_column_names();
+    const ColumnAttributes column_attributes = table.get_column_attributes();
+    const ValueDict &conjunction = *select->select_conjunction;
+    DbIndex *best = nullptr;
+    uint best_prefix = 0;
+    double best_cost = scan->cost;
+    for (auto index: *indices) {
+        // how many leading key columns have a value of the right type
+        uint prefix = 0;
+        ValueDict prefix_values;
+        for (auto const &column_name: index->get_key_columns()) {
+            auto found = conjunction.find(column_name);
+            auto column = std::find(column_names.begin(), column_names.end(), column_name);
+            if (found == conjunction.end() || column == column_names.end() ||
+                found->second.data_type != column_attributes[column - column_names.begin()].get_data_type())
+                break;
+            prefix_values.insert(*found);
+            prefix++;
+        }
+        if (prefix == 0)
+            continue;
+        double matching_rows = statistics == nullptr ? -1.0 : statistics->matching_rows(prefix_values);
+        double cost = index->lookup_cost(prefix, table_blocks, matching_rows);
+        if (cost >= 0 && (best == nullptr ? cost <= best_cost : cost < best_cost)) {
+            best = index;
+            best_prefix = prefix;
+            best_cost = cost;
+        }
+    }
+    if (best == nullptr)
+        return select;
+
+    ValueDict key;
+    ValueDict *residual = new ValueDict(conjunction);
+    for (uint i = 0; i < best_prefix; i++) {
+        const Identifier &column_name = best->get_key_columns()[i];
+        key[column_name] = conjunction.at(column_name);
+        residual->erase(column_name);
+    }
+    PlanType type = best_prefix == best->get_key_columns().size() ? IndexLookup : IndexRange;
+    EvalPlan *index_scan = new EvalPlan(type, table, *best, KeyBound(&key), KeyBound(&key));
+    index_scan->cost = best_cost;
+    delete select;
+    if (residual->empty()) {
+        delete residual;
+        return index_scan;
+    }
+    return new EvalPlan(residual, index_scan);
 }
 
+/**
+ * Pick how to do a join (made by the planner as a HashJoin), and each of its sides. It can be:
+ *      a hash join, building the side expected to have fewer rows, for the cost of reading both sides; or
+ *      an index join, if one side is a single table with an index on just its join column, for the cost of reading
+ *      the other side plus, for each of that side's rows, an index lookup.
+ * Rows are estimated from the tables' statistics where there are any (see estimate_rows).
+ * @param join     the join; taken over by this method
+ * @param catalog  for the indices and statistics of each table (or nullptr to just do a hash join)
+ * @return         the equivalent plan
+ */
+EvalPlan *EvalPlan::optimize_join(EvalPlan *join, PlanCatalog *catalog) {
+    EvalPlan *sides[] = {join->relation, join->right};
+    const JoinKey keys[] = {join->left_key, join->right_key};
+    EvalPlan *optimized[] = {optimize_side(new EvalPlan(sides[0]), catalog),
+                             optimize_side(new EvalPlan(sides[1]), catalog)};
+    double costs[2], rows[2];
+    for (int i = 0; i < 2; i++) {
+        costs[i] = optimized[i]->cost >= 0 ? optimized[i]->cost : optimized[i]->relation->cost;
+        rows[i] = estimate_rows(sides[i], catalog);
+    }
+
+    // a hash join builds the smaller side; an index join probes the table with the index
+    int build = rows[0] < rows[1] ? 0 : 1;
+    double best_cost = costs[0] + costs[1];
+    DbIndex *best = nullptr;
+    int inner = -1;
+    for (int i = 0; catalog != nullptr && i < 2; i++) {
+        if (!is_table_side(sides[i]))
+            continue;
+        const EvalPlan *scan = sides[i]->type == TableScan ? sides[i] : sides[i]->relation;
+        const TableStatistics *statistics = catalog->get_statistics(scan->table.get_table_name());
+        double distinct = key_distinct(sides[i], keys[i], catalog);
+        double per_key = statistics != nullptr && distinct >= 1 ? statistics->row_count / distinct : -1.0;
+        for (auto index: catalog->get_indices(scan->table.get_table_name())) {
+            if (index->get_key_columns().size() != 1 || index->get_key_columns().front() != keys[i].column_name)
+                continue;
+            double lookup = index->lookup_cost(1, scan->table.get_block_count(), per_key);
+            double cost = costs[1 - i] + (rows[1 - i] < 1 ? 1 : rows[1 - i]) * lookup;
+            if (lookup >= 0 && cost < best_cost) {
+                best = index;
+                inner = i;
+                best_cost = cost;
+            }
+        }
+    }
+
+    EvalPlan *plan;
+    if (best != nullptr) {
+        // the inner side is left as it was: its selection is checked on the rows the index finds
+        sides[inner] = new EvalPlan(sides[inner]);
+        plan = new EvalPlan(optimized[1 - inner], keys[1 - inner], sides[inner], keys[inner]);
+        plan->type = IndexJoin;
+        plan->index = best;
+        delete optimized[inner];
+    } else {
+        plan = new EvalPlan(optimized[1 - build], keys[1 - build], optimized[build], keys[build]);
+    }
+    plan->cost = best_cost;
+    delete join;
+    return plan;
+}
+
+// One side of a join, optimized on its own (freed by caller); side is taken over by this method
+EvalPlan *EvalPlan::optimize_side(EvalPlan *side, PlanCatalog *catalog) {
+    if (side->type == HashJoin)
+        return optimize_join(side, catalog);
+    if (catalog == nullptr)
+        return optimize_select(side, nullptr, nullptr);
+    const EvalPlan *scan = side;
+    while (scan->relation != nullptr)
+        scan = scan->relation;
+    IndexList indices = catalog->get_indices(scan->table.get_table_name());
+    return optimize_select(side, &indices, catalog->get_statistics(scan->table.get_table_name()));
+}
+
+/**
+ * Estimated number of rows an unoptimized join side comes to: from the table's statistics if it has been analyzed,
+ * otherwise from its size in blocks (ROWS_PER_BLOCK) and TableStatistics::DEFAULT_SELECTIVITY for each value in its
+ * selection. A join of two sides comes to the product of their rows over the larger number of distinct join keys,
+ * or, if neither is known, as many rows as the bigger side (as for a foreign key).
+ * @param plan     a TableScan, a Select over one, or a HashJoin of those
+ * @param catalog  for the statistics (or nullptr)
+ * @return         number of rows
+ */
+double EvalPlan::estimate_rows(const EvalPlan *plan, PlanCatalog *catalog) {
+    if (plan->type == HashJoin) {
+        double left = estimate_rows(plan->relation, catalog), right = estimate_rows(plan->right, catalog);
+        double distinct = std::max(key_distinct(plan->relation, plan->left_key, catalog),
+                                   key_distinct(plan->right, plan->right_key, catalog));
+        return distinct > 0 ? left * right / distinct : std::max(left, right);
+    }
+    const ValueDict *conjunction = plan->type == Select ? plan->select_conjunction : nullptr;
+    while (plan->relation != nullptr)
+        plan = plan->relation;
+    const TableStatistics *statistics =
+            catalog == nullptr ? nullptr : catalog->get_statistics(plan->table.get_table_name());
+    if (statistics != nullptr)
+        return conjunction == nullptr ? statistics->row_count : statistics->matching_rows(*conjunction);
+    double rows = plan->table.get_block_count() * ROWS_PER_BLOCK;
+    if (conjunction != nullptr)
+        rows *= std::pow(TableStatistics::DEFAULT_SELECTIVITY, (double) conjunction->size());
+    return rows;
+}
+
+// Estimated number of distinct values of a one-table side's join column (0 if there are no statistics to say)
+double EvalPlan::key_distinct(const EvalPlan *side, const JoinKey &key, PlanCatalog *catalog) {
+    if (catalog == nullptr || !is_table_side(side))
+        return 0;
+    while (side->relation != nullptr)
+        side = side->relation;
+    const TableStatistics *statistics = catalog->get_statistics(side->table.get_table_name());
+    if (statistics == nullptr)
+        return 0;
+    auto found = statistics->columns.find(key.column_name);
+    return found == statistics->columns.end() ? 0 : found->second.distinct;
+}
 
-EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+// Whether a join side is a single table: a TableScan, or a Select over one
+bool EvalPlan::is_table_side(const EvalPlan *side) {
+    return side->type == TableScan || (side->type == Select && side->relation->type == TableScan);
 }
 
-ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
-    if (this->type != ProjectAll && this->type != Project)
+// Only the columns the plan already has values for are changed
+void EvalPlan::bind(const ValueDict &values) {
+    for (auto const &item: values) {
+        if (this->select_conjunction != nullptr && this->select_conjunction->count(item.first) != 0)
+            (*this->select_conjunction)[item.first] = item.second;
+        if (this->min_key.key.count(item.first) != 0)
+            this->min_key.key[item.first] = item.second;
+        if (this->max_key.key.count(item.first) != 0)
+            this->max_key.key[item.first] = item.second;
+    }
+    if (this->relation != nullptr)
+        this->relation->bind(values);
+    if (this->right != nullptr)
+        this->right->bind(values);
+}
+
+// Write out the column=value pairs, e.g., a=1, b="x"
+static void explain_values(std::ostream &out, const ValueDict &values, const char *separator) {
+    bool first = true;
+    for (auto const &item: values) {
+        if (!first)
+            out << separator;
+        first = false;
+        out << item.first << '=';
+        if (item.second.data_type == ColumnAttribute::TEXT)
+            out << '"' << item.second.s << '"';
+        else
+            out << item.second;
+    }
+}
+
+// One end of an index range: [key] if inclusive, (key) if not, * if unbounded
+static void explain_bound(std::ostream &out, const KeyBound &bound) {
+    if (bound.is_unbounded()) {
+        out << '*';
+        return;
+    }
+    out << (bound.inclusive ? '[' : '(');
+    explain_values(out, bound.key, ", ");
+    out << (bound.inclusive ? ']' : ')');
+}
+
+// What a node did, e.g., (actual rows 3, 0.042 ms, blocks read 1, rows examined 6, bytes marshalled 60)
+static void explain_actual(std::ostream &out, const ExecCounters &actual, bool has_iterator) {
+    std::ostringstream details;
+    details << std::fixed << std::setprecision(3);
+    if (has_iterator)
+        details << ", actual rows " << actual.rows_emitted << ", " << actual.seconds * 1000 << " ms";
+    const std::pair<const char *, u_long> counts[] = {
+            {"blocks read",      actual.blocks_read},
+            {"blocks written",   actual.blocks_written},
+            {"blocks skipped",   actual.blocks_skipped},
+            {"rows examined",    actual.rows_examined},
+            {"index descents",   actual.index_descents},
+            {"bytes marshalled", actual.bytes_marshalled}};
+    for (auto const &count: counts)
+        if (count.second != 0)
+            details << ", " << count.first << ' ' << count.second;
+    if (!details.str().empty())
+        out << " (" << details.str().substr(2) << ")";
+}
+
+std::string EvalPlan::explain(uint depth, const PlanProfile *profile) const {
+    std::ostringstream out;
+    out << std::string(2 * depth, ' ');
+    switch (this->type) {
+        case ProjectAll:
+            out << "ProjectAll";
+            break;
+        case Project: {
+            out << "Project ";
+            bool first = true;
+            for (auto const &column_name: *this->projection) {
+                out << (first ? "" : ", ") << column_name;
+                first = false;
+            }
+            break;
+        }
+        case Select:
+            out << "Select ";
+            explain_values(out, *this->select_conjunction, " and ");
+            break;
+        case TableScan:
+            out << "TableScan " << this->table.get_table_name();
+            break;
+        case IndexLookup:
+            out << "IndexLookup " << this->table.get_table_name() << " using " << this->index->get_name() << ' ';
+            explain_values(out, this->min_key.key, " and ");
+            break;
+        case IndexRange:
+            out << "IndexRange " << this->table.get_table_name() << " using " << this->index->get_name() << ' ';
+            explain_bound(out, this->min_key);
+            out << " to ";
+            explain_bound(out, this->max_key);
+            break;
+        case Aggregate:
+        case GroupBy: {
+            out << (this->type == Aggregate ? "Aggregate " : "GroupBy ");
+            bool first = true;
+            if (this->group_by != nullptr) {
+                for (auto const &column_name: *this->group_by) {
+                    out << (first ? "" : ", ") << column_name;
+                    first = false;
+                }
+                out << ':';
+            }
+            first = true;
+            for (auto const &aggregate: *this->aggregates) {
+                out << (first && this->group_by == nullptr ? "" : first ? " " : ", ") << aggregate.name;
+                first = false;
+            }
+            break;
+        }
+        case HashJoin:
+        case IndexJoin:
+            out << (this->type == HashJoin ? "HashJoin " : "IndexJoin ")
+                << this->left_key.qualified(this->left_key.column_name) << " = "
+                << this->right_key.qualified(this->right_key.column_name);
+            if (this->type == IndexJoin)
+                out << " using " << this->index->get_name();
+            break;
+        case Limit:
+            out << "Limit " << this->limit;
+            if (this->offset > 0)
+                out << " offset " << this->offset;
+            break;
+    }
+    if (this->cost >= 0)
+        out << " (cost " << this->cost << ")";
+    if (profile != nullptr) {
+        auto actual = profile->find(this);
+        if (actual != profile->end())
+            explain_actual(out, actual->second, actual->second.seconds > 0 || actual->second.rows_emitted > 0);
+    }
+    if (this->relation != nullptr)
+        out << std::endl << this->relation->explain(depth + 1, profile);
+    if (this->right != nullptr)
+        out << std::endl << this->right->explain(depth + 1, profile);
+    return out.str();
+}
+
+Rows *EvalPlan::evaluate() {
+    const EvalPlan *top = this->type == Limit ? this->relation : this;
+    if (top->type != ProjectAll && top->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
-    if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
+    Rows *ret = new Rows();
+    EvalIterator *rows = iterator();
+    try {
+        rows->open();
+        Row row;
+        while (rows->next(row))
+            ret->push_back(row);  // copying gives the kept row its own TEXT bytes
+        rows->close();
+    } catch (...) {
+        delete ret;
+        delete rows;
+        throw;
+    }
+    delete rows;
     return ret;
 }
 
+/**
+ * Run the plan to the end with every iterator profiled, and with counting turned on (see ExecStats) so that the
+ * storage work can be charged to the nodes at the bottom of the plan (each table's to the first node reading it).
+ * @param profile  filled in for each node that has an iterator of its own, and for the bottom nodes
+ */
+void EvalPlan::analyze(PlanProfile &profile) {
+    std::vector<const EvalPlan *> bottoms;
+    get_leaves(bottoms);
+    std::vector<std::pair<const EvalPlan *, ExecCounters *>> tables;
+    for (auto bottom: bottoms) {
+        ExecCounters *counters = ExecStats::for_table(bottom->table.get_table_name());
+        bool seen = false;
+        for (auto const &table: tables)
+            seen = seen || table.second == counters;
+        if (!seen)
+            tables.push_back(std::make_pair(bottom, counters));
+    }
+    bool was_enabled = ExecStats::enabled;
+    ExecStats::enabled = true;
+    std::vector<ExecCounters> before;
+    for (auto const &table: tables)
+        before.push_back(ExecStats::snapshot(table.second));
+    EvalIterator *rows = nullptr;
+    try {
+        rows = iterator(&profile);
+        rows->open();
+        Row row;
+        while (rows->next(row))
+            continue;
+        rows->close();
+    } catch (...) {
+        delete rows;
+        ExecStats::enabled = was_enabled;
+        throw;
+    }
+    delete rows;  // scans add in their tallies as they are freed
+    ExecStats::enabled = was_enabled;
+    for (size_t i = 0; i < tables.size(); i++)
+        profile[tables[i].first] += ExecStats::snapshot(tables[i].second) - before[i];
+}
+
+// The nodes at the bottom of the plan, where its tables are read (one for each side of each join), left to right
+void EvalPlan::get_leaves(std::vector<const EvalPlan *> &leaves) const {
+    if (this->relation == nullptr)
+        leaves.push_back(this);
+    else
+        this->relation->get_leaves(leaves);
+    if (this->right != nullptr)
+        this->right->get_leaves(leaves);
+}
+
+// Each node's iterator is wrapped in a ProfileIterator when profiling
+EvalIterator *EvalPlan::iterator(PlanProfile *profile, bool serial) {
+    EvalIterator *rows = make_iterator(profile, serial);
+    if (profile == nullptr)
+        return rows;
+    return new ProfileIterator(rows, (*profile)[this]);
+}
+
+EvalIterator *EvalPlan::make_iterator(PlanProfile *profile, bool serial) {
+    // selections and projections directly over a table scan are pushed down into the scan
+    switch (this->type) {
+        case TableScan:
+            return new TableScanIterator(this->table, nullptr, nullptr);
+        case IndexLookup:
+        case IndexRange:
+            return new IndexScanIterator(this->table, *this->index, this->type == IndexLookup, this->min_key,
+                                         this->max_key, nullptr);
+        case Select:
+            if (this->relation->type == TableScan)
+                return new TableScanIterator(this->relation->table, this->select_conjunction, nullptr);
+            return new SelectIterator(this->relation->iterator(profile, serial), this->select_conjunction);
+        case Project:
+        case ProjectAll: {
+            const ColumnNames *column_names = this->type == Project ? this->projection : nullptr;
+            return input_iterator(column_names, profile, serial);
+        }
+        case Aggregate:
+        case GroupBy:
+            // a bare COUNT(*) of a whole table is read off the blocks without looking at any rows
+            if (this->type == Aggregate && this->relation->type == TableScan && this->aggregates->size() == 1 &&
+                this->aggregates->front().function == AggregateFunction::COUNT &&
+                this->aggregates->front().column_name.empty())
+                return new CountIterator(this->relation->table, this->aggregates->front().name);
+            return new AggregateIterator(input_iterator(this->input_columns.empty() ? nullptr : &this->input_columns,
+                                                        profile, false), this->group_by, this->aggregates);
+        case HashJoin:
+            return new HashJoinIterator(this->relation->iterator(profile, serial), this->left_key,
+                                        this->right->iterator(profile, false), this->right_key);
+        case IndexJoin: {
+            EvalPlan *scan = this->right->type == Select ? this->right->relation : this->right;
+            return new IndexJoinIterator(this->relation->iterator(profile, serial), this->left_key, scan->table,
+                                         *this->index, this->right->select_conjunction, this->right_key);
+        }
+        case Limit:
+            return new LimitIterator(this->relation->iterator(profile, true), this->limit, this->offset);
+        default:
+            throw DbRelationError("Not implemented: iterator for this plan type");
+    }
+}
+
+/**
+ * The iterator for the rows under this node, restricted to the given columns (pushed down into a scan under it).
+ * @param projection  the columns (or nullptr for all of them)
+ * @param profile     as for iterator()
+ * @param serial      as for iterator()
+ * @return            the iterator (freed by caller)
+ */
+EvalIterator *EvalPlan::input_iterator(const ColumnNames *projection, PlanProfile *profile, bool serial) {
+    if (this->relation->type == TableScan)
+        return scan_iterator(this->relation->table, nullptr, projection, serial);
+    if (this->relation->type == IndexLookup || this->relation->type == IndexRange)
+        return new IndexScanIterator(this->relation->table, *this->relation->index,
+                                     this->relation->type == IndexLookup, this->relation->min_key,
+                                     this->relation->max_key, projection);
+    if (this->relation->type == Select && this->relation->relation->type == TableScan)
+        return scan_iterator(this->relation->relation->table, this->relation->select_conjunction, projection,
+                             serial);
+    if (projection == nullptr)
+        return this->relation->iterator(profile, serial);
+    return new ProjectIterator(this->relation->iterator(profile, serial), projection);
+}
+
+// Scans of big tables are split up among worker threads (unless the scan is to be serial, or is part of a
+// transaction: its Berkeley DB handle isn't to be used from more than one thread at a time)
+EvalIterator *EvalPlan::scan_iterator(DbRelation &table, const ValueDict *conjunction,
+                                      const ColumnNames *projection, bool serial) {
+    if (!serial && Transaction::current() == nullptr && ParallelScanIterator::worthwhile(table))
+        return new ParallelScanIterator(table, conjunction, projection);
+    return new TableScanIterator(table, conjunction, projection);
+}
+
 EvalPipeline EvalPlan::pipeline() {
-    // base cases
-    if (this->type == TableScan)
-        return EvalPipeline(&this->table, this->table.select());
-    if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
-
-    // recursive case
-    if (this->type == Select) {
-        EvalPipeline pipeline = this->relation->pipeline();
-        DbRelation *temp_table = pipeline.first;
-        Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
+    if (this->type != TableScan && this->type != Select && this->type != IndexLookup && this->type != IndexRange)
+        throw DbRelationError("Not implemented: pipeline other than Select, TableScan, IndexLookup, or IndexRange");
+
+    // find the table the handles belong to
+    EvalPlan *scan = this;
+    while (scan->type == Select)
+        scan = scan->relation;
+
+    // collect the handles in a single streaming pass
+    Handles *handles = new Handles();
+    EvalIterator *rows = iterator();
+    try {
+        rows->open();
+        while (rows->advance())
+            handles->push_back(rows->get_handle());
+        rows->close();
+    } catch (...) {
         delete handles;
-        return ret;
+        delete rows;
+        throw;
+    }
+    delete rows;
+    return EvalPipeline(&scan->table, handles);
+}
+
+
+// Aggregates' types come from their columns, everything else's from the table (of the join) at the bottom of the plan
+ColumnAttributes *EvalPlan::get_column_attributes(const ColumnNames &column_names) const {
+    const EvalPlan *aggregation = this, *bottom = this;
+    while (aggregation != nullptr && aggregation->type != Aggregate && aggregation->type != GroupBy)
+        aggregation = aggregation->relation;
+    while (bottom->relation != nullptr && bottom->type != HashJoin && bottom->type != IndexJoin)
+        bottom = bottom->relation;
+    if (aggregation == nullptr && bottom->relation == nullptr)
+        return bottom->table.get_column_attributes(column_names);
+    ColumnAttributes *column_attributes = new ColumnAttributes();
+    try {
+        for (auto const &column_name: column_names) {
+            const AggregateFunction *aggregate = nullptr;
+            if (aggregation != nullptr)
+                for (auto const &candidate: *aggregation->aggregates)
+                    if (aggregate == nullptr && candidate.name == column_name)
+                        aggregate = &candidate;
+            if (aggregate != nullptr)
+                column_attributes->push_back(ColumnAttribute(aggregate->result_type()));
+            else
+                column_attributes->push_back(column_attribute(bottom, column_name));
+        }
+    } catch (...) {
+        delete column_attributes;
+        throw;
+    }
+    return column_attributes;
+}
+
+/**
+ * Data type of a column of the rows a table scan or a join evaluates to.
+ * @param bottom       a TableScan (or other node reading one table), or a HashJoin or IndexJoin
+ * @param column_name  the column (qualified, for a join)
+ * @return             its attribute
+ * @throws DbRelationError if there is no such column
+ */
+ColumnAttribute EvalPlan::column_attribute(const EvalPlan *bottom, const Identifier &column_name) {
+    if (bottom->type == HashJoin || bottom->type == IndexJoin) {
+        const std::pair<const EvalPlan *, const JoinKey *> sides[] = {{bottom->relation, &bottom->left_key},
+                                                                      {bottom->right,    &bottom->right_key}};
+        for (auto const &side: sides) {
+            const EvalPlan *plan = side.first;
+            const Identifier &qualifier = side.second->qualifier;
+            while (plan->relation != nullptr && plan->type != HashJoin && plan->type != IndexJoin)
+                plan = plan->relation;
+            if (qualifier.empty()) {
+                try {
+                    return column_attribute(plan, column_name);
+                } catch (DbRelationError &e) {
+                    continue;  // must be on the other side
+                }
+            }
+            if (column_name.compare(0, qualifier.size() + 1, qualifier + ".") == 0)
+                return column_attribute(plan, column_name.substr(qualifier.size() + 1));
+        }
+        throw DbRelationError("unknown column " + column_name);
+    }
+    ColumnNames one(1, column_name);
+    ColumnAttributes *attribute = bottom->table.get_column_attributes(one);
+    ColumnAttribute found = attribute->front();
+    delete attribute;
+    return found;
+}
+
+/****************
+ * EvalIterator *
+ ****************/
+
+// Default is to make the row and throw it away
+bool EvalIterator::advance() {
+    Row row;
+    return next(row);
+}
+
+Handle EvalIterator::get_handle() const {
+    throw DbRelationError("Not implemented: handles from this plan");
+}
+
+TableScanIterator::TableScanIterator(DbRelation &table, const ValueDict *conjunction, const ColumnNames *projection)
+        : table(table), conjunction(conjunction), projection(projection), cursor(nullptr) {
+}
+
+TableScanIterator::~TableScanIterator() {
+    delete cursor;
+}
+
+void TableScanIterator::open() {
+    delete cursor;
+    cursor = table.cursor(conjunction);
+}
+
+bool TableScanIterator::next(Row &row) {
+    if (!cursor->next())
+        return false;
+    cursor->project_row(projection, row);
+    return true;
+}
+
+bool TableScanIterator::advance() {
+    return cursor->next();
+}
+
+Handle TableScanIterator::get_handle() const {
+    return cursor->get_handle();
+}
+
+void TableScanIterator::close() {
+    delete cursor;
+    cursor = nullptr;
+}
+
+const ColumnNames &TableScanIterator::get_column_names() const {
+    if (projection == nullptr || projection->empty())
+        return table.get_column_names();
+    return *projection;
+}
+
+ParallelScanIterator::ParallelScanIterator(DbRelation &table, const ValueDict *conjunction,
+                                           const ColumnNames *projection)
+        : table(table), conjunction(conjunction), projection(projection), last_block(0), results(), finished(),
+          shares(), morsel(0), i(0), stopping(false), error(), threads(), latch(), changed() {
+}
+
+ParallelScanIterator::~ParallelScanIterator() {
+    close();
+}
+
+bool ParallelScanIterator::worthwhile(DbRelation &table) {
+    return std::thread::hardware_concurrency() > 1 && table.get_block_count() >= 4 * MORSEL_BLOCKS;
+}
+
+uint ParallelScanIterator::worker_count(uint morsels) {
+    uint n = std::thread::hardware_concurrency();  // 0 if it can't tell
+    if (n > MAX_WORKERS)
+        n = MAX_WORKERS;
+    if (n > morsels)
+        n = morsels;
+    return n == 0 ? 1 : n;
+}
+
+/**
+ * Deal out the morsels and start the workers on them (all but the first, whose share is left to the thread calling
+ * next() and to the others to steal from).
+ */
+void ParallelScanIterator::open() {
+    close();
+    this->last_block = this->table.get_block_count();  // also opens the table before any worker needs it
+    uint morsels = (this->last_block + MORSEL_BLOCKS - 1) / MORSEL_BLOCKS;
+    this->results.assign(morsels, Rows());
+    this->finished.assign(morsels, false);
+    this->morsel = 0;
+    this->i = 0;
+    this->stopping = false;
+    this->error = nullptr;
+
+    uint n = worker_count(morsels);
+    this->shares.resize(n);
+    for (uint worker = 0; worker < n; worker++)
+        this->shares[worker] = worker;
+    for (uint worker = 1; worker < n; worker++) {
+        try {
+            this->threads.push_back(std::thread(&ParallelScanIterator::work, this, worker));
+        } catch (std::system_error &e) {
+            break;  // out of threads -- the workers we have will steal the rest
+        }
     }
+}
+
+/**
+ * Hand out the rows the workers found, in block order, waiting for each morsel to be finished (or scanning it here,
+ * if no worker has taken it yet).
+ * @param row  the next row (with its own copy of any TEXT)
+ * @return     false if there are no more rows
+ * @throws     whatever the scan of a morsel ran into
+ */
+bool ParallelScanIterator::next(Row &row) {
+    while (this->morsel < this->results.size()) {
+        if (this->i == 0) {
+            std::unique_lock<std::mutex> guard(this->latch);
+            while (!this->finished[this->morsel]) {
+                if (this->error)
+                    std::rethrow_exception(this->error);
+                uint &share = this->shares[this->morsel % this->shares.size()];
+                if (share == this->morsel) {
+                    share += this->shares.size();
+                    run(guard, this->morsel);
+                } else {
+                    this->changed.wait(guard);
+                }
+            }
+        }
+        Rows &rows = this->results[this->morsel];
+        if (this->i < rows.size()) {
+            row = std::move(rows[this->i++]);
+            return true;
+        }
+        Rows().swap(rows);  // done with this morsel
+        std::lock_guard<std::mutex> guard(this->latch);
+        this->morsel++;
+        this->i = 0;
+        this->changed.notify_all();  // the workers waiting for next() to catch up
+    }
+    return false;
+}
+
+// Stop the workers (after the morsels they are on) and let go of the rows not handed out
+void ParallelScanIterator::close() {
+    {
+        std::lock_guard<std::mutex> guard(this->latch);
+        this->stopping = true;
+        this->changed.notify_all();
+    }
+    for (auto &thread: this->threads)
+        thread.join();
+    this->threads.clear();
+    this->results.clear();
+    this->finished.clear();
+}
+
+const ColumnNames &ParallelScanIterator::get_column_names() const {
+    if (projection == nullptr || projection->empty())
+        return table.get_column_names();
+    return *projection;
+}
+
+/**
+ * Get a worker its next morsel: the next one in its own share or, failing that, the next one in the share furthest
+ * behind, as long as it isn't too far ahead of next() (else wait for next() to catch up).
+ * @param guard   holding the latch
+ * @param worker  which worker is asking
+ * @param found   set to the morsel taken
+ * @return        false if there are no morsels left anywhere (or the scan is stopping)
+ */
+bool ParallelScanIterator::take(std::unique_lock<std::mutex> &guard, uint worker, uint &found) {
+    uint n = (uint) this->shares.size();
+    while (!this->stopping) {
+        uint behind = 0;
+        for (uint other = 1; other < n; other++)
+            if (this->shares[other] < this->shares[behind])
+                behind = other;
+        if (this->shares[behind] >= this->results.size())
+            return false;
+        size_t limit = this->morsel + AHEAD_MORSELS * n;
+        uint share = this->shares[worker] < this->results.size() && this->shares[worker] < limit ? worker : behind;
+        if (this->shares[share] < limit) {
+            found = this->shares[share];
+            this->shares[share] += n;
+            return true;
+        }
+        this->changed.wait(guard);
+    }
+    return false;
+}
+
+/**
+ * Scan a morsel without holding the latch, then mark it finished (or else stop the scan, keeping what went wrong).
+ * @param guard      holding the latch (again, on return)
+ * @param morsel_no  which morsel
+ */
+void ParallelScanIterator::run(std::unique_lock<std::mutex> &guard, uint morsel_no) {
+    guard.unlock();
+    std::exception_ptr failure;
+    try {
+        scan(morsel_no);
+    } catch (...) {
+        failure = std::current_exception();
+    }
+    guard.lock();
+    if (failure) {
+        if (!this->error)
+            this->error = failure;
+        this->stopping = true;
+    } else {
+        this->finished[morsel_no] = true;
+    }
+    this->changed.notify_all();
+}
+
+// One worker's loop: scan morsels until there are none left (or the scan stops)
+void ParallelScanIterator::work(uint worker) {
+    std::unique_lock<std::mutex> guard(this->latch);
+    uint morsel_no;
+    while (take(guard, worker, morsel_no))
+        run(guard, morsel_no);
+}
+
+/**
+ * Select and project the rows of one morsel into its place in results.
+ * @param morsel_no  which morsel
+ */
+void ParallelScanIterator::scan(uint morsel_no) {
+    BlockID first = morsel_no * MORSEL_BLOCKS + 1;
+    BlockID last = first + MORSEL_BLOCKS - 1;
+    if (last > this->last_block)
+        last = this->last_block;
+    Rows &rows = this->results[morsel_no];
+    DbCursor *cursor = this->table.cursor(this->conjunction, first, last);
+    try {
+        Row row;
+        while (cursor->next()) {
+            cursor->project_row(this->projection, row);
+            rows.push_back(row);  // copying gives the kept row its own TEXT bytes
+        }
+    } catch (...) {
+        delete cursor;
+        throw;
+    }
+    delete cursor;
+}
+
+IndexScanIterator::IndexScanIterator(DbRelation &table, DbIndex &index, bool lookup, const KeyBound &min,
+                                     const KeyBound &max, const ColumnNames *projection)
+        : table(table), index(index), lookup(lookup), min(min), max(max), projection(projection), handles(nullptr),
+          next_handle(0), cursor(nullptr), handle() {
+}
+
+IndexScanIterator::~IndexScanIterator() {
+    close();
+}
+
+void IndexScanIterator::open() {
+    close();
+    this->index.open();
+    if (this->lookup) {
+        ValueDict key(this->min.key);
+        this->handles = this->index.lookup(&key);
+        this->next_handle = 0;
+    } else {
+        this->cursor = this->index.range_cursor(this->min, this->max);
+    }
+}
+
+bool IndexScanIterator::next(Row &row) {
+    if (!advance())
+        return false;
+    ValueDict *values = this->table.project(this->handle, this->projection);
+    row.assign(*values, get_column_names());
+    delete values;
+    return true;
+}
+
+bool IndexScanIterator::advance() {
+    if (this->cursor != nullptr) {
+        if (!this->cursor->next())
+            return false;
+        this->handle = this->cursor->get_handle();
+        return true;
+    }
+    if (this->handles == nullptr || this->next_handle >= this->handles->size())
+        return false;
+    this->handle = (*this->handles)[this->next_handle++];
+    return true;
+}
 
-    throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
+Handle IndexScanIterator::get_handle() const {
+    return this->handle;
 }
 
+void IndexScanIterator::close() {
+    delete this->handles;
+    this->handles = nullptr;
+    delete this->cursor;
+    this->cursor = nullptr;
+}
+
+const ColumnNames &IndexScanIterator::get_column_names() const {
+    if (this->projection == nullptr || this->projection->empty())
+        return this->table.get_column_names();
+    return *this->projection;
+}
+
+SelectIterator::SelectIterator(EvalIterator *input, const ValueDict *conjunction) : input(input),
+                                                                                   conjunction(conjunction),
+                                                                                   predicates() {
+}
+
+SelectIterator::~SelectIterator() {
+    delete input;
+}
+
+// Open the input and line the conjunction up with the positions in its rows
+void SelectIterator::open() {
+    input->open();
+    const ColumnNames &column_names = input->get_column_names();
+    predicates.clear();
+    for (auto const &predicate: *conjunction) {
+        auto it = std::find(column_names.begin(), column_names.end(), predicate.first);
+        if (it == column_names.end())
+            throw DbRelationError("unknown column " + predicate.first);
+        predicates.push_back(std::make_pair((uint) (it - column_names.begin()), &predicate.second));
+    }
+}
+
+// Pull rows from the input until one has all the conjunction's values
+bool SelectIterator::next(Row &row) {
+    while (input->next(row)) {
+        bool is_selected = true;
+        for (auto const &predicate: predicates) {
+            if (!row.equals(predicate.first, *predicate.second)) {
+                is_selected = false;
+                break;
+            }
+        }
+        if (is_selected)
+            return true;
+    }
+    return false;
+}
+
+Handle SelectIterator::get_handle() const {
+    return input->get_handle();
+}
+
+void SelectIterator::close() {
+    input->close();
+}
+
+const ColumnNames &SelectIterator::get_column_names() const {
+    return input->get_column_names();
+}
+
+ProjectIterator::ProjectIterator(EvalIterator *input, const ColumnNames *projection) : input(input),
+                                                                                      projection(projection),
+                                                                                      positions(), input_row() {
+}
+
+ProjectIterator::~ProjectIterator() {
+    delete input;
+}
+
+// Open the input and find each projected column's position in its rows
+void ProjectIterator::open() {
+    input->open();
+    const ColumnNames &column_names = input->get_column_names();
+    positions.clear();
+    for (auto const &column_name: *projection) {
+        auto it = std::find(column_names.begin(), column_names.end(), column_name);
+        if (it == column_names.end())
+            throw DbRelationError("unknown column " + column_name);
+        positions.push_back((uint) (it - column_names.begin()));
+    }
+}
+
+bool ProjectIterator::next(Row &row) {
+    if (!input->next(input_row))
+        return false;
+    row.clear();
+    row.reserve((uint) positions.size());
+    for (auto position: positions)
+        row.append(input_row, position);
+    return true;
+}
+
+Handle ProjectIterator::get_handle() const {
+    return input->get_handle();
+}
+
+void ProjectIterator::close() {
+    input->close();
+}
+
+const ColumnNames &ProjectIterator::get_column_names() const {
+    return *projection;
+}
+
+LimitIterator::LimitIterator(EvalIterator *input, u_long limit, u_long offset) : input(input), limit(limit),
+                                                                                offset(offset), produced(0) {
+}
+
+LimitIterator::~LimitIterator() {
+    delete this->input;
+}
+
+void LimitIterator::open() {
+    this->input->open();
+    this->produced = 0;
+    for (u_long skipped = 0; skipped < this->offset && this->limit > 0; skipped++)
+        if (!this->input->advance())
+            break;
+}
+
+bool LimitIterator::next(Row &row) {
+    if (this->produced >= this->limit || !this->input->next(row))
+        return false;
+    this->produced++;
+    return true;
+}
+
+bool LimitIterator::advance() {
+    if (this->produced >= this->limit || !this->input->advance())
+        return false;
+    this->produced++;
+    return true;
+}
+
+Handle LimitIterator::get_handle() const {
+    return this->input->get_handle();
+}
+
+void LimitIterator::close() {
+    this->input->close();
+}
+
+const ColumnNames &LimitIterator::get_column_names() const {
+    return this->input->get_column_names();
+}
+
+AggregateIterator::AggregateIterator(EvalIterator *input, const ColumnNames *group_by,
+                                     const AggregateFunctions *aggregates)
+        : input(input), group_by(group_by), aggregates(aggregates), column_names(), groups(nullptr), group(0),
+          empty_group(false) {
+    if (group_by != nullptr)
+        column_names = *group_by;
+    for (auto const &aggregate: *aggregates)
+        column_names.push_back(aggregate.name);
+}
+
+AggregateIterator::~AggregateIterator() {
+    delete groups;
+    delete input;
+}
+
+// Line the group by columns and the aggregates' columns up with the input's rows, and fold every row in
+void AggregateIterator::open() {
+    input->open();
+    const ColumnNames &input_columns = input->get_column_names();
+    auto position = [&input_columns](const Identifier &column_name) {
+        auto it = std::find(input_columns.begin(), input_columns.end(), column_name);
+        if (it == input_columns.end())
+            throw DbRelationError("unknown column " + column_name);
+        return (uint) (it - input_columns.begin());
+    };
+    std::vector<uint> key_positions, argument_positions;
+    if (group_by != nullptr)
+        for (auto const &column_name: *group_by)
+            key_positions.push_back(position(column_name));
+    bool counts_only = key_positions.empty(), no_extremes = true;
+    for (auto const &aggregate: *aggregates) {
+        argument_positions.push_back(aggregate.column_name.empty() ? 0 : position(aggregate.column_name));
+        if (aggregate.function != AggregateFunction::COUNT)
+            counts_only = false;
+        if (aggregate.function == AggregateFunction::MIN || aggregate.function == AggregateFunction::MAX)
+            no_extremes = false;
+    }
+
+    delete groups;
+    groups = new GroupTable((uint) key_positions.size(), *aggregates);
+    group = 0;
+    Row row;
+    if (counts_only) {
+        while (input->advance())  // the rows don't have to be made, just counted
+            groups->add(row, key_positions, argument_positions);
+    } else {
+        while (input->next(row))
+            groups->add(row, key_positions, argument_positions);
+    }
+    empty_group = groups->size() == 0 && group_by == nullptr && no_extremes;
+}
+
+bool AggregateIterator::next(Row &row) {
+    if (empty_group) {
+        empty_group = false;
+        row.clear();
+        for (size_t i = 0; i < aggregates->size(); i++)
+            row.append_int(0);
+        return true;
+    }
+    if (groups == nullptr || group >= groups->size())
+        return false;
+    groups->result(group++, row);
+    return true;
+}
+
+void AggregateIterator::close() {
+    input->close();
+    delete groups;
+    groups = nullptr;
+}
+
+const ColumnNames &AggregateIterator::get_column_names() const {
+    return column_names;
+}
+
+CountIterator::CountIterator(DbRelation &table, const Identifier &name) : table(table), column_names(1, name),
+                                                                          done(true) {
+}
+
+void CountIterator::open() {
+    done = false;
+}
+
+bool CountIterator::next(Row &row) {
+    if (done)
+        return false;
+    done = true;
+    u_long n = table.count();
+    if (n > INT32_MAX)
+        throw DbRelationError(column_names.front() + " is too big for an INT");
+    row.clear();
+    row.append_int((int32_t) n);
+    return true;
+}
+
+void CountIterator::close() {
+    done = true;
+}
+
+const ColumnNames &CountIterator::get_column_names() const {
+    return column_names;
+}
+
+// Where a column is in the rows of an input
+static uint column_position(const EvalIterator *input, const Identifier &column_name) {
+    const ColumnNames &column_names = input->get_column_names();
+    auto it = std::find(column_names.begin(), column_names.end(), column_name);
+    if (it == column_names.end())
+        throw DbRelationError("unknown column " + column_name);
+    return (uint) (it - column_names.begin());
+}
+
+// The partition a row goes into, by the top bits of its key's hash (the hash table's buckets go by the bottom ones)
+static uint partition_of(uint64_t hash) {
+    return (uint) (hash >> (64 - HashJoinIterator::PARTITION_BITS));
+}
+
+// A joined row: the fields of one row and then those of the other
+static void join_rows(const Row &first, const Row &second, Row &row) {
+    row.clear();
+    row.reserve(first.size() + second.size());
+    for (uint i = 0; i < first.size(); i++)
+        row.append(first, i);
+    for (uint i = 0; i < second.size(); i++)
+        row.append(second, i);
+}
+
+size_t HashJoinIterator::memory_budget = 16 << 20;
+
+HashJoinIterator::HashJoinIterator(EvalIterator *probe, const JoinKey &probe_key, EvalIterator *build,
+                                   const JoinKey &build_key)
+        : probe(probe), probe_key(probe_key), build(build), build_key(build_key), column_names(), probe_position(0),
+          build_position(0), table(nullptr), build_partitions(), probe_partitions(), partition(0), probe_row(),
+          match(JoinHashTable::END) {
+    for (auto const &column_name: probe->get_column_names())
+        column_names.push_back(probe_key.qualified(column_name));
+    for (auto const &column_name: build->get_column_names())
+        column_names.push_back(build_key.qualified(column_name));
+}
+
+HashJoinIterator::~HashJoinIterator() {
+    discard_partitions();
+    delete table;
+    delete probe;
+    delete build;
+}
+
+/**
+ * Build the hash table from the whole build input, spilling it to partitions if it gets too big (and then
+ * partitioning the whole probe input as well).
+ */
+void HashJoinIterator::open() {
+    discard_partitions();
+    delete table;
+    table = nullptr;
+    match = JoinHashTable::END;
+
+    build->open();
+    build_position = column_position(build, build_key.column_name);
+    table = new JoinHashTable(build_position);
+    Row row;
+    while (build->next(row)) {
+        if (spilled()) {
+            build_partitions[partition_of(JoinHashTable::hash(row, build_position))]->append(row);
+        } else {
+            table->add(row);
+            if (table->get_bytes() > memory_budget)
+                spill();
+        }
+    }
+    build->close();
+
+    probe->open();
+    probe_position = column_position(probe, probe_key.column_name);
+    if (spilled()) {
+        while (probe->next(row))
+            probe_partitions[partition_of(JoinHashTable::hash(row, probe_position))]->append(row);
+        for (auto rows: probe_partitions)
+            rows->rewind();
+        partition = 0;
+        load_partition();
+    }
+}
+
+// Pull probe rows until one has a match, then hand out its matches one by one
+bool HashJoinIterator::next(Row &row) {
+    while (match == JoinHashTable::END) {
+        if (!next_probe_row())
+            return false;
+        match = table->first(probe_row, probe_position);
+    }
+    join_rows(probe_row, table->get(match), row);
+    match = table->next(match, probe_row, probe_position);
+    return true;
+}
+
+void HashJoinIterator::close() {
+    probe->close();
+    discard_partitions();
+    delete table;
+    table = nullptr;
+}
+
+const ColumnNames &HashJoinIterator::get_column_names() const {
+    return column_names;
+}
+
+// Go over to partitions, starting with the build rows already in the table
+void HashJoinIterator::spill() {
+    for (uint i = 0; i < PARTITIONS; i++) {
+        build_partitions.push_back(new SpillFile("_join_build"));
+        probe_partitions.push_back(new SpillFile("_join_probe"));
+    }
+    for (size_t i = 0; i < table->size(); i++)
+        build_partitions[partition_of(JoinHashTable::hash(table->get(i), build_position))]->append(table->get(i));
+    table->clear();
+}
+
+// Fill the table from the current build partition (unless its probe partition is empty), and get rid of the file
+void HashJoinIterator::load_partition() {
+    table->clear();
+    SpillFile *rows = build_partitions[partition];
+    if (probe_partitions[partition]->size() > 0) {
+        rows->rewind();
+        Row row;
+        while (rows->next(row))
+            table->add(row);
+    }
+    rows->drop();
+}
+
+// The next row of the probe input, or, once spilled, of the current probe partition (moving on to the next pair)
+bool HashJoinIterator::next_probe_row() {
+    if (!spilled())
+        return probe->next(probe_row);
+    while (partition < PARTITIONS) {
+        if (probe_partitions[partition]->next(probe_row))
+            return true;
+        probe_partitions[partition]->drop();
+        if (++partition < PARTITIONS)
+            load_partition();
+    }
+    return false;
+}
+
+void HashJoinIterator::discard_partitions() {
+    for (auto rows: build_partitions) {
+        rows->drop();
+        delete rows;
+    }
+    for (auto rows: probe_partitions) {
+        rows->drop();
+        delete rows;
+    }
+    build_partitions.clear();
+    probe_partitions.clear();
+}
+
+IndexJoinIterator::IndexJoinIterator(EvalIterator *outer, const JoinKey &outer_key, DbRelation &table,
+                                     DbIndex &index, const ValueDict *conjunction, const JoinKey &inner_key)
+        : outer(outer), outer_key(outer_key), table(table), index(index), conjunction(conjunction),
+          inner_key(inner_key), column_names(), outer_position(0), outer_row(), inner_row(), handles(nullptr),
+          next_handle(0) {
+    for (auto const &column_name: outer->get_column_names())
+        column_names.push_back(outer_key.qualified(column_name));
+    for (auto const &column_name: table.get_column_names())
+        column_names.push_back(inner_key.qualified(column_name));
+}
+
+IndexJoinIterator::~IndexJoinIterator() {
+    delete handles;
+    delete outer;
+}
+
+void IndexJoinIterator::open() {
+    outer->open();
+    outer_position = column_position(outer, outer_key.column_name);
+    index.open();
+    delete handles;
+    handles = nullptr;
+    next_handle = 0;
+}
+
+// Hand out the inner rows the index found for the current outer row, looking up the next outer row when they run out
+bool IndexJoinIterator::next(Row &row) {
+    while (true) {
+        while (handles != nullptr && next_handle < handles->size()) {
+            ValueDict *values = table.project((*handles)[next_handle++]);
+            bool is_selected = true;
+            if (conjunction != nullptr) {
+                for (auto const &predicate: *conjunction) {
+                    auto found = values->find(predicate.first);
+                    if (found == values->end() || found->second != predicate.second) {
+                        is_selected = false;
+                        break;
+                    }
+                }
+            }
+            if (is_selected)
+                inner_row.assign(*values, table.get_column_names());
+            delete values;
+            if (is_selected) {
+                join_rows(outer_row, inner_row, row);
+                return true;
+            }
+        }
+        delete handles;
+        handles = nullptr;
+        if (!outer->next(outer_row))
+            return false;
+        ValueDict key;
+        key[inner_key.column_name] = outer_row.get_value(outer_position);
+        handles = index.lookup(&key);
+        next_handle = 0;
+    }
+}
+
+void IndexJoinIterator::close() {
+    outer->close();
+    delete handles;
+    handles = nullptr;
+}
+
+const ColumnNames &IndexJoinIterator::get_column_names() const {
+    return column_names;
+}
+
+ProfileIterator::ProfileIterator(EvalIterator *input, ExecCounters &counters) : input(input), counters(counters) {
+}
+
+ProfileIterator::~ProfileIterator() {
+    delete input;
+}
+
+void ProfileIterator::open() {
+    Clock::time_point began = Clock::now();
+    input->open();
+    charge(began);
+}
+
+bool ProfileIterator::next(Row &row) {
+    Clock::time_point began = Clock::now();
+    bool found = input->next(row);
+    charge(began);
+    if (found)
+        counters.rows_emitted++;
+    return found;
+}
+
+bool ProfileIterator::advance() {
+    Clock::time_point began = Clock::now();
+    bool found = input->advance();
+    charge(began);
+    if (found)
+        counters.rows_emitted++;
+    return found;
+}
+
+Handle ProfileIterator::get_handle() const {
+    return input->get_handle();
+}
+
+void ProfileIterator::close() {
+    Clock::time_point began = Clock::now();
+    input->close();
+    charge(began);
+}
+
+const ColumnNames &ProfileIterator::get_column_names() const {
+    return input->get_column_names();
+}
+
+/**
+ * Testing function for the parallel scan: it has to find the same rows, in the same order, as the plain scan.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_parallel_scan() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_parallel_scan", column_names, column_attributes);
+    table.create();
+    std::string pad(100, '.');
+    for (int i = 0; i < 5000; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value((i % 3 == 0 ? "fizz" : "buzz") + pad);
+        table.insert(&row);
+    }
+    if (table.get_block_count() < 4 * ParallelScanIterator::MORSEL_BLOCKS)
+        return assertion_failure("test table too small", table.get_block_count());
+
+    ValueDict where;
+    where["b"] = Value("fizz" + pad);
+    ColumnNames a_only;
+    a_only.push_back("a");
+    const ValueDict *conjunctions[] = {nullptr, &where};
+    const ColumnNames *projections[] = {nullptr, &a_only};
+    bool ok = true;
+    for (auto conjunction: conjunctions) {
+        for (auto projection: projections) {
+            TableScanIterator plain(table, conjunction, projection);
+            ParallelScanIterator parallel(table, conjunction, projection);
+            plain.open();
+            parallel.open();
+            Row expected, got;
+            uint count = 0;
+            while (ok && plain.next(expected)) {
+                if (!parallel.next(got) || got.size() != expected.size() || got.get_n(0) != expected.get_n(0))
+                    ok = assertion_failure("parallel scan row", count, expected.get_n(0));
+                if (ok && got.size() > 1 && got.get_string(1) != expected.get_string(1))
+                    ok = assertion_failure("parallel scan text", count);
+                count++;
+            }
+            if (ok && parallel.next(got))
+                ok = assertion_failure("parallel scan extra rows", count);
+            if (ok && count != (conjunction == nullptr ? 5000U : 1667U))
+                ok = assertion_failure("parallel scan count", count);
+            plain.close();
+            parallel.close();
+        }
+    }
+
+    // closed (or just freed) partway through, the workers stop without scanning the rest
+    for (int closing = 0; ok && closing < 2; closing++) {
+        ParallelScanIterator *parallel = new ParallelScanIterator(table, nullptr, nullptr);
+        parallel->open();
+        Row got;
+        if (!parallel->next(got) || got.get_n(0) != 0)
+            ok = assertion_failure("parallel scan first row", closing);
+        if (closing == 1)
+            parallel->close();
+        delete parallel;
+    }
+    table.drop();
+    return ok;
+}
+
+/**
+ * Testing function for the hash join: the same rows have to come out of it whether it fits in memory or has to spill
+ * its partitions to disk.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_hash_join() {
+    ColumnNames a_columns, b_columns;
+    a_columns.push_back("a");
+    a_columns.push_back("s");
+    b_columns.push_back("k");
+    b_columns.push_back("n");
+    ColumnAttributes a_attributes, b_attributes;
+    a_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    a_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    b_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    b_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable a_table("__test_join_a", a_columns, a_attributes), b_table("__test_join_b", b_columns, b_attributes);
+    a_table.create();
+    b_table.create();
+    std::string pad(40, '.');
+    for (int i = 0; i < 3000; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["s"] = Value("k" + std::to_string(i % 200) + pad);
+        a_table.insert(&row);
+    }
+    for (int j = 0; j < 250; j++) {  // the last 50 have no matches
+        ValueDict row;
+        row["k"] = Value("k" + std::to_string(j) + pad);
+        row["n"] = Value(j);
+        b_table.insert(&row);
+    }
+
+    bool ok = true;
+    size_t budget = HashJoinIterator::memory_budget;
+    for (size_t memory: {budget, (size_t) 8192}) {
+        HashJoinIterator::memory_budget = memory;
+        HashJoinIterator join(new TableScanIterator(b_table, nullptr, nullptr), JoinKey("b", "k"),
+                              new TableScanIterator(a_table, nullptr, nullptr), JoinKey("a", "s"));
+        try {
+            join.open();
+            if (join.spilled() != (memory != budget))
+                ok = assertion_failure("hash join spilled", memory);
+            const ColumnNames &column_names = join.get_column_names();
+            if (column_names.size() != 4 || column_names[0] != "b.k" || column_names[3] != "a.s")
+                ok = assertion_failure("hash join column names", column_names.size());
+            Row row;
+            uint count = 0;
+            long sum = 0;
+            while (ok && join.next(row)) {
+                if (row.get_n(1) != row.get_n(2) % 200 || row.get_string(0) != row.get_string(3))
+                    ok = assertion_failure("hash join row", count, row.get_n(2));
+                sum += row.get_n(2);
+                count++;
+            }
+            if (ok && (count != 3000 || sum != 2999L * 3000 / 2))
+                ok = assertion_failure("hash join count", memory, count);
+            join.close();
+        } catch (...) {
+            HashJoinIterator::memory_budget = budget;
+            a_table.drop();
+            b_table.drop();
+            throw;
+        }
+    }
+    HashJoinIterator::memory_budget = budget;
+    a_table.drop();
+    b_table.drop();
+    return ok;
+}
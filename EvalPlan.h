@@ -6,38 +6,613 @@
  */
 #pragma once
 
+#include <exception>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "Arena.h"
+#include "ColumnStatistics.h"
+#include "ExecStats.h"
+#include "HashAggregate.h"
+#include "HashJoin.h"
 #include "storage_engine.h"
 
 
+class EvalPlan;
+
 typedef std::pair<DbRelation *, Handles *> EvalPipeline;
+typedef std::vector<DbIndex *> IndexList;
+typedef std::map<const EvalPlan *, ExecCounters> PlanProfile;  // what each node of a plan did (EXPLAIN ANALYZE)
+
+/**
+ * @class JoinKey - one side of a join's equality: the column it is on, and what that side's columns are called in
+ * the joined rows
+ *
+ *      A side that is one table has its columns qualified by the table's alias (or name), e.g., e.id; a side that is
+ *      itself a join already has qualified names, so its qualifier is empty (and its column is a qualified name).
+ */
+class JoinKey {
+public:
+    JoinKey() : qualifier(), column_name() {}
+
+    JoinKey(Identifier qualifier, Identifier column_name) : qualifier(qualifier), column_name(column_name) {}
+
+    Identifier qualifier;    // or empty
+    Identifier column_name;  // as the side's own rows have it
+
+    // What a column of this side is called in the joined rows
+    Identifier qualified(const Identifier &name) const { return qualifier.empty() ? name : qualifier + "." + name; }
+};
+
+/**
+ * @class PlanCatalog - what the optimizer can find out about each of the tables of a join
+ */
+class PlanCatalog {
+public:
+    virtual ~PlanCatalog() {}
+
+    // The indices on a table
+    virtual IndexList get_indices(const Identifier &table_name) = 0;
+
+    // The table's statistics, or nullptr if it hasn't been analyzed
+    virtual const TableStatistics *get_statistics(const Identifier &table_name) = 0;
+};
+
+/**
+ * @class EvalIterator - pull-based (open/next/close) evaluation of a plan, one row at a time
+ *
+ * Rows are passed by position (see get_column_names) in a Row supplied by the caller, so that a scan can
+ * reuse the same storage for every row it produces. Iterators (and plans) come out of the current arena, if any,
+ * e.g., the one SQLExec resets for each statement.
+ */
+class EvalIterator : public ArenaAllocated {
+public:
+    virtual ~EvalIterator() {}
+
+    /**
+     * Get ready to produce rows.
+     */
+    virtual void open() = 0;
+
+    /**
+     * Produce the next row.
+     * @param row  filled in with the next row's values (TEXT fields may be views that are only good until the
+     *             following call to next())
+     * @returns    false if there are no more rows
+     */
+    virtual bool next(Row &row) = 0;
+
+    /**
+     * Move past the next row without materializing it (for when only get_handle() is needed).
+     * @returns  false if there are no more rows
+     */
+    virtual bool advance();
+
+    /**
+     * Handle (in the underlying table) of the row most recently produced.
+     * @returns  handle of current row
+     * @throws   DbRelationError if the plan's rows don't correspond to table rows
+     */
+    virtual Handle get_handle() const;
+
+    /**
+     * Release any resources held for producing rows.
+     */
+    virtual void close() = 0;
+
+    /**
+     * Which column each position of the produced rows holds.
+     * @returns  column names, in row order
+     */
+    virtual const ColumnNames &get_column_names() const = 0;
+};
+
+/**
+ * @class TableScanIterator - streams rows out of a table, with any selection and projection pushed down
+ */
+class TableScanIterator : public EvalIterator {
+public:
+    TableScanIterator(DbRelation &table, const ValueDict *conjunction, const ColumnNames *projection);
+
+    virtual ~TableScanIterator();
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual bool advance();
+
+    virtual Handle get_handle() const;
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+protected:
+    DbRelation &table;
+    const ValueDict *conjunction;  // or nullptr
+    const ColumnNames *projection;  // or nullptr for all columns
+    DbCursor *cursor;
+};
+
+/**
+ * @class ParallelScanIterator - a table scan, with any selection and projection pushed down, done by a few worker
+ * threads at once
+ *
+ *      The table's blocks are cut into morsels of MORSEL_BLOCKS consecutive blocks, dealt out to the workers in turn
+ *      (worker w gets morsels w, w + n, w + 2n, ...). A worker takes the next morsel of its own share; once it can't,
+ *      it steals the next one from the share furthest behind, so a worker held up on slow blocks doesn't hold up the
+ *      scan. Each morsel's rows are kept separately and handed out in morsel order on next() as soon as that morsel
+ *      is finished, so the rows come out in the same order as from a TableScanIterator. The thread calling next()
+ *      scans the morsel it is waiting for itself if no worker has taken it yet.
+ *
+ *      No morsel more than AHEAD_MORSELS per worker past the one next() is on is taken, so a worker that far ahead
+ *      waits for next() to catch up. The rows held at once don't grow with the table, and if next() isn't called
+ *      any more, the scan stops. The table must not change until the iterator is closed.
+ */
+class ParallelScanIterator : public EvalIterator {
+public:
+    static const uint MORSEL_BLOCKS = 8;
+    static const uint MAX_WORKERS = 8;  // well under the pages a HeapFile's buffer pool has to pin
+    static const uint AHEAD_MORSELS = 2;  // per worker, how far the scan gets ahead of next()
+
+    ParallelScanIterator(DbRelation &table, const ValueDict *conjunction, const ColumnNames *projection);
+
+    virtual ~ParallelScanIterator();
+
+    ParallelScanIterator(const ParallelScanIterator &other) = delete;
+
+    ParallelScanIterator &operator=(const ParallelScanIterator &other) = delete;
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+    /**
+     * Whether a table is big enough to be worth scanning in parallel.
+     * @param table  the table
+     * @returns      true if it has at least a few morsels' worth of blocks (and there is more than one core)
+     */
+    static bool worthwhile(DbRelation &table);
+
+    /**
+     * How many workers to use for a scan.
+     * @param morsels  number of morsels in the scan
+     * @returns        number of workers (including the thread calling next())
+     */
+    static uint worker_count(uint morsels);
+
+protected:
+    DbRelation &table;
+    const ValueDict *conjunction;  // or nullptr
+    const ColumnNames *projection;  // or nullptr for all columns
+    BlockID last_block;
+    std::vector<Rows> results;  // by morsel, each filled in by whoever scans it
+    std::vector<bool> finished;  // by morsel
+    std::vector<uint> shares;  // the next morsel left in each worker's share (past the last morsel when used up)
+    size_t morsel;  // which morsel next() is handing out
+    size_t i;  // position in that morsel's rows
+    bool stopping;  // set by close(), or once a morsel's scan goes wrong
+    std::exception_ptr error;  // what went wrong
+    std::vector<std::thread> threads;
+    std::mutex latch;  // for finished, shares, morsel, stopping and error
+    std::condition_variable changed;
+
+    bool take(std::unique_lock<std::mutex> &guard, uint worker, uint &found);
+
+    void run(std::unique_lock<std::mutex> &guard, uint morsel_no);
+
+    void work(uint worker);
+
+    void scan(uint morsel_no);
+};
+
+/**
+ * @class IndexScanIterator - streams the rows of a table that an index finds, in the index's key order
+ */
+class IndexScanIterator : public EvalIterator {
+public:
+    IndexScanIterator(DbRelation &table, DbIndex &index, bool lookup, const KeyBound &min, const KeyBound &max,
+                      const ColumnNames *projection);
+
+    virtual ~IndexScanIterator();
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual bool advance();
+
+    virtual Handle get_handle() const;
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+protected:
+    DbRelation &table;
+    DbIndex &index;
+    bool lookup;  // use index.lookup(min.key) rather than a range cursor
+    const KeyBound &min;
+    const KeyBound &max;
+    const ColumnNames *projection;  // or nullptr for all columns
+    Handles *handles;  // for a lookup
+    size_t next_handle;
+    DbIndexCursor *cursor;  // for a range
+    Handle handle;
+};
+
+/**
+ * @class SelectIterator - passes through the rows of its input that match the conjunction
+ */
+class SelectIterator : public EvalIterator {
+public:
+    SelectIterator(EvalIterator *input, const ValueDict *conjunction);
+
+    virtual ~SelectIterator();
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual Handle get_handle() const;
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+protected:
+    EvalIterator *input;
+    const ValueDict *conjunction;
+    std::vector<std::pair<uint, const Value *>> predicates;  // conjunction by position in the input rows
+};
+
+/**
+ * @class ProjectIterator - restricts the rows of its input to the given columns
+ */
+class ProjectIterator : public EvalIterator {
+public:
+    ProjectIterator(EvalIterator *input, const ColumnNames *projection);
+
+    virtual ~ProjectIterator();
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual Handle get_handle() const;
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+protected:
+    EvalIterator *input;
+    const ColumnNames *projection;
+    std::vector<uint> positions;  // projection by position in the input rows
+    Row input_row;
+};
+
+/**
+ * @class LimitIterator - passes through the rows of its input after the first offset, up to limit of them
+ *
+ *      Once it has passed on limit rows it doesn't ask its input for any more, so a scan under it reads only as
+ *      many blocks as it takes to find them (see EvalPlan::iterator on serial scans).
+ */
+class LimitIterator : public EvalIterator {
+public:
+    LimitIterator(EvalIterator *input, u_long limit, u_long offset);
+
+    virtual ~LimitIterator();
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual bool advance();
+
+    virtual Handle get_handle() const;
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+protected:
+    EvalIterator *input;
+    u_long limit;
+    u_long offset;
+    u_long produced;  // rows passed on since open()
+};
+
+/**
+ * @class AggregateIterator - groups the rows of its input and works out the aggregates of each group
+ *
+ *      All the input's rows go into a GroupTable in open(); then each group's row (the group by columns, then the
+ *      aggregates) comes out on next(), in no particular order. With no group by columns there is a single group,
+ *      and if there are no rows at all it still comes out if every aggregate is a COUNT or a SUM (as zero--there
+ *      are no NULLs for the MINs and MAXes to be).
+ */
+class AggregateIterator : public EvalIterator {
+public:
+    AggregateIterator(EvalIterator *input, const ColumnNames *group_by, const AggregateFunctions *aggregates);
+
+    virtual ~AggregateIterator();
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+protected:
+    EvalIterator *input;
+    const ColumnNames *group_by;
+    const AggregateFunctions *aggregates;
+    ColumnNames column_names;  // group_by, then the aggregates' names
+    GroupTable *groups;
+    size_t group;  // the next one to hand out
+    bool empty_group;  // whether to hand out the all-zero row for no rows
+};
 
-class EvalPlan {
+/**
+ * @class CountIterator - the number of rows in a table, in a one-row, one-column result (see DbRelation::count)
+ */
+class CountIterator : public EvalIterator {
+public:
+    CountIterator(DbRelation &table, const Identifier &name);
+
+    virtual ~CountIterator() {}
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+protected:
+    DbRelation &table;
+    ColumnNames column_names;
+    bool done;
+};
+
+/**
+ * @class HashJoinIterator - the rows of an equijoin, found by building a hash table of one input and probing it with
+ * each row of the other
+ *
+ *      The build input is read into a JoinHashTable in open(). If that takes more than memory_budget bytes, the
+ *      join goes over to partitions (a grace hash join): the rows in the table and the rest of the build input are
+ *      split by hash into PARTITIONS SpillFiles, then so is the whole probe input, and each pair of partitions is
+ *      joined in turn, the build partition loaded into the table and its probe partition streamed past it. A
+ *      partition that is still too big is loaded anyway. Otherwise the probe input is streamed straight past the
+ *      table. Each joined row is the probe row's fields and then the build row's, with their columns qualified
+ *      (see JoinKey).
+ */
+class HashJoinIterator : public EvalIterator {
+public:
+    static const uint PARTITION_BITS = 4;  // top bits of the hash that pick a row's partition
+    static const uint PARTITIONS = 1 << PARTITION_BITS;
+    static size_t memory_budget;  // bytes of build rows held in memory before spilling
+
+    HashJoinIterator(EvalIterator *probe, const JoinKey &probe_key, EvalIterator *build, const JoinKey &build_key);
+
+    virtual ~HashJoinIterator();
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+    // Whether the last open() had to spill
+    bool spilled() const { return !probe_partitions.empty(); }
+
+protected:
+    EvalIterator *probe;
+    JoinKey probe_key;
+    EvalIterator *build;
+    JoinKey build_key;
+    ColumnNames column_names;  // the probe input's, then the build input's (qualified)
+    uint probe_position;
+    uint build_position;
+    JoinHashTable *table;
+    std::vector<SpillFile *> build_partitions;  // empty unless spilled
+    std::vector<SpillFile *> probe_partitions;
+    uint partition;  // the pair of partitions being joined
+    Row probe_row;
+    uint32_t match;  // next build row for probe_row, or JoinHashTable::END
+
+    virtual void spill();
+
+    virtual void load_partition();
+
+    virtual bool next_probe_row();
+
+    virtual void discard_partitions();
+};
+
+/**
+ * @class IndexJoinIterator - the rows of an equijoin, found by looking up each row of the outer input in an index on
+ * the inner table's join column (an index nested-loop join)
+ *
+ *      Each inner row the index finds is checked against the inner table's own conjunction (if any). Each joined row
+ *      is the outer row's fields and then the inner row's, with their columns qualified (see JoinKey).
+ */
+class IndexJoinIterator : public EvalIterator {
+public:
+    IndexJoinIterator(EvalIterator *outer, const JoinKey &outer_key, DbRelation &table, DbIndex &index,
+                      const ValueDict *conjunction, const JoinKey &inner_key);
+
+    virtual ~IndexJoinIterator();
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+protected:
+    EvalIterator *outer;
+    JoinKey outer_key;
+    DbRelation &table;
+    DbIndex &index;
+    const ValueDict *conjunction;  // or nullptr
+    JoinKey inner_key;
+    ColumnNames column_names;  // the outer input's, then the table's (qualified)
+    uint outer_position;
+    Row outer_row;
+    Row inner_row;
+    Handles *handles;  // what the index found for outer_row
+    size_t next_handle;
+};
+
+/**
+ * @class ProfileIterator - passes the rows of its input through untouched, counting them and timing the input
+ *
+ *      Only put into a plan's iterators for EXPLAIN ANALYZE, so plans run without it cost nothing extra. The time
+ *      includes the input's own inputs.
+ */
+class ProfileIterator : public EvalIterator {
+public:
+    ProfileIterator(EvalIterator *input, ExecCounters &counters);
+
+    virtual ~ProfileIterator();
+
+    virtual void open();
+
+    virtual bool next(Row &row);
+
+    virtual bool advance();
+
+    virtual Handle get_handle() const;
+
+    virtual void close();
+
+    virtual const ColumnNames &get_column_names() const;
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    EvalIterator *input;
+    ExecCounters &counters;
+
+    void charge(Clock::time_point began) {
+        counters.seconds += std::chrono::duration<double>(Clock::now() - began).count();
+    }
+};
+
+class EvalPlan : public ArenaAllocated {
 public:
     enum PlanType {
-        ProjectAll, Project, Select, TableScan
+        ProjectAll, Project, Select, TableScan, IndexLookup, IndexRange, Aggregate, GroupBy, HashJoin, IndexJoin, Limit
     };
 
+    static const double ROWS_PER_BLOCK;  // guess for a table with no statistics
+
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
     EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(ColumnNames *group_by, AggregateFunctions *aggregates,
+             EvalPlan *relation);  // use for Aggregate (group_by nullptr) and GroupBy
+    EvalPlan(PlanType type, DbRelation &table, DbIndex &index, const KeyBound &min,
+             const KeyBound &max);  // use for IndexLookup (key in min) and IndexRange
+    EvalPlan(EvalPlan *left, const JoinKey &left_key, EvalPlan *right,
+             const JoinKey &right_key);  // use for HashJoin (optimize() picks how to do it)
+    EvalPlan(u_long limit, u_long offset, EvalPlan *relation);  // use for Limit
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
-    // Attempt to get the best equivalent evaluation plan
-    EvalPlan *optimize();
+    // Attempt to get the best equivalent evaluation plan, using any of the given indices (freed by caller), with
+    // the table's statistics (if it has been analyzed) to estimate how many rows an index would find; a join gets
+    // the indices and statistics of each of its tables from the catalog instead
+    EvalPlan *optimize(const IndexList *indices = nullptr, const TableStatistics *statistics = nullptr,
+                       PlanCatalog *catalog = nullptr);
+
+    // Put new values into the plan's selections and index keys, for the columns given (e.g., to run a cached
+    // plan with different literals)
+    void bind(const ValueDict &values);
+
+    // Describe the plan, one node per line, indented by depth (with what each node did, if profiled)
+    std::string explain(uint depth = 0, const PlanProfile *profile = nullptr) const;
 
-    // Evaluate the plan: evaluate gets values, pipeline gets handles
-    ValueDicts *evaluate();
+    // Evaluate the plan, throwing the rows away but noting in profile what each node did (see ProfileIterator)
+    // and how much work the table and its indices did underneath (on the scan or index node)
+    void analyze(PlanProfile &profile);
+
+    // Evaluate the plan: evaluate gets values (by position in the projection), pipeline gets handles
+    Rows *evaluate();
 
     EvalPipeline pipeline();
 
+    // Data type of each of the given columns of the rows the plan evaluates to (freed by caller)
+    ColumnAttributes *get_column_attributes(const ColumnNames &column_names) const;
+
+    // Evaluate the plan lazily: rows are pulled from the returned iterator (freed by caller, must not
+    // outlive this plan or the profile, if given). A serial iterator reads the tables whose rows it passes on a
+    // block at a time as they are wanted, rather than scanning a big one all at once in parallel in open(), so
+    // that the first rows come out right away and a caller that stops early doesn't pay for the rest (the
+    // rows under an aggregation or a hash join's build side are all read anyway, so those still scan in parallel).
+    EvalIterator *iterator(PlanProfile *profile = nullptr, bool serial = false);
+
 protected:
 
     PlanType type;
-    EvalPlan *relation;  // for everything except TableScan
+    EvalPlan *relation;  // for everything except TableScan (for HashJoin, the probe side; IndexJoin, the outer side)
+    EvalPlan *right;  // for HashJoin, the build side; IndexJoin, the inner table's scan (with any selection)
+    JoinKey left_key;  // for HashJoin, IndexJoin: relation's side of the join
+    JoinKey right_key;  // for HashJoin, IndexJoin: right's side
     ColumnNames *projection;  // for Project
     ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
+    ColumnNames *group_by;  // for GroupBy
+    AggregateFunctions *aggregates;  // for Aggregate, GroupBy
+    ColumnNames input_columns;  // for Aggregate, GroupBy: what the aggregates need of the rows under them
+    DbRelation &table;  // for TableScan, IndexLookup, IndexRange
+    DbIndex *index;  // for IndexLookup, IndexRange, IndexJoin
+    KeyBound min_key;  // for IndexLookup (the key), IndexRange
+    KeyBound max_key;  // for IndexRange
+    u_long limit;  // for Limit: most rows passed on
+    u_long offset;  // for Limit: rows skipped first
+    double cost;  // estimated block reads, if optimize() has figured it out (else negative)
+
+    static EvalPlan *optimize_select(EvalPlan *select, const IndexList *indices,
+                                     const TableStatistics *statistics);
+
+    static EvalPlan *optimize_join(EvalPlan *join, PlanCatalog *catalog);
+
+    static EvalPlan *optimize_side(EvalPlan *side, PlanCatalog *catalog);
+
+    static double estimate_rows(const EvalPlan *plan, PlanCatalog *catalog);
+
+    static double key_distinct(const EvalPlan *side, const JoinKey &key, PlanCatalog *catalog);
+
+    static bool is_table_side(const EvalPlan *side);
+
+    static ColumnAttribute column_attribute(const EvalPlan *bottom, const Identifier &column_name);
+
+    void get_leaves(std::vector<const EvalPlan *> &leaves) const;
+
+    EvalIterator *make_iterator(PlanProfile *profile, bool serial);
+
+    EvalIterator *input_iterator(const ColumnNames *projection, PlanProfile *profile, bool serial);
+
+    static EvalIterator *scan_iterator(DbRelation &table, const ValueDict *conjunction,
+                                       const ColumnNames *projection, bool serial);
 };
 
+bool test_parallel_scan();
+
+bool test_hash_join();
+
@@ -0,0 +1,53 @@
+/**
+ * @file ExecStats.cpp - implementation of ExecCounters and ExecStats
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include "ExecStats.h"
+
+bool ExecStats::enabled = false;
+std::mutex ExecStats::lock;
+std::map<std::string, ExecCounters> ExecStats::tables;
+
+ExecCounters &ExecCounters::operator+=(const ExecCounters &other) {
+    blocks_read += other.blocks_read;
+    blocks_written += other.blocks_written;
+    blocks_skipped += other.blocks_skipped;
+    rows_examined += other.rows_examined;
+    rows_emitted += other.rows_emitted;
+    index_descents += other.index_descents;
+    bytes_marshalled += other.bytes_marshalled;
+    seconds += other.seconds;
+    return *this;
+}
+
+// What was counted since other was taken (other being an earlier snapshot of the same counters)
+ExecCounters ExecCounters::operator-(const ExecCounters &other) const {
+    ExecCounters difference;
+    difference.blocks_read = blocks_read - other.blocks_read;
+    difference.blocks_written = blocks_written - other.blocks_written;
+    difference.blocks_skipped = blocks_skipped - other.blocks_skipped;
+    difference.rows_examined = rows_examined - other.rows_examined;
+    difference.rows_emitted = rows_emitted - other.rows_emitted;
+    difference.index_descents = index_descents - other.index_descents;
+    difference.bytes_marshalled = bytes_marshalled - other.bytes_marshalled;
+    difference.seconds = seconds - other.seconds;
+    return difference;
+}
+
+// Entries in a std::map stay put, so the pointer is good for as long as the program runs
+ExecCounters *ExecStats::for_table(const std::string &table_name) {
+    std::lock_guard<std::mutex> guard(lock);
+    return &tables[table_name];
+}
+
+ExecCounters ExecStats::snapshot(const ExecCounters *counters) {
+    std::lock_guard<std::mutex> guard(lock);
+    return *counters;
+}
+
+std::map<std::string, ExecCounters> ExecStats::get_tables() {
+    std::lock_guard<std::mutex> guard(lock);
+    return tables;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file ExecStats.h - counters of the work done by queries (for EXPLAIN ANALYZE and SHOW STATS)
+ * ExecCounters
+ * ExecStats
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include "db_cxx.h"
+
+/**
+ * @class ExecCounters - how much work was done (by a table and its indices, or by one node of a plan)
+ */
+class ExecCounters {
+public:
+    ExecCounters() : blocks_read(0), blocks_written(0), blocks_skipped(0), rows_examined(0), rows_emitted(0),
+                     index_descents(0), bytes_marshalled(0), seconds(0.0) {}
+
+    u_long blocks_read;       // blocks read from Berkeley DB (buffer pool misses)
+    u_long blocks_written;    // dirty blocks written back to Berkeley DB
+    u_long blocks_skipped;    // blocks a scan passed over without reading, because of the zone map
+    u_long rows_examined;     // records looked at by scans and projections
+    u_long rows_emitted;      // rows handed back (by a plan node, or by SELECTs on the table)
+    u_long index_descents;    // walks from an index's root to a leaf (or probes of a hash bucket)
+    u_long bytes_marshalled;  // record bytes marshalled or unmarshalled
+    double seconds;           // wall time (spent in a plan node and its inputs, or in SELECTs on the table)
+
+    ExecCounters &operator+=(const ExecCounters &other);
+
+    ExecCounters operator-(const ExecCounters &other) const;
+};
+
+/**
+ * @class ExecStats - cumulative counters for each table (its indices' work counts towards the table)
+ *
+ *      Nothing is counted unless enabled is set (by SET STATS ON, or for the duration of an EXPLAIN ANALYZE), and
+ *      when it isn't, counting costs a test of enabled. It is only changed while no other statement is running (see
+ *      SQLExec::is_read_only). Storage objects get their table's counters once, from for_table(), and hand them to
+ *      count() or add() as they go; scans keep their own tallies and add them in once at the end. Counters may be
+ *      changed from several threads at once (e.g., by the workers of a parallel scan), so they are only touched
+ *      under a lock.
+ */
+class ExecStats {
+public:
+    static bool enabled;
+
+    /**
+     * The counters for a table, kept for as long as the program runs.
+     * @param table_name  the table
+     * @returns           its counters (never freed, so it's fine to hang on to them)
+     */
+    static ExecCounters *for_table(const std::string &table_name);
+
+    /**
+     * Add to one of the counters (if counting is enabled).
+     * @param counters  the counters (nullptr to not count)
+     * @param counter   which one, e.g., &ExecCounters::blocks_read
+     * @param n         how much to add
+     */
+    static void count(ExecCounters *counters, u_long ExecCounters::*counter, u_long n = 1) {
+        if (enabled && counters != nullptr) {
+            std::lock_guard<std::mutex> guard(lock);
+            counters->*counter += n;
+        }
+    }
+
+    /**
+     * Add in a tally of counts (if counting is enabled).
+     * @param counters  the counters (nullptr to not count)
+     * @param tally     what to add
+     */
+    static void add(ExecCounters *counters, const ExecCounters &tally) {
+        if (enabled && counters != nullptr) {
+            std::lock_guard<std::mutex> guard(lock);
+            *counters += tally;
+        }
+    }
+
+    /**
+     * A consistent copy of some counters.
+     * @param counters  the counters
+     * @returns         their current values
+     */
+    static ExecCounters snapshot(const ExecCounters *counters);
+
+    /**
+     * Copies of all the tables' counters.
+     * @returns  counters by table name
+     */
+    static std::map<std::string, ExecCounters> get_tables();
+
+protected:
+    static std::mutex lock;
+    static std::map<std::string, ExecCounters> tables;
+};
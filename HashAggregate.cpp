@@ -0,0 +1,240 @@
+/**
+ * @file HashAggregate.cpp - implementation of GroupTable
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <climits>
+#include <cstring>
+#include "ColumnStatistics.h"
+#include "HashAggregate.h"
+#include "SlottedPage.h"  // assertion_failure
+
+using namespace std;
+
+Identifier AggregateFunction::default_name(Function function, const Identifier &column_name) {
+    static const char *const names[] = {"COUNT", "SUM", "MIN", "MAX"};
+    return string(names[function]) + "(" + (column_name.empty() ? "*" : column_name) + ")";
+}
+
+const uint32_t GroupTable::EMPTY;
+
+GroupTable::GroupTable(uint key_size, const AggregateFunctions &aggregates)
+        : key_size(key_size), aggregates(aggregates), has_text(false), slots(16, EMPTY), keys(), hashes(), numbers(),
+          texts(), identity() {
+    for (auto const &aggregate: this->aggregates)
+        if (aggregate.result_type() == ColumnAttribute::TEXT)
+            this->has_text = true;
+    for (uint i = 0; i < key_size; i++)
+        this->identity.push_back(i);
+}
+
+void GroupTable::add(const Row &row, const vector<uint> &key_positions, const vector<uint> &argument_positions) {
+    bool added;
+    uint32_t group = find(row, key_positions, hash_key(row, key_positions), added);
+    const size_t at = (size_t) group * this->aggregates.size();
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        const AggregateFunction &aggregate = this->aggregates[i];
+        if (aggregate.function == AggregateFunction::COUNT) {
+            this->numbers[at + i]++;
+            continue;
+        }
+        uint position = argument_positions[i];
+        if (row.get_data_type(position) != aggregate.data_type)
+            throw DbRelationError(aggregate.name + " got a value of the wrong type");
+        if (aggregate.data_type == ColumnAttribute::TEXT) {
+            const char *s = row.get_s(position);
+            u_int16_t size = row.get_size(position);
+            string &so_far = this->texts[at + i];
+            int comparison = added ? 0 : memcmp(s, so_far.data(), min((size_t) size, so_far.size()));
+            if (comparison == 0 && !added)
+                comparison = size < so_far.size() ? -1 : size > so_far.size() ? 1 : 0;
+            if (added || (aggregate.function == AggregateFunction::MIN ? comparison < 0 : comparison > 0))
+                so_far.assign(s, size);
+            continue;
+        }
+        int64_t n = row.get_n(position);
+        int64_t &so_far = this->numbers[at + i];
+        if (aggregate.function == AggregateFunction::SUM)
+            so_far += n;
+        else if (added || (aggregate.function == AggregateFunction::MIN ? n < so_far : n > so_far))
+            so_far = n;
+    }
+}
+
+void GroupTable::merge(const GroupTable &other) {
+    for (size_t g = 0; g < other.size(); g++) {
+        bool added;
+        uint32_t group = find(other.keys[g], this->identity, other.hashes[g], added);
+        const size_t at = (size_t) group * this->aggregates.size(), from = g * this->aggregates.size();
+        for (size_t i = 0; i < this->aggregates.size(); i++) {
+            AggregateFunction::Function function = this->aggregates[i].function;
+            if (this->aggregates[i].result_type() == ColumnAttribute::TEXT) {
+                const string &theirs = other.texts[from + i];
+                if (added || (function == AggregateFunction::MIN ? theirs < this->texts[at + i]
+                                                                 : theirs > this->texts[at + i]))
+                    this->texts[at + i] = theirs;
+                continue;
+            }
+            int64_t n = other.numbers[from + i];
+            int64_t &so_far = this->numbers[at + i];
+            if (function == AggregateFunction::COUNT || function == AggregateFunction::SUM)
+                so_far += n;
+            else if (added || (function == AggregateFunction::MIN ? n < so_far : n > so_far))
+                so_far = n;
+        }
+    }
+}
+
+void GroupTable::result(size_t group, Row &row) const {
+    row.clear();
+    row.reserve(this->key_size + (uint) this->aggregates.size());
+    const Row &key = this->keys[group];
+    for (uint i = 0; i < this->key_size; i++) {
+        if (key.get_data_type(i) == ColumnAttribute::TEXT)
+            row.append_text_view(key.get_s(i), key.get_size(i));  // a view of our own copy
+        else
+            row.append(key, i);
+    }
+    const size_t at = group * this->aggregates.size();
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        const AggregateFunction &aggregate = this->aggregates[i];
+        if (aggregate.result_type() == ColumnAttribute::TEXT) {
+            const string &s = this->texts[at + i];
+            row.append_text_view(s.data(), (u_int16_t) s.size());
+        } else {
+            int64_t n = this->numbers[at + i];
+            if (n > INT32_MAX || n < INT32_MIN)
+                throw DbRelationError(aggregate.name + " is too big for an INT");
+            if (aggregate.result_type() == ColumnAttribute::BOOLEAN)
+                row.append_boolean((int32_t) n);
+            else
+                row.append_int((int32_t) n);
+        }
+    }
+}
+
+/**
+ * Find the group a key belongs to, starting a new one (with its aggregates not yet set) if there isn't one.
+ * @param row            holds the key
+ * @param key_positions  where each key field is in the row
+ * @param hash           of the key (see hash_key)
+ * @param added          set to whether the group is new
+ * @return               the group number
+ */
+uint32_t GroupTable::find(const Row &row, const vector<uint> &key_positions, uint64_t hash, bool &added) {
+    const size_t mask = this->slots.size() - 1;
+    size_t slot = (size_t) hash & mask;
+    while (this->slots[slot] != EMPTY) {
+        uint32_t group = this->slots[slot];
+        if (this->hashes[group] == hash) {
+            const Row &key = this->keys[group];
+            uint i = 0;
+            while (i < this->key_size && same_field(row, key_positions[i], key, i))
+                i++;
+            if (i == this->key_size) {
+                added = false;
+                return group;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    uint32_t group = (uint32_t) this->keys.size();
+    this->slots[slot] = group;
+    this->keys.emplace_back();
+    Row &key = this->keys.back();
+    key.reserve(this->key_size);
+    for (auto position: key_positions) {
+        if (row.get_data_type(position) == ColumnAttribute::TEXT)
+            key.append_text(row.get_s(position), row.get_size(position));  // the row's may be a view
+        else
+            key.append(row, position);
+    }
+    this->hashes.push_back(hash);
+    this->numbers.resize(this->numbers.size() + this->aggregates.size(), 0);
+    if (this->has_text)
+        this->texts.resize(this->texts.size() + this->aggregates.size());
+    if (2 * this->keys.size() > this->slots.size())
+        grow();
+    added = true;
+    return group;
+}
+
+// Double the slots and put each group back in
+void GroupTable::grow() {
+    this->slots.assign(2 * this->slots.size(), EMPTY);
+    const size_t mask = this->slots.size() - 1;
+    for (uint32_t group = 0; group < this->keys.size(); group++) {
+        size_t slot = (size_t) this->hashes[group] & mask;
+        while (this->slots[slot] != EMPTY)
+            slot = (slot + 1) & mask;
+        this->slots[slot] = group;
+    }
+}
+
+uint64_t GroupTable::hash_key(const Row &row, const vector<uint> &key_positions) {
+    uint64_t hash = 0;
+    for (auto position: key_positions) {
+        uint64_t field = row.get_data_type(position) == ColumnAttribute::TEXT
+                         ? HyperLogLog::hash(row.get_s(position), row.get_size(position))
+                         : HyperLogLog::hash(row.get_n(position));
+        hash = (hash ^ field) * 0x100000001b3ULL + (hash >> 29);
+    }
+    return hash;
+}
+
+bool GroupTable::same_field(const Row &a, uint i, const Row &b, uint j) {
+    if (a.get_data_type(i) != b.get_data_type(j))
+        return false;
+    if (a.get_data_type(i) != ColumnAttribute::TEXT)
+        return a.get_n(i) == b.get_n(j);
+    return a.get_size(i) == b.get_size(j) && memcmp(a.get_s(i), b.get_s(j), a.get_size(i)) == 0;
+}
+
+/**
+ * Testing function for GroupTable: groups of INT and TEXT keys, every aggregate, enough groups to make the table
+ * grow, and two partial tables merged into one.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_group_table() {
+    AggregateFunctions aggregates;
+    aggregates.push_back(AggregateFunction(AggregateFunction::COUNT, "", ColumnAttribute::INT, "COUNT(*)"));
+    aggregates.push_back(AggregateFunction(AggregateFunction::SUM, "n", ColumnAttribute::INT, "SUM(n)"));
+    aggregates.push_back(AggregateFunction(AggregateFunction::MIN, "n", ColumnAttribute::INT, "MIN(n)"));
+    aggregates.push_back(AggregateFunction(AggregateFunction::MAX, "s", ColumnAttribute::TEXT, "MAX(s)"));
+    vector<uint> key_positions = {0, 1}, argument_positions = {0, 2, 2, 3};
+
+    // rows (k, "k%3", n, "x<n>") for n in 0..2999, k = n % 100; half of them into each of two partial tables
+    GroupTable whole(2, aggregates), first(2, aggregates), second(2, aggregates);
+    for (int n = 0; n < 3000; n++) {
+        string label = to_string(n % 100 % 3), text = "x" + to_string(n);
+        Row row;
+        row.append_int(n % 100);
+        row.append_text_view(label.data(), (u_int16_t) label.size());
+        row.append_int(n);
+        row.append_text_view(text.data(), (u_int16_t) text.size());
+        whole.add(row, key_positions, argument_positions);
+        (n % 2 == 0 ? first : second).add(row, key_positions, argument_positions);
+    }
+    first.merge(second);
+    for (GroupTable *table: {&whole, &first}) {
+        if (table->size() != 100)
+            return assertion_failure("group count", table->size());
+        vector<bool> seen(100, false);
+        for (size_t g = 0; g < table->size(); g++) {
+            Row row;
+            table->result(g, row);
+            int k = row.get_n(0);
+            if (k < 0 || k >= 100 || seen[k] || row.get_string(1) != to_string(k % 3))
+                return assertion_failure("group key", g, k);
+            seen[k] = true;
+            // n = k + 100 i for i in 0..29
+            if (row.get_n(2) != 30 || row.get_n(3) != 30 * k + 100 * 435 || row.get_n(4) != k)
+                return assertion_failure("group aggregates", k, row.get_n(3));
+            if (row.get_string(5) != "x" + to_string(900 + k))  // as strings, the one starting with 9 is the biggest
+                return assertion_failure("group max text", k);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file HashAggregate.h - grouping rows and folding up their values (COUNT, SUM, MIN, MAX)
+ * AggregateFunction
+ * GroupTable
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include "storage_engine.h"
+
+/**
+ * @class AggregateFunction - one aggregate of a query, e.g., SUM(a)
+ */
+class AggregateFunction {
+public:
+    enum Function {
+        COUNT, SUM, MIN, MAX
+    };
+
+    AggregateFunction(Function function, Identifier column_name, ColumnAttribute::DataType data_type,
+                      Identifier name) : function(function), column_name(column_name), data_type(data_type),
+                                         name(name) {}
+
+    Function function;
+    Identifier column_name;               // what it is over (empty for COUNT(*))
+    ColumnAttribute::DataType data_type;  // of the column (INT for COUNT(*))
+    Identifier name;                      // what its result column is called, e.g., SUM(a)
+
+    // Data type of the result
+    ColumnAttribute::DataType result_type() const {
+        return function == MIN || function == MAX ? data_type : ColumnAttribute::INT;
+    }
+
+    // Default name of the result column, e.g., COUNT(*)
+    static Identifier default_name(Function function, const Identifier &column_name);
+};
+
+typedef std::vector<AggregateFunction> AggregateFunctions;
+
+/**
+ * @class GroupTable - the groups of rows seen so far, with each aggregate's value so far for each group
+ *
+ *      An open-addressing hash table (linear probing, never more than half full) of group numbers. A group's key is
+ *      kept as a Row of its own, so keys are compared field by field in their own types (no strings are made of
+ *      them); its hash is kept too, so growing the table doesn't have to hash the keys again. The aggregates' values
+ *      are kept in one array for the whole table, COUNT and SUM and the MIN and MAX of INTs as 64-bit integers
+ *      and the MIN and MAX of TEXT as strings.
+ *
+ *      Each worker of a parallel scan can fill in a GroupTable of its own (partial aggregation), and then they
+ *      are merged.
+ */
+class GroupTable {
+public:
+    /**
+     * @param key_size    number of key fields (0 for a single group of all the rows)
+     * @param aggregates  what to work out for each group
+     */
+    GroupTable(uint key_size, const AggregateFunctions &aggregates);
+
+    virtual ~GroupTable() {}
+
+    GroupTable(const GroupTable &other) = delete;
+
+    GroupTable &operator=(const GroupTable &other) = delete;
+
+    /**
+     * Fold a row into its group (starting a new group for it if need be).
+     * @param row                 the row
+     * @param key_positions       where each key field is in the row
+     * @param argument_positions  where each aggregate's column is in the row (ignored for COUNT)
+     */
+    virtual void add(const Row &row, const std::vector<uint> &key_positions,
+                     const std::vector<uint> &argument_positions);
+
+    /**
+     * Fold the groups of another table (with the same key size and aggregates) into this one.
+     * @param other  the other table, e.g., one worker's partial aggregates
+     */
+    virtual void merge(const GroupTable &other);
+
+    // Number of groups
+    size_t size() const { return keys.size(); }
+
+    /**
+     * A group's row: its key fields and then the value of each aggregate.
+     * @param group  which group (0 through size() - 1)
+     * @param row    filled in with the group's row (TEXT fields are views that are good as long as this table is)
+     * @throws DbRelationError if a SUM is too big for an INT
+     */
+    virtual void result(size_t group, Row &row) const;
+
+protected:
+    static const uint32_t EMPTY = UINT32_MAX;
+
+    uint key_size;
+    AggregateFunctions aggregates;
+    bool has_text;                   // any MIN or MAX of TEXT
+    std::vector<uint32_t> slots;     // group number, or EMPTY (size a power of two)
+    Rows keys;                       // by group
+    std::vector<uint64_t> hashes;    // of each group's key
+    std::vector<int64_t> numbers;    // aggregates.size() for each group, in order
+    std::vector<std::string> texts;  // the same, for a MIN or MAX of TEXT (only if has_text)
+    std::vector<uint> identity;      // 0, 1, ... key_size - 1: where a key's own fields are
+
+    virtual uint32_t find(const Row &row, const std::vector<uint> &key_positions, uint64_t hash, bool &added);
+
+    virtual void grow();
+
+    static uint64_t hash_key(const Row &row, const std::vector<uint> &key_positions);
+
+    static bool same_field(const Row &a, uint i, const Row &b, uint j);
+};
+
+bool test_group_table();
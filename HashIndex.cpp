@@ -0,0 +1,598 @@
+/**
+ * @file HashIndex.cpp - implementation of HashIndex
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <cmath>
+#include "HashIndex.h"
+#include "btree.h"
+
+const double HashIndex::SPLIT_LOAD = 0.75;
+
+HashIndex::HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
+                                                                                                            name,
+                                                                                                            key_columns,
+                                                                                                            unique),
+                                                                                                    closed(true),
+                                                                                                    file(relation.get_table_name() +
+                                                                                                         "-" + name),
+                                                                                                    overflow_file(
+                                                                                                            relation.get_table_name() +
+                                                                                                            "-" + name +
+                                                                                                            "-overflow"),
+                                                                                                    key_profile(),
+                                                                                                    level(0), split(0),
+                                                                                                    bytes(0),
+                                                                                                    free_head(0) {
+    ExecCounters *counters = ExecStats::for_table(relation.get_table_name());
+    file.set_counters(counters);
+    overflow_file.set_counters(counters);
+    build_key_profile();
+}
+
+/**
+ * Create the index, loading it from the rows already in the relation. Enough buckets are made up front that the
+ * entries fill about SPLIT_LOAD of them, so nothing has to be split while loading.
+ */
+void HashIndex::create() {
+    file.set_block_size(relation.get_block_size());
+    overflow_file.set_block_size(relation.get_block_size());
+    file.create();
+    overflow_file.create();
+    closed = false;
+
+    // key and handle of every row, in one pass over the relation
+    KeyEntries entries;
+    DbCursor *cursor = relation.cursor(nullptr);
+    try {
+        Row row;
+        KeyValue key(key_columns.size());
+        while (cursor->next()) {
+            cursor->project_row(&key_columns, row);
+            for (uint i = 0; i < row.size(); i++)
+                key[i] = row.get_value(i);
+            entries.push_back(std::make_pair(key, cursor->get_handle()));
+            if (!unique) {
+                entries.back().first.push_back(Value((int32_t) cursor->get_handle().first));
+                entries.back().first.push_back(Value((int32_t) cursor->get_handle().second));
+            }
+        }
+    } catch (...) {
+        delete cursor;
+        throw;
+    }
+    delete cursor;
+
+    bytes = 0;
+    free_head = 0;
+    for (auto const &entry: entries)
+        bytes += entry_size(&entry.first);
+    level = 0;
+    split = 0;
+    while ((1U << level) * page_capacity() * SPLIT_LOAD < bytes)
+        level++;
+    std::vector<KeyEntries> buckets(get_bucket_count());
+    for (auto &entry: entries)
+        buckets[bucket(&entry.first)].push_back(std::move(entry));
+    entries.clear();
+
+    std::vector<BlockID> spare;
+    for (uint b = 0; b < buckets.size(); b++) {
+        BTreeLeaf *page = new BTreeLeaf(file, 0, key_profile, true);  // block b + 2
+        page->save();
+        delete page;
+        KeyEntries &bucket_entries = buckets[b];
+        std::sort(bucket_entries.begin(), bucket_entries.end());
+        for (size_t i = 1; unique && i < bucket_entries.size(); i++)
+            if (bucket_entries[i - 1].first == bucket_entries[i].first)
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+        write_chain(b, bucket_entries, spare);
+    }
+    write_stat();
+}
+
+// Drop the index.
+void HashIndex::drop() {
+    close();
+    file.drop();
+    overflow_file.drop();
+}
+
+// Open existing index. Enables: lookup, insert, delete.
+void HashIndex::open() {
+    std::lock_guard<std::mutex> guard(this->latch);
+    if (closed) {
+        file.open();
+        overflow_file.open();
+        read_stat();
+        closed = false;
+    }
+}
+
+// Closes the index. Disables: lookup, insert, delete.
+void HashIndex::close() {
+    std::lock_guard<std::mutex> guard(this->latch);
+    if (!closed) {
+        file.close();
+        overflow_file.close();
+        closed = true;
+    }
+}
+
+// Find all the rows whose columns are equal to key (which must have a value for every key column).
+Handles *HashIndex::lookup(ValueDict *key_dict) const {
+    KeyValue key;
+    for (auto const &column_name: key_columns) {
+        auto found = key_dict->find(column_name);
+        if (found == key_dict->end())
+            throw DbRelationError("hash index lookup needs a value for " + column_name);
+        key.push_back(found->second);
+    }
+    Handles *handles = new Handles();
+    for (BTreeLeaf *page = first_page(bucket(&key)); page != nullptr; page = next_page(page))
+        for (size_t i = page->lower_bound(&key); i < page->size() && page->compare_entry(i, &key) == 0; i++)
+            handles->push_back(page->get_entry_handle(i));
+    return handles;
+}
+
+// Insert a row with the given handle. Row must exist in relation already.
+void HashIndex::insert(Handle handle) {
+    open();
+    KeyValue *key = entry_key(handle, handle);
+    uint b = bucket(key);
+    try {
+        if (unique && contains(b, key))
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        add(b, key, handle);
+    } catch (...) {
+        delete key;
+        throw;
+    }
+    bytes += entry_size(key);
+    delete key;
+    if (bytes > SPLIT_LOAD * get_bucket_count() * page_capacity())
+        split_next();
+    write_stat();
+}
+
+// Delete the entry for a row, which must still be in the relation. Nothing happens if it isn't in the index.
+void HashIndex::del(Handle handle) {
+    open();
+    KeyValue *key = entry_key(handle, handle);
+    if (remove(key, handle)) {
+        bytes -= entry_size(key);
+        write_stat();
+    }
+    delete key;
+}
+
+// Point the entries for moved rows at where they are now (their keys are found through the new handles).
+void HashIndex::relocate(const Relocations *moves) {
+    open();
+    for (auto const &move: *moves) {
+        KeyValue *key = entry_key(move.second, move.first);
+        if (remove(key, move.first)) {
+            if (!unique) {
+                key->resize(key_columns.size());
+                key->push_back(Value((int32_t) move.second.first));
+                key->push_back(Value((int32_t) move.second.second));
+            }
+            add(bucket(key), key, move.second);  // the same bucket, since only the key columns are hashed
+        }
+        delete key;
+    }
+    write_stat();
+}
+
+// One read for the bucket (more if it has overflowed), then one block of the relation per row found. Only whole
+// keys can be looked up.
+double HashIndex::lookup_cost(uint prefix_size, uint32_t table_blocks, double matching_rows) {
+    if (prefix_size < key_columns.size())
+        return -1.0;
+    open();
+    double chain = bytes / (get_bucket_count() * (double) page_capacity());
+    double rows = unique ? 1
+                         : matching_rows >= 0 ? matching_rows
+                                              : table_blocks * pow(BTreeIndex::COLUMN_SELECTIVITY, prefix_size);
+    return (chain < 1 ? 1 : chain) + (rows < 1 ? 1 : rows);
+}
+
+// Figure out the data types of each key component (plus the handle's if not unique).
+void HashIndex::build_key_profile() {
+    std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
+    const ColumnAttributes column_attributes = relation.get_column_attributes();
+    uint col_num = 0;
+    for (auto const &column_name: relation.get_column_names()) {
+        ColumnAttribute ca = column_attributes[col_num++];
+        types_by_colname[column_name] = ca.get_data_type();
+    }
+    for (auto const &column_name: key_columns)
+        key_profile.push_back(types_by_colname[column_name]);
+    if (!unique) {
+        key_profile.push_back(ColumnAttribute::INT);  // handle's block id
+        key_profile.push_back(ColumnAttribute::INT);  // and record id
+    }
+}
+
+// Get level, split, bytes, and the free list from the stat block.
+void HashIndex::read_stat() {
+    SlottedPage *block = file.get(STAT);
+    uint32_t values[BYTES];
+    for (RecordID record_id = LEVEL; record_id <= BYTES; record_id++) {
+        Dbt *dbt = block->get(record_id);
+        values[record_id - LEVEL] = *(uint32_t *) dbt->get_data();
+        delete dbt;
+    }
+    free_head = 0;
+    if (block->size() >= FREE) {
+        Dbt *dbt = block->get(FREE);
+        free_head = *(BlockID *) dbt->get_data();
+        delete dbt;
+    }
+    file.unpin(block);
+    level = values[LEVEL - 1];
+    split = values[SPLIT - 1];
+    bytes = values[BYTES - 1];
+}
+
+// Put level, split, bytes, and the free list into the stat block.
+void HashIndex::write_stat() {
+    SlottedPage *block = file.get(STAT);
+    uint32_t values[] = {level, split, bytes, free_head};
+    for (RecordID record_id = LEVEL; record_id <= FREE; record_id++) {
+        Dbt dbt(&values[record_id - LEVEL], sizeof(uint32_t));
+        if (block->size() < record_id)
+            block->add(&dbt);
+        else
+            block->put(record_id, dbt);
+    }
+    file.put(block);
+    file.unpin(block);
+}
+
+// The key for the row at row_handle, with handle on the end if this isn't a unique index (freed by caller).
+KeyValue *HashIndex::entry_key(Handle row_handle, Handle handle) const {
+    ValueDict *row = relation.project(row_handle, &key_columns);
+    KeyValue *key = new KeyValue();
+    for (auto const &column_name: key_columns)
+        key->push_back((*row)[column_name]);
+    delete row;
+    if (!unique) {
+        key->push_back(Value((int32_t) handle.first));
+        key->push_back(Value((int32_t) handle.second));
+    }
+    return key;
+}
+
+// Bytes an entry takes up in a block, including its record header.
+uint HashIndex::entry_size(const KeyValue *key) const {
+    uint size = 4 + HANDLE_SZ;
+    for (uint i = 0; i < key_profile.size(); i++) {
+        if (key_profile[i] == ColumnAttribute::TEXT)
+            size += sizeof(uint16_t) + (uint) (*key)[i].s.size();
+        else if (key_profile[i] == ColumnAttribute::BOOLEAN)
+            size += sizeof(uint8_t);
+        else
+            size += sizeof(int32_t);
+    }
+    return size;
+}
+
+// FNV-1a hash of the key columns (not the handle of a non-unique entry), stable from run to run.
+uint32_t HashIndex::hash(const KeyValue *key) const {
+    uint32_t h = 2166136261U;
+    for (uint i = 0; i < key_columns.size(); i++) {
+        const Value &value = (*key)[i];
+        const char *data;
+        size_t size;
+        int32_t n = value.n;
+        if (value.data_type == ColumnAttribute::TEXT) {
+            data = value.s.data();
+            size = value.s.size() + 1;  // with the terminating null, so ("a", "bc") and ("ab", "c") differ
+        } else {
+            data = (const char *) &n;
+            size = sizeof(n);
+        }
+        for (size_t j = 0; j < size; j++) {
+            h ^= (uint8_t) data[j];
+            h *= 16777619U;
+        }
+    }
+    return h;
+}
+
+// Which bucket a key belongs in.
+uint HashIndex::bucket(const KeyValue *key) const {
+    uint32_t h = hash(key);
+    uint b = h & ((1U << level) - 1);
+    if (b < split)
+        b = h & ((2U << level) - 1);  // already split this round
+    return b;
+}
+
+// The first block of a bucket's chain (freed by caller). Each time counts as one probe of the index.
+BTreeLeaf *HashIndex::first_page(uint bucket) const {
+    ExecStats::count(file.get_counters(), &ExecCounters::index_descents);
+    return new BTreeLeaf(file, bucket_block(bucket), key_profile, false);
+}
+
+// The block after the given one in its chain (or nullptr at the end), letting go of the given one.
+BTreeLeaf *HashIndex::next_page(BTreeLeaf *page) const {
+    BlockID next_id = page->get_next_leaf();
+    delete page;
+    return next_id == 0 ? nullptr : new BTreeLeaf(overflow_file, next_id, key_profile, false);
+}
+
+// Whether any block of the bucket has an entry for key.
+bool HashIndex::contains(uint bucket, const KeyValue *key) const {
+    for (BTreeLeaf *page = first_page(bucket); page != nullptr; page = next_page(page)) {
+        size_t i = page->lower_bound(key);
+        if (i < page->size() && page->compare_entry(i, key) == 0) {
+            delete page;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Put an entry into a bucket: in its first block if there's room, otherwise in the first overflow block, otherwise
+ * in a new overflow block put at the front of the overflow chain. So an insert reads at most two blocks of the
+ * bucket; room left by deletes further down the chain isn't reused.
+ * @param bucket  where key hashes to
+ * @param key     key of the entry
+ * @param handle  handle of the entry
+ */
+void HashIndex::add(uint bucket, const KeyValue *key, Handle handle) {
+    BTreeLeaf *page = first_page(bucket);
+    if (page->add(key, handle)) {
+        delete page;
+        return;
+    }
+    BlockID first_overflow = page->get_next_leaf();
+    if (first_overflow != 0) {
+        BTreeLeaf overflow(overflow_file, first_overflow, key_profile, false);
+        if (overflow.add(key, handle)) {
+            delete page;
+            return;
+        }
+    }
+    BTreeLeaf *overflow = new_overflow();
+    overflow->set_next_leaf(first_overflow);
+    if (!overflow->add(key, handle)) {
+        free_overflow(overflow->get_id());
+        delete overflow;
+        delete page;
+        throw DbRelationError("index key too big for a block");
+    }
+    page->set_next_leaf(overflow->get_id());
+    page->save();
+    delete overflow;
+    delete page;
+}
+
+// An empty overflow block, off the free list if there is one there.
+BTreeLeaf *HashIndex::new_overflow() {
+    if (free_head == 0)
+        return new BTreeLeaf(overflow_file, 0, key_profile, true);
+    BTreeLeaf *overflow = new BTreeLeaf(overflow_file, free_head, key_profile, false);
+    free_head = overflow->get_next_leaf();
+    overflow->reset(0);
+    return overflow;
+}
+
+// Put an overflow block that is no longer in any chain on the free list (what was in it is gone).
+void HashIndex::free_overflow(BlockID block_id) {
+    BTreeLeaf overflow(overflow_file, block_id, key_profile, false);
+    overflow.reset(free_head);
+    overflow.save();
+    free_head = block_id;
+}
+
+// Take out the entry for key with the given handle, if it's there.
+bool HashIndex::remove(const KeyValue *key, Handle handle) {
+    KeyValue column_key(key->begin(), key->begin() + key_columns.size());
+    for (BTreeLeaf *page = first_page(bucket(&column_key)); page != nullptr; page = next_page(page)) {
+        size_t i = page->lower_bound(key);
+        if (i < page->size() && page->compare_entry(i, key) == 0 && page->get_entry_handle(i) == handle) {
+            page->del(i);
+            page->save();
+            delete page;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Fill a bucket's chain with the given entries, starting from its (already emptied) first block and then taking
+ * overflow blocks from spare and then the free list before making new ones.
+ * @param bucket   bucket to write
+ * @param entries  entries for the bucket, sorted
+ * @param spare    overflow blocks that can be reused (the ones taken are removed)
+ */
+void HashIndex::write_chain(uint bucket, const KeyEntries &entries, std::vector<BlockID> &spare) {
+    BTreeLeaf *page = first_page(bucket);
+    page->reset(0);
+    for (auto const &entry: entries) {
+        if (page->add(&entry.first, entry.second))
+            continue;
+        BTreeLeaf *overflow;
+        if (spare.empty()) {
+            overflow = new_overflow();
+        } else {
+            overflow = new BTreeLeaf(overflow_file, spare.back(), key_profile, false);
+            overflow->reset(0);
+            spare.pop_back();
+        }
+        page->set_next_leaf(overflow->get_id());
+        page->save();
+        delete page;
+        page = overflow;
+        if (!page->add(&entry.first, entry.second)) {
+            delete page;
+            throw DbRelationError("index key too big for a block");
+        }
+    }
+    page->save();
+    delete page;
+}
+
+// Split the next bucket in turn between itself and a new bucket at the end.
+void HashIndex::split_next() {
+    uint from = split;
+    uint to = (1U << level) + split;
+    uint32_t mask = (2U << level) - 1;
+    BTreeLeaf *fresh = new BTreeLeaf(file, 0, key_profile, true);
+    BlockID fresh_id = fresh->get_id();
+    fresh->save();
+    delete fresh;
+    if (fresh_id != bucket_block(to))
+        throw DbRelationError("hash index file out of step with its buckets");
+
+    KeyEntries stay, move;
+    std::vector<BlockID> spare;
+    bool first = true;
+    for (BTreeLeaf *page = first_page(from); page != nullptr; page = next_page(page)) {
+        if (!first)
+            spare.push_back(page->get_id());
+        first = false;
+        for (size_t i = 0; i < page->size(); i++) {
+            KeyValue *key = page->get_entry_key(i);
+            KeyEntries &entries = (hash(key) & mask) == from ? stay : move;
+            entries.push_back(std::make_pair(std::move(*key), page->get_entry_handle(i)));
+            delete key;
+        }
+    }
+    split++;
+    if (split == 1U << level) {
+        level++;
+        split = 0;
+    }
+    std::sort(stay.begin(), stay.end());
+    std::sort(move.begin(), move.end());
+    std::reverse(spare.begin(), spare.end());  // reuse them in chain order
+    write_chain(from, stay, spare);
+    write_chain(to, move, spare);
+    for (BlockID block_id: spare)
+        free_overflow(block_id);
+}
+
+// Test helper. Look up a single-column key.
+static size_t test_lookup_count(HashIndex &index, const Identifier &column_name, const Value &value) {
+    ValueDict key;
+    key[column_name] = value;
+    Handles *handles = index.lookup(&key);
+    size_t n = handles->size();
+    delete handles;
+    return n;
+}
+
+bool test_hash_index() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("__test_hash", column_names, column_attributes);
+    table.create();
+    for (int i = 0; i < 10000; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value("group " + std::to_string(i % 7));
+        table.insert(&row);
+    }
+
+    // unique index on a, loaded from the table and then grown by inserts
+    ColumnNames a;
+    a.push_back("a");
+    HashIndex unique_index(table, "hash_a", a, true);
+    unique_index.create();
+    uint loaded_buckets = unique_index.get_bucket_count();
+    for (int i = 10000; i < 30000; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value("group " + std::to_string(i % 7));
+        unique_index.insert(table.insert(&row));
+    }
+    if (unique_index.get_bucket_count() <= loaded_buckets) {
+        std::cout << "hash index did not split " << loaded_buckets << std::endl;
+        return false;
+    }
+    for (int i = 0; i < 30000; i += 13)
+        if (test_lookup_count(unique_index, "a", Value(i)) != 1) {
+            std::cout << "hash lookup failed " << i << std::endl;
+            return false;
+        }
+    // every overflow block is in a bucket's chain or else on the free list, to be used again
+    size_t chained = 0, freed = 0;
+    for (uint bucket = 0; bucket < unique_index.get_bucket_count(); bucket++) {
+        BTreeLeaf *page = unique_index.next_page(unique_index.first_page(bucket));
+        for (; page != nullptr; page = unique_index.next_page(page))
+            chained++;
+    }
+    for (BlockID block_id = unique_index.free_head; block_id != 0; freed++) {
+        BTreeLeaf page(unique_index.overflow_file, block_id, unique_index.key_profile, false);
+        block_id = page.get_next_leaf();
+    }
+    BlockIDs *overflow_ids = unique_index.overflow_file.block_ids();
+    size_t overflow_blocks = overflow_ids->size();
+    delete overflow_ids;
+    if (chained + freed + 1 != overflow_blocks) {  // block 1 was made with the file and isn't used
+        std::cout << "hash overflow blocks lost " << chained << " " << freed << " " << overflow_blocks << std::endl;
+        return false;
+    }
+    if (test_lookup_count(unique_index, "a", Value(-1)) != 0) {
+        std::cout << "hash lookup of missing key failed" << std::endl;
+        return false;
+    }
+    ValueDict key;
+    key["a"] = Value(42);
+    Handles *handles = unique_index.lookup(&key);
+    Handle handle = handles->back();
+    delete handles;
+    try {
+        unique_index.insert(handle);
+        std::cout << "hash index took a duplicate" << std::endl;
+        return false;
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    unique_index.del(handle);
+    if (test_lookup_count(unique_index, "a", Value(42)) != 0 || test_lookup_count(unique_index, "a", Value(43)) != 1) {
+        std::cout << "hash delete failed" << std::endl;
+        return false;
+    }
+
+    // non-unique index on a column with just a few values
+    ColumnNames b;
+    b.push_back("b");
+    HashIndex group_index(table, "hash_b", b, false);
+    group_index.create();
+    size_t total = 0;
+    for (int i = 0; i < 7; i++) {
+        size_t n = test_lookup_count(group_index, "b", Value("group " + std::to_string(i)));
+        if (n < 4285 || n > 4286) {
+            std::cout << "non-unique hash lookup failed " << i << " " << n << std::endl;
+            return false;
+        }
+        total += n;
+    }
+    key.clear();
+    key["b"] = Value("group 0");
+    handles = group_index.lookup(&key);
+    group_index.del(handles->front());
+    delete handles;
+    if (total != 30000 || test_lookup_count(group_index, "b", Value("group 0")) != 4285) {
+        std::cout << "non-unique hash delete failed" << std::endl;
+        return false;
+    }
+
+    group_index.drop();
+    unique_index.drop();
+    table.drop();
+    return true;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file HashIndex.h - HashIndex: linear hashing over HeapFile blocks
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <mutex>
+#include "BTreeNode.h"
+
+/**
+ * @class HashIndex - equality-only index using linear hashing
+ *
+ *      Buckets are numbered from 0; bucket b's first block is block b + 2 of the index's file (block 1 holds the
+ *      level, the next bucket to split, the bytes taken up by entries, and the first free overflow block). The rest
+ *      of a bucket's chain is in a second file of overflow blocks. Every block is laid out like a BTreeLeaf: the
+ *      next block of the chain, then the entries in key order. Overflow blocks a split has no more use for are
+ *      chained (empty) the same way on a free list, which is drawn on before the overflow file is grown.
+ *
+ *      A key hashes to bucket h mod 2^level, or to h mod 2^(level + 1) if that bucket has already been split in
+ *      this round. When the entries would fill more than SPLIT_LOAD of the buckets' first blocks, the next bucket
+ *      in turn is split between itself and a new bucket at the end of the file.
+ *
+ *      As with BTreeIndex, a non-unique index keeps the row's handle on the end of each key.
+ */
+class HashIndex : public DbIndex {
+public:
+    static const double SPLIT_LOAD;  // how full the buckets' first blocks get (on average) before a split
+
+    HashIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+
+    virtual ~HashIndex() {}
+
+    virtual void create();
+
+    virtual void drop();
+
+    virtual void open();
+
+    virtual void close();
+
+    virtual Handles *lookup(ValueDict *key) const;
+
+    virtual void insert(Handle handle);
+
+    virtual void del(Handle handle);
+
+    virtual void relocate(const Relocations *moves);
+
+    virtual double lookup_cost(uint prefix_size, uint32_t table_blocks, double matching_rows);
+
+    uint get_bucket_count() const { return (1U << this->level) + this->split; }
+
+protected:
+    static const BlockID STAT = 1;
+    static const RecordID LEVEL = 1;  // where the stat block keeps level
+    static const RecordID SPLIT = LEVEL + 1;  // next bucket to split
+    static const RecordID BYTES = SPLIT + 1;  // bytes used by entries
+    static const RecordID FREE = BYTES + 1;  // first free overflow block (not there in an older index: none)
+    static const uint HANDLE_SZ = sizeof(BlockID) + sizeof(RecordID);
+    static const uint PAGE_OVERHEAD = 4 + 4 + sizeof(BlockID);  // block header plus the chain's next pointer
+
+    bool closed;
+    std::mutex latch;                // held while opening or closing (lookups may run at once)
+    mutable HeapFile file;           // stat block and the first block of each bucket
+    mutable HeapFile overflow_file;  // the rest of the buckets' chains
+    KeyProfile key_profile;
+    uint level;
+    uint split;
+    uint32_t bytes;
+    BlockID free_head;
+
+    // room for entries in a block
+    uint page_capacity() const { return this->file.get_block_size() - PAGE_OVERHEAD; }
+
+    void build_key_profile();
+
+    void read_stat();
+
+    void write_stat();
+
+    KeyValue *entry_key(Handle row_handle, Handle handle) const;
+
+    uint entry_size(const KeyValue *key) const;
+
+    uint32_t hash(const KeyValue *key) const;
+
+    uint bucket(const KeyValue *key) const;
+
+    BlockID bucket_block(uint bucket) const { return bucket + STAT + 1; }
+
+    BTreeLeaf *first_page(uint bucket) const;
+
+    BTreeLeaf *next_page(BTreeLeaf *page) const;
+
+    bool contains(uint bucket, const KeyValue *key) const;
+
+    void add(uint bucket, const KeyValue *key, Handle handle);
+
+    bool remove(const KeyValue *key, Handle handle);
+
+    BTreeLeaf *new_overflow();  // freed by caller
+
+    void free_overflow(BlockID block_id);
+
+    void write_chain(uint bucket, const KeyEntries &entries, std::vector<BlockID> &spare);
+
+    void split_next();
+
+    friend bool test_hash_index();
+};
+
+bool test_hash_index();
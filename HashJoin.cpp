@@ -0,0 +1,201 @@
+/**
+ * @file HashJoin.cpp - implementation of JoinHashTable and SpillFile
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+#include "ColumnStatistics.h"
+#include "HashJoin.h"
+
+using namespace std;
+
+const uint32_t JoinHashTable::END;
+
+JoinHashTable::JoinHashTable(uint key_position) : key_position(key_position), rows(), hashes(), chain(),
+                                                  buckets(16, END), bytes(0) {
+}
+
+void JoinHashTable::add(const Row &row) {
+    uint64_t h = hash(row, this->key_position);
+    uint32_t row_number = (uint32_t) this->rows.size();
+    this->rows.push_back(row);  // copying gives the kept row its own TEXT bytes
+    this->hashes.push_back(h);
+    size_t bucket = (size_t) h & (this->buckets.size() - 1);
+    this->chain.push_back(this->buckets[bucket]);
+    this->buckets[bucket] = row_number;
+    this->bytes += this->rows.back().footprint() + sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    if (this->rows.size() > this->buckets.size())
+        grow();
+}
+
+uint32_t JoinHashTable::first(const Row &probe, uint position) const {
+    uint64_t h = hash(probe, position);
+    return find(this->buckets[(size_t) h & (this->buckets.size() - 1)], h, probe, position);
+}
+
+uint32_t JoinHashTable::next(uint32_t match, const Row &probe, uint position) const {
+    return find(this->chain[match], this->hashes[match], probe, position);
+}
+
+void JoinHashTable::clear() {
+    Rows().swap(this->rows);
+    vector<uint64_t>().swap(this->hashes);
+    vector<uint32_t>().swap(this->chain);
+    this->buckets.assign(16, END);
+    this->bytes = 0;
+}
+
+uint64_t JoinHashTable::hash(const Row &row, uint position) {
+    if (row.get_data_type(position) == ColumnAttribute::TEXT)
+        return HyperLogLog::hash(row.get_s(position), row.get_size(position));
+    return HyperLogLog::hash(row.get_n(position));
+}
+
+/**
+ * Follow a chain from the given row to the first one whose key equals the probe's field.
+ * @param row_number  where to start (or END)
+ * @param hash        of the probe's field
+ * @param probe       the probe row
+ * @param position    where the field is in it
+ * @return            the matching row's number, or END
+ */
+uint32_t JoinHashTable::find(uint32_t row_number, uint64_t hash, const Row &probe, uint position) const {
+    for (; row_number != END; row_number = this->chain[row_number]) {
+        if (this->hashes[row_number] != hash)
+            continue;
+        const Row &row = this->rows[row_number];
+        uint key = this->key_position;
+        if (row.get_data_type(key) != probe.get_data_type(position))
+            continue;
+        if (row.get_data_type(key) != ColumnAttribute::TEXT) {
+            if (row.get_n(key) == probe.get_n(position))
+                return row_number;
+        } else if (row.get_size(key) == probe.get_size(position) &&
+                   memcmp(row.get_s(key), probe.get_s(position), row.get_size(key)) == 0) {
+            return row_number;
+        }
+    }
+    return END;
+}
+
+// Double the buckets and chain each row back in (rows with a common bucket stay in the same order)
+void JoinHashTable::grow() {
+    this->buckets.assign(2 * this->buckets.size(), END);
+    const size_t mask = this->buckets.size() - 1;
+    for (uint32_t row_number = (uint32_t) this->rows.size(); row_number-- > 0;) {
+        size_t bucket = (size_t) this->hashes[row_number] & mask;
+        this->chain[row_number] = this->buckets[bucket];
+        this->buckets[bucket] = row_number;
+    }
+}
+
+SpillFile::SpillFile(const string &prefix) : file(unique_name(prefix), 2), block(nullptr), cursor(nullptr),
+                                             record_id(0), buffer(), rows(0), dropped(false) {
+    this->file.set_block_size(DbBlock::MAX_BLOCK_SZ);
+    this->file.create();
+    this->block = this->file.get(1);
+}
+
+SpillFile::~SpillFile() {
+    delete this->cursor;
+    if (this->block != nullptr)
+        this->file.unpin(this->block);
+}
+
+void SpillFile::append(const Row &row) {
+    this->buffer.clear();
+    for (uint i = 0; i < row.size(); i++) {
+        ColumnAttribute::DataType data_type = row.get_data_type(i);
+        this->buffer.push_back((char) data_type);
+        if (data_type == ColumnAttribute::TEXT) {
+            u_int16_t size = row.get_size(i);
+            const char *s = row.get_s(i);
+            this->buffer.insert(this->buffer.end(), (const char *) &size, (const char *) &size + sizeof(size));
+            this->buffer.insert(this->buffer.end(), s, s + size);
+        } else if (data_type == ColumnAttribute::BOOLEAN) {
+            this->buffer.push_back((char) row.get_n(i));
+        } else {
+            int32_t n = row.get_n(i);
+            this->buffer.insert(this->buffer.end(), (const char *) &n, (const char *) &n + sizeof(n));
+        }
+    }
+    Dbt data(this->buffer.data(), (u_int32_t) this->buffer.size());
+    try {
+        this->block->add(&data);
+    } catch (DbBlockNoRoomError &e) {
+        this->file.put(this->block);
+        this->file.unpin(this->block);
+        this->block = nullptr;
+        this->block = this->file.get_new();
+        try {
+            this->block->add(&data);
+        } catch (DbBlockNoRoomError &) {
+            throw DbRelationError("row of " + to_string(data.get_size()) + " bytes is too big to spill");
+        }
+    }
+    this->rows++;
+}
+
+void SpillFile::rewind() {
+    if (this->block != nullptr) {
+        this->file.put(this->block);
+        this->file.unpin(this->block);
+        this->block = nullptr;
+    }
+    delete this->cursor;
+    this->cursor = new BlockCursor(this->file);
+    this->record_id = 0;
+}
+
+bool SpillFile::next(Row &row) {
+    while (true) {
+        SlottedPage *page = this->cursor->get_block();
+        if (page != nullptr && (this->record_id = page->next_id(this->record_id)) != 0)
+            break;
+        if (this->cursor->next() == nullptr)
+            return false;
+        this->record_id = 0;
+    }
+    Dbt data;
+    this->cursor->get_block()->get(this->record_id, data);
+    const char *bytes = (const char *) data.get_data(), *end = bytes + data.get_size();
+    row.clear();
+    while (bytes < end) {
+        ColumnAttribute::DataType data_type = (ColumnAttribute::DataType) *bytes++;
+        if (data_type == ColumnAttribute::TEXT) {
+            u_int16_t size;
+            memcpy(&size, bytes, sizeof(size));
+            row.append_text_view(bytes + sizeof(size), size);
+            bytes += sizeof(size) + size;
+        } else if (data_type == ColumnAttribute::BOOLEAN) {
+            row.append_boolean(*bytes++);
+        } else {
+            int32_t n;
+            memcpy(&n, bytes, sizeof(n));
+            row.append_int(n);
+            bytes += sizeof(n);
+        }
+    }
+    return true;
+}
+
+void SpillFile::drop() {
+    if (this->dropped)
+        return;
+    delete this->cursor;
+    this->cursor = nullptr;
+    if (this->block != nullptr)
+        this->file.unpin(this->block);
+    this->block = nullptr;
+    this->dropped = true;
+    this->file.drop();
+}
+
+// e.g., _join_spill_1234_7 for the 7th spill file of process 1234
+string SpillFile::unique_name(const string &prefix) {
+    static atomic<u_long> count(0);
+    return prefix + "_" + to_string((long) getpid()) + "_" + to_string(++count);
+}
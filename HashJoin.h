@@ -0,0 +1,148 @@
+/**
+ * @file HashJoin.h - the rows of one side of a hash join, in memory or spilled to disk
+ * JoinHashTable
+ * SpillFile
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include "HeapFile.h"
+
+/**
+ * @class JoinHashTable - the build side's rows of a hash join, chained by the hash of their join column
+ *
+ *      Each row is copied in (with its own TEXT bytes). The buckets are a power of two, doubled whenever there are
+ *      more rows than buckets; each bucket holds its first row and each row the next one in its bucket, so rows
+ *      with the same key (however many) are just a longer chain. Each row's hash is kept, so most rows that don't
+ *      match are passed over without comparing keys, and growing doesn't have to hash anything again.
+ */
+class JoinHashTable {
+public:
+    static const uint32_t END = UINT32_MAX;  // no (more) matching rows
+
+    /**
+     * @param key_position  where the join column is in the rows to be added
+     */
+    JoinHashTable(uint key_position);
+
+    virtual ~JoinHashTable() {}
+
+    JoinHashTable(const JoinHashTable &other) = delete;
+
+    JoinHashTable &operator=(const JoinHashTable &other) = delete;
+
+    /**
+     * Add a row (copied).
+     * @param row  the row
+     */
+    virtual void add(const Row &row);
+
+    /**
+     * The first row whose key equals a field of another row.
+     * @param probe     the other row
+     * @param position  where the field is in it
+     * @return          the matching row's number, or END if there isn't one
+     */
+    virtual uint32_t first(const Row &probe, uint position) const;
+
+    /**
+     * The next row whose key equals the same field, after the given one.
+     * @param match     a row number returned by first() or next() for the same probe
+     * @param probe     the other row
+     * @param position  where the field is in it
+     * @return          the matching row's number, or END if there are no more
+     */
+    virtual uint32_t next(uint32_t match, const Row &probe, uint position) const;
+
+    const Row &get(uint32_t row_number) const { return rows[row_number]; }
+
+    size_t size() const { return rows.size(); }
+
+    // About how many bytes of memory the rows take up
+    size_t get_bytes() const { return bytes; }
+
+    // Forget all the rows
+    virtual void clear();
+
+    /**
+     * Hash of one field of a row (the same for equal values, whichever row they are in).
+     * @param row       the row
+     * @param position  where the field is in it
+     * @return          the hash
+     */
+    static uint64_t hash(const Row &row, uint position);
+
+protected:
+    uint key_position;
+    Rows rows;
+    std::vector<uint64_t> hashes;   // of each row's key
+    std::vector<uint32_t> chain;    // next row in each row's bucket, or END
+    std::vector<uint32_t> buckets;  // first row in each bucket, or END (size a power of two)
+    size_t bytes;
+
+    virtual uint32_t find(uint32_t row_number, uint64_t hash, const Row &probe, uint position) const;
+
+    virtual void grow();
+};
+
+/**
+ * @class SpillFile - a temporary HeapFile of Rows, written once and then read back in the same order
+ *
+ *      For the partitions of a hash join that doesn't fit in memory. Each row is a record of its fields in turn,
+ *      each field a byte for its data type and then the value: INTs as 4 bytes, BOOLEANs as 1, TEXT as a 2-byte
+ *      size and the characters. The file has DbBlock::MAX_BLOCK_SZ blocks (so any row fits) in a two-frame buffer
+ *      pool, since only one block is ever in use at a time. Its name is unique to the process; drop() gets rid of it.
+ */
+class SpillFile {
+public:
+    /**
+     * Create a new, empty spill file.
+     * @param prefix  start of its name, e.g., what it is for
+     */
+    SpillFile(const std::string &prefix);
+
+    virtual ~SpillFile();
+
+    SpillFile(const SpillFile &other) = delete;
+
+    SpillFile &operator=(const SpillFile &other) = delete;
+
+    /**
+     * Add a row to the end of the file.
+     * @param row  the row
+     */
+    virtual void append(const Row &row);
+
+    /**
+     * Done adding rows; get ready to read them back from the beginning.
+     */
+    virtual void rewind();
+
+    /**
+     * Read the next row.
+     * @param row  replaced with the row (TEXT fields are views that are good until the next call)
+     * @return     false if there are no more rows
+     */
+    virtual bool next(Row &row);
+
+    // Number of rows appended
+    u_long size() const { return rows; }
+
+    /**
+     * Delete the file.
+     */
+    virtual void drop();
+
+protected:
+    HeapFile file;
+    SlottedPage *block;   // being written (pinned), until rewind()
+    BlockCursor *cursor;  // for reading, after rewind()
+    RecordID record_id;   // last one read from the cursor's block
+    std::vector<char> buffer;
+    u_long rows;
+    bool dropped;
+
+    static std::string unique_name(const std::string &prefix);
+};
@@ -4,18 +4,43 @@
  * @see Seattle University, CPSC5300
  */
 #include <cstring>
+#include <new>
 #include "db_cxx.h"
 #include "HeapFile.h"
+#include "Transaction.h"
 
 using namespace std;
 typedef uint16_t u16;
 
+std::set<HeapFile *> HeapFile::open_files;
+std::recursive_mutex HeapFile::open_files_latch;
+
 /**
  * Constructor
  * @param name
+ * @param pool_size  number of DbBlock::BLOCK_SZ frames in this file's buffer pool
  */
-HeapFile::HeapFile(string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0) {
+HeapFile::HeapFile(string name, uint pool_size) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0),
+                                                  block_size(DbBlock::BLOCK_SZ),
+                                                  pool_bytes((pool_size == 0 ? 1 : pool_size) * DbBlock::BLOCK_SZ),
+                                                  frames(pool_size == 0 ? 1 : pool_size), frame_index(),
+                                                  clock_hand(0), pool_stats(), free_space(name), zone_map(nullptr),
+                                                  counters(nullptr) {
     this->dbfilename = this->name + ".db";
+    this->free_space.set_block_size(this->block_size);
+}
+
+/**
+ * Destructor -- writes back anything still dirty and frees the pool.
+ */
+HeapFile::~HeapFile() {
+    std::lock_guard<std::recursive_mutex> files(HeapFile::open_files_latch);
+    if (!this->closed)
+        flush();
+    release_frames();
+    free_frames();
+    delete this->zone_map;
+    HeapFile::open_files.erase(this);
 }
 
 /**
@@ -24,16 +49,21 @@ HeapFile::HeapFile(string name) : DbFile(name), dbfilename(""), last(0), closed(
 void HeapFile::create(void) {
     db_open(DB_CREATE | DB_EXCL);
     SlottedPage *page = get_new(); // force one page to exist
-    delete page;
+    unpin(page);
 }
 
 /**
  * Delete the physical file.
  */
 void HeapFile::drop(void) {
+    std::lock_guard<std::recursive_mutex> files(HeapFile::open_files_latch);
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    release_frames();  // no point in writing anything back
     close();
-    Db db(_DB_ENV, 0);
-    db.remove(this->dbfilename.c_str(), nullptr, 0);
+    _DB_ENV->dbremove(Transaction::current(), this->dbfilename.c_str(), nullptr, 0);
+    this->free_space.drop();
+    if (this->zone_map != nullptr)
+        this->zone_map->drop();
 }
 
 /**
@@ -44,53 +74,105 @@ void HeapFile::open(void) {
 }
 
 /**
- * Close the physical file.
+ * Close the physical file. Any pages still pinned are invalidated.
  */
 void HeapFile::close(void) {
+    std::lock_guard<std::recursive_mutex> files(HeapFile::open_files_latch);
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    if (this->closed)
+        return;
+    flush();
+    release_frames();
     this->db.close(0);
+    this->free_space.close();
+    if (this->zone_map != nullptr)
+        this->zone_map->close();
     this->closed = true;
+    HeapFile::open_files.erase(this);
 }
 
 /**
  * Allocate a new block for the database file.
- * @return the new empty DbBlock that is managing the records in this block and its block id.
+ * @return the new empty DbBlock that is managing the records in this block and its block id (pinned).
  */
 SlottedPage *HeapFile::get_new(void) {
-    char block[DbBlock::BLOCK_SZ];
-    memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    uint frame_no = claim_frame();
+    Frame &frame = this->frames[frame_no];
+    memset(frame.data, 0, this->block_size);
 
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
+    BlockID block_id = ++this->last;
+    SlottedPage *page = install(frame_no, block_id, true);
 
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage *page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
-    delete page;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, this->last);
+    // write out the empty block right away so Berkeley DB has the record number allocated
+    Dbt key(&block_id, sizeof(block_id));
+    this->db.put(Transaction::current(), &key, page->get_block(), 0);
+    this->free_space.set(block_id, page->unused_bytes());
+    if (this->zone_map != nullptr)
+        this->zone_map->summarize(page);
+    return page;
 }
 
 /**
  * Get a block from the database file.
  * @param block_id
- * @return          the given slotted page (freed by caller)
+ * @return          the given slotted page (pinned -- caller must unpin)
  */
 SlottedPage *HeapFile::get(BlockID block_id) {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    auto found = this->frame_index.find(block_id);
+    if (found != this->frame_index.end()) {
+        Frame &frame = this->frames[found->second];
+        frame.pin_count++;
+        frame.referenced = true;
+        this->pool_stats.hits++;
+        return frame.page;
+    }
+
+    this->pool_stats.misses++;
+    ExecStats::count(this->counters, &ExecCounters::blocks_read);
+    uint frame_no = claim_frame();
+    Frame &frame = this->frames[frame_no];
     Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, block_id, false);
+    Dbt data(frame.data, this->block_size);
+    data.set_ulen(this->block_size);
+    data.set_flags(DB_DBT_USERMEM);  // copy straight into our frame
+    this->db.get(Transaction::current(), &key, &data, 0);
+    return install(frame_no, block_id, false);
 }
 
 /**
- * Write a block back to the database file.
+ * Write a block back to the database file. For blocks in the pool this just marks them dirty; the write
+ * to Berkeley DB happens when the frame is flushed or evicted.
  * @param block
  */
 void HeapFile::put(DbBlock *block) {
-    int block_id = block->get_block_id();
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    BlockID block_id = block->get_block_id();
+    auto found = this->frame_index.find(block_id);
+    if (found != this->frame_index.end() && this->frames[found->second].page == block) {
+        this->frames[found->second].dirty = true;
+        this->free_space.set(block_id, this->frames[found->second].page->unused_bytes());
+        return;
+    }
     Dbt key(&block_id, sizeof(block_id));
-    this->db.put(nullptr, &key, block->get_block(), 0);
+    this->db.put(Transaction::current(), &key, block->get_block(), 0);
+}
+
+/**
+ * Release a pin gotten from get() or get_new().
+ * @param block  the page returned by get() or get_new()
+ */
+void HeapFile::unpin(DbBlock *block) {
+    if (block == nullptr)
+        return;
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    auto found = this->frame_index.find(block->get_block_id());
+    if (found == this->frame_index.end())
+        return;
+    Frame &frame = this->frames[found->second];
+    if (frame.page == block && frame.pin_count > 0)
+        frame.pin_count--;
 }
 
 /**
@@ -104,28 +186,606 @@ BlockIDs *HeapFile::block_ids() const {
     return vec;
 }
 
+void HeapFile::set_block_size(uint block_size) {
+    if (block_size < DbBlock::BLOCK_SZ || block_size > DbBlock::MAX_BLOCK_SZ || (block_size & (block_size - 1)) != 0)
+        throw DbRelationError("block size must be a power of two from " + to_string(DbBlock::BLOCK_SZ) + " to " +
+                              to_string(DbBlock::MAX_BLOCK_SZ) + ", not " + to_string(block_size));
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    if (this->closed)
+        this->block_size = block_size;
+}
+
+void HeapFile::note_free_space(const SlottedPage *block) {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    this->free_space.set(block->get_block_id(), block->unused_bytes());
+}
+
+void HeapFile::keep_zone_map(const std::vector<ColumnAttribute::DataType> &column_types) {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    if (this->zone_map == nullptr)
+        this->zone_map = new ZoneMap(this->name, column_types);
+}
+
+void HeapFile::widen_zone(BlockID block_id, const Dbt *data) {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    if (this->zone_map != nullptr)
+        this->zone_map->widen(block_id, data);
+}
+
+void HeapFile::summarize_zone(SlottedPage *block) {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    if (this->zone_map != nullptr)
+        this->zone_map->summarize(block);
+}
+
+bool HeapFile::zone_may_match(BlockID block_id, const std::vector<const Value *> &where_by_column) const {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    return this->zone_map == nullptr || this->zone_map->may_match(block_id, where_by_column);
+}
+
+void HeapFile::truncate(BlockID new_last) {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    if (new_last >= this->last)
+        return;
+    for (auto &frame: this->frames) {
+        if (frame.page == nullptr || frame.page->get_block_id() <= new_last)
+            continue;
+        if (frame.pin_count > 0)
+            throw DbRelationError("can't give back pinned block " + to_string(frame.page->get_block_id()));
+        this->frame_index.erase(frame.page->get_block_id());
+        drop_page(frame);
+        frame.dirty = false;
+        frame.referenced = false;
+    }
+    for (BlockID block_id = this->last; block_id > new_last; block_id--) {
+        Dbt key(&block_id, sizeof(block_id));
+        this->db.del(Transaction::current(), &key, 0);
+    }
+    this->last = new_last;
+    this->free_space.truncate(new_last);
+    if (this->zone_map != nullptr)
+        this->zone_map->truncate(new_last);
+}
+
+/**
+ * Write back all the dirty frames (and the free-space map).
+ */
+void HeapFile::flush(void) {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    for (auto &frame: this->frames)
+        if (frame.page != nullptr && frame.dirty)
+            write_back(frame);
+    this->free_space.flush();
+    if (this->zone_map != nullptr)
+        this->zone_map->flush();
+}
+
+void HeapFile::discard(void) {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    for (auto &frame: this->frames)
+        frame.dirty = false;
+    this->free_space.discard();
+    if (this->zone_map != nullptr)
+        this->zone_map->discard();
+}
+
+void HeapFile::reload(void) {
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
+    if (this->closed)
+        return;
+    release_frames();
+    this->last = get_block_count();
+    read_maps();
+}
+
+/**
+ * Write back the dirty frames of every open file.
+ */
+void HeapFile::flush_all(void) {
+    std::lock_guard<std::recursive_mutex> files(HeapFile::open_files_latch);
+    for (auto file: HeapFile::open_files)
+        file->flush();
+}
+
+void HeapFile::discard_all(void) {
+    std::lock_guard<std::recursive_mutex> files(HeapFile::open_files_latch);
+    for (auto file: HeapFile::open_files)
+        file->discard();
+}
+
+void HeapFile::reload_all(void) {
+    std::lock_guard<std::recursive_mutex> files(HeapFile::open_files_latch);
+    for (auto file: HeapFile::open_files)
+        file->reload();
+}
+
+/**
+ * Add up the buffer pool counters of every open file.
+ * @return the totals
+ */
+BufferPoolStats HeapFile::get_total_pool_stats(void) {
+    std::lock_guard<std::recursive_mutex> files(HeapFile::open_files_latch);
+    BufferPoolStats total;
+    for (auto file: HeapFile::open_files) {
+        const BufferPoolStats &stats = file->get_pool_stats();
+        total.hits += stats.hits;
+        total.misses += stats.misses;
+        total.evictions += stats.evictions;
+        total.write_backs += stats.write_backs;
+    }
+    return total;
+}
+
 /**
  * Ask BerkDb how many blocks we are currently using in the file.
  * @return number of blocks
  */
 uint32_t HeapFile::get_block_count() {
     DB_BTREE_STAT *stat;
-    this->db.stat(nullptr, &stat, DB_FAST_STAT);
+    this->db.stat(Transaction::current(), &stat, DB_FAST_STAT);
     uint32_t bt_ndata = stat->bt_ndata;
     free(stat);
+
+    // for RecNo the fast count is only an upper bound -- it can include blocks given back by truncate()
+    char *buffer = new char[this->block_size];
+    while (bt_ndata > 0) {
+        Dbt key(&bt_ndata, sizeof(bt_ndata));
+        Dbt data(buffer, this->block_size);
+        data.set_ulen(this->block_size);
+        data.set_flags(DB_DBT_USERMEM);
+        if (this->db.get(Transaction::current(), &key, &data, 0) == 0)
+            break;
+        bt_ndata--;
+    }
+    delete[] buffer;
     return bt_ndata;
 }
 
 /**
- * Wrapper for Berkeley DB open, which does both open and creation.
+ * Wrapper for Berkeley DB open, which does both open and creation. Afterwards the block size is the file's record
+ * length, and the buffer pool has been resized for it if need be.
  * @param flags BerkDb flags
  */
 void HeapFile::db_open(uint flags) {
+    {
+        std::lock_guard<std::recursive_mutex> guard(this->latch);
+        if (!this->closed)
+            return;  // without waiting on the other files (the usual case, e.g., for every statement on a table)
+    }
+    std::lock_guard<std::recursive_mutex> files(HeapFile::open_files_latch);
+    std::lock_guard<std::recursive_mutex> guard(this->latch);
     if (!this->closed)
         return;
-    this->db.set_re_len(DbBlock::BLOCK_SZ); // record length - will be ignored if file already exists
-    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0644);
+    this->db.set_re_len(this->block_size); // record length - will be ignored if file already exists
+    if (flags & DB_CREATE)
+        this->db.set_pagesize(this->block_size);  // so that each block is one Berkeley DB page
+    this->db.open(Transaction::current(), this->dbfilename.c_str(), nullptr, DB_RECNO, flags | DB_THREAD, 0644);
+
+    u_int32_t re_len = this->block_size;
+    this->db.get_re_len(&re_len);
+    uint frame_count = max(min((uint) this->frames.size(), MIN_POOL_SIZE), this->pool_bytes / re_len);
+    if (re_len != this->block_size || frame_count != this->frames.size()) {
+        release_frames();
+        free_frames();
+        this->frames.assign(frame_count, Frame());
+        this->block_size = re_len;
+    }
+    this->free_space.set_block_size(this->block_size);
 
     this->last = flags ? 0 : get_block_count();
     this->closed = false;
+    HeapFile::open_files.insert(this);
+    read_maps();
+}
+
+/**
+ * Read in the free-space map and zone map, building a map from the blocks if need be: for a heap file from before
+ * we kept free-space maps (or zone maps), or blocks added since the map was last written back.
+ */
+void HeapFile::read_maps() {
+    BlockID mapped = this->free_space.open();
+    this->free_space.truncate(this->last);
+    BlockID zoned = this->last;
+    if (this->zone_map != nullptr) {
+        zoned = this->zone_map->open();
+        this->zone_map->truncate(this->last);
+    }
+    for (BlockID block_id = min(mapped, zoned) + 1; block_id <= this->last; block_id++) {
+        SlottedPage *page = get(block_id);
+        if (block_id > mapped)
+            note_free_space(page);
+        if (block_id > zoned)
+            summarize_zone(page);
+        unpin(page);
+    }
+}
+
+/**
+ * Find a frame to hold a block we are about to bring in: an empty one if there is one, otherwise
+ * evict an unpinned one using the clock (second-chance) algorithm.
+ * @return index of the (now empty) frame
+ * @throws DbRelationError if every frame is pinned
+ */
+uint HeapFile::claim_frame() {
+    uint n = (uint) this->frames.size();
+    for (uint sweep = 0; sweep < 2 * n; sweep++) {
+        uint frame_no = this->clock_hand;
+        this->clock_hand = (this->clock_hand + 1) % n;
+        Frame &frame = this->frames[frame_no];
+        if (frame.page == nullptr) {
+            if (frame.data == nullptr) {
+                frame.data = new char[this->block_size];
+                frame.page_memory = ::operator new(sizeof(SlottedPage));
+            }
+            return frame_no;
+        }
+        if (frame.pin_count > 0)
+            continue;
+        if (frame.referenced) {
+            frame.referenced = false;  // second chance
+            continue;
+        }
+        if (frame.dirty)
+            write_back(frame);
+        this->frame_index.erase(frame.page->get_block_id());
+        drop_page(frame);
+        this->pool_stats.evictions++;
+        return frame_no;
+    }
+    throw DbRelationError("buffer pool for " + this->name + " exhausted: all " + to_string(n) + " frames pinned");
+}
+
+/**
+ * Wrap the data in a claimed frame with a SlottedPage and pin it.
+ * @param frame_no  frame from claim_frame() whose data is already filled in (or zeroed if is_new)
+ * @param block_id  block now in the frame
+ * @param is_new    pass-through to SlottedPage to initialize the block
+ * @return          the pinned page
+ */
+SlottedPage *HeapFile::install(uint frame_no, BlockID block_id, bool is_new) {
+    Frame &frame = this->frames[frame_no];
+    Dbt data(frame.data, this->block_size);
+    frame.page = new(frame.page_memory) SlottedPage(data, block_id, is_new);
+    frame.pin_count = 1;
+    frame.dirty = false;
+    frame.referenced = true;
+    this->frame_index[block_id] = frame_no;
+    return frame.page;
+}
+
+/**
+ * Write a frame's block to Berkeley DB and mark it clean.
+ * @param frame  a resident frame
+ */
+void HeapFile::write_back(Frame &frame) {
+    BlockID block_id = frame.page->get_block_id();
+    Dbt key(&block_id, sizeof(block_id));
+    this->db.put(Transaction::current(), &key, frame.page->get_block(), 0);
+    frame.dirty = false;
+    this->pool_stats.write_backs++;
+    ExecStats::count(this->counters, &ExecCounters::blocks_written);
+}
+
+/**
+ * Empty all the frames without writing anything back (but keep their memory for reuse).
+ */
+void HeapFile::release_frames() {
+    for (auto &frame: this->frames) {
+        drop_page(frame);
+        frame.pin_count = 0;
+        frame.dirty = false;
+        frame.referenced = false;
+    }
+    this->frame_index.clear();
+    this->clock_hand = 0;
+}
+
+/**
+ * Take the SlottedPage out of a frame (if there is one), keeping its memory for the next block put in the frame.
+ * @param frame  the frame
+ */
+void HeapFile::drop_page(Frame &frame) {
+    if (frame.page != nullptr)
+        frame.page->~SlottedPage();
+    frame.page = nullptr;
+}
+
+/**
+ * Free the memory of all the (already emptied) frames.
+ */
+void HeapFile::free_frames() {
+    for (auto &frame: this->frames) {
+        delete[] frame.data;
+        ::operator delete(frame.page_memory);
+        frame.data = nullptr;
+        frame.page_memory = nullptr;
+    }
+}
+
+const uint FreeSpaceMap::GROUP_SZ;
+const uint8_t FreeSpaceMap::PADDING;
+
+/**
+ * Constructor
+ * @param name  name of the heap file this map is for
+ */
+FreeSpaceMap::FreeSpaceMap(string name) : dbfilename(name + ".fsm.db"), granule(DbBlock::BLOCK_SZ / 256),
+                                          closed(true), db(_DB_ENV, 0), entries(), dirty(), maxima() {
+}
+
+BlockID FreeSpaceMap::open(void) {
+    if (this->closed) {
+        this->db.set_re_len(DbBlock::BLOCK_SZ);
+        this->db.open(Transaction::current(), this->dbfilename.c_str(), nullptr, DB_RECNO, DB_CREATE | DB_THREAD, 0644);
+        this->closed = false;
+    }
+    this->entries.clear();
+    this->dirty.clear();
+    for (db_recno_t record = 1;; record++) {
+        this->entries.resize(record * DbBlock::BLOCK_SZ);
+        Dbt key(&record, sizeof(record));
+        Dbt data(&this->entries[(record - 1) * DbBlock::BLOCK_SZ], DbBlock::BLOCK_SZ);
+        data.set_ulen(DbBlock::BLOCK_SZ);
+        data.set_flags(DB_DBT_USERMEM);
+        if (this->db.get(Transaction::current(), &key, &data, 0) != 0) {
+            this->entries.resize((record - 1) * DbBlock::BLOCK_SZ);
+            break;
+        }
+        this->dirty.push_back(false);
+    }
+
+    // the padding of the last record isn't for any block written back (see flush)
+    size_t mapped = this->entries.size();
+    size_t last_record = this->dirty.empty() ? 0 : (this->dirty.size() - 1) * DbBlock::BLOCK_SZ;
+    while (mapped > last_record && this->entries[mapped - 1] == PADDING)
+        mapped--;
+    this->entries.resize(mapped);
+    this->maxima.resize((this->entries.size() + GROUP_SZ - 1) / GROUP_SZ);
+    for (size_t group = 0; group < this->maxima.size(); group++)
+        summarize(group);
+    return (BlockID) this->entries.size();
+}
+
+void FreeSpaceMap::close(void) {
+    if (this->closed)
+        return;
+    flush();
+    this->db.close(0);
+    this->closed = true;
+}
+
+void FreeSpaceMap::drop(void) {
+    this->entries.clear();
+    this->dirty.clear();
+    this->maxima.clear();
+    if (!this->closed) {
+        this->db.close(0);
+        this->closed = true;
+    }
+    try {
+        _DB_ENV->dbremove(Transaction::current(), this->dbfilename.c_str(), nullptr, 0);
+    } catch (DbException &e) {
+        // never got created
+    }
+}
+
+void FreeSpaceMap::flush(void) {
+    if (this->closed)
+        return;
+    vector<char> buffer;
+    for (db_recno_t i = 0; i < this->dirty.size(); i++) {
+        if (!this->dirty[i])
+            continue;
+        size_t start = i * DbBlock::BLOCK_SZ;
+        size_t n = min((size_t) DbBlock::BLOCK_SZ, this->entries.size() - start);
+        buffer.assign(DbBlock::BLOCK_SZ, PADDING);
+        memcpy(buffer.data(), &this->entries[start], n);
+        db_recno_t record = i + 1;
+        Dbt key(&record, sizeof(record));
+        Dbt data(buffer.data(), DbBlock::BLOCK_SZ);
+        this->db.put(Transaction::current(), &key, &data, 0);
+        this->dirty[i] = false;
+    }
+}
+
+void FreeSpaceMap::discard(void) {
+    this->dirty.assign(this->dirty.size(), false);
+}
+
+void FreeSpaceMap::set(BlockID block_id, u_int16_t unused_bytes) {
+    if (block_id > this->entries.size()) {
+        this->entries.resize(block_id, 0);
+        this->dirty.resize((block_id + DbBlock::BLOCK_SZ - 1) / DbBlock::BLOCK_SZ, true);
+        this->maxima.resize((block_id + GROUP_SZ - 1) / GROUP_SZ, 0);
+    }
+    uint8_t entry = (uint8_t) min(unused_bytes / this->granule, 255U);
+    uint8_t was = this->entries[block_id - 1];
+    if (was != entry) {
+        this->entries[block_id - 1] = entry;
+        this->dirty[(block_id - 1) / DbBlock::BLOCK_SZ] = true;
+        size_t group = (block_id - 1) / GROUP_SZ;
+        if (entry > this->maxima[group])
+            this->maxima[group] = entry;
+        else if (was == this->maxima[group])
+            summarize(group);  // it may have been the only one with that much room
+    }
+}
+
+BlockID FreeSpaceMap::find(u_int16_t size) const {
+    uint needed = (size + 4U + this->granule - 1) / this->granule;  // 4 for the record's slot header
+    if (needed > 255)
+        return 0;
+    for (size_t group = 0; group < this->maxima.size(); group++) {
+        if (this->maxima[group] < needed)
+            continue;
+        size_t end = min(this->entries.size(), (group + 1) * GROUP_SZ);
+        for (size_t i = group * GROUP_SZ; i < end; i++)
+            if (this->entries[i] >= needed)
+                return (BlockID) (i + 1);
+    }
+    return 0;
+}
+
+void FreeSpaceMap::truncate(BlockID last) {
+    if (last >= this->entries.size())
+        return;
+    this->entries.resize(last);
+    this->dirty.resize((last + DbBlock::BLOCK_SZ - 1) / DbBlock::BLOCK_SZ);
+    if (!this->dirty.empty())
+        this->dirty.back() = true;
+    this->maxima.resize((last + GROUP_SZ - 1) / GROUP_SZ);
+    if (!this->maxima.empty())
+        summarize(this->maxima.size() - 1);
+}
+
+// Work out the largest entry of a group of blocks over again
+void FreeSpaceMap::summarize(size_t group) {
+    size_t end = min(this->entries.size(), (group + 1) * GROUP_SZ);
+    uint8_t largest = 0;
+    for (size_t i = group * GROUP_SZ; i < end; i++)
+        largest = max(largest, this->entries[i]);
+    this->maxima[group] = largest;
+}
+
+/**
+ * Move on to the next block of the file.
+ * @return the next block (pinned until the following call or destruction), or nullptr at the end
+ */
+SlottedPage *BlockCursor::next() {
+    this->file.unpin(this->block);
+    this->block = nullptr;
+    BlockID end = this->file.get_last_block_id();
+    if (this->last != 0 && this->last < end)
+        end = this->last;
+    if (this->block_id >= end)
+        return nullptr;
+    this->block = this->file.get(++this->block_id);
+    return this->block;
+}
+
+SlottedPage *BlockCursor::next(const std::vector<const Value *> &where_by_column, u_long &skipped) {
+    this->file.unpin(this->block);
+    this->block = nullptr;
+    BlockID end = this->file.get_last_block_id();
+    if (this->last != 0 && this->last < end)
+        end = this->last;
+    while (this->block_id < end) {
+        if (this->file.zone_may_match(++this->block_id, where_by_column)) {
+            this->block = this->file.get(this->block_id);
+            return this->block;
+        }
+        skipped++;
+    }
+    return nullptr;
+}
+
+/**
+ * Testing function for the HeapFile buffer pool.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_heap_file() {
+    HeapFile file("_test_heap_file_cpp", 4);
+    file.create();
+
+    // fill more blocks than there are frames, one record each
+    char rec[] = "block number xx";
+    for (int i = 2; i <= 10; i++) {
+        SlottedPage *page = file.get_new();
+        rec[13] = (char) ('0' + i / 10);
+        rec[14] = (char) ('0' + i % 10);
+        Dbt rec_dbt(rec, sizeof(rec));
+        page->add(&rec_dbt);
+        file.put(page);
+        file.unpin(page);
+    }
+    if (file.get_pool_stats().evictions == 0)
+        return assertion_failure("no evictions with 10 blocks in 4 frames");
+
+    // evicted blocks were written back
+    for (BlockID block_id = 2; block_id <= 10; block_id++) {
+        SlottedPage *page = file.get(block_id);
+        Dbt *got = page->get(1);
+        rec[13] = (char) ('0' + block_id / 10);
+        rec[14] = (char) ('0' + block_id % 10);
+        bool same = got != nullptr && got->get_size() == sizeof(rec) && memcmp(got->get_data(), rec, sizeof(rec)) == 0;
+        delete got;
+        file.unpin(page);
+        if (!same)
+            return assertion_failure("block not written back", block_id);
+    }
+
+    // a resident block is a hit and is the same page for every pinner
+    u_long hits = file.get_pool_stats().hits;
+    SlottedPage *first = file.get(10);
+    SlottedPage *second = file.get(10);
+    if (first != second || file.get_pool_stats().hits != hits + 2)
+        return assertion_failure("resident block was not a hit");
+    file.unpin(first);
+    file.unpin(second);
+
+    // can't evict pinned frames
+    SlottedPage *pinned[4];
+    for (BlockID block_id = 1; block_id <= 4; block_id++)
+        pinned[block_id - 1] = file.get(block_id);
+    try {
+        file.get(5);
+        return assertion_failure("failed to throw when all frames pinned");
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    for (auto page: pinned)
+        file.unpin(page);
+
+    // dirty frames survive a close and reopen
+    SlottedPage *page = file.get(3);
+    char rec2[] = "changed";
+    Dbt rec2_dbt(rec2, sizeof(rec2));
+    page->put(1, rec2_dbt);
+    file.put(page);
+    file.unpin(page);
+    file.close();
+    HeapFile reopened("_test_heap_file_cpp", 4);  // Berkeley DB won't let us reopen a closed handle
+    reopened.open();
+    page = reopened.get(3);
+    Dbt *got = page->get(1);
+    bool same = got->get_size() == sizeof(rec2) && memcmp(got->get_data(), rec2, sizeof(rec2)) == 0;
+    delete got;
+    reopened.unpin(page);
+    if (!same)
+        return assertion_failure("dirty block lost on close");
+    reopened.drop();
+
+    // bigger blocks hold a record no 4 KB block could, and the file remembers its block size
+    try {
+        file.set_block_size(DbBlock::BLOCK_SZ * 3);
+        return assertion_failure("failed to throw on a block size that isn't a power of two");
+    } catch (DbRelationError &e) {
+        // expected
+    }
+    HeapFile big("_test_heap_file_cpp_big", 64);
+    big.set_block_size(4 * DbBlock::BLOCK_SZ);
+    big.create();
+    if (big.get_block_size() != 4 * DbBlock::BLOCK_SZ || big.get_pool_size() != 16)
+        return assertion_failure("big blocks not sized", big.get_block_size(), big.get_pool_size());
+    std::string text(3 * DbBlock::BLOCK_SZ, 'x');
+    Dbt text_dbt(&text[0], (u_int32_t) text.size());
+    page = big.get_new();
+    page->add(&text_dbt);
+    big.put(page);
+    big.unpin(page);
+    big.close();
+    HeapFile big_reopened("_test_heap_file_cpp_big", 64);
+    big_reopened.open();
+    if (big_reopened.get_block_size() != 4 * DbBlock::BLOCK_SZ || big_reopened.get_last_block_id() != 2)
+        return assertion_failure("big blocks not reopened", big_reopened.get_block_size(),
+                                 big_reopened.get_last_block_id());
+    page = big_reopened.get(2);
+    got = page->get(1);
+    same = got != nullptr && got->get_size() == text.size() && memcmp(got->get_data(), text.data(), text.size()) == 0;
+    delete got;
+    big_reopened.unpin(page);
+    if (!same)
+        return assertion_failure("big record lost on close");
+    big_reopened.drop();
+    return true;
 }
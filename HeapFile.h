@@ -7,8 +7,112 @@
  */
 #pragma once
 
+#include <mutex>
+#include <set>
+#include <unordered_map>
 #include "db_cxx.h"
+#include "ExecStats.h"
 #include "SlottedPage.h"
+#include "ZoneMap.h"
+
+
+/**
+ * @class BufferPoolStats - counters kept by each HeapFile's buffer pool (useful for sizing the pool)
+ */
+class BufferPoolStats {
+public:
+    BufferPoolStats() : hits(0), misses(0), evictions(0), write_backs(0) {}
+
+    u_long hits;         // get() found the block already resident
+    u_long misses;       // get() had to read the block from Berkeley DB
+    u_long evictions;    // resident blocks thrown out to make room for another
+    u_long write_backs;  // dirty blocks written to Berkeley DB
+};
+
+
+/**
+ * @class FreeSpaceMap - coarse record of how much room each block of a HeapFile has left
+ *
+ * One byte per block: the block's unused_bytes() divided by the granule (1/256th of the heap file's block size),
+ * rounded down so that the map never promises more room than there is. Kept in its own Berkeley DB RecNo file
+ * next to the heap file (<name>.fsm.db), BLOCK_SZ entries to a record whatever the heap file's block size. It is
+ * only a hint: callers still have to be ready for DbBlockNoRoomError.
+ *
+ * The rest of the last record, past the blocks the map knows about, is written as PADDING entries, and open()
+ * takes a run of them at the end as blocks that were added after the map was last written back (so they have to be
+ * looked at again, e.g., after a crash). A block whose entry really is PADDING is just looked at again for nothing.
+ *
+ * In memory it also keeps the largest entry of each group of GROUP_SZ blocks, so that find() passes over a run of
+ * full blocks a group at a time rather than a block at a time.
+ */
+class FreeSpaceMap {
+public:
+    FreeSpaceMap(std::string name);
+
+    virtual ~FreeSpaceMap() {}
+
+    FreeSpaceMap(const FreeSpaceMap &other) = delete;
+
+    FreeSpaceMap &operator=(const FreeSpaceMap &other) = delete;
+
+    /**
+     * Open the map's file (creating it if need be) and read in the map.
+     * @return  number of blocks the map has entries for (which may be more than the heap file has); the heap file's
+     *          blocks after those have to be set()
+     */
+    virtual BlockID open(void);
+
+    virtual void close(void);
+
+    virtual void drop(void);
+
+    /**
+     * Write any changed entries back to Berkeley DB.
+     */
+    virtual void flush(void);
+
+    /**
+     * Forget which entries have changed, so that they are never written back (open() reads them in again).
+     */
+    virtual void discard(void);
+
+    /**
+     * Note how much room a block has now.
+     * @param block_id      block that changed
+     * @param unused_bytes  the block's unused_bytes()
+     */
+    virtual void set(BlockID block_id, u_int16_t unused_bytes);
+
+    /**
+     * Find the first block with room for another record.
+     * @param size  size of the record (not including its slot header)
+     * @return      block id, or 0 if no block has room
+     */
+    virtual BlockID find(u_int16_t size) const;
+
+    /**
+     * Forget the entries for blocks after last.
+     * @param last  new final block id
+     */
+    virtual void truncate(BlockID last);
+
+    // Size the granule for the heap file's blocks (before any set or find)
+    void set_block_size(uint block_size) { this->granule = block_size / 256; }
+
+protected:
+    static const uint GROUP_SZ = 256;  // blocks per entry of maxima
+    static const uint8_t PADDING = 255;  // fills out the last record (as an entry: the block is all room)
+
+    std::string dbfilename;
+    uint granule;                  // bytes of room per unit of an entry
+    bool closed;
+    Db db;
+    std::vector<uint8_t> entries;  // entries[block_id - 1]
+    std::vector<bool> dirty;       // by Berkeley DB record (zero-based)
+    std::vector<uint8_t> maxima;   // maxima[g] is the largest of entries[g * GROUP_SZ] on (not written back)
+
+    virtual void summarize(size_t group);
+};
 
 
 /**
@@ -16,14 +120,44 @@
  *
  * Heap file organization. Built on top of Berkeley DB RecNo file. There is one of our
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
-        for buffer management and file management.
+        for file management.
         Uses SlottedPage for storing records within blocks.
+
+        Blocks are cached in a small buffer pool of pinned frames. get() and get_new() pin a frame and return
+        its SlottedPage (the same object for every pinner of a block); callers must unpin() it when done
+        rather than delete it. put() only marks the frame dirty; dirty frames are written back to Berkeley DB
+        when they are evicted (clock replacement), on flush(), or on close().
+
+        A FreeSpaceMap tracks which blocks have room for more records (updated by get_new() and put()). A file
+        whose records are table rows can also keep a ZoneMap of what values each block could have, which its
+        table widens as it adds rows and which scans consult to pass over blocks (see BlockCursor::next).
+
+        Blocks are DbBlock::BLOCK_SZ bytes unless set_block_size() picks a larger size before create(); an existing
+        file's block size is its Berkeley DB record length, so it is whatever the file was created with. The pool
+        is sized in bytes: with bigger blocks it has proportionally fewer frames.
+
+        The buffer pool is latched, so several threads can pin and unpin blocks of the same file at once (e.g.,
+        the workers of a parallel scan). What they do with a page once they have it pinned is up to them.
  */
 class HeapFile : public DbFile {
 public:
-    HeapFile(std::string name);
+    /**
+     * number of frames in a buffer pool unless otherwise requested
+     */
+    static const uint DEFAULT_POOL_SIZE = 32;
+
+    /**
+     * fewest frames a buffer pool is cut down to for big blocks (enough for a parallel scan's workers and a few more)
+     */
+    static const uint MIN_POOL_SIZE = 16;
 
-    virtual ~HeapFile() {}
+    /**
+     * @param name       name of the file (without the .db)
+     * @param pool_size  room in the buffer pool, in DbBlock::BLOCK_SZ frames
+     */
+    HeapFile(std::string name, uint pool_size = DEFAULT_POOL_SIZE);
+
+    virtual ~HeapFile();
 
     HeapFile(const HeapFile &other) = delete;
 
@@ -47,22 +181,238 @@ public:
 
     virtual void put(DbBlock *block);
 
+    virtual void unpin(DbBlock *block);
+
     virtual BlockIDs *block_ids() const;
 
+    /**
+     * Find a block that (according to the free-space map) has room for another record.
+     * @param size  size of the record
+     * @return      block id, or 0 if none has room (so use get_new())
+     */
+    virtual BlockID find_free_space(u_int16_t size) const {
+        std::lock_guard<std::recursive_mutex> guard(latch);
+        return free_space.find(size);
+    }
+
+    /**
+     * Correct the free-space map for a block (e.g., if it turned out not to have the room the map said).
+     * @param block  a pinned page of this file
+     */
+    virtual void note_free_space(const SlottedPage *block);
+
+    /**
+     * Keep a zone map of the file's blocks (built from the blocks the first time the file is opened).
+     * @param column_types  data type of each column of the rows in the file, in order
+     */
+    virtual void keep_zone_map(const std::vector<ColumnAttribute::DataType> &column_types);
+
+    /**
+     * Widen a block's zone map entry (if there is a zone map) to take in a row just added to it.
+     * @param block_id  the block
+     * @param data      the row's record
+     */
+    virtual void widen_zone(BlockID block_id, const Dbt *data);
+
+    /**
+     * Work out a block's zone map entry (if there is a zone map) afresh from its rows.
+     * @param block  a pinned page of this file
+     */
+    virtual void summarize_zone(SlottedPage *block);
+
+    /**
+     * Could a block have rows that meet the given predicates, according to the zone map?
+     * @param block_id         the block
+     * @param where_by_column  for each column number, the value it must equal (or nullptr if unconstrained)
+     * @return                 false only if the zone map rules the block out (true if there is no zone map)
+     */
+    virtual bool zone_may_match(BlockID block_id, const std::vector<const Value *> &where_by_column) const;
+
+    /**
+     * Give back all the blocks after new_last (their contents are discarded).
+     * @param new_last  block id of what will be the final block
+     * @throws DbRelationError if any of the blocks being given back are pinned
+     */
+    virtual void truncate(BlockID new_last);
+
+    /**
+     * Write all the dirty frames in the buffer pool back to Berkeley DB.
+     */
+    virtual void flush(void);
+
+    /**
+     * Flush every open HeapFile (e.g., at the end of a statement).
+     */
+    static void flush_all(void);
+
+    /**
+     * Forget the changes to the file not yet written back, so that they never are (e.g., once the transaction they
+     * were made in has aborted). The blocks stay in the buffer pool, as they are, until reload().
+     */
+    virtual void discard(void);
+
+    /**
+     * Throw out the buffer pool and read the file's maps in again, so that the file is as it is in Berkeley DB. Any
+     * pages still pinned are invalidated.
+     */
+    virtual void reload(void);
+
+    /**
+     * Discard the changes to every open HeapFile.
+     */
+    static void discard_all(void);
+
+    /**
+     * Reload every open HeapFile (e.g., after discard_all, once the files an aborted transaction may have created or
+     * dropped are closed).
+     */
+    static void reload_all(void);
+
     /**
      * Get the id of the current final block in the heap file.
      * @return block id of last block
      */
     virtual uint32_t get_last_block_id() { return last; }
 
+    /**
+     * Accessor for the buffer pool counters.
+     * @return hit/miss/eviction/write-back counts since this file was constructed
+     */
+    const BufferPoolStats &get_pool_stats() const { return pool_stats; }
+
+    /**
+     * The buffer pool counters of all the files open right now, added up (e.g., to count the block reads of a
+     * benchmark without getting at each file involved).
+     * @return hit/miss/eviction/write-back counts summed over the open files
+     */
+    static BufferPoolStats get_total_pool_stats(void);
+
+    /**
+     * Have the file's block reads and writes counted (see ExecStats) towards the given counters.
+     * @param counters  the counters of the table the file belongs to (nullptr to not count)
+     */
+    void set_counters(ExecCounters *counters) { this->counters = counters; }
+
+    ExecCounters *get_counters() const { return counters; }
+
+    /**
+     * Choose the block size for create() (an existing file keeps its own when it is opened).
+     * @param block_size  a power of two from DbBlock::BLOCK_SZ to DbBlock::MAX_BLOCK_SZ
+     * @throws DbRelationError if it isn't one
+     */
+    virtual void set_block_size(uint block_size);
+
+    /**
+     * Accessor for the block size (as created, once the file is open).
+     * @return bytes per block
+     */
+    uint get_block_size() const { return block_size; }
+
+    /**
+     * Accessor for the number of frames in the buffer pool.
+     * @return pool size
+     */
+    uint get_pool_size() const { return (uint) frames.size(); }
+
 protected:
+    /**
+     * One slot in the buffer pool. The page is nullptr when the frame is empty.
+     */
+    class Frame {
+    public:
+        Frame() : data(nullptr), page_memory(nullptr), page(nullptr), pin_count(0), dirty(false),
+                  referenced(false) {}
+
+        char *data;         // block_size bytes owned by the pool
+        void *page_memory;  // room for page, also owned by the pool (so a SlottedPage is never allocated per block)
+        SlottedPage *page;  // SlottedPage wrapping data (built in page_memory)
+        uint pin_count;
+        bool dirty;
+        bool referenced;    // second-chance bit for clock replacement
+    };
+
     std::string dbfilename;
     uint32_t last;
     bool closed;
     Db db;
+    uint block_size;
+    uint pool_bytes;  // what the pool is sized from
+    std::vector<Frame> frames;
+    std::unordered_map<BlockID, uint> frame_index;  // resident block id -> index into frames
+    uint clock_hand;
+    BufferPoolStats pool_stats;
+    FreeSpaceMap free_space;
+    ZoneMap *zone_map;       // or nullptr
+    ExecCounters *counters;  // or nullptr
+    mutable std::recursive_mutex latch;  // held by every public method that touches the pool or the map
 
     virtual void db_open(uint flags = 0);
 
+    virtual void read_maps();
+
     virtual uint32_t get_block_count();
+
+    virtual uint claim_frame();
+
+    virtual SlottedPage *install(uint frame_no, BlockID block_id, bool is_new);
+
+    virtual void write_back(Frame &frame);
+
+    virtual void release_frames();
+
+    virtual void drop_page(Frame &frame);
+
+    virtual void free_frames();
+
+private:
+    // all the files currently open (for flush_all)
+    static std::set<HeapFile *> open_files;
+    static std::recursive_mutex open_files_latch;  // always taken before any file's own latch
+};
+
+/**
+ * @class BlockCursor - walks the blocks of a HeapFile in order, keeping only the current one pinned
+ */
+class BlockCursor {
+public:
+    /**
+     * @param file   the heap file
+     * @param first  first block to visit
+     * @param last   last block to visit (0 for through the end of the file)
+     */
+    BlockCursor(HeapFile &file, BlockID first = 1, BlockID last = 0) : file(file), block_id(first - 1), last(last),
+                                                                       block(nullptr) {}
+
+    virtual ~BlockCursor() { file.unpin(block); }
+
+    BlockCursor(const BlockCursor &other) = delete;
+
+    BlockCursor &operator=(const BlockCursor &other) = delete;
+
+    /**
+     * Unpin the current block (if any) and pin the next one.
+     * @return  the next block, or nullptr if there are no more
+     */
+    virtual SlottedPage *next();
+
+    /**
+     * Unpin the current block (if any) and pin the next one that the file's zone map doesn't rule out, passing
+     * over the rest without reading them.
+     * @param where_by_column  for each column number, the value it must equal (or nullptr if unconstrained)
+     * @param skipped          incremented for each block passed over
+     * @return                 the next block, or nullptr if there are no more
+     */
+    virtual SlottedPage *next(const std::vector<const Value *> &where_by_column, u_long &skipped);
+
+    SlottedPage *get_block() const { return block; }
+
+    BlockID get_block_id() const { return block_id; }
+
+protected:
+    HeapFile &file;
+    BlockID block_id;
+    BlockID last;
+    SlottedPage *block;
 };
 
+bool test_heap_file();
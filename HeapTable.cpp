@@ -3,6 +3,7 @@
  * @author K Lundeen
  * @see Seattle University, CPSC5300
  */
+#include <algorithm>
 #include <cstring>
 #include "HeapTable.h"
 
@@ -17,6 +18,11 @@ typedef uint16_t u16;
  */
 HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes) : DbRelation(
         table_name, column_names, column_attributes), file(table_name) {
+    file.set_counters(ExecStats::for_table(table_name));
+    std::vector<ColumnAttribute::DataType> column_types;
+    for (auto const &column_attribute: this->column_attributes)
+        column_types.push_back(column_attribute.get_data_type());
+    file.keep_zone_map(column_types);
 }
 
 /**
@@ -73,6 +79,51 @@ Handle HeapTable::insert(const ValueDict *row) {
     return handle;
 }
 
+/**
+ * Execute: INSERT INTO <table_name> (<column_names>) VALUES (<row>), (<row>), ...
+ * All the rows are marshaled (and so checked) up front into one buffer, then packed into blocks, filling each
+ * block as far as it will go before moving on to the next.
+ * @param column_names  which column each position of the rows is for
+ * @param rows          values for the new rows
+ * @return              handle of each inserted row, in order (freed by caller)
+ */
+Handles *HeapTable::insert_batch(const ColumnNames *column_names, const Rows *rows) {
+    open();
+    std::vector<uint> positions = bind_row(column_names);
+    std::vector<char> bytes;
+    std::vector<size_t> ends;
+    ends.reserve(rows->size());
+    for (auto const &row: *rows) {
+        marshal(row, positions, bytes);
+        ends.push_back(bytes.size());
+    }
+
+    Handles *handles = new Handles();
+    handles->reserve(rows->size());
+    SlottedPage *block = nullptr;
+    try {
+        size_t start = 0;
+        for (auto end: ends) {
+            Dbt data(&bytes[start], (u_int32_t) (end - start));
+            RecordID record_id = add_record(&data, block);
+            handles->push_back(Handle(block->get_block_id(), record_id));
+            start = end;
+        }
+    } catch (...) {
+        if (block != nullptr) {
+            this->file.put(block);  // the rows that made it in are still there
+            this->file.unpin(block);
+        }
+        delete handles;
+        throw;
+    }
+    if (block != nullptr) {
+        this->file.put(block);
+        this->file.unpin(block);
+    }
+    return handles;
+}
+
 /**
  * Conceptually, execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
  * where handle is sufficient to identify one specific record (e.g., returned from an insert
@@ -96,8 +147,10 @@ void HeapTable::del(const Handle handle) {
     RecordID record_id = handle.second;
     SlottedPage *block = this->file.get(block_id);
     block->del(record_id);
+    if (block->size() == 0)
+        this->file.summarize_zone(block);  // otherwise its zone map entry just stays wider than it needs to be
     this->file.put(block);
-    delete block;
+    this->file.unpin(block);
 }
 
 /**
@@ -114,21 +167,10 @@ Handles *HeapTable::select() {
  * @return list of handles of the selected rows
  */
 Handles *HeapTable::select(const ValueDict *where) {
-    open();
     Handles *handles = new Handles();
-    BlockIDs *block_ids = file.block_ids();
-    for (auto const &block_id: *block_ids) {
-        SlottedPage *block = file.get(block_id);
-        RecordIDs *record_ids = block->ids();
-        for (auto const &record_id: *record_ids) {
-            Handle handle(block_id, record_id);
-            if (selected(handle, where))
-                handles->push_back(handle);
-        }
-        delete record_ids;
-        delete block;
-    }
-    delete block_ids;
+    HeapTableCursor cursor(*this, where);
+    while (cursor.next())
+        handles->push_back(cursor.get_handle());
     return handles;
 }
 
@@ -163,25 +205,60 @@ ValueDict *HeapTable::project(Handle handle) {
  * @return a sequence of values for handle given by column_names
  */
 ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
+    std::vector<uint> positions = bind_columns(column_names);
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
     SlottedPage *block = file.get(block_id);
-    Dbt *data = block->get(record_id);
-    ValueDict *row = unmarshal(data);
-    delete data;
-    delete block;
-    if (column_names->empty())
-        return row;
-    ValueDict *result = new ValueDict();
-    for (auto const &column_name: *column_names) {
-        if (row->find(column_name) == row->end())
-            throw DbRelationError("table does not have column named '" + column_name + "'");
-        (*result)[column_name] = (*row)[column_name];
+    Dbt data;
+    block->get(record_id, data);
+    Row row, scratch;
+    unmarshal(&data, positions, row, scratch);
+    if (ExecStats::enabled) {
+        ExecCounters tally;
+        tally.rows_examined = 1;
+        tally.bytes_marshalled = data.get_size();
+        ExecStats::add(file.get_counters(), tally);
     }
-    delete row;
+    ValueDict *result = row.to_dict(positions.empty() ? this->column_names : *column_names);  // while still pinned
+    file.unpin(block);
     return result;
 }
 
+/**
+ * Select and project in one pass over the file: each block is read once, the predicates are checked
+ * against the marshaled bytes, and only qualifying rows are unmarshaled (and only the wanted columns).
+ * @param where         predicates to match (nullptr for all rows)
+ * @param column_names  columns to be included in the result (nullptr or empty for all columns)
+ * @return              list of the projected rows
+ */
+ValueDicts *HeapTable::select_project(const ValueDict *where, const ColumnNames *column_names) {
+    ValueDicts *rows = new ValueDicts();
+    HeapTableCursor cursor(*this, where);
+    while (cursor.next())
+        rows->push_back(cursor.project(column_names));
+    return rows;
+}
+
+/**
+ * Stream the rows that satisfy the where clause.
+ * @param where  predicates to match (nullptr for all rows)
+ * @return       cursor over the selected rows (freed by caller)
+ */
+DbCursor *HeapTable::cursor(const ValueDict *where) {
+    return new HeapTableCursor(*this, where);
+}
+
+/**
+ * Stream the rows in some of the blocks that satisfy the where clause.
+ * @param where  predicates to match (nullptr for all rows)
+ * @param first  first block to scan
+ * @param last   last block to scan
+ * @return       cursor over the selected rows in those blocks (freed by caller)
+ */
+DbCursor *HeapTable::cursor(const ValueDict *where, BlockID first, BlockID last) {
+    return new HeapTableCursor(*this, where, first, last);
+}
+
 /**
  * Check if the given row is acceptable to insert.
  * @param row to be validated
@@ -203,27 +280,157 @@ ValueDict *HeapTable::validate(const ValueDict *row) const {
 }
 
 /**
- * Appends a record to the file.
+ * Appends a record to the file, in the first block the free-space map says has room for it.
  * @param row to be appended
  * @return handle of newly inserted row
  */
 Handle HeapTable::append(const ValueDict *row) {
     Dbt *data = marshal(row);
-    SlottedPage *block = this->file.get(this->file.get_last_block_id());
-    RecordID record_id;
-    try {
-        record_id = block->add(data);
-    } catch (DbBlockNoRoomError &e) {
+    Handle handle = append(data);
+    delete[] (char *) data->get_data();
+    delete data;
+    return handle;
+}
+
+/**
+ * Appends an already marshaled record to the file.
+ * @param data  bits of the record
+ * @return      handle of newly inserted row
+ */
+Handle HeapTable::append(const Dbt *data) {
+    SlottedPage *block = nullptr;
+    RecordID record_id = add_record(data, block);
+    this->file.put(block);
+    BlockID block_id = block->get_block_id();
+    this->file.unpin(block);
+    return Handle(block_id, record_id);
+}
+
+/**
+ * Add a marshaled record to the given block if it fits, otherwise to the first block the free-space map says has
+ * room for it, otherwise to a new block. The block's zone map entry is widened to take it in.
+ * @param data   bits of the record
+ * @param block  pinned block to try first (or nullptr); on return, the pinned block the record went into (any
+ *               block given up on has been put and unpinned)
+ * @return       record id of the record within block
+ * @throws       DbRelationError if the record won't fit even in an empty block
+ */
+RecordID HeapTable::add_record(const Dbt *data, SlottedPage *&block) {
+    u16 size = (u16) data->get_size();
+    while (true) {
+        if (block != nullptr) {
+            try {
+                RecordID record_id = block->add(data);
+                this->file.widen_zone(block->get_block_id(), data);
+                return record_id;
+            } catch (DbBlockNoRoomError &e) {
+                this->file.put(block);  // also corrects the free-space map if it was out of date
+                this->file.unpin(block);
+                block = nullptr;
+            }
+        }
+        BlockID block_id = this->file.find_free_space(size);
+        if (block_id != 0) {
+            block = this->file.get(block_id);
+            continue;
+        }
         // need a new block
-        delete block;
         block = this->file.get_new();
-        record_id = block->add(data);
+        RecordID record_id;
+        try {
+            record_id = block->add(data);
+        } catch (DbBlockNoRoomError &e) {
+            this->file.unpin(block);
+            block = nullptr;
+            throw DbRelationError("row too big for a block");
+        }
+        this->file.widen_zone(block->get_block_id(), data);
+        return record_id;
     }
-    this->file.put(block);
-    delete block;
-    delete[] (char *) data->get_data();
-    delete data;
-    return Handle(this->file.get_last_block_id(), record_id);
+}
+
+// Add up the live record counts in the blocks' headers (no rows are unmarshalled)
+u_long HeapTable::count() {
+    open();
+    BlockCursor blocks(this->file);
+    u_long n = 0;
+    for (SlottedPage *block = blocks.next(); block != nullptr; block = blocks.next())
+        n += block->size();
+    return n;
+}
+
+// How many blocks a scan goes through
+uint32_t HeapTable::get_block_count() {
+    open();
+    return this->file.get_last_block_id();
+}
+
+// The block size the table's file was created with
+uint HeapTable::get_block_size() {
+    open();
+    return this->file.get_block_size();
+}
+
+/**
+ * Execute: VACUUM <table_name>
+ * Compact each block, move the rows out of the blocks at the end of the file and into the free space in earlier
+ * ones (if allowed), and give back the blocks at the end that are left empty. The blocks' zone map entries come out
+ * of it fitting just the rows they have.
+ * @param relocate  whether rows may be moved to other blocks
+ * @return          old and new handle of each row that was moved (freed by caller)
+ */
+Relocations *HeapTable::vacuum(bool relocate) {
+    open();
+    Relocations *moves = new Relocations();
+    BlockID last = this->file.get_last_block_id();
+
+    // empty out the blocks at the end, as long as the earlier blocks have room
+    for (BlockID tail_id = last; relocate && tail_id > 1; tail_id--) {
+        SlottedPage *tail = this->file.get(tail_id);
+        bool emptied = true;
+        for (RecordID record_id = tail->next_id(0); record_id != 0; record_id = tail->next_id(record_id)) {
+            Dbt *data = tail->get(record_id);
+            BlockID block_id = this->file.find_free_space((u16) data->get_size());
+            if (block_id == 0 || block_id >= tail_id) {
+                delete data;
+                emptied = false;
+                break;
+            }
+            SlottedPage *block = this->file.get(block_id);
+            try {
+                RecordID new_id = block->add(data);
+                this->file.widen_zone(block_id, data);
+                this->file.put(block);
+                moves->push_back(std::make_pair(Handle(tail_id, record_id), Handle(block_id, new_id)));
+                tail->del(record_id);
+            } catch (DbBlockNoRoomError &e) {
+                this->file.note_free_space(block);
+                emptied = false;
+            }
+            this->file.unpin(block);
+            delete data;
+            if (!emptied)
+                break;
+        }
+        this->file.put(tail);
+        this->file.unpin(tail);
+        if (!emptied)
+            break;
+    }
+
+    // compact what's left and find the last block with anything in it
+    BlockID new_last = 1;
+    for (BlockID block_id = 1; block_id <= last; block_id++) {
+        SlottedPage *block = this->file.get(block_id);
+        block->compact();
+        this->file.summarize_zone(block);  // tightened up to just the rows that are left
+        this->file.put(block);
+        if (block->size() > 0)
+            new_last = block_id;
+        this->file.unpin(block);
+    }
+    this->file.truncate(new_last);
+    return moves;
 }
 
 /**
@@ -233,43 +440,82 @@ Handle HeapTable::append(const ValueDict *row) {
  * @return bits of the record as it should appear on disk
  */
 Dbt *HeapTable::marshal(const ValueDict *row) const {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const &column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        ValueDict::const_iterator column = row->find(column_name);
-        Value value = column->second;
+    // size it first, so the record is allocated just once (and nothing is left to free if it won't fit)
+    uint size = 0;
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++) {
+        ColumnAttribute::DataType data_type = this->column_attributes[col_num].get_data_type();
+        if (data_type == ColumnAttribute::DataType::INT) {
+            size += sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            u_long length = row->find(this->column_names[col_num])->second.s.length();
+            if (length > UINT16_MAX)
+                throw DbRelationError("text field too long to marshal");
+            size += sizeof(u16) + (uint) length;
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            size += sizeof(uint8_t);
+        } else {
+            throw DbRelationError("Only know how to marshal INT, TEXT, and BOOLEAN");
+        }
+        if (size > this->file.get_block_size())
+            throw DbRelationError("row too big to marshal");
+    }
 
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("row too big to marshal");
-            *(int32_t *) (bytes + offset) = value.n;
+    char *bytes = new char[size];
+    uint offset = 0;
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++) {
+        ColumnAttribute::DataType data_type = this->column_attributes[col_num].get_data_type();
+        const Value &value = row->find(this->column_names[col_num])->second;
+        if (data_type == ColumnAttribute::DataType::INT) {
+            memcpy(bytes + offset, &value.n, sizeof(int32_t));
             offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            u_long size = value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("row too big to marshal");
-            *(u16 *) (bytes + offset) = size;
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            u16 length = (u16) value.s.length();
+            memcpy(bytes + offset, &length, sizeof(u16));
             offset += sizeof(u16);
-            memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("row too big to marshal");
-            *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
-            offset += sizeof(uint8_t);
+            memcpy(bytes + offset, value.s.data(), length); // assume ascii for now
+            offset += length;
+        } else {
+            bytes[offset++] = (char) (uint8_t) value.n;
+        }
+    }
+    ExecStats::count(file.get_counters(), &ExecCounters::bytes_marshalled, size);
+    return new Dbt(bytes, size);
+}
+
+/**
+ * Figure out the bits to go into the file for a row given by position.
+ * @param row        values for the tuple
+ * @param positions  for each of our columns, its position in row (see bind_row)
+ * @param bytes      the bits of the record are added to the end of this
+ */
+void HeapTable::marshal(const Row &row, const std::vector<uint> &positions, std::vector<char> &bytes) const {
+    size_t start = bytes.size();
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++) {
+        uint position = positions[col_num];
+        ColumnAttribute::DataType data_type = this->column_attributes[col_num].get_data_type();
+        bool is_text = row.get_data_type(position) == ColumnAttribute::DataType::TEXT;
+        if (data_type == ColumnAttribute::DataType::INT) {
+            if (is_text)
+                throw DbRelationError("column " + this->column_names[col_num] + " is not TEXT");
+            int32_t n = row.get_n(position);
+            bytes.insert(bytes.end(), (char *) &n, (char *) &n + sizeof(n));
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            if (!is_text)
+                throw DbRelationError("column " + this->column_names[col_num] + " is TEXT");
+            u16 size = row.get_size(position);
+            bytes.insert(bytes.end(), (char *) &size, (char *) &size + sizeof(size));
+            bytes.insert(bytes.end(), row.get_s(position), row.get_s(position) + size);  // assume ascii for now
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            if (is_text)
+                throw DbRelationError("column " + this->column_names[col_num] + " is not TEXT");
+            bytes.push_back((char) (uint8_t) row.get_n(position));
         } else {
             throw DbRelationError("Only know how to marshal INT, TEXT, and BOOLEAN");
         }
     }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+    if (bytes.size() - start > this->file.get_block_size())
+        throw DbRelationError("row too big to marshal");
+    ExecStats::count(file.get_counters(), &ExecCounters::bytes_marshalled, bytes.size() - start);
 }
 
 /**
@@ -278,34 +524,111 @@ Dbt *HeapTable::marshal(const ValueDict *row) const {
  * @return row data for the tuple
  */
 ValueDict *HeapTable::unmarshal(Dbt *data) const {
-    ValueDict *row = new ValueDict();
-    Value value;
-    char *bytes = (char *) data->get_data();
+    Row row;
+    unmarshal(data, row);
+    return row.to_dict(this->column_names);
+}
+
+/**
+ * Lay out the fields of a record by column position. TEXT fields are views of the record's bytes, so the row
+ * is only good for as long as the block it came from stays pinned.
+ * @param data  file data for the tuple
+ * @param row   filled in with all the columns, in table order
+ */
+void HeapTable::unmarshal(const Dbt *data, Row &row) const {
+    row.clear();
+    row.reserve((uint) this->column_attributes.size());
+    const char *bytes = (const char *) data->get_data();
     uint offset = 0;
-    uint col_num = 0;
-    for (auto const &column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        value.data_type = ca.get_data_type();
+    for (auto const &ca: this->column_attributes) {
         if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t *) (bytes + offset);
+            row.append_int(*(int32_t *) (bytes + offset));
             offset += sizeof(int32_t);
         } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
             u16 size = *(u16 *) (bytes + offset);
             offset += sizeof(u16);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = string(buffer);  // assume ascii for now
+            row.append_text_view(bytes + offset, size);  // assume ascii for now
             offset += size;
         } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t *) (bytes + offset);
+            row.append_boolean(*(uint8_t *) (bytes + offset));
             offset += sizeof(uint8_t);
         } else {
             throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
         }
-        (*row)[column_name] = value;
     }
-    return row;
+}
+
+/**
+ * Lay out some of the columns of a record (as views of its bytes, like unmarshal(data, row)).
+ * @param data       file data for the tuple
+ * @param positions  column numbers wanted, in the order wanted (empty for all columns, see bind_columns)
+ * @param row        filled in with the wanted columns
+ * @param scratch    holds the whole row along the way (passed in so its storage can be reused)
+ */
+void HeapTable::unmarshal(const Dbt *data, const std::vector<uint> &positions, Row &row, Row &scratch) const {
+    if (positions.empty()) {
+        unmarshal(data, row);
+        return;
+    }
+    unmarshal(data, scratch);
+    row.clear();
+    row.reserve((uint) positions.size());
+    for (auto position: positions)
+        row.append(scratch, position);
+}
+
+/**
+ * Line up the where-clause values with our columns so they can be checked against marshaled rows.
+ * @param where  predicates to match (may be nullptr)
+ * @return       for each column number, the value it must equal (or nullptr if unconstrained)
+ * @throws       DbRelationError if where refers to a column we don't have
+ */
+std::vector<const Value *> HeapTable::bind_where(const ValueDict *where) const {
+    std::vector<const Value *> where_by_column(this->column_names.size(), nullptr);
+    if (where == nullptr)
+        return where_by_column;
+    for (auto const &predicate: *where) {
+        auto it = std::find(this->column_names.begin(), this->column_names.end(), predicate.first);
+        if (it == this->column_names.end())
+            throw DbRelationError("table does not have column named '" + predicate.first + "'");
+        where_by_column[it - this->column_names.begin()] = &predicate.second;
+    }
+    return where_by_column;
+}
+
+/**
+ * Check the predicates directly against the marshaled bits of a row (without unmarshaling it).
+ * @param data             file data for the tuple
+ * @param where_by_column  predicates lined up with our columns (from bind_where)
+ * @return                 true if every predicate is met, false otherwise
+ */
+bool HeapTable::matches(const Dbt *data, const std::vector<const Value *> &where_by_column) const {
+    const char *bytes = (const char *) data->get_data();
+    uint offset = 0;
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++) {
+        const Value *want = where_by_column[col_num];
+        ColumnAttribute::DataType data_type = this->column_attributes[col_num].get_data_type();
+        if (want != nullptr && want->data_type != data_type)
+            return false;
+        if (data_type == ColumnAttribute::DataType::INT) {
+            if (want != nullptr && want->n != *(int32_t *) (bytes + offset))
+                return false;
+            offset += sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            u16 size = *(u16 *) (bytes + offset);
+            offset += sizeof(u16);
+            if (want != nullptr && (want->s.length() != size || memcmp(want->s.data(), bytes + offset, size) != 0))
+                return false;
+            offset += size;
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            if (want != nullptr && want->n != *(uint8_t *) (bytes + offset))
+                return false;
+            offset += sizeof(uint8_t);
+        } else {
+            throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+        }
+    }
+    return true;
 }
 
 /**
@@ -317,12 +640,98 @@ ValueDict *HeapTable::unmarshal(Dbt *data) const {
 bool HeapTable::selected(Handle handle, const ValueDict *where) {
     if (where == nullptr)
         return true;
-    ValueDict *row = this->project(handle, where);
-    bool is_selected = *row == *where;
-    delete row;
+    SlottedPage *block = file.get(handle.first);
+    Dbt data;
+    bool is_selected = block->get(handle.second, data) && matches(&data, bind_where(where));
+    file.unpin(block);
     return is_selected;
 }
 
+/**
+ * Constructor -- opens the table and binds the where clause (which is copied).
+ * @param table  table to scan
+ * @param where  predicates to match (nullptr for all rows)
+ * @param first  first block to scan
+ * @param last   last block to scan (0 for through the end of the table)
+ */
+HeapTableCursor::HeapTableCursor(HeapTable &table, const ValueDict *where, BlockID first, BlockID last)
+        : table(table), blocks(table.file, first, last), record_id(0), has_where(where != nullptr), where(),
+          where_by_column(), bound_columns(nullptr), positions(), scratch(), tally() {
+    table.open();
+    if (has_where)
+        this->where = *where;
+    this->where_by_column = table.bind_where(has_where ? &this->where : nullptr);
+}
+
+// Add what the scan did into the table's counters
+HeapTableCursor::~HeapTableCursor() {
+    ExecStats::add(this->table.file.get_counters(), this->tally);
+}
+
+/**
+ * Advance to the next live record that satisfies the where clause, moving on to the next block
+ * when this one is used up (passing over any blocks the zone map rules out).
+ * @return false if there are no more qualifying rows
+ */
+bool HeapTableCursor::next() {
+    SlottedPage *block = this->blocks.get_block();
+    while (true) {
+        if (block != nullptr)
+            this->record_id = block->next_id(this->record_id);
+        if (block == nullptr || this->record_id == 0) {
+            block = this->has_where ? this->blocks.next(this->where_by_column, this->tally.blocks_skipped)
+                                    : this->blocks.next();
+            this->record_id = 0;
+            if (block == nullptr)
+                return false;
+            continue;
+        }
+        this->tally.rows_examined++;
+        if (!this->has_where)
+            return true;
+        Dbt data;
+        block->get(this->record_id, data);
+        if (this->table.matches(&data, this->where_by_column))
+            return true;
+    }
+}
+
+/**
+ * Handle of the current row.
+ * @return handle
+ */
+Handle HeapTableCursor::get_handle() const {
+    return Handle(this->blocks.get_block_id(), this->record_id);
+}
+
+/**
+ * Unmarshal the current row straight out of the pinned block.
+ * @param column_names  columns to be included in the result (nullptr or empty for all)
+ * @return              the projected row (freed by caller)
+ */
+ValueDict *HeapTableCursor::project(const ColumnNames *column_names) {
+    Row row;
+    project_row(column_names, row);
+    return row.to_dict(this->positions.empty() ? this->table.column_names : *column_names);
+}
+
+/**
+ * Lay out the current row by position straight out of the pinned block (TEXT fields are views of the block,
+ * good until the next call to next()).
+ * @param column_names  columns to be included in the result, in order (nullptr or empty for all)
+ * @param row           filled in with the projected values
+ */
+void HeapTableCursor::project_row(const ColumnNames *column_names, Row &row) {
+    if (column_names != this->bound_columns) {
+        this->positions = this->table.bind_columns(column_names);
+        this->bound_columns = column_names;
+    }
+    Dbt data;
+    this->blocks.get_block()->get(this->record_id, data);
+    this->table.unmarshal(&data, this->positions, row, this->scratch);
+    this->tally.bytes_marshalled += data.get_size();
+}
+
 /**
  * Test helper. Sets the row's a and b values.
  * @param row to set
@@ -372,6 +781,10 @@ bool test_heap_storage() {
         return assertion_failure("slotted page tests failed");
     cout << endl << "slotted page tests ok" << endl;
 
+    if (!test_heap_file())
+        return assertion_failure("heap file tests failed");
+    cout << "heap file tests ok" << endl;
+
     ColumnNames column_names;
     column_names.push_back("a");
     column_names.push_back("b");
@@ -431,7 +844,148 @@ bool test_heap_storage() {
             return false;
     }
     cout << "del ok" << endl;
-    table.drop();
     delete handles;
+
+    DbCursor *cursor = table.cursor(nullptr);
+    i = -1;
+    while (cursor->next())
+        if (!test_compare(table, cursor->get_handle(), i++, b))
+            return false;
+    delete cursor;
+    if (i != 999)
+        return false;
+    cout << "cursor ok" << endl;
+
+    ValueDict where;
+    where["a"] = Value(12);
+    ColumnNames b_only;
+    b_only.push_back("b");
+    ValueDicts *rows = table.select_project(&where, &b_only);
+    bool projected = rows->size() == 1 && rows->at(0)->size() == 1 && rows->at(0)->at("b").s == b;
+    for (auto row: *rows)
+        delete row;
+    delete rows;
+    if (!projected)
+        return false;
+    cout << "select_project ok" << endl;
+
+    // the zone map lets a scan go straight to the one block that can have a=12, and pass over all of them for a
+    // text that isn't there
+    const BufferPoolStats &pool = table.file.get_pool_stats();
+    u_long pinned = pool.hits + pool.misses;
+    uint found = 0;
+    cursor = table.cursor(&where);
+    while (cursor->next())
+        found++;
+    delete cursor;
+    if (found != 1 || pool.hits + pool.misses - pinned != 1)
+        return assertion_failure("zone map for INT", found, (double) (pool.hits + pool.misses - pinned));
+    ValueDict missing;
+    missing["b"] = Value("no such text");
+    pinned = pool.hits + pool.misses;
+    handles = table.select(&missing);
+    found = (uint) handles->size();
+    delete handles;
+    if (found != 0 || pool.hits + pool.misses - pinned > 1)
+        return assertion_failure("zone map for TEXT", found, (double) (pool.hits + pool.misses - pinned));
+    std::vector<ColumnAttribute::DataType> zone_types(1, ColumnAttribute::INT);
+    ZoneMap zones("_test_zone", zone_types);  // blocks 6 on were added after it was written back
+    zones.open();
+    char zone_block[DbBlock::BLOCK_SZ];
+    for (BlockID block_id = 1; block_id <= 5; block_id++) {
+        Dbt block_dbt(zone_block, sizeof(zone_block));
+        SlottedPage page(block_dbt, block_id, true);
+        Dbt row(&block_id, sizeof(block_id));
+        page.add(&row);
+        zones.summarize(&page);
+    }
+    zones.flush();
+    zones.close();
+    BlockID zoned = zones.open();
+    zones.drop();
+    if (zoned != 5)
+        return assertion_failure("zone map reopened", zoned);
+    cout << "zone map ok" << endl;
+
+    // rows by position, in projection order, outliving the cursor once copied
+    ColumnNames c_b_a;
+    c_b_a.push_back("c");
+    c_b_a.push_back("b");
+    c_b_a.push_back("a");
+    Rows kept;
+    cursor = table.cursor(&where);
+    Row positional;
+    while (cursor->next()) {
+        cursor->project_row(&c_b_a, positional);
+        kept.push_back(positional);
+    }
+    delete cursor;
+    if (kept.size() != 1 || kept[0].size() != 3 || kept[0].get_data_type(0) != ColumnAttribute::BOOLEAN || kept[0].get_n(0) != 1 || kept[0].get_string(1) != b
+        || kept[0].get_n(2) != 12)
+        return false;
+    cout << "rows ok" << endl;
+
+    // space from deleted rows gets reused, and vacuum gives back the blocks left empty
+    BlockID last = table.file.get_last_block_id();
+    handles = table.select();
+    for (size_t k = handles->size() / 2; k < handles->size(); k++)
+        table.del((*handles)[k]);
+    delete handles;
+    for (i = 0; i < 100; i++) {
+        test_set_row(row, i, b);
+        table.insert(&row);
+    }
+    if (table.file.get_last_block_id() != last)
+        return assertion_failure("space from deleted rows not reused", last, table.file.get_last_block_id());
+    delete table.vacuum(true);
+    handles = table.select();
+    size_t remaining = handles->size();
+    delete handles;
+    if (remaining != 600 || table.file.get_last_block_id() >= last)
+        return assertion_failure("vacuum", (double) remaining, table.file.get_last_block_id());
+    where["a"] = Value(50);  // there are two, one of them moved by vacuum
+    handles = table.select(&where);
+    remaining = handles->size();
+    delete handles;
+    if (remaining != 2)
+        return assertion_failure("zone map after vacuum", (double) remaining);
+    FreeSpaceMap map("_test_fsm");  // never opened: just the map in memory
+    for (BlockID block_id = 1; block_id <= 1000; block_id++)
+        map.set(block_id, block_id == 700 ? 2000 : 10);
+    BlockID roomy = map.find(100);
+    map.set(700, 10);
+    map.set(3, 2000);
+    BlockID first = map.find(100);
+    map.truncate(2);
+    if (roomy != 700 || first != 3 || map.find(100) != 0)
+        return assertion_failure("free-space map find", roomy, first);
+    FreeSpaceMap stored("_test_fsm");  // blocks 11 on were added after it was written back
+    stored.open();
+    for (BlockID block_id = 1; block_id <= 10; block_id++)
+        stored.set(block_id, 10);
+    stored.flush();
+    stored.close();
+    BlockID mapped = stored.open();
+    stored.drop();
+    if (mapped != 10)
+        return assertion_failure("free-space map reopened", mapped);
+    cout << "free space/vacuum ok" << endl;
+
+    // a batch of rows, with the columns in a different order than the table's
+    Rows batch(200);
+    for (i = 0; i < 200; i++) {
+        batch[i].append_boolean(i % 2 == 0);
+        batch[i].append_text(b.c_str(), (u_int16_t) b.size());
+        batch[i].append_int(i);
+    }
+    handles = table.insert_batch(&c_b_a, &batch);
+    bool batched = handles->size() == 200;
+    for (i = 0; batched && i < 200; i++)
+        batched = test_compare(table, (*handles)[i], i, b);
+    delete handles;
+    if (!batched)
+        return assertion_failure("insert_batch", i);
+    cout << "insert_batch ok" << endl;
+    table.drop();
     return true;
 }
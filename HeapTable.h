@@ -41,6 +41,8 @@ public:
 
     virtual Handle insert(const ValueDict *row);
 
+    virtual Handles *insert_batch(const ColumnNames *column_names, const Rows *rows);
+
     virtual void update(const Handle handle, const ValueDict *new_values);
 
     virtual void del(const Handle handle);
@@ -57,6 +59,22 @@ public:
 
     using DbRelation::project;
 
+    virtual ValueDicts *select_project(const ValueDict *where, const ColumnNames *column_names);
+
+    virtual DbCursor *cursor(const ValueDict *where);
+
+    virtual DbCursor *cursor(const ValueDict *where, BlockID first, BlockID last);
+
+    virtual u_long count();
+
+    virtual Relocations *vacuum(bool relocate);
+
+    virtual uint32_t get_block_count();
+
+    virtual void set_block_size(uint block_size) { this->file.set_block_size(block_size); }
+
+    virtual uint get_block_size();
+
 protected:
     HeapFile file;
 
@@ -64,11 +82,63 @@ protected:
 
     virtual Handle append(const ValueDict *row);
 
+    virtual Handle append(const Dbt *data);
+
+    virtual RecordID add_record(const Dbt *data, SlottedPage *&block);
+
     virtual Dbt *marshal(const ValueDict *row) const;
 
+    virtual void marshal(const Row &row, const std::vector<uint> &positions, std::vector<char> &bytes) const;
+
     virtual ValueDict *unmarshal(Dbt *data) const;
 
+    virtual void unmarshal(const Dbt *data, Row &row) const;
+
+    virtual void unmarshal(const Dbt *data, const std::vector<uint> &positions, Row &row, Row &scratch) const;
+
+    virtual std::vector<const Value *> bind_where(const ValueDict *where) const;
+
+    virtual bool matches(const Dbt *data, const std::vector<const Value *> &where_by_column) const;
+
     virtual bool selected(Handle handle, const ValueDict *where);
+
+    friend class HeapTableCursor;
+
+    friend bool test_heap_storage();
+};
+
+/**
+ * @class HeapTableCursor - streams the qualifying rows of a HeapTable, one pinned block at a time
+ */
+class HeapTableCursor : public DbCursor {
+public:
+    HeapTableCursor(HeapTable &table, const ValueDict *where, BlockID first = 1, BlockID last = 0);
+
+    virtual ~HeapTableCursor();
+
+    HeapTableCursor(const HeapTableCursor &other) = delete;
+
+    HeapTableCursor &operator=(const HeapTableCursor &other) = delete;
+
+    virtual bool next();
+
+    virtual Handle get_handle() const;
+
+    virtual ValueDict *project(const ColumnNames *column_names);
+
+    virtual void project_row(const ColumnNames *column_names, Row &row);
+
+protected:
+    HeapTable &table;
+    BlockCursor blocks;
+    RecordID record_id;
+    bool has_where;
+    ValueDict where;
+    std::vector<const Value *> where_by_column;  // points into where
+    const ColumnNames *bound_columns;            // the projection that positions was computed for
+    std::vector<uint> positions;
+    Row scratch;                                 // whole current row, when projecting only some of it
+    ExecCounters tally;                          // added into the table's counters at the end
 };
 
 bool test_heap_storage();
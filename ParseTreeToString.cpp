@@ -135,9 +135,20 @@ string ParseTreeToString::expression(const Expr *expr) {
         case kExprLiteralInt:
             ret += to_string(expr->ival);
             break;
-        case kExprFunctionRef:
-            ret += string(expr->name) + "?" + expr->expr->name;
+        case kExprFunctionRef: {
+            ret += string(expr->name) + "(";
+            bool doComma = false;
+            if (expr->exprList != NULL) {
+                for (Expr *argument : *expr->exprList) {
+                    if (doComma)
+                        ret += ", ";
+                    ret += expression(argument);
+                    doComma = true;
+                }
+            }
+            ret += ")";
             break;
+        }
         case kExprOperator:
             ret += operator_expression(expr);
             break;
@@ -229,6 +240,11 @@ string ParseTreeToString::select(const SelectStatement *stmt) {
     ret += " FROM " + table_ref(stmt->fromTable);
     if (stmt->whereClause != NULL)
         ret += " WHERE " + expression(stmt->whereClause);
+    if (stmt->limit != NULL && stmt->limit->limit != kNoLimit) {
+        ret += " LIMIT " + to_string(stmt->limit->limit);
+        if (stmt->limit->offset != kNoOffset)
+            ret += " OFFSET " + to_string(stmt->limit->offset);
+    }
     return ret;
 }
 
@@ -3,7 +3,14 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <fstream>
 #include "SQLExec.h"
+#include "DelimitedReader.h"
+#include "Transaction.h"
 
 using namespace std;
 using namespace hsql;
@@ -11,9 +18,83 @@ using namespace hsql;
 // define static data
 Tables *SQLExec::tables = nullptr;
 Indices *SQLExec::indices = nullptr;
+unordered_map<string, SQLExec::CachedPlan> SQLExec::plan_cache;
+u_long SQLExec::plan_cache_clock = 0;
+std::mutex SQLExec::plan_cache_latch;
+thread_local map<Identifier, string> SQLExec::prepared;
 
-// make query result be printable
-ostream &operator<<(ostream &out, const QueryResult &qres) {
+// plans and iterators of the statement being executed on this thread (see StatementArena)
+static thread_local Arena statement_arena;
+static thread_local uint statement_depth = 0;
+
+/**
+ * Makes the statement arena current while a statement executes, first resetting it unless the statement is inside
+ * another one. So what a statement allocates there (including the iterators of a streamed result) is good until the
+ * next statement starts.
+ */
+class StatementArena {
+public:
+    StatementArena() : scope(begin()) {}
+
+    virtual ~StatementArena() { statement_depth--; }
+
+protected:
+    ArenaScope scope;
+
+    static Arena *begin() {
+        if (statement_depth++ == 0)
+            statement_arena.reset();
+        return &statement_arena;
+    }
+};
+
+/**
+ * Runs a statement that can change the database in a transaction, unless it is inside another statement (which
+ * already has one). Unless commit() gets called, the transaction is aborted when this goes away, and so is everything
+ * cached that may have seen its changes.
+ */
+class StatementTransaction {
+public:
+    StatementTransaction(bool writes) : transaction(nullptr) {
+        if (writes)
+            begin();
+    }
+
+    // Start the transaction, for a statement only found to change the database once it is looked at
+    void begin() {
+        if (this->transaction == nullptr && Transaction::current() == nullptr)
+            this->transaction = new Transaction();
+    }
+
+    virtual ~StatementTransaction() {
+        if (this->transaction != nullptr && this->transaction->is_active()) {
+            try {
+                this->transaction->abort();
+                SQLExec::discard_cached();
+            } catch (...) {
+                // nothing more to be done about it here
+            }
+        }
+        delete this->transaction;
+    }
+
+    StatementTransaction(const StatementTransaction &other) = delete;
+
+    StatementTransaction &operator=(const StatementTransaction &other) = delete;
+
+    // Write back the blocks the statement dirtied (in the transaction), then commit it
+    void commit() {
+        HeapFile::flush_all();
+        if (this->transaction != nullptr)
+            this->transaction->commit();
+    }
+
+protected:
+    Transaction *transaction;
+};
+
+// make query result be printable (pulling the rows of a streamed one as it goes)
+ostream &operator<<(ostream &out, QueryResult &qres) {
     if (qres.column_names != nullptr) {
         for (auto const &column_name: *qres.column_names)
             out << column_name << " ";
@@ -21,73 +102,1135 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
         for (unsigned int i = 0; i < qres.column_names->size(); i++)
             out << "----------+";
         out << endl;
-        for (auto const &row: *qres.rows) {
-            for (auto const &column_name: *qres.column_names) {
-                Value value = row->at(column_name);
-                switch (value.data_type) {
-                    case ColumnAttribute::INT:
-                        out << value.n;
-                        break;
-                    case ColumnAttribute::TEXT:
-                        out << "\"" << value.s << "\"";
-                        break;
-                    case ColumnAttribute::BOOLEAN:
-                        out << (value.n == 0 ? "false" : "true");
-                        break;
-                    default:
-                        out << "???";
+        qres.buffer.clear();
+        uint batched = 0;
+        try {
+            Row row;
+            size_t i = 0;
+            while (qres.rows != nullptr ? i < qres.rows->size() : qres.next(row)) {
+                QueryResult::format(qres.rows != nullptr ? (*qres.rows)[i++] : row, qres.buffer);
+                if (++batched == QueryResult::BATCH_SIZE) {
+                    out << qres.buffer;
+                    qres.buffer.clear();
+                    batched = 0;
+                    if (!out)
+                        break;  // nothing more can be written, so there is no use pulling more rows
                 }
-                out << " ";
             }
-            out << endl;
+        } catch (DbRelationError &e) {
+            qres.message = string("Error: DbRelationError: ") + e.what();  // after whatever rows did come out
         }
+        out << qres.buffer;
+        qres.buffer.clear();
     }
     out << qres.message;
     return out;
 }
 
+QueryResult::QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows,
+                         string message) : column_names(column_names), column_attributes(column_attributes),
+                                           rows(new Rows()), message(message), stream(nullptr), stream_open(false),
+                                           plan(nullptr), table_name(), row_count(0), seconds(0.0), buffer() {
+    this->rows->resize(rows->size());
+    for (uint i = 0; i < rows->size(); i++) {
+        (*this->rows)[i].assign(*(*rows)[i], *column_names);
+        delete (*rows)[i];
+    }
+    delete rows;
+}
+
+QueryResult::QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, EvalIterator *stream,
+                         EvalPlan *plan, const Identifier &table_name, double seconds)
+        : column_names(column_names), column_attributes(column_attributes), rows(nullptr), message(""),
+          stream(stream), stream_open(true), plan(plan), table_name(table_name), row_count(0), seconds(seconds),
+          buffer() {
+}
+
 QueryResult::~QueryResult() {
+    if (stream_open) {
+        try {
+            stream->close();  // not used up
+        } catch (...) {
+        }
+    }
+    delete stream;
+    delete plan;
     if (column_names != nullptr)
         delete column_names;
     if (column_attributes != nullptr)
         delete column_attributes;
-    if (rows != nullptr) {
-        for (auto row: *rows)
-            delete row;
+    if (rows != nullptr)
         delete rows;
+}
+
+bool QueryResult::next(Row &row) {
+    if (!this->stream_open)
+        return false;
+    std::chrono::steady_clock::time_point began;
+    if (ExecStats::enabled)
+        began = std::chrono::steady_clock::now();
+    bool found;
+    try {
+        found = this->stream->next(row);
+    } catch (...) {
+        finish();
+        throw;
+    }
+    if (ExecStats::enabled)
+        this->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    if (!found) {
+        finish();
+        return false;
+    }
+    this->row_count++;
+    return true;
+}
+
+// The rows have run out: close the stream and count the query's rows and time against its table
+void QueryResult::finish() {
+    this->stream_open = false;
+    this->message = "successufly returned " + to_string(this->row_count) + " rows";
+    this->stream->close();
+    if (ExecStats::enabled) {
+        ExecCounters tally;
+        tally.rows_emitted = this->row_count;
+        tally.seconds = this->seconds;
+        ExecStats::add(ExecStats::for_table(this->table_name), tally);
+    }
+}
+
+// Add a row's values to the output, e.g., 1 "one" true
+void QueryResult::format(const Row &row, string &out) {
+    for (uint i = 0; i < row.size(); i++) {
+        switch (row.get_data_type(i)) {
+            case ColumnAttribute::INT:
+                out += to_string(row.get_n(i));
+                break;
+            case ColumnAttribute::TEXT:
+                out += '"';
+                out.append(row.get_s(i), row.get_size(i));
+                out += '"';
+                break;
+            case ColumnAttribute::BOOLEAN:
+                out += row.get_n(i) == 0 ? "false" : "true";
+                break;
+            default:
+                out += "???";
+        }
+        out += ' ';
     }
+    out += '\n';
 }
 
 
-QueryResult *SQLExec::execute(const SQLStatement *statement) {
-    // initialize _tables table, if not yet present
+// Initialize _tables table, if not yet present (opening the schema tables outside of any transaction, so that
+// they stay open whatever becomes of the first one)
+void SQLExec::initialize() {
     if (SQLExec::tables == nullptr) {
         SQLExec::tables = new Tables();
         SQLExec::indices = new Indices();
+        Tables::get_table(Columns::TABLE_NAME);
+        Tables::get_statistics_table();
     }
+}
+
+void SQLExec::discard_cached() {
+    HeapFile::discard_all();  // nothing the transaction did gets written back
+    {
+        lock_guard<mutex> guard(SQLExec::plan_cache_latch);
+        for (auto &entry: SQLExec::plan_cache)
+            delete entry.second.plan;
+        SQLExec::plan_cache.clear();
+    }
+    Indices::discard_cache();
+    Tables::discard_cache();
+    Statistics::discard_cache();
+    HeapFile::reload_all();
+    Catalog::load(*SQLExec::tables, Tables::get_table(Columns::TABLE_NAME), *SQLExec::indices);
+}
+
+QueryResult *SQLExec::execute(const SQLStatement *statement) {
+    StatementArena arena;
+    initialize();
 
     try {
+        StatementTransaction transaction(statement->type() != kStmtSelect && statement->type() != kStmtShow);
+        QueryResult *result;
         switch (statement->type()) {
             case kStmtCreate:
-                return create((const CreateStatement *) statement);
+                result = create((const CreateStatement *) statement);
+                break;
             case kStmtDrop:
-                return drop((const DropStatement *) statement);
+                result = drop((const DropStatement *) statement);
+                break;
             case kStmtShow:
-                return show((const ShowStatement *) statement);
+                result = show((const ShowStatement *) statement);
+                break;
             case kStmtInsert:
-                return insert((const InsertStatement *) statement);
+                result = insert((const InsertStatement *) statement);
+                break;
             case kStmtDelete:
-                return del((const DeleteStatement *) statement);
+                result = del((const DeleteStatement *) statement);
+                break;
             case kStmtSelect:
-                return select((const SelectStatement *) statement);
+                result = select((const SelectStatement *) statement);
+                break;
             default:
-                return new QueryResult("not implemented");
+                result = new QueryResult("not implemented");  // committed anyway, so nothing is thrown away
+                break;
+        }
+        transaction.commit();
+        return result;
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    }
+}
+
+/**
+ * @class StatementScanner - splits up the text of a statement that the SQL parser doesn't handle
+ */
+class StatementScanner {
+public:
+    enum TokenType {
+        END, WORD, NUMBER, STRING, PUNCTUATION
+    };
+
+    StatementScanner(const string &text) : text(text), pos(0), start(0), type(END), token() { advance(); }
+
+    TokenType get_type() const { return type; }
+
+    const string &get_token() const { return token; }
+
+    // Is the current token the given keyword (any case) or punctuation?
+    bool is(const string &s) const {
+        if (type == WORD)
+            return token.size() == s.size() && equal(token.begin(), token.end(), s.begin(),
+                                                     [](char a, char b) { return toupper(a) == toupper(b); });
+        return type == PUNCTUATION && token == s;
+    }
+
+    // Move past the current token if it is the given keyword or punctuation.
+    bool accept(const string &s) {
+        if (!is(s))
+            return false;
+        advance();
+        return true;
+    }
+
+    void expect(const string &s) {
+        if (!accept(s))
+            throw SQLExecError("expected " + s + " but found '" + token + "'");
+    }
+
+    Identifier expect_identifier() {
+        if (type != WORD)
+            throw SQLExecError("expected a name but found '" + token + "'");
+        Identifier identifier = token;
+        advance();
+        return identifier;
+    }
+
+    Value expect_literal() {
+        Value value;
+        if (type == NUMBER)
+            value = Value(stoi(token));
+        else if (type == STRING)
+            value = Value(token);
+        else
+            throw SQLExecError("expected a literal but found '" + token + "'");
+        advance();
+        return value;
+    }
+
+    void expect_end() {
+        if (type != END)
+            throw SQLExecError("unexpected '" + token + "'");
+    }
+
+    // Move past the current token, whatever it is.
+    void skip() {
+        if (type != END)
+            advance();
+    }
+
+    // The rest of the text, starting with the current token
+    string rest() const {
+        return text.substr(start);
+    }
+
+protected:
+    const string &text;
+    size_t pos;
+    size_t start;  // where the current token starts
+    TokenType type;
+    string token;
+
+    void advance() {
+        while (pos < text.size() && isspace(text[pos]))
+            pos++;
+        token.clear();
+        start = pos;
+        if (pos >= text.size() || (text[pos] == ';' && text.find_first_not_of(" \t\r\n", pos + 1) == string::npos)) {
+            type = END;
+            pos = text.size();
+            return;
+        }
+        char c = text[pos];
+        size_t start = pos;
+        if (isalpha(c) || c == '_') {
+            while (pos < text.size() && (isalnum(text[pos]) || text[pos] == '_'))
+                pos++;
+            type = WORD;
+            token = text.substr(start, pos - start);
+        } else if (isdigit(c) || (c == '-' && pos + 1 < text.size() && isdigit(text[pos + 1]))) {
+            pos++;
+            while (pos < text.size() && isdigit(text[pos]))
+                pos++;
+            type = NUMBER;
+            token = text.substr(start, pos - start);
+        } else if (c == '"' || c == '\'') {
+            // doubled quote marks stand for one
+            type = STRING;
+            pos++;
+            while (true) {
+                if (pos >= text.size())
+                    throw SQLExecError("unterminated string");
+                if (text[pos] == c) {
+                    if (pos + 1 < text.size() && text[pos + 1] == c) {
+                        token += c;
+                        pos += 2;
+                        continue;
+                    }
+                    pos++;
+                    break;
+                }
+                token += text[pos++];
+            }
+        } else {
+            type = PUNCTUATION;
+            token = string(1, c);
+            pos++;
+        }
+    }
+};
+
+
+/**
+ * Key for the plan cache: the statement's tokens with each literal replaced by a placeholder (? for a number, '?'
+ * for a string, since the plan for one needn't work for the other).
+ * @param text      text of the statement
+ * @param literals  filled in with the statement's literals, in order
+ * @return          the key, or empty if the text is more than one statement
+ */
+static string plan_cache_key(const string &text, vector<Value> &literals) {
+    StatementScanner scanner(text);
+    string key;
+    while (scanner.get_type() != StatementScanner::END) {
+        if (!key.empty())
+            key += ' ';
+        if (scanner.get_type() == StatementScanner::NUMBER || scanner.get_type() == StatementScanner::STRING) {
+            key += scanner.get_type() == StatementScanner::NUMBER ? "?" : "'?'";
+            try {
+                literals.push_back(scanner.expect_literal());
+            } catch (out_of_range &e) {
+                return "";  // too big for an INT, so let the parser complain about it
+            }
+            continue;
+        }
+        if (scanner.is(";"))
+            return "";
+        key += scanner.get_token();
+        scanner.skip();
+    }
+    return key;
+}
+
+// A literal as it would be written in a statement (quoted with whichever quote mark it doesn't have, if it can be)
+static string literal_text(const Value &value) {
+    if (value.data_type != ColumnAttribute::TEXT)
+        return to_string(value.n);
+    char quote = value.s.find('"') != string::npos && value.s.find('\'') == string::npos ? '\'' : '"';
+    string text(1, quote);
+    for (auto c: value.s) {
+        if (c == quote)
+            text += c;  // doubled, as StatementScanner expects
+        text += c;
+    }
+    return text + quote;
+}
+
+/**
+ * Put the parameters of an EXECUTE into a prepared statement.
+ * @param text        text of the prepared statement, with a ? for each parameter
+ * @param parameters  values for the ?s, in order
+ * @return            text of the statement with the values in place of the ?s
+ * @throws SQLExecError if there are too many or too few parameters
+ */
+static string bind_parameters(const string &text, const vector<Value> &parameters) {
+    StatementScanner scanner(text);
+    string bound;
+    size_t next = 0;
+    while (scanner.get_type() != StatementScanner::END) {
+        if (!bound.empty())
+            bound += ' ';
+        if (scanner.is("?")) {
+            if (next < parameters.size())
+                bound += literal_text(parameters[next]);
+            next++;
+        } else if (scanner.get_type() == StatementScanner::STRING) {
+            bound += literal_text(Value(scanner.get_token()));
+        } else {
+            bound += scanner.get_token();
+        }
+        scanner.skip();
+    }
+    if (next != parameters.size())
+        throw SQLExecError("expected " + to_string(next) + (next == 1 ? " parameter" : " parameters") + " but got " +
+                           to_string(parameters.size()));
+    return bound;
+}
+
+// Check for statements the parser doesn't handle (and statements the plan cache can handle without the parser)
+QueryResult *SQLExec::execute_extended(const string &query) {
+    StatementScanner scanner(query);
+    if (!scanner.is("VACUUM") && !scanner.is("INSERT") && !scanner.is("EXPLAIN") && !scanner.is("CREATE") &&
+        !scanner.is("SELECT") && !scanner.is("DELETE") && !scanner.is("PREPARE") && !scanner.is("EXECUTE") &&
+        !scanner.is("DEALLOCATE") && !scanner.is("SHOW") && !scanner.is("SET") && !scanner.is("ANALYZE") &&
+        !scanner.is("COPY"))
+        return nullptr;
+    StatementArena arena;
+    initialize();
+    try {
+        // begun only once a statement that changes the database is known to be executed here, not by the parser (the
+        // statement an EXECUTE binds gets a transaction of its own if it isn't read-only, see execute_text)
+        StatementTransaction transaction(false);
+        QueryResult *result;
+        if (scanner.accept("VACUUM")) {
+            Identifier table_name = scanner.expect_identifier();
+            scanner.expect_end();
+            transaction.begin();
+            result = vacuum(table_name);
+        } else if (scanner.accept("ANALYZE")) {
+            Identifier table_name = scanner.expect_identifier();
+            scanner.expect_end();
+            transaction.begin();
+            result = analyze(table_name);
+        } else if (scanner.accept("COPY")) {
+            transaction.begin();
+            result = copy(scanner);
+        } else if (scanner.accept("EXPLAIN")) {
+            bool analyze = scanner.accept("ANALYZE");
+            result = explain(scanner.rest(), analyze);
+        } else if (scanner.accept("SHOW")) {
+            if (!scanner.accept("STATS"))
+                return nullptr;  // the parser can take care of it
+            scanner.expect_end();
+            result = show_stats();
+        } else if (scanner.accept("SET")) {
+            result = set(scanner);
+        } else if (scanner.accept("CREATE")) {
+            if (scanner.accept("UNIQUE")) {
+                transaction.begin();
+                result = create_unique_index("CREATE " + scanner.rest());
+            } else {
+                result = create_table_with(scanner, transaction);  // nullptr if the parser can take care of it
+            }
+        } else if (scanner.accept("PREPARE")) {
+            result = prepare(scanner);
+        } else if (scanner.accept("EXECUTE")) {
+            result = execute_prepared(scanner);
+        } else if (scanner.accept("DEALLOCATE")) {
+            result = deallocate(scanner);
+        } else if (scanner.is("SELECT") || scanner.is("DELETE")) {
+            result = execute_cached(query, transaction);  // nullptr if the parser can take care of it
+        } else {
+            result = insert_batch(scanner, transaction);  // nullptr if the parser can take care of it
         }
+        if (result == nullptr)
+            return nullptr;  // nothing was begun or written
+        transaction.commit();
+        return result;
     } catch (DbRelationError &e) {
         throw SQLExecError(string("DbRelationError: ") + e.what());
     }
 }
 
+// Only a single SELECT, SHOW or EXPLAIN (anything else, or more than one statement, may change the database), or an
+// EXECUTE of one this thread's session prepared. Not EXPLAIN ANALYZE, though, which turns on counting
+// (ExecStats::enabled) for everyone while it runs and would be charged with what the other statements read.
+bool SQLExec::is_read_only(const string &query) {
+    StatementScanner scanner(query);
+    if (scanner.accept("EXECUTE") && scanner.get_type() == StatementScanner::WORD) {
+        auto found = SQLExec::prepared.find(scanner.get_token());
+        return found != SQLExec::prepared.end() && is_read_only(found->second);
+    }
+    if (!scanner.is("SELECT") && !scanner.is("SHOW") && !scanner.is("EXPLAIN"))
+        return false;
+    if (scanner.accept("EXPLAIN") && scanner.is("ANALYZE"))
+        return false;
+    while (scanner.get_type() != StatementScanner::END) {
+        if (scanner.accept(";")) {
+            if (scanner.get_type() != StatementScanner::END)
+                return false;
+        } else {
+            scanner.skip();
+        }
+    }
+    return true;
+}
+
+// ANALYZE <table>
+QueryResult *SQLExec::analyze(Identifier table_name) {
+    if (!Catalog::has_table(table_name))
+        throw SQLExecError("no such table " + table_name);
+    TableStatistics *statistics = TableStatistics::sample(SQLExec::tables->get_table(table_name));
+    try {
+        Tables::get_statistics_table().put(table_name, *statistics);
+    } catch (...) {
+        delete statistics;
+        throw;
+    }
+    string message = "analyzed " + table_name + ": about " + to_string((u_long) (statistics->row_count + 0.5)) +
+                     " rows (sampled " + to_string(statistics->sampled_blocks) +
+                     (statistics->sampled_blocks == 1 ? " block)" : " blocks)");
+    delete statistics;
+    return new QueryResult(message);
+}
+
+// The first table of a FROM clause (the one a query's execution statistics are charged to)
+static const TableRef *first_table(const TableRef *from) {
+    while (from->type != kTableName) {
+        if (from->type == kTableJoin)
+            from = from->join->left;
+        else if (from->type == kTableCrossProduct)
+            from = from->list->front();
+        else
+            throw SQLExecError("subqueries in FROM are not supported");
+    }
+    return from;
+}
+
+// EXPLAIN <select or delete statement>, or EXPLAIN ANALYZE <select statement> to run it and say what each step did
+QueryResult *SQLExec::explain(const string &statement_text, bool analyze) {
+    SQLParserResult *parse = SQLParser::parseSQLString(statement_text);
+    if (!parse->isValid() || parse->size() != 1) {
+        delete parse;
+        throw SQLExecError("can only explain one valid SELECT or DELETE statement");
+    }
+    const SQLStatement *statement = parse->getStatement(0);
+    EvalPlan *plan = nullptr;
+    try {
+        if (statement->type() == kStmtSelect) {
+            ColumnNames column_names;
+            plan = select_plan((const SelectStatement *) statement, column_names);
+        } else if (statement->type() == kStmtDelete && !analyze) {
+            plan = delete_plan((const DeleteStatement *) statement);
+        } else {
+            throw SQLExecError(analyze ? "can only explain analyze SELECT statements"
+                                       : "can only explain SELECT or DELETE statements");
+        }
+    } catch (...) {
+        delete parse;
+        throw;
+    }
+    Identifier table_name = statement->type() == kStmtSelect
+                            ? first_table(((const SelectStatement *) statement)->fromTable)->name
+                            : ((const DeleteStatement *) statement)->tableName;
+    delete parse;
+    IndexList indices = table_indices(table_name);
+    TableCatalog catalog;
+    EvalPlan *optimized = plan->optimize(&indices, Tables::get_statistics_table().get(table_name), &catalog);
+    delete plan;
+    string message;
+    try {
+        if (analyze) {
+            PlanProfile profile;
+            optimized->analyze(profile);
+            message = optimized->explain(0, &profile);
+        } else {
+            message = optimized->explain();
+        }
+    } catch (...) {
+        delete optimized;
+        throw;
+    }
+    delete optimized;
+    return new QueryResult(message);
+}
+
+// SET STATS ON or SET STATS OFF, or SET DURABILITY FULL or SET DURABILITY RELAXED (for this session's commits)
+QueryResult *SQLExec::set(StatementScanner &scanner) {
+    if (scanner.accept("DURABILITY")) {
+        bool relaxed = scanner.accept("RELAXED");
+        if (!relaxed)
+            scanner.expect("FULL");
+        scanner.expect_end();
+        Transaction::set_relaxed(relaxed);
+        return new QueryResult(string("durability ") + (relaxed ? "relaxed" : "full"));
+    }
+    scanner.expect("STATS");
+    bool on = scanner.accept("ON");
+    if (!on)
+        scanner.expect("OFF");
+    scanner.expect_end();
+    ExecStats::enabled = on;
+    return new QueryResult(string("statistics collection ") + (on ? "on" : "off"));
+}
+
+// Counters only fit in an INT column up to a point
+static Value counter_value(u_long n) {
+    return Value((int32_t) (n > INT_MAX ? INT_MAX : n));
+}
+
+// SHOW STATS: the counters of each table that has been counted
+QueryResult *SQLExec::show_stats() {
+    ColumnNames *column_names = new ColumnNames;
+    column_names->push_back("table_name");
+    column_names->push_back("blocks_read");
+    column_names->push_back("blocks_written");
+    column_names->push_back("blocks_skipped");
+    column_names->push_back("rows_examined");
+    column_names->push_back("rows_emitted");
+    column_names->push_back("index_descents");
+    column_names->push_back("bytes_marshalled");
+    column_names->push_back("microseconds");
+
+    ColumnAttributes *column_attributes = new ColumnAttributes;
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    for (uint i = 1; i < column_names->size(); i++)
+        column_attributes->push_back(ColumnAttribute(ColumnAttribute::INT));
+
+    ValueDicts *rows = new ValueDicts;
+    for (auto const &table: ExecStats::get_tables()) {
+        const ExecCounters &counts = table.second;
+        if (counts.blocks_read == 0 && counts.blocks_written == 0 && counts.blocks_skipped == 0 &&
+            counts.rows_examined == 0 && counts.rows_emitted == 0 && counts.index_descents == 0 &&
+            counts.bytes_marshalled == 0)
+            continue;
+        ValueDict *row = new ValueDict;
+        (*row)["table_name"] = Value(table.first);
+        (*row)["blocks_read"] = counter_value(counts.blocks_read);
+        (*row)["blocks_written"] = counter_value(counts.blocks_written);
+        (*row)["blocks_skipped"] = counter_value(counts.blocks_skipped);
+        (*row)["rows_examined"] = counter_value(counts.rows_examined);
+        (*row)["rows_emitted"] = counter_value(counts.rows_emitted);
+        (*row)["index_descents"] = counter_value(counts.index_descents);
+        (*row)["bytes_marshalled"] = counter_value(counts.bytes_marshalled);
+        (*row)["microseconds"] = counter_value((u_long) (counts.seconds * 1e6 + 0.5));
+        rows->push_back(row);
+    }
+    u_long n = rows->size();
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + to_string(n) + " rows" +
+                           (ExecStats::enabled ? "" : " (statistics collection is off)"));
+}
+
+// PREPARE <name> AS <statement, with a ? for each parameter>
+QueryResult *SQLExec::prepare(StatementScanner &scanner) {
+    Identifier name = scanner.expect_identifier();
+    scanner.expect("AS");
+    if (scanner.is("PREPARE") || scanner.is("EXECUTE") || scanner.is("DEALLOCATE"))
+        throw SQLExecError("cannot prepare a " + scanner.get_token() + " statement");
+    if (scanner.get_type() == StatementScanner::END)
+        throw SQLExecError("expected a statement to prepare");
+    SQLExec::prepared[name] = scanner.rest();
+    return new QueryResult("prepared " + name);
+}
+
+// EXECUTE <name> [(<literals>)]
+QueryResult *SQLExec::execute_prepared(StatementScanner &scanner) {
+    Identifier name = scanner.expect_identifier();
+    auto found = SQLExec::prepared.find(name);
+    if (found == SQLExec::prepared.end())
+        throw SQLExecError("no prepared statement " + name);
+    vector<Value> parameters;
+    if (scanner.accept("(") && !scanner.accept(")")) {
+        do {
+            parameters.push_back(scanner.expect_literal());
+        } while (scanner.accept(","));
+        scanner.expect(")");
+    }
+    scanner.expect_end();
+    return execute_text(bind_parameters(found->second, parameters));
+}
+
+// DEALLOCATE [PREPARE] <name>
+QueryResult *SQLExec::deallocate(StatementScanner &scanner) {
+    scanner.accept("PREPARE");
+    Identifier name = scanner.expect_identifier();
+    scanner.expect_end();
+    if (SQLExec::prepared.erase(name) == 0)
+        throw SQLExecError("no prepared statement " + name);
+    return new QueryResult("deallocated " + name);
+}
+
+// Run one statement, through the plan cache or the parser, as the shell would
+QueryResult *SQLExec::execute_text(const string &statement_text) {
+    QueryResult *result = execute_extended(statement_text);
+    if (result != nullptr)
+        return result;
+    SQLParserResult *parse = SQLParser::parseSQLString(statement_text);
+    if (!parse->isValid() || parse->size() != 1) {
+        delete parse;
+        throw SQLExecError("invalid SQL: " + statement_text);
+    }
+    try {
+        result = execute(parse->getStatement(0));
+    } catch (...) {
+        delete parse;
+        throw;
+    }
+    delete parse;
+    return result;
+}
+
+/**
+ * Run a SELECT or DELETE with a plan from the plan cache, planning it (and caching the plan) if need be.
+ * @param query        text of the statement
+ * @param transaction  begun for a DELETE, once it has a plan
+ * @return             the query result (freed by caller), or nullptr if the statement isn't one whose plan can be
+ *                     cached
+ */
+QueryResult *SQLExec::execute_cached(const string &query, StatementTransaction &transaction) {
+    vector<Value> literals;
+    string key = plan_cache_key(query, literals);
+    if (key.empty())
+        return nullptr;
+
+    // the latch is only held to look at the cache or change it, not while the catalog is checked or a statement is
+    // planned, so whatever another session did to the entry meanwhile is looked for again afterwards
+    std::unique_lock<std::mutex> guard(SQLExec::plan_cache_latch);
+    auto found = SQLExec::plan_cache.find(key);
+    if (found != SQLExec::plan_cache.end()) {
+        CachedPlan seen = found->second;
+        guard.unlock();
+        bool current = is_current(seen);
+        guard.lock();
+        found = SQLExec::plan_cache.find(key);
+        if (!current && found != SQLExec::plan_cache.end() && found->second.plan == seen.plan) {
+            delete found->second.plan;
+            SQLExec::plan_cache.erase(found);
+            found = SQLExec::plan_cache.end();
+        }
+    }
+    if (found == SQLExec::plan_cache.end()) {
+        guard.unlock();
+        CachedPlan entry;
+        if (!plan_statement(query, literals, entry))
+            return nullptr;
+        guard.lock();
+        found = SQLExec::plan_cache.find(key);
+        if (found != SQLExec::plan_cache.end()) {
+            // another session planned the same statement meanwhile, and either plan will do
+            delete entry.plan;
+        } else {
+            if (SQLExec::plan_cache.size() >= PLAN_CACHE_SIZE) {
+                // make room by throwing out the least recently used plan
+                auto oldest = SQLExec::plan_cache.begin();
+                for (auto it = SQLExec::plan_cache.begin(); it != SQLExec::plan_cache.end(); it++)
+                    if (it->second.last_used < oldest->second.last_used)
+                        oldest = it;
+                delete oldest->second.plan;
+                SQLExec::plan_cache.erase(oldest);
+            }
+            found = SQLExec::plan_cache.insert(make_pair(key, entry)).first;
+        }
+    }
+
+    // statements on other threads may be running the cached plan, so this one binds its literals to a copy
+    CachedPlan &entry = found->second;
+    entry.last_used = ++SQLExec::plan_cache_clock;
+    ValueDict values;
+    for (size_t i = 0; i < literals.size(); i++)
+        values[entry.parameters[i]] = literals[i];
+    EvalPlan *plan = new EvalPlan(entry.plan);
+    Identifier table_name = entry.table_name;
+    ColumnNames column_names = entry.column_names;
+    bool is_select = entry.is_select;
+    guard.unlock();
+
+    plan->bind(values);
+    if (is_select)
+        return evaluate_select(SQLExec::tables->get_table(table_name), column_names, plan, true);
+    try {
+        transaction.begin();
+        QueryResult *result = evaluate_delete(table_name, plan);
+        delete plan;
+        return result;
+    } catch (...) {
+        delete plan;
+        throw;
+    }
+}
+
+// The columns of the where clause's literals, in the order they are written
+static void where_columns(const Expr *expr, ColumnNames &column_names) {
+    if (expr == nullptr || expr->type != kExprOperator)
+        return;
+    if (expr->opType == Expr::AND) {
+        where_columns(expr->expr, column_names);
+        where_columns(expr->expr2, column_names);
+    } else if (expr->opType == Expr::SIMPLE_OP && expr->expr != nullptr && expr->expr->name != nullptr) {
+        column_names.push_back(expr->expr->name);
+    }
+}
+
+/**
+ * Parse and plan a statement for the plan cache.
+ * @param query     text of the statement
+ * @param literals  the statement's literals, in order
+ * @param entry     filled in with the plan (on success)
+ * @return          false if the statement isn't a SELECT or DELETE whose literals are all values for different
+ *                  columns of its where clause (or it doesn't parse or plan -- the parser will report why)
+ */
+bool SQLExec::plan_statement(const string &query, const vector<Value> &literals, CachedPlan &entry) {
+    ArenaScope heap(nullptr);  // the cached plan outlives the statement
+    SQLParserResult *parse = SQLParser::parseSQLString(query);
+    if (!parse->isValid() || parse->size() != 1 ||
+        (parse->getStatement(0)->type() != kStmtSelect && parse->getStatement(0)->type() != kStmtDelete)) {
+        delete parse;
+        return false;
+    }
+    const SQLStatement *statement = parse->getStatement(0);
+    entry.is_select = statement->type() == kStmtSelect;
+    if (entry.is_select && ((const SelectStatement *) statement)->fromTable->type != kTableName) {
+        delete parse;
+        return false;  // a join's where clause can have the same column name for more than one table
+    }
+    const Expr *where_clause;
+    if (entry.is_select) {
+        entry.table_name = ((const SelectStatement *) statement)->fromTable->name;
+        where_clause = ((const SelectStatement *) statement)->whereClause;
+    } else {
+        entry.table_name = ((const DeleteStatement *) statement)->tableName;
+        where_clause = ((const DeleteStatement *) statement)->expr;
+    }
+    where_columns(where_clause, entry.parameters);
+
+    EvalPlan *plan = nullptr;
+    try {
+        DbRelation &table = SQLExec::tables->get_table(entry.table_name);
+        entry.table_version = Catalog::get_table_version(entry.table_name);
+        entry.table_blocks = table.get_block_count();
+        if (entry.is_select)
+            plan = select_plan((const SelectStatement *) statement, entry.column_names);
+        else
+            plan = delete_plan((const DeleteStatement *) statement);
+    } catch (exception &e) {
+        delete parse;
+        return false;
+    }
+
+    // each literal has to be the value of its own column in the where clause
+    bool parameterized = entry.parameters.size() == literals.size();
+    ValueDict *where = nullptr;
+    if (parameterized && where_clause != nullptr) {
+        where = get_where_conjunction(where_clause, nullptr);
+        parameterized = where->size() == literals.size();
+        for (size_t i = 0; parameterized && i < literals.size(); i++) {
+            auto found = where->find(entry.parameters[i]);
+            parameterized = found != where->end() && found->second == literals[i];
+        }
+    }
+    delete where;
+    delete parse;
+    if (!parameterized) {
+        delete plan;
+        return false;
+    }
+
+    IndexList indices = table_indices(entry.table_name);
+    entry.plan = plan->optimize(&indices, Tables::get_statistics_table().get(entry.table_name));
+    delete plan;
+    return true;
+}
+
+// Whether a cached plan still fits its table: same schema, and not so different in size that a new plan may be better
+bool SQLExec::is_current(const CachedPlan &entry) {
+    if (Catalog::get_table_version(entry.table_name) != entry.table_version)
+        return false;
+    uint32_t blocks = SQLExec::tables->get_table(entry.table_name).get_block_count();
+    return blocks <= 2 * entry.table_blocks + 1 && entry.table_blocks <= 2 * blocks + 1;
+}
+
+// CREATE UNIQUE INDEX ... (given the statement without the UNIQUE)
+QueryResult *SQLExec::create_unique_index(const string &statement_text) {
+    SQLParserResult *parse = SQLParser::parseSQLString(statement_text);
+    if (!parse->isValid() || parse->size() != 1 || parse->getStatement(0)->type() != kStmtCreate ||
+        ((const CreateStatement *) parse->getStatement(0))->type != CreateStatement::kIndex) {
+        delete parse;
+        throw SQLExecError("expected CREATE UNIQUE INDEX <index_name> ON <table_name> [USING ...] (<columns>)");
+    }
+    QueryResult *result;
+    try {
+        result = create_index((const CreateStatement *) parse->getStatement(0), true);
+    } catch (...) {
+        delete parse;
+        throw;
+    }
+    delete parse;
+    return result;
+}
+
+/**
+ * CREATE TABLE ... WITH (storage=heap|column, page_size=<bytes>), either option or both, the parser not knowing about
+ * WITH: it gets the statement without it.
+ * @param scanner      just past CREATE
+ * @param transaction  begun once the statement is known to be one
+ * @return             the query result (freed by caller), or nullptr if there is no WITH
+ */
+QueryResult *SQLExec::create_table_with(StatementScanner &scanner, StatementTransaction &transaction) {
+    const string rest = scanner.rest();
+    int depth = 0;
+    while (scanner.get_type() != StatementScanner::END && !(depth == 0 && scanner.is("WITH"))) {
+        if (scanner.is("("))
+            depth++;
+        else if (scanner.is(")"))
+            depth--;
+        scanner.skip();
+    }
+    if (scanner.get_type() == StatementScanner::END)
+        return nullptr;
+    string create_text = "CREATE " + rest.substr(0, rest.size() - scanner.rest().size());
+    scanner.expect("WITH");
+    scanner.expect("(");
+    string storage = Tables::HEAP_STORAGE;
+    uint block_size = DbBlock::BLOCK_SZ;
+    do {
+        if (scanner.accept("STORAGE")) {
+            scanner.expect("=");
+            storage = scanner.expect_identifier();
+            transform(storage.begin(), storage.end(), storage.begin(), ::toupper);
+            if (storage != Tables::HEAP_STORAGE && storage != Tables::COLUMN_STORAGE)
+                throw SQLExecError("unknown storage '" + storage + "' (expected heap or column)");
+        } else if (scanner.accept("PAGE_SIZE")) {
+            scanner.expect("=");
+            Value size = scanner.expect_literal();
+            if (size.data_type != ColumnAttribute::INT || size.n < (int32_t) DbBlock::BLOCK_SZ ||
+                size.n > (int32_t) DbBlock::MAX_BLOCK_SZ || (size.n & (size.n - 1)) != 0)
+                throw SQLExecError("page_size must be a power of two from " + to_string(DbBlock::BLOCK_SZ) + " to " +
+                                   to_string(DbBlock::MAX_BLOCK_SZ));
+            block_size = (uint) size.n;
+        } else {
+            throw SQLExecError("expected STORAGE or PAGE_SIZE but found '" + scanner.get_token() + "'");
+        }
+    } while (scanner.accept(","));
+    scanner.expect(")");
+    scanner.expect_end();
+
+    SQLParserResult *parse = SQLParser::parseSQLString(create_text);
+    if (!parse->isValid() || parse->size() != 1 || parse->getStatement(0)->type() != kStmtCreate ||
+        ((const CreateStatement *) parse->getStatement(0))->type != CreateStatement::kTable) {
+        delete parse;
+        throw SQLExecError(
+                "expected CREATE TABLE <table_name> (<columns>) WITH (storage=heap|column, page_size=<bytes>)");
+    }
+    QueryResult *result;
+    try {
+        transaction.begin();
+        result = create_table((const CreateStatement *) parse->getStatement(0), storage, block_size);
+    } catch (...) {
+        delete parse;
+        throw;
+    }
+    delete parse;
+    return result;
+}
+
+// INSERT INTO <table_name> [(<column_names>)] VALUES (<literals>), (<literals>), ... (the transaction is begun once
+// the statement is known to be one)
+QueryResult *SQLExec::insert_batch(StatementScanner &scanner, StatementTransaction &transaction) {
+    Identifier table_name;
+    ColumnNames column_names;
+    Rows rows;
+    try {
+        scanner.expect("INSERT");
+        scanner.expect("INTO");
+        table_name = scanner.expect_identifier();
+        if (scanner.accept("(")) {
+            do {
+                column_names.push_back(scanner.expect_identifier());
+            } while (scanner.accept(","));
+            scanner.expect(")");
+        }
+        scanner.expect("VALUES");
+        do {
+            Row row;
+            scanner.expect("(");
+            do {
+                row.append(scanner.expect_literal());
+            } while (scanner.accept(","));
+            scanner.expect(")");
+            rows.push_back(std::move(row));
+        } while (scanner.accept(","));
+        scanner.expect_end();
+    } catch (SQLExecError &e) {
+        return nullptr;  // not something we handle here
+    }
+    if (rows.size() < 2)
+        return nullptr;  // a plain INSERT
+
+    transaction.begin();
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    if (column_names.empty())
+        column_names = table.get_column_names();
+    for (auto const &row: rows)
+        if (row.size() != column_names.size())
+            throw SQLExecError("don't know how to handle NULLs, defaults, etc. yet");
+
+    IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+    Handles *handles = table.insert_batch(&column_names, &rows);
+    size_t n = handles->size();
+    try {
+        for (auto const &index_name: index_names)
+            SQLExec::indices->get_index(table_name, index_name).insert_batch(handles);
+    } catch (DbRelationError &e) {
+        delete handles;  // and aborting the statement's transaction takes the rows back out
+        throw SQLExecError(string("Error inserting into index: ") + e.what());
+    }
+    delete handles;
+    size_t num_indices = index_names.size();
+    return new QueryResult("successfully inserted " + to_string(n) + " rows into " + table_name +
+                           (num_indices == 0 ? "" : (" and " + to_string(num_indices) +
+                                                     (num_indices == 1 ? " index" : " indices"))));
+}
+
+/**
+ * COPY <table_name> [(<column_names>)] FROM '<path>' [WITH (format=csv|tsv, delimiter='<c>', header=true|false)]
+ *
+ * Loads the rows of a CSV (the default) or TSV file a buffer at a time, straight into the table with insert_batch. A
+ * relative path is taken from the database environment's directory. The indices are brought up to date once, at the
+ * end: if most of the table's blocks are new, each is built over again with its bulk loader, otherwise the new rows
+ * go into each in one batch. Either the whole file goes in or none of it does (the statement's transaction is
+ * aborted).
+ * @param scanner  just past COPY
+ * @return         the query result (freed by caller)
+ */
+QueryResult *SQLExec::copy(StatementScanner &scanner) {
+    Identifier table_name = scanner.expect_identifier();
+    ColumnNames column_names;
+    if (scanner.accept("(")) {
+        do {
+            column_names.push_back(scanner.expect_identifier());
+        } while (scanner.accept(","));
+        scanner.expect(")");
+    }
+    scanner.expect("FROM");
+    Value path = scanner.expect_literal();
+    if (path.data_type != ColumnAttribute::TEXT)
+        throw SQLExecError("expected the file name in quotes");
+    char delimiter = ',';
+    bool quoting = true, header = false;
+    if (scanner.accept("WITH")) {
+        scanner.expect("(");
+        do {
+            if (scanner.accept("FORMAT")) {
+                scanner.expect("=");
+                if (scanner.accept("CSV")) {
+                    delimiter = ',';
+                    quoting = true;
+                } else if (scanner.accept("TSV")) {
+                    delimiter = '\t';
+                    quoting = false;
+                } else {
+                    throw SQLExecError("unknown format '" + scanner.get_token() + "' (expected csv or tsv)");
+                }
+            } else if (scanner.accept("DELIMITER")) {
+                scanner.expect("=");
+                Value c = scanner.expect_literal();
+                if (c.data_type != ColumnAttribute::TEXT || c.s.size() != 1 || c.s[0] == '\n' || c.s[0] == '"')
+                    throw SQLExecError("delimiter must be one character in quotes");
+                delimiter = c.s[0];
+            } else if (scanner.accept("HEADER")) {
+                scanner.expect("=");
+                if (scanner.accept("TRUE"))
+                    header = true;
+                else if (scanner.accept("FALSE"))
+                    header = false;
+                else
+                    throw SQLExecError("expected TRUE or FALSE but found '" + scanner.get_token() + "'");
+            } else {
+                throw SQLExecError("expected FORMAT, DELIMITER, or HEADER but found '" + scanner.get_token() + "'");
+            }
+        } while (scanner.accept(","));
+        scanner.expect(")");
+    }
+    scanner.expect_end();
+
+    if (!Catalog::has_table(table_name))
+        throw SQLExecError("no such table " + table_name);
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    if (column_names.empty())
+        column_names = table.get_column_names();
+    ColumnAttributes *column_attributes = table.get_column_attributes(column_names);
+    vector<ColumnAttribute::DataType> column_types;
+    for (auto const &column_attribute: *column_attributes)
+        column_types.push_back(column_attribute.get_data_type());
+    delete column_attributes;
+
+    string file_name = path.s;
+    if (file_name.empty() || file_name[0] != '/') {
+        const char *home;
+        _DB_ENV->get_home(&home);
+        file_name = string(home) + "/" + file_name;
+    }
+    DelimitedReader reader(file_name, column_types, delimiter, quoting);
+
+    IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+    uint32_t blocks_before = table.get_block_count();
+    Handles handles;
+    try {
+        if (header)
+            reader.skip_line();
+        Rows rows;
+        while (reader.next_batch(rows)) {
+            Handles *batch = table.insert_batch(&column_names, &rows);
+            handles.insert(handles.end(), batch->begin(), batch->end());
+            delete batch;
+        }
+    } catch (DbRelationError &e) {
+        throw SQLExecError("Error copying into " + table_name + ": " + e.what());
+    }
+
+    bool rebuild = table.get_block_count() - blocks_before >= blocks_before;
+    try {
+        for (auto const &index_name: index_names) {
+            if (rebuild)
+                SQLExec::indices->rebuild_index(table_name, index_name);
+            else
+                SQLExec::indices->get_index(table_name, index_name).insert_batch(&handles);
+        }
+    } catch (DbRelationError &e) {
+        throw SQLExecError(string("Error inserting into index: ") + e.what());
+    }
+    size_t n = handles.size();
+    size_t num_indices = index_names.size();
+    return new QueryResult("successfully copied " + to_string(n) + " rows into " + table_name +
+                           (num_indices == 0 ? "" : (" and " + to_string(num_indices) +
+                                                     (num_indices == 1 ? " index" : " indices"))));
+}
+
+// Give back the space from deleted rows
+QueryResult *SQLExec::vacuum(Identifier table_name) {
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    if (table.get_column_names().empty())
+        throw SQLExecError("no such table " + table_name);
+
+    Relocations *moves = table.vacuum(true);
+    try {
+        if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME || table_name == Indices::TABLE_NAME)
+            Catalog::relocate(table_name, moves);
+        for (auto const &index: table_indices(table_name))
+            index->relocate(moves);
+    } catch (...) {
+        delete moves;
+        throw;
+    }
+    size_t n = moves->size();
+    delete moves;
+    return new QueryResult("vacuumed " + table_name + " (moved " + to_string(n) + (n == 1 ? " row)" : " rows)"));
+}
+
 // Insert into a table and indices
 QueryResult *SQLExec::insert(const InsertStatement *statement) {
     Identifier tableName;
@@ -143,8 +1286,7 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
         handle = table.insert(&row);
     }
     catch (...) {
-        table.del(handle);
-        throw SQLExecError("Error inserting into table");
+        throw SQLExecError("Error inserting into table");  // the statement's transaction is aborted
     }
 
     numIndices = indexNames.size();
@@ -156,11 +1298,7 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
         }
     }
     catch (...) {
-        for (uint i = 0; i < numIndices; i++) {
-            DbIndex &index = SQLExec::indices->get_index(tableName, indexNames.at(i));
-            index.del(handle);
-        }
-        throw SQLExecError("Error inserting into index");
+        throw SQLExecError("Error inserting into index");  // the statement's transaction takes the row back out
     }
 
     return new QueryResult("successfully inserted 1 row into " + tableName +
@@ -171,36 +1309,58 @@ EXIT:
     throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
 }
 
+// The indices on the given table
+IndexList SQLExec::table_indices(const Identifier &table_name) {
+    IndexList ret;
+    for (auto const &index_name: SQLExec::indices->get_index_names(table_name))
+        ret.push_back(&SQLExec::indices->get_index(table_name, index_name));
+    return ret;
+}
+
+// Plan for finding the rows to delete (before optimization; freed by caller)
+EvalPlan *SQLExec::delete_plan(const DeleteStatement *statement) {
+    DbRelation &table = SQLExec::tables->get_table(statement->tableName);
+    EvalPlan *plan = new EvalPlan(table);
+    if (statement->expr != nullptr)
+        plan = new EvalPlan(get_where_conjunction(statement->expr, &table.get_column_names()), plan);
+    return plan;
+}
+
 // Delete a table and any indices present
 QueryResult *SQLExec::del(const DeleteStatement *statement) {
     Identifier tableName;
     EvalPlan *plan;
+
+    tableName = statement->tableName;
+    plan = delete_plan(statement);
+    IndexList table_index_list = table_indices(tableName);
+    EvalPlan *optimized = plan->optimize(&table_index_list, Tables::get_statistics_table().get(tableName));
+    delete plan;
+    QueryResult *result;
+    try {
+        result = evaluate_delete(tableName, optimized);
+    } catch (...) {
+        delete optimized;
+        throw;
+    }
+    delete optimized;
+    return result;
+}
+
+// Delete the rows an optimized plan finds, from the table and its indices
+QueryResult *SQLExec::evaluate_delete(const Identifier &tableName, EvalPlan *plan) {
     EvalPipeline pipeline;
     IndexNames indexNames;
     Handles *handles;
     uint numRows;
     uint numIndices;
-    
-    tableName = statement->tableName;
-    DbRelation &table = SQLExec::tables->get_table(tableName);
-    plan = new EvalPlan(table);
-
-    if (statement->expr != nullptr) {
-        plan = new EvalPlan(get_where_conjunction(statement->expr, &table.get_column_names()), plan);
-    }
-    else {
-        plan = plan->optimize();
-    }
 
     pipeline = plan->pipeline();
-    
     indexNames = SQLExec::indices->get_index_names(tableName);
     handles = pipeline.second;
     for (auto const& indexName: indexNames) {
         DbIndex &index = SQLExec::indices->get_index(tableName, indexName);
-        for (auto const& handle: *handles) {
-            index.del(handle);
-        }
+        index.del_batch(handles);
     }
     
     for (auto const& handle: *handles) {
@@ -209,6 +1369,7 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
     
     numRows = handles->size();
     numIndices = indexNames.size();
+    delete handles;
 
     return new QueryResult("successfully deleted " + to_string(numRows) +
                            (numRows == 1 ? " row" : " rows") + " from " +
@@ -217,40 +1378,401 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
                            (numIndices == 1 ? " index" : " indices"))));
 }
 
-QueryResult *SQLExec::select(const SelectStatement *statement) { 
-    //table and columns
-    Identifier table_name = statement->fromTable->name;
-    DbRelation &table = SQLExec::tables->get_table(table_name);
-    ColumnNames *column_names = new ColumnNames;
-    //Evalplan 
-    EvalPlan* plan;
+/**
+ * @class SelectScope - the tables a query is on, and what their columns are called in the rows of its plan
+ *
+ *      A query on one table has its columns by their own names. A join's are qualified by their table's alias (or
+ *      name), e.g., e.id, since more than one of its tables can have a column of that name; a column referred to
+ *      without a qualifier has to be in just one of them.
+ */
+class SelectScope {
+public:
+    SelectScope() : qualifiers(), tables(), join_conditions() {}
+
+    std::vector<Identifier> qualifiers;  // by table, in FROM order
+    std::vector<DbRelation *> tables;
+    std::vector<const Expr *> join_conditions;  // the ON clauses
+
+    bool is_join() const { return tables.size() > 1; }
+
+    void add(const Identifier &qualifier, DbRelation &table) {
+        if (find(qualifiers.begin(), qualifiers.end(), qualifier) != qualifiers.end())
+            throw SQLExecError("table " + qualifier + " is in FROM more than once (give it an alias)");
+        qualifiers.push_back(qualifier);
+        tables.push_back(&table);
+    }
 
+    uint find_column(const Expr *column, Identifier &column_name) const;
+
+    // What a column reference is called in the plan's rows
+    Identifier resolve(const Expr *column) const {
+        Identifier column_name;
+        uint table_no = find_column(column, column_name);
+        return is_join() ? qualifiers[table_no] + "." + column_name : column_name;
+    }
+
+    ColumnAttribute::DataType data_type(uint table_no, const Identifier &column_name) const;
+
+    // Every column of every table, in order, for SELECT *
+    ColumnNames all_columns() const {
+        ColumnNames column_names;
+        for (uint i = 0; i < tables.size(); i++)
+            for (auto const &column_name: tables[i]->get_column_names())
+                column_names.push_back(is_join() ? qualifiers[i] + "." + column_name : column_name);
+        return column_names;
+    }
+};
+
+/**
+ * Which table a column reference is to (for a query on one table, that table, whatever the reference says).
+ * @param column       the column reference
+ * @param column_name  set to what the column is called in its table
+ * @return             the table's number in the scope
+ * @throws SQLExecError if no table of a join has the column, or more than one might
+ */
+uint SelectScope::find_column(const Expr *column, Identifier &column_name) const {
+    column_name = column->name;
+    if (!is_join())
+        return 0;
+    int found = -1;
+    for (uint i = 0; i < tables.size(); i++) {
+        if (column->table != nullptr && qualifiers[i] != column->table)
+            continue;
+        const ColumnNames &column_names = tables[i]->get_column_names();
+        if (find(column_names.begin(), column_names.end(), column_name) == column_names.end())
+            continue;
+        if (found >= 0)
+            throw SQLExecError("column " + column_name + " is ambiguous");
+        found = (int) i;
+    }
+    if (found < 0)
+        throw SQLExecError("unknown column " + (column->table != nullptr ? string(column->table) + "." : "") +
+                           column_name);
+    return (uint) found;
+}
+
+ColumnAttribute::DataType SelectScope::data_type(uint table_no, const Identifier &column_name) const {
+    ColumnNames one(1, column_name);
+    ColumnAttributes *column_attributes = tables[table_no]->get_column_attributes(one);
+    ColumnAttribute::DataType data_type = column_attributes->front().get_data_type();
+    delete column_attributes;
+    return data_type;
+}
+
+/**
+ * @class JoinCondition - a column of one of a join's tables that has to equal a column of another
+ */
+class JoinCondition {
+public:
+    uint tables[2];          // by number in the scope
+    Identifier columns[2];   // as each table has it
+};
+
+/**
+ * Sort the conjuncts of a join's ON and WHERE clauses into each table's selection (column = literal) and the
+ * conditions between tables (column = column).
+ * @param expr        an ON or WHERE clause
+ * @param scope       the join's tables
+ * @param selections  each table's conjunction, added to
+ * @param conditions  added to
+ */
+static void join_conjuncts(const Expr *expr, const SelectScope &scope, vector<ValueDict> &selections,
+                           vector<JoinCondition> &conditions) {
+    if (expr == nullptr || expr->type != kExprOperator)
+        throw SQLExecError("Invalid where clause expression");
+    if (expr->opType == Expr::AND) {
+        join_conjuncts(expr->expr, scope, selections, conditions);
+        join_conjuncts(expr->expr2, scope, selections, conditions);
+        return;
+    }
+    if (expr->opType != Expr::SIMPLE_OP || expr->expr->type != kExprColumnRef)
+        throw SQLExecError("Only supports AND conjunctions of column = value or column = column");
+    Identifier column_name;
+    uint table_no = scope.find_column(expr->expr, column_name);
+    switch (expr->expr2->type) {
+        case kExprLiteralInt:
+            selections[table_no][column_name] = Value(expr->expr2->ival);
+            break;
+        case kExprLiteralString:
+            selections[table_no][column_name] = Value(expr->expr2->name);
+            break;
+        case kExprColumnRef: {
+            JoinCondition condition;
+            condition.tables[0] = table_no;
+            condition.columns[0] = column_name;
+            condition.tables[1] = scope.find_column(expr->expr2, condition.columns[1]);
+            if (condition.tables[0] == condition.tables[1])
+                throw SQLExecError("can only compare columns of different tables");
+            if (scope.data_type(condition.tables[0], condition.columns[0]) !=
+                scope.data_type(condition.tables[1], condition.columns[1]))
+                throw SQLExecError("can't join " + scope.resolve(expr->expr) + " to " + scope.resolve(expr->expr2) +
+                                   " (they are different types)");
+            conditions.push_back(condition);
+            break;
+        }
+        default:
+            throw SQLExecError("Only supports INT and TEXT expression types");
+    }
+}
+
+/**
+ * Plan for the rows of a join (before optimization; freed by caller): each table's scan, with its own selection,
+ * and the tables joined one at a time, each on a condition with those before it (a left-deep tree of HashJoins,
+ * which the optimizer decides how to do). The next table to join is always the first one in FROM order that has
+ * such a condition.
+ * @param scope         the join's tables (and ON clauses)
+ * @param where_clause  the WHERE clause (or nullptr)
+ * @throws SQLExecError if a table has no condition joining it to the others, or there are conditions left over
+ */
+static EvalPlan *join_plan(const SelectScope &scope, const Expr *where_clause) {
+    const uint n = (uint) scope.tables.size();
+    vector<ValueDict> selections(n);
+    vector<JoinCondition> conditions;
+    for (auto const condition: scope.join_conditions)
+        join_conjuncts(condition, scope, selections, conditions);
+    if (where_clause != nullptr)
+        join_conjuncts(where_clause, scope, selections, conditions);
+
+    // the order: which table comes next, and on which condition
+    vector<bool> joined(n, false), used(conditions.size(), false);
+    vector<pair<uint, uint>> steps;
+    joined[0] = true;
+    for (uint step = 1; step < n; step++) {
+        uint next = n, by = 0;
+        for (uint c = 0; c < conditions.size(); c++) {
+            const JoinCondition &condition = conditions[c];
+            if (used[c] || joined[condition.tables[0]] == joined[condition.tables[1]])
+                continue;
+            uint table_no = joined[condition.tables[0]] ? condition.tables[1] : condition.tables[0];
+            if (table_no < next) {
+                next = table_no;
+                by = c;
+            }
+        }
+        if (next == n) {
+            uint missing = (uint) (find(joined.begin(), joined.end(), false) - joined.begin());
+            throw SQLExecError("no join condition for " + scope.qualifiers[missing] +
+                               " (cross products are not supported)");
+        }
+        joined[next] = true;
+        used[by] = true;
+        steps.push_back(make_pair(next, by));
+    }
+    if (find(used.begin(), used.end(), false) != used.end())
+        throw SQLExecError("only one join condition for each table is supported");
+
+    auto scan = [&scope, &selections](uint table_no) {
+        EvalPlan *plan = new EvalPlan(*scope.tables[table_no]);
+        if (!selections[table_no].empty())
+            plan = new EvalPlan(new ValueDict(selections[table_no]), plan);
+        return plan;
+    };
+    EvalPlan *plan = scan(0);
+    for (size_t i = 0; i < steps.size(); i++) {
+        const JoinCondition &condition = conditions[steps[i].second];
+        uint inner = condition.tables[0] == steps[i].first ? 0 : 1;  // the condition's side on the new table
+        uint outer_table = condition.tables[1 - inner];
+        const Identifier &outer_column = condition.columns[1 - inner];
+        JoinKey left_key = i == 0 ? JoinKey(scope.qualifiers[outer_table], outer_column)
+                                  : JoinKey("", scope.qualifiers[outer_table] + "." + outer_column);
+        plan = new EvalPlan(plan, left_key, scan(steps[i].first),
+                            JoinKey(scope.qualifiers[steps[i].first], condition.columns[inner]));
+    }
+    return plan;
+}
+
+/**
+ * The aggregate a select list expression calls for, e.g., SUM(a).
+ * @param expr   a function call from the select list
+ * @param scope  the tables the query is on
+ * @return       the aggregate (named by its alias, if it has one)
+ * @throws SQLExecError if it isn't COUNT, SUM, MIN, or MAX of one of the tables' columns (or COUNT(*))
+ */
+static AggregateFunction aggregate_function(const Expr *expr, const SelectScope &scope) {
+    string name = expr->name;
+    transform(name.begin(), name.end(), name.begin(), ::toupper);
+    AggregateFunction::Function function;
+    if (name == "COUNT")
+        function = AggregateFunction::COUNT;
+    else if (name == "SUM")
+        function = AggregateFunction::SUM;
+    else if (name == "MIN")
+        function = AggregateFunction::MIN;
+    else if (name == "MAX")
+        function = AggregateFunction::MAX;
+    else
+        throw SQLExecError("unknown function " + name + " (expected COUNT, SUM, MIN, or MAX)");
+    if (expr->distinct)
+        throw SQLExecError(name + "(DISTINCT ...) is not supported yet");
+    if (expr->exprList == nullptr || expr->exprList->size() != 1)
+        throw SQLExecError(name + " takes one column");
+
+    const Expr *argument = expr->exprList->front();
+    Identifier column_name;
+    ColumnAttribute::DataType data_type = ColumnAttribute::INT;
+    if (argument->type == kExprStar && function == AggregateFunction::COUNT) {
+        // COUNT(*)
+    } else if (argument->type == kExprColumnRef) {
+        Identifier table_column;
+        uint table_no = scope.find_column(argument, table_column);
+        column_name = scope.resolve(argument);
+        data_type = scope.data_type(table_no, table_column);
+        if (function == AggregateFunction::SUM && data_type != ColumnAttribute::INT)
+            throw SQLExecError("SUM needs an INT column, not " + column_name);
+    } else {
+        throw SQLExecError(name + " takes one column");
+    }
+    return AggregateFunction(function, column_name, data_type,
+                             expr->alias != nullptr ? Identifier(expr->alias)
+                                                    : AggregateFunction::default_name(function, column_name));
+}
+
+/**
+ * Plan for a query (before optimization; freed by caller), and the columns it returns. With aggregates or a GROUP BY,
+ * the selection goes under an Aggregate or GroupBy (and the projection over it puts the columns in order). A LIMIT
+ * goes over the projection.
+ */
+EvalPlan *SQLExec::select_plan(const SelectStatement *statement, ColumnNames &column_names) {
+    //table(s) and columns
+    SelectScope scope;
+    from_tables(statement->fromTable, scope);
+    DbRelation &table = *scope.tables.front();
+    const ColumnNames &table_columns = table.get_column_names();
 
     //iterate over select list 
+    AggregateFunctions aggregates;
+    ColumnNames plain_columns;
     for(auto const &e : *statement->selectList){
         if(e->type == kExprStar){
-            for(auto const column : table.get_column_names()){
-                column_names->push_back(column);
+            for(auto const column : scope.all_columns()){
+                column_names.push_back(column);
+                plain_columns.push_back(column);
             }
         }
         else if(e->type == kExprColumnRef){
-            column_names->push_back(e->name);
+            column_names.push_back(scope.resolve(e));
+            plain_columns.push_back(column_names.back());
+        }
+        else if(e->type == kExprFunctionRef){
+            aggregates.push_back(aggregate_function(e, scope));
+            column_names.push_back(aggregates.back().name);
         }
-        else return new QueryResult("Invalid selection");
+        else throw SQLExecError("Invalid selection");
     }
 
-    //If there is a where clause...
-    plan = new EvalPlan(table);
-    if(statement->whereClause != nullptr){
-        plan = new EvalPlan(get_where_conjunction(statement->whereClause, &table.get_column_names()), plan);
+    //group by columns, which are the only others an aggregating query can have
+    ColumnNames group_by;
+    if (statement->groupBy != nullptr) {
+        if (statement->groupBy->having != nullptr)
+            throw SQLExecError("HAVING is not supported yet");
+        for (auto const &e: *statement->groupBy->columns) {
+            if (e->type != kExprColumnRef)
+                throw SQLExecError("can only GROUP BY columns");
+            if (!scope.is_join() && find(table_columns.begin(), table_columns.end(), e->name) == table_columns.end())
+                throw SQLExecError(string("unknown column ") + e->name);
+            group_by.push_back(scope.resolve(e));
+        }
+    }
+    bool aggregating = !aggregates.empty() || statement->groupBy != nullptr;
+    if (aggregating)
+        for (auto const &column_name: plain_columns)
+            if (find(group_by.begin(), group_by.end(), column_name) == group_by.end())
+                throw SQLExecError("column " + column_name + " has to be in the GROUP BY to be selected");
+
+    //If there is a where clause... (a join sorts it out among its tables)
+    EvalPlan *plan;
+    if (scope.is_join()) {
+        plan = join_plan(scope, statement->whereClause);
+    } else {
+        plan = new EvalPlan(table);
+        if(statement->whereClause != nullptr){
+            plan = new EvalPlan(get_where_conjunction(statement->whereClause, &table.get_column_names()), plan);
+        }
+    }
+    if (aggregating)
+        plan = new EvalPlan(statement->groupBy != nullptr ? new ColumnNames(group_by) : nullptr,
+                            new AggregateFunctions(aggregates), plan);
+    //projection, and a limit on how many of its rows come out
+    plan = new EvalPlan(new ColumnNames(column_names), plan);
+    if (statement->limit != nullptr && statement->limit->limit != kNoLimit) {
+        if (statement->limit->limit < 0 || statement->limit->offset < kNoOffset) {
+            delete plan;
+            throw SQLExecError("LIMIT and OFFSET can't be negative");
+        }
+        u_long offset = statement->limit->offset == kNoOffset ? 0 : (u_long) statement->limit->offset;
+        plan = new EvalPlan((u_long) statement->limit->limit, offset, plan);
+    }
+    return plan;
+}
+
+// Add the tables of a FROM clause to the scope, with the conditions of its joins
+void SQLExec::from_tables(const TableRef *from, SelectScope &scope) {
+    switch (from->type) {
+        case kTableName:
+            scope.add(from->alias != nullptr ? from->alias : from->name, SQLExec::tables->get_table(from->name));
+            break;
+        case kTableJoin:
+            if (from->join->type != kJoinInner && from->join->type != kJoinCross)
+                throw SQLExecError("only inner joins are supported");
+            from_tables(from->join->left, scope);
+            from_tables(from->join->right, scope);
+            if (from->join->condition != nullptr)
+                scope.join_conditions.push_back(from->join->condition);
+            break;
+        case kTableCrossProduct:
+            for (auto const table: *from->list)
+                from_tables(table, scope);
+            break;
+        default:
+            throw SQLExecError("subqueries in FROM are not supported");
     }
-    //projection
-    plan = new EvalPlan(column_names, plan);
+}
+
+QueryResult *SQLExec::select(const SelectStatement *statement) { 
+    Identifier table_name = first_table(statement->fromTable)->name;
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    ColumnNames column_names;
+    EvalPlan *plan;
+    try {
+        plan = select_plan(statement, column_names);
+    } catch (SQLExecError &e) {
+        return new QueryResult(e.what());
+    }
+
     //optimize
-    EvalPlan *optimize = plan->optimize();
-    ValueDicts* rows = optimize->evaluate();
-    ColumnAttributes *column_attributes = table.get_column_attributes(*column_names);    
-    return new QueryResult(column_names, column_attributes, rows, "successufly returned " + to_string(rows->size()) + " rows"); 
+    IndexList table_index_list = table_indices(table_name);
+    TableCatalog catalog;
+    EvalPlan *optimize = plan->optimize(&table_index_list, Tables::get_statistics_table().get(table_name), &catalog);
+    delete plan;
+    try {
+        return evaluate_select(table, column_names, optimize, true);
+    } catch (...) {
+        delete optimize;
+        throw;
+    }
+}
+
+// Start streaming the rows of an optimized plan of a query (the result frees the plan if take_plan is set)
+QueryResult *SQLExec::evaluate_select(DbRelation &table, const ColumnNames &column_names, EvalPlan *plan,
+                                      bool take_plan) {
+    std::chrono::steady_clock::time_point began;
+    if (ExecStats::enabled)
+        began = std::chrono::steady_clock::now();
+    ColumnAttributes *column_attributes = plan->get_column_attributes(column_names);
+    EvalIterator *rows = nullptr;
+    try {
+        rows = plan->iterator(nullptr, true);
+        rows->open();
+    } catch (...) {
+        delete rows;
+        delete column_attributes;
+        throw;
+    }
+    double seconds = 0.0;
+    if (ExecStats::enabled)
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    return new QueryResult(new ColumnNames(column_names), column_attributes, rows, take_plan ? plan : nullptr,
+                           table.get_table_name(), seconds);
 }
 
 // Pull out conjunctions of equality predicates from parse tree
@@ -318,7 +1840,7 @@ QueryResult *SQLExec::create(const CreateStatement *statement) {
     }
 }
 
-QueryResult *SQLExec::create_table(const CreateStatement *statement) {
+QueryResult *SQLExec::create_table(const CreateStatement *statement, const string &storage, uint block_size) {
     Identifier table_name = statement->tableName;
     ColumnNames column_names;
     ColumnAttributes column_attributes;
@@ -330,47 +1852,31 @@ QueryResult *SQLExec::create_table(const CreateStatement *statement) {
         column_attributes.push_back(column_attribute);
     }
 
-    // Add to schema: _tables and _columns
+    // Add to schema: _tables and _columns (if anything goes wrong, the statement's transaction takes it all back)
     ValueDict row;
     row["table_name"] = table_name;
-    Handle t_handle = SQLExec::tables->insert(&row);  // Insert into _tables
-    try {
-        Handles c_handles;
-        DbRelation &columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
-        try {
-            for (uint i = 0; i < column_names.size(); i++) {
-                row["column_name"] = column_names[i];
-                row["data_type"] = Value(column_attributes[i].get_data_type() == ColumnAttribute::INT ? "INT" : "TEXT");
-                c_handles.push_back(columns.insert(&row));  // Insert into _columns
-            }
-
-            // Finally, actually create the relation
-            DbRelation &table = SQLExec::tables->get_table(table_name);
-            if (statement->ifNotExists)
-                table.create_if_not_exists();
-            else
-                table.create();
-
-        } catch (...) {
-            // attempt to remove from _columns
-            try {
-                for (auto const &handle: c_handles)
-                    columns.del(handle);
-            } catch (...) {}
-            throw;
-        }
-
-    } catch (exception &e) {
-        try {
-            // attempt to remove from _tables
-            SQLExec::tables->del(t_handle);
-        } catch (...) {}
-        throw;
+    row["storage"] = Value(storage);
+    SQLExec::tables->insert(&row);  // Insert into _tables
+    row.erase("storage");
+    DbRelation &columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
+    for (uint i = 0; i < column_names.size(); i++) {
+        row["column_name"] = column_names[i];
+        row["data_type"] = Value(column_attributes[i].get_data_type() == ColumnAttribute::INT ? "INT" : "TEXT");
+        columns.insert(&row);  // Insert into _columns
     }
+
+    // Finally, actually create the relation
+    DbRelation &table = SQLExec::tables->get_table(table_name);
+    if (block_size != DbBlock::BLOCK_SZ)
+        table.set_block_size(block_size);
+    if (statement->ifNotExists)
+        table.create_if_not_exists();
+    else
+        table.create();
     return new QueryResult("created " + table_name);
 }
 
-QueryResult *SQLExec::create_index(const CreateStatement *statement) {
+QueryResult *SQLExec::create_index(const CreateStatement *statement, bool unique) {
     Identifier index_name = statement->indexName;
     Identifier table_name = statement->tableName;
 
@@ -383,32 +1889,22 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
         if (find(table_columns.begin(), table_columns.end(), col_name) == table_columns.end())
             throw SQLExecError(string("Column '") + col_name + "' does not exist in " + table_name);
 
-    // insert a row for every column in index into _indices
+    // insert a row for every column in index into _indices (taken back out by the statement's transaction if the
+    // index can't be made)
     ValueDict row;
     row["table_name"] = Value(table_name);
     row["index_name"] = Value(index_name);
     row["index_type"] = Value(statement->indexType);
-    row["is_unique"] = Value(string(statement->indexType) == "BTREE"); // assume HASH is non-unique --
+    row["is_unique"] = Value(unique);
     int seq = 0;
-    Handles i_handles;
-    try {
-        for (auto const &col_name: *statement->indexColumns) {
-            row["seq_in_index"] = Value(++seq);
-            row["column_name"] = Value(col_name);
-            i_handles.push_back(SQLExec::indices->insert(&row));
-        }
-
-        DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
-        index.create();
-
-    } catch (...) {
-        // attempt to remove from _indices
-        try {  // if any exception happens in the reversal below, we still want to re-throw the original ex
-            for (auto const &handle: i_handles)
-                SQLExec::indices->del(handle);
-        } catch (...) {}
-        throw;  // re-throw the original exception (which should give the client some clue as to why it did
+    for (auto const &col_name: *statement->indexColumns) {
+        row["seq_in_index"] = Value(++seq);
+        row["column_name"] = Value(col_name);
+        SQLExec::indices->insert(&row);
     }
+
+    DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
+    index.create();
     return new QueryResult("created index " + index_name);
 }
 
@@ -426,13 +1922,11 @@ QueryResult *SQLExec::drop(const DropStatement *statement) {
 
 QueryResult *SQLExec::drop_table(const DropStatement *statement) {
     Identifier table_name = statement->name;
-    if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME)
+    if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME || table_name == Statistics::TABLE_NAME)
         throw SQLExecError("cannot drop a schema table");
 
-    ValueDict where;
-    where["table_name"] = Value(table_name);
-
-    // get the table
+    // get the table (checking it exists first, so we don't cache a column-less relation for the name)
+    Handle t_handle = Catalog::get_table_handle(table_name);
     DbRelation &table = SQLExec::tables->get_table(table_name);
 
     // remove any indices
@@ -440,25 +1934,26 @@ QueryResult *SQLExec::drop_table(const DropStatement *statement) {
         DbIndex &index = SQLExec::indices->get_index(table_name, index_name);
         index.drop();  // drop the index
     }
-    Handles *handles = SQLExec::indices->select(&where);
-    for (auto const &handle: *handles)
+    Handles handles;
+    for (auto const &row: Catalog::get_indices(table_name))
+        handles.push_back(row.handle);
+    for (auto const &handle: handles)
         SQLExec::indices->del(handle);  // remove all rows from _indices for each index on this table
-    delete handles;
 
-    // remove from _columns schema
+    // remove from _statistics and _columns schema
+    Tables::get_statistics_table().remove(table_name);
     DbRelation &columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
-    handles = columns.select(&where);
-    for (auto const &handle: *handles)
+    handles.clear();
+    for (auto const &row: Catalog::get_columns(table_name))
+        handles.push_back(row.handle);
+    for (auto const &handle: handles)
         columns.del(handle);
-    delete handles;
 
     // remove table
     table.drop();
 
     // finally, remove from _tables schema
-    handles = SQLExec::tables->select(&where);
-    SQLExec::tables->del(*handles->begin()); // expect only one row from select
-    delete handles;
+    SQLExec::tables->del(t_handle);
 
     return new QueryResult(string("dropped ") + table_name);
 }
@@ -472,13 +1967,12 @@ QueryResult *SQLExec::drop_index(const DropStatement *statement) {
     index.drop();
 
     // remove rows from _indices for this index
-    ValueDict where;
-    where["table_name"] = Value(table_name);
-    where["index_name"] = Value(index_name);
-    Handles *handles = SQLExec::indices->select(&where);
-    for (auto const &handle: *handles)
+    Handles handles;
+    for (auto const &row: Catalog::get_indices(table_name))
+        if (row.index_name == index_name)
+            handles.push_back(row.handle);
+    for (auto const &handle: handles)
         SQLExec::indices->del(handle);
-    delete handles;
 
     return new QueryResult("dropped index " + index_name);
 }
@@ -518,17 +2012,21 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) {
     column_names->push_back("is_unique");
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
 
-    ValueDict where;
-    where["table_name"] = Value(string(statement->tableName));
-    Handles *handles = SQLExec::indices->select(&where);
-    u_long n = handles->size();
-
+    Identifier table_name = statement->tableName;
     ValueDicts *rows = new ValueDicts;
-    for (auto const &handle: *handles) {
-        ValueDict *row = SQLExec::indices->project(handle, column_names);
+    for (auto const &index_column: Catalog::get_indices(table_name)) {
+        ValueDict *row = new ValueDict;
+        (*row)["table_name"] = Value(table_name);
+        (*row)["index_name"] = Value(index_column.index_name);
+        (*row)["column_name"] = Value(index_column.column_name);
+        (*row)["seq_in_index"] = Value(index_column.seq_in_index);
+        (*row)["index_type"] = Value(index_column.index_type);
+        Value is_unique(index_column.is_unique ? 1 : 0);
+        is_unique.data_type = ColumnAttribute::BOOLEAN;
+        (*row)["is_unique"] = is_unique;
         rows->push_back(row);
     }
-    delete handles;
+    u_long n = rows->size();
     return new QueryResult(column_names, column_attributes, rows,
                            "successfully returned " + to_string(n) + " rows");
 }
@@ -540,25 +2038,20 @@ QueryResult *SQLExec::show_tables() {
     ColumnAttributes *column_attributes = new ColumnAttributes;
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
 
-    Handles *handles = SQLExec::tables->select();
-    u_long n = handles->size() - 3;
-
     ValueDicts *rows = new ValueDicts;
-    for (auto const &handle: *handles) {
-        ValueDict *row = SQLExec::tables->project(handle, column_names);
-        Identifier table_name = row->at("table_name").s;
-        if (table_name != Tables::TABLE_NAME && table_name != Columns::TABLE_NAME && table_name != Indices::TABLE_NAME)
+    for (auto const &table_name: Catalog::get_table_names()) {
+        if (table_name != Tables::TABLE_NAME && table_name != Columns::TABLE_NAME && table_name != Indices::TABLE_NAME &&
+            table_name != Statistics::TABLE_NAME) {
+            ValueDict *row = new ValueDict;
+            (*row)["table_name"] = Value(table_name);
             rows->push_back(row);
-        else
-            delete row;
+        }
     }
-    delete handles;
+    u_long n = rows->size();
     return new QueryResult(column_names, column_attributes, rows, "successfully returned " + to_string(n) + " rows");
 }
 
 QueryResult *SQLExec::show_columns(const ShowStatement *statement) {
-    DbRelation &columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
-
     ColumnNames *column_names = new ColumnNames;
     column_names->push_back("table_name");
     column_names->push_back("column_name");
@@ -567,28 +2060,27 @@ QueryResult *SQLExec::show_columns(const ShowStatement *statement) {
     ColumnAttributes *column_attributes = new ColumnAttributes;
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
 
-    ValueDict where;
-    where["table_name"] = Value(statement->tableName);
-    Handles *handles = columns.select(&where);
-    u_long n = handles->size();
-
+    Identifier table_name = statement->tableName;
     ValueDicts *rows = new ValueDicts;
-    for (auto const &handle: *handles) {
-        ValueDict *row = columns.project(handle, column_names);
+    for (auto const &column: Catalog::get_columns(table_name)) {
+        ValueDict *row = new ValueDict;
+        (*row)["table_name"] = Value(table_name);
+        (*row)["column_name"] = Value(column.column_name);
+        (*row)["data_type"] = Value(column.data_type);
         rows->push_back(row);
     }
-    delete handles;
+    u_long n = rows->size();
     return new QueryResult(column_names, column_attributes, rows, "successfully returned " + to_string(n) + " rows");
 }
 
 // Test Function for Milestone 5
 bool test_queries() {
-    const int num_queries = 28;
+    const int num_queries = 83;
     const string queries[num_queries] = {"show tables",
                                          "create table foo (id int, data text)",
                                          "show tables",
                                          "show columns from foo",
-                                         "create index fx on foo (id)",
+                                         "create unique index fx on foo (id)",
                                          "create index fz on foo (data)",
                                          "show index from foo",
                                          "insert into foo (id, data) values (1,\"one\")",
@@ -598,6 +2090,13 @@ bool test_queries() {
                                          "select * from foo where id=3",
                                          "select * from foo where id=1 and data=\"one\"",
                                          "select * from foo where id=99 and data=\"nine\"",
+                                         "explain select * from foo where id=1 and data=\"one\"",
+                                         "explain delete from foo",
+                                         "set stats on",
+                                         "explain analyze select * from foo where id=1 and data=\"one\"",
+                                         "select data from foo where id=2",
+                                         "show stats",
+                                         "set stats off",
                                          "select id from foo",
                                          "select data from foo where id=1",
                                          "delete from foo where id=1",
@@ -606,16 +2105,85 @@ bool test_queries() {
                                          "select * from foo",
                                          "insert into foo values (2, \"Two\"); insert into foo values (3, \"Three\"); insert into foo values (99, \"wowzers, Penny!!\")",
                                          "select * from foo",
+                                         "insert into foo values (4, \"Four\"), (5, 'Five'), (-6, \"minus six\")",
+                                         "select * from foo where id=5",
+                                         "analyze foo",
+                                         "select column_name, row_count, distinct_count, min_value, max_value from _statistics",
+                                         "prepare by_id as select data from foo where id = ?",
+                                         "execute by_id(-6)",
+                                         "execute by_id(99)",
+                                         "execute by_id",
                                          "drop index fz from foo",
+                                         "execute by_id(4)",
                                          "show index from foo",
                                          "insert into foo (id) VALUES (100)",
                                          "select * from foo",
                                          "drop table foo",
+                                         "create table goo (id int, data text) with (storage=column)",
+                                         "insert into goo values (1, \"one\"), (2, \"two\"), (3, \"three\")",
+                                         "select * from goo where id=2",
+                                         "delete from goo where data=\"one\"",
+                                         "select data from goo",
+                                         "drop table goo",
+                                         "create table hoo (id int, data text) with (page_size=5000)",
+                                         "create table hoo (id int, data text) with (page_size=16384, storage=heap)",
+                                         "insert into hoo values (1, \"one\"), (2, \"two\")",
+                                         "select * from hoo where id=2",
+                                         "drop table hoo",
+                                         "create table ioo (id int, data text)",
+                                         "create unique index ix on ioo (id)",
+                                         "copy ioo from 'ioo.csv' with (header=true)",
+                                         "select * from ioo",
+                                         "copy ioo from 'ioo.csv' with (header=true)",
+                                         "copy ioo from 'ioo_bad.csv'",
+                                         "copy ioo (data, id) from 'ioo.tsv' with (format=tsv)",
+                                         "select * from ioo where id=250",
+                                         "select * from ioo where id=7",
+                                         "select id, data from ioo limit 3 offset 2",
+                                         "explain select * from ioo limit 3",
+                                         "select count(*) from ioo",
+                                         "select count(*), min(id), max(data) from ioo where data=\"group 2\"",
+                                         "select data, count(*), sum(id) from ioo group by data",
+                                         "explain select sum(id) as total from ioo where id=250",
+                                         "select id, count(*) from ioo",
+                                         "create table joo (label text, n int)",
+                                         "insert into joo values (\"group 1\", 1), (\"group 2\", 2), (\"nobody\", 9)",
+                                         "select joo.n, count(*), min(ioo.id) from ioo join joo on ioo.data = joo.label group by joo.n",
+                                         "select i.id, j.label from ioo i, joo j where i.data = j.label and i.id = 250",
+                                         "analyze joo",
+                                         "explain select j.label, i.data from joo j join ioo i on j.n = i.id where j.label = \"group 1\"",
+                                         "select j.label, i.data from joo j join ioo i on j.n = i.id",
+                                         "explain select count(*) from ioo join joo on ioo.data = joo.label",
+                                         "select id from ioo a join ioo b on a.id = b.id",
+                                         "select n from ioo, joo",
+                                         "drop table joo",
+                                         "drop table ioo",
                                          "show tables"};
     bool passed = true;
 
+    // files for the COPYs, in the database environment's directory
+    const char *home;
+    _DB_ENV->get_home(&home);
+    ofstream(string(home) + "/ioo.csv") << "id,data\r\n1,one\r\n2,\"two, or \"\"deux\"\"\"\r\n\r\n3,\"three\nlines\"\r\n";
+    ofstream(string(home) + "/ioo_bad.csv") << "7,seven\neight,8\n";
+    ofstream tsv(string(home) + "/ioo.tsv");
+    for (int i = 10; i < 500; i++)
+        tsv << "group " << i % 4 << "\t" << i << "\n";
+    tsv.close();
+
     for (int i = 0; i < num_queries; i++) {
         cout << "SQL> " << queries[i] << endl;
+        try {
+            QueryResult *query_result = SQLExec::execute_extended(queries[i]);
+            if (query_result != nullptr) {
+                cout << *query_result << endl;
+                delete query_result;
+                continue;
+            }
+        } catch (SQLExecError &e) {
+            cout << "Error: " << e.what() << endl;
+            continue;
+        }
         SQLParserResult *result = SQLParser::parseSQLString(queries[i]);
         if(result->isValid()) {
             //if result is valid, pass result to our own execute function
@@ -637,6 +2205,12 @@ bool test_queries() {
         }
         delete result;
     }
+
+    // an EXECUTE is as read-only as the statement it binds (by_id is still prepared)
+    if (!SQLExec::is_read_only("execute by_id(4)") || SQLExec::is_read_only("execute nonesuch(4)")) {
+        cout << "read-only EXECUTE failed" << endl;
+        passed = false;
+    }
     
     return passed;
 }
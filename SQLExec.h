@@ -7,6 +7,7 @@
 
 #include <exception>
 #include <string>
+#include <unordered_map>
 #include "SQLParser.h"
 #include "schema_tables.h"
 #include "EvalPlan.h"
@@ -22,16 +23,44 @@ public:
 
 /**
  * @class QueryResult - data structure to hold all the returned data for a query execution
+ * Each row has its values in the same order as column_names.
+ *
+ *      The rows of a SELECT are streamed rather than held: they are pulled from the plan's iterator as the result
+ *      is written out (see operator<<), formatted BATCH_SIZE rows at a time into a buffer that is reused for each
+ *      batch, and the message (which has the number of rows) is only filled in once they have all come out. A
+ *      streamed result has to be used up or freed before the next statement is executed.
  */
 class QueryResult {
 public:
-    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message("") {}
+    static const uint BATCH_SIZE = 256;  // rows formatted before writing them out
+
+    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message(""), stream(nullptr),
+                    stream_open(false), plan(nullptr), table_name(), row_count(0), seconds(0.0), buffer() {}
 
     QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
-                                       message(message) {}
+                                       message(message), stream(nullptr), stream_open(false), plan(nullptr),
+                                       table_name(), row_count(0), seconds(0.0), buffer() {}
+
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, Rows *rows, std::string message)
+            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message),
+              stream(nullptr), stream_open(false), plan(nullptr), table_name(), row_count(0), seconds(0.0),
+              buffer() {}
 
-    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message)
-            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
+    // compatibility: takes (and frees) rows keyed by column name
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message);
+
+    /**
+     * A result whose rows are streamed.
+     * @param column_names       the columns (freed by this result)
+     * @param column_attributes  their types (freed by this result)
+     * @param stream             already opened iterator on the plan (closed and freed by this result)
+     * @param plan               the plan, if this result is to free it (else nullptr--its owner has to keep it
+     *                           until this result is done with it, e.g., in the plan cache)
+     * @param table_name         table the query's rows and time are counted against (see ExecStats)
+     * @param seconds            time already spent on the query (e.g., opening the iterator)
+     */
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, EvalIterator *stream, EvalPlan *plan,
+                const Identifier &table_name, double seconds);
 
     virtual ~QueryResult();
 
@@ -39,43 +68,158 @@ public:
 
     ColumnAttributes *get_column_attributes() const { return column_attributes; }
 
-    ValueDicts *get_rows() const { return rows; }
+    // nullptr for a streamed result
+    Rows *get_rows() const { return rows; }
 
+    // only set for a streamed result once its rows have run out
     const std::string &get_message() const { return message; }
 
-    friend std::ostream &operator<<(std::ostream &stream, const QueryResult &qres);
+    bool is_streamed() const { return stream != nullptr; }
+
+    /**
+     * Pull the next row of a streamed result.
+     * @param row  filled in with the row (TEXT fields may be views that are only good until the next call)
+     * @return     false if there are no more rows (or the result isn't streamed)
+     */
+    virtual bool next(Row &row);
+
+    friend std::ostream &operator<<(std::ostream &stream, QueryResult &qres);
 
 protected:
     ColumnNames *column_names;
     ColumnAttributes *column_attributes;
-    ValueDicts *rows;
+    Rows *rows;
     std::string message;
+    EvalIterator *stream;  // for a streamed result
+    bool stream_open;  // until its rows run out
+    EvalPlan *plan;  // or nullptr
+    Identifier table_name;
+    u_long row_count;  // streamed so far
+    double seconds;  // spent getting them
+    std::string buffer;  // the rows of the batch being formatted
+
+    virtual void finish();
+
+    static void format(const Row &row, std::string &out);
 };
 
 
+class StatementScanner;
+
+class StatementTransaction;
+
+class SelectScope;
+
 /**
  * @class SQLExec - execution engine
  */
 class SQLExec {
 public:
     /**
-     * Execute the given SQL statement.
+     * Execute the given SQL statement. One that may change the database is done in a transaction: committed if it
+     * succeeds (though maybe not on disk until Transaction::wait_durable), otherwise aborted, so that it has done
+     * nothing at all.
      * @param statement   the Hyrise AST of the SQL statement to execute
      * @returns           the query result (freed by caller)
      */
     static QueryResult *execute(const hsql::SQLStatement *statement);
 
+    /**
+     * Execute one of the statements our SQL parser doesn't know about (e.g., VACUUM <table>), or a SELECT or
+     * DELETE whose plan is (or can be) in the plan cache. Done in a transaction, as by execute().
+     * @param query  the text of the statement
+     * @returns      the query result (freed by caller), or nullptr if query is to go through the parser instead
+     */
+    static QueryResult *execute_extended(const std::string &query);
+
+    /**
+     * Whether a statement only reads the database, and so may be executed at the same time as other such statements
+     * (on other threads). Ones that change it have to be executed on their own.
+     * @param query  the text of the statement
+     * @returns      true if it only reads
+     */
+    static bool is_read_only(const std::string &query);
+
+    /**
+     * Get the catalog tables ready (done by the first statement executed, if not before).
+     */
+    static void initialize();
+
+    /**
+     * Throw away all that is cached about the database (plans, tables, indices, statistics, blocks), then read the
+     * catalog in again. For after a transaction aborts: some of what is cached may be its changes, which never
+     * happened.
+     */
+    static void discard_cached();
+
+    /**
+     * Forget the statements PREPARE'd on this thread. Each session has its own, so this is done when a session
+     * starts (on a worker thread some other session may have used).
+     */
+    static void forget_prepared() { SQLExec::prepared.clear(); }
+
+    /**
+     * most plans kept in the plan cache at once
+     */
+    static const size_t PLAN_CACHE_SIZE = 128;
+
 protected:
+    /**
+     * @class CachedPlan - an optimized plan for a SELECT or DELETE, good for any statement with the same text
+     * except for its literals. Each literal is the value for one column of the where clause, so that re-running
+     * the plan is a matter of binding the new literals to those columns.
+     */
+    class CachedPlan {
+    public:
+        CachedPlan() : table_name(), table_version(0), table_blocks(0), is_select(false), column_names(),
+                       parameters(), plan(nullptr), last_used(0) {}
+
+        Identifier table_name;
+        u_long table_version;   // Catalog::get_table_version(table_name) when planned
+        uint32_t table_blocks;  // the table's size when planned
+        bool is_select;
+        ColumnNames column_names;  // what a SELECT returns
+        ColumnNames parameters;  // the column each literal is a value for, in the order of the literals
+        EvalPlan *plan;  // optimized
+        u_long last_used;
+    };
+
     // the one place in the system that holds the _tables table and _indices table
     static Tables *tables;
     static Indices *indices;
 
+    // plans by statement text with the literals taken out (see plan_cache_key), shared by all the sessions
+    static std::unordered_map<std::string, CachedPlan> plan_cache;
+    static u_long plan_cache_clock;
+    static std::mutex plan_cache_latch;  // held while the cache is looked at or changed, not while planning
+
+    // PREPARE'd statements by name, of the session running on this thread (see forget_prepared)
+    static thread_local std::map<Identifier, std::string> prepared;
+
+    /**
+     * @class TableCatalog - the indices and statistics of a join's tables, for the optimizer
+     */
+    class TableCatalog : public PlanCatalog {
+    public:
+        virtual IndexList get_indices(const Identifier &table_name) { return table_indices(table_name); }
+
+        virtual const TableStatistics *get_statistics(const Identifier &table_name) {
+            return Tables::get_statistics_table().get(table_name);
+        }
+    };
+
     // recursive decent into the AST
     static QueryResult *create(const hsql::CreateStatement *statement);
 
-    static QueryResult *create_table(const hsql::CreateStatement *statement);
+    static QueryResult *create_table(const hsql::CreateStatement *statement,
+                                     const std::string &storage = Tables::HEAP_STORAGE,
+                                     uint block_size = DbBlock::BLOCK_SZ);
+
+    static QueryResult *create_table_with(StatementScanner &scanner, StatementTransaction &transaction);
+
+    static QueryResult *create_index(const hsql::CreateStatement *statement, bool unique = false);
 
-    static QueryResult *create_index(const hsql::CreateStatement *statement);
+    static QueryResult *create_unique_index(const std::string &statement_text);
 
     static QueryResult *drop(const hsql::DropStatement *statement);
 
@@ -96,6 +240,47 @@ protected:
     static QueryResult *del(const hsql::DeleteStatement *statement);
 
     static QueryResult *select(const hsql::SelectStatement *statement);
+
+    static QueryResult *vacuum(Identifier table_name);
+
+    static QueryResult *analyze(Identifier table_name);
+
+    static QueryResult *insert_batch(StatementScanner &scanner, StatementTransaction &transaction);
+
+    static QueryResult *copy(StatementScanner &scanner);
+
+    static QueryResult *explain(const std::string &statement_text, bool analyze);
+
+    static QueryResult *set(StatementScanner &scanner);
+
+    static QueryResult *show_stats();
+
+    static QueryResult *prepare(StatementScanner &scanner);
+
+    static QueryResult *execute_prepared(StatementScanner &scanner);
+
+    static QueryResult *deallocate(StatementScanner &scanner);
+
+    static QueryResult *execute_text(const std::string &statement_text);
+
+    static QueryResult *execute_cached(const std::string &query, StatementTransaction &transaction);
+
+    static bool plan_statement(const std::string &query, const std::vector<Value> &literals, CachedPlan &entry);
+
+    static bool is_current(const CachedPlan &entry);
+
+    static QueryResult *evaluate_select(DbRelation &table, const ColumnNames &column_names, EvalPlan *plan,
+                                        bool take_plan);
+
+    static QueryResult *evaluate_delete(const Identifier &table_name, EvalPlan *plan);
+
+    static EvalPlan *select_plan(const hsql::SelectStatement *statement, ColumnNames &column_names);
+
+    static void from_tables(const hsql::TableRef *from, SelectScope &scope);
+
+    static EvalPlan *delete_plan(const hsql::DeleteStatement *statement);
+
+    static IndexList table_indices(const Identifier &table_name);
     
     static ValueDict *get_where_conjunction(const hsql::Expr *parseWhere, const ColumnNames *columnNames);
 
@@ -0,0 +1,467 @@
+/**
+ * @file Server.cpp - implementation of ReadWriteLock, Session and Server
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <streambuf>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Server.h"
+#include "ParseTreeToString.h"
+#include "SQLExec.h"
+#include "Transaction.h"
+
+using namespace std;
+using namespace hsql;
+
+void ReadWriteLock::lock_shared() {
+    unique_lock<mutex> guard(this->latch);
+    this->changed.wait(guard, [this] { return !this->writing && this->writers_waiting == 0; });
+    this->readers++;
+}
+
+void ReadWriteLock::unlock_shared() {
+    lock_guard<mutex> guard(this->latch);
+    if (--this->readers == 0)
+        this->changed.notify_all();
+}
+
+void ReadWriteLock::lock() {
+    unique_lock<mutex> guard(this->latch);
+    this->writers_waiting++;
+    this->changed.wait(guard, [this] { return !this->writing && this->readers == 0; });
+    this->writers_waiting--;
+    this->writing = true;
+}
+
+void ReadWriteLock::unlock() {
+    lock_guard<mutex> guard(this->latch);
+    this->writing = false;
+    this->changed.notify_all();
+}
+
+/**
+ * @class ReplyBuffer - stream buffer holding what a statement writes out, up to a limit
+ *
+ *      Past the limit nothing more is taken, and the stream writing into it goes bad (see overflow), which is what
+ *      stops a result from pulling any more of its rows.
+ */
+class ReplyBuffer : public streambuf {
+public:
+    ReplyBuffer(size_t limit) : limit(limit), text(), full(false) {}
+
+    const string &str() const { return text; }
+
+    bool is_full() const { return full; }
+
+protected:
+    size_t limit;
+    string text;
+    bool full;
+
+    virtual int overflow(int c) {
+        if (c == traits_type::eof())
+            return traits_type::not_eof(c);
+        if (this->text.size() >= this->limit) {
+            this->full = true;
+            return traits_type::eof();
+        }
+        this->text += (char) c;
+        return c;
+    }
+
+    virtual streamsize xsputn(const char *s, streamsize n) {
+        size_t room = this->limit - this->text.size();
+        if ((size_t) n > room) {
+            this->text.append(s, room);
+            this->full = true;
+            return (streamsize) room;
+        }
+        this->text.append(s, (size_t) n);
+        return n;
+    }
+};
+
+ReadWriteLock Session::statement_lock;
+const size_t Session::REPLY_LIMIT;
+
+void Session::run() {
+    Transaction::set_relaxed(false);  // whatever the last session on this thread set
+    SQLExec::forget_prepared();  // and whatever it prepared
+    while (!this->done) {
+        this->out << "SQL> " << flush;
+        string query;
+        if (!getline(this->in, query))
+            break;
+        if (!query.empty() && query.back() == '\r')
+            query.pop_back();  // e.g., from telnet
+        if (query.length() == 0)
+            continue;  // blank line -- just skip
+        if (!command(query))
+            execute(query);
+    }
+}
+
+void Session::execute(const string &query) {
+    // a client slow to take what it is sent mustn't hold the statement lock (and so everyone else) while it does
+    bool read_only = SQLExec::is_read_only(query);
+    ReplyBuffer buffer(REPLY_LIMIT);
+    ostream replies(&buffer);
+    {
+        ReadWriteLock::Guard guard(Session::statement_lock, read_only);
+        execute(query, replies);
+    }
+    this->out << buffer.str();
+    if (buffer.is_full())
+        this->out << endl << "Error: result cut off after " << REPLY_LIMIT << " bytes" << endl;
+
+    // what a change says can't be told until it is on disk, but there is no need to hold up everyone else for that
+    if (!read_only) {
+        try {
+            Transaction::wait_durable();
+        } catch (DbException &e) {
+            this->out << "Error: committed but maybe not durable: " << e.what() << endl;
+        }
+    }
+    this->out << flush;
+}
+
+void Session::execute(const string &query, ostream &out) {
+    // statements the parser doesn't know about (and ones with a cached plan)
+    try {
+        QueryResult *result = SQLExec::execute_extended(query);
+        if (result != nullptr) {
+            out << *result << endl;
+            delete result;
+            return;
+        }
+    } catch (SQLExecError &e) {
+        out << "Error: " << e.what() << endl;
+        return;
+    }
+
+    // parse and execute
+    SQLParserResult *parse = SQLParser::parseSQLString(query);
+    if (!parse->isValid()) {
+        out << "invalid SQL: " << query << endl;
+        out << parse->errorMsg() << endl;
+    } else {
+        for (uint i = 0; i < parse->size(); ++i) {
+            const SQLStatement *statement = parse->getStatement(i);
+            try {
+                out << ParseTreeToString::statement(statement) << endl;
+                QueryResult *result = SQLExec::execute(statement);
+                out << *result << endl;
+                delete result;
+            } catch (SQLExecError &e) {
+                out << "Error: " << e.what() << endl;
+            }
+        }
+    }
+    delete parse;
+}
+
+bool Session::command(const string &query) {
+    if (query != "quit")
+        return false;
+    this->done = true;
+    return true;
+}
+
+/**
+ * @class SocketBuffer - stream buffer for reading and writing a connected socket
+ */
+class SocketBuffer : public streambuf {
+public:
+    static const size_t BUFFER_SIZE = 4096;
+
+    SocketBuffer(int socket) : socket(socket) {
+        setg(this->input, this->input, this->input);
+        setp(this->output, this->output + BUFFER_SIZE);
+    }
+
+    virtual ~SocketBuffer() { sync(); }
+
+protected:
+    int socket;
+    char input[BUFFER_SIZE];
+    char output[BUFFER_SIZE];
+
+    virtual int underflow() {
+        ssize_t n;
+        do {
+            n = recv(this->socket, this->input, BUFFER_SIZE, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+            return traits_type::eof();
+        setg(this->input, this->input, this->input + n);
+        return traits_type::to_int_type(this->input[0]);
+    }
+
+    virtual int overflow(int c) {
+        if (sync() != 0)
+            return traits_type::eof();
+        if (c != traits_type::eof()) {
+            *pptr() = (char) c;
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    // Send all that has been written (a client that has gone away gets no SIGPIPE, just an error)
+    virtual int sync() {
+        const char *next = pbase();
+        while (next < pptr()) {
+            ssize_t n = send(this->socket, next, pptr() - next, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return -1;
+            next += n;
+        }
+        setp(this->output, this->output + BUFFER_SIZE);
+        return 0;
+    }
+};
+
+/**
+ * @class ClientSession - a Session for a connection, which can also stop the server
+ */
+class ClientSession : public Session {
+public:
+    ClientSession(Server &server, istream &in, ostream &out) : Session(in, out), server(server) {}
+
+protected:
+    Server &server;
+
+    virtual bool command(const string &query) {
+        if (query != "shutdown")
+            return Session::command(query);
+        this->out << "shutting down" << endl;
+        this->server.stop();
+        this->done = true;
+        return true;
+    }
+};
+
+Server::Server(uint16_t port, uint threads) : listener(-1), port(port), thread_count(threads == 0 ? 1 : threads),
+                                              stopping(false), latch(), arrived(), waiting(), connected() {
+    this->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (this->listener < 0)
+        throw ServerError(string("can't make a socket: ") + strerror(errno));
+    int yes = 1;
+    setsockopt(this->listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    socklen_t size = sizeof(address);
+    if (bind(this->listener, (sockaddr *) &address, size) != 0 || listen(this->listener, SOMAXCONN) != 0 ||
+        getsockname(this->listener, (sockaddr *) &address, &size) != 0) {
+        string error = strerror(errno);
+        close(this->listener);
+        throw ServerError("can't listen on port " + to_string(port) + ": " + error);
+    }
+    this->port = ntohs(address.sin_port);
+}
+
+Server::~Server() {
+    close(this->listener);
+}
+
+void Server::serve() {
+    SQLExec::initialize();  // before there are sessions to race each other to do it
+    vector<thread> workers;
+    for (uint i = 0; i < this->thread_count; i++)
+        workers.push_back(thread(&Server::work, this));
+
+    while (!this->stopping) {
+        pollfd ready;
+        ready.fd = this->listener;
+        ready.events = POLLIN;
+        ready.revents = 0;
+        if (poll(&ready, 1, POLL_MS) <= 0)
+            continue;  // time to check for stop() again (or a signal came in)
+        int connection = accept(this->listener, nullptr, nullptr);
+        if (connection < 0)
+            continue;
+        lock_guard<mutex> guard(this->latch);
+        if (this->waiting.empty() && this->connected.size() >= this->thread_count)
+            cerr << "(sql5300: all " << this->thread_count << " sessions busy, new connections wait for one to end)"
+                 << endl;
+        this->waiting.push_back(connection);
+        this->arrived.notify_one();
+    }
+
+    {
+        // the sessions still running see the end of their input (after the statement they are on, if any)
+        lock_guard<mutex> guard(this->latch);
+        for (auto connection: this->connected)
+            shutdown(connection, SHUT_RDWR);
+        this->arrived.notify_all();
+    }
+    for (auto &worker: workers)
+        worker.join();
+    for (auto connection: this->waiting)
+        close(connection);
+    this->waiting.clear();
+}
+
+// Run sessions one after another, as connections come in, until the server stops
+void Server::work() {
+    while (true) {
+        int connection;
+        {
+            unique_lock<mutex> guard(this->latch);
+            this->arrived.wait(guard, [this] { return this->stopping || !this->waiting.empty(); });
+            if (this->stopping)
+                return;
+            connection = this->waiting.front();
+            this->waiting.pop_front();
+            this->connected.insert(connection);
+        }
+        run_session(connection);
+        {
+            lock_guard<mutex> guard(this->latch);
+            this->connected.erase(connection);
+        }
+        close(connection);
+    }
+}
+
+/**
+ * Run a session on a connection (until its client quits or goes away).
+ * @param connection  the connected socket
+ */
+void Server::run_session(int connection) {
+    SocketBuffer buffer(connection);
+    istream in(&buffer);
+    ostream out(&buffer);
+    ClientSession session(*this, in, out);
+    try {
+        session.run();
+    } catch (exception &e) {
+        out << "Error: " << e.what() << endl;  // and the session is over, but not the server
+    }
+}
+
+// Connect to a server on this machine
+static int connect_to(uint16_t port) {
+    int connection = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connection >= 0 && connect(connection, (sockaddr *) &address, sizeof(address)) != 0) {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+// Everything the server sends up to its next prompt (or until it hangs up)
+static string reply(int connection) {
+    string received;
+    char bytes[1024];
+    while (received.size() < 5 || received.compare(received.size() - 5, 5, "SQL> ") != 0) {
+        ssize_t n = recv(connection, bytes, sizeof(bytes), 0);
+        if (n <= 0)
+            break;
+        received.append(bytes, n);
+    }
+    return received;
+}
+
+// Send a line to the server and get back what it makes of it
+static string request(int connection, const string &line) {
+    string sent = line + "\n";
+    if (send(connection, sent.data(), sent.size(), MSG_NOSIGNAL) != (ssize_t) sent.size())
+        return "";
+    return reply(connection);
+}
+
+/**
+ * Testing function for Server: several clients querying a table at once while another inserts into it, then a
+ * client shutting down the server.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_server() {
+    const int READERS = 4, QUERIES = 25, ROWS = 10;
+    if (!SQLExec::is_read_only("explain select b from _test_server") ||
+        SQLExec::is_read_only("explain analyze select b from _test_server"))
+        return assertion_failure("read-only statements");  // EXPLAIN ANALYZE turns on counting for everyone
+    Server server(0, READERS + 2);
+    thread serving(&Server::serve, &server);
+    atomic<int> failures(0);
+
+    int setup = connect_to(server.get_port());
+    if (setup < 0 || reply(setup).find("SQL> ") == string::npos ||
+        request(setup, "create table _test_server (a int, b text)").find("created _test_server") == string::npos)
+        failures++;
+    for (int i = 0; i < ROWS && failures == 0; i++)
+        if (request(setup, "insert into _test_server values (" + to_string(i) + ", 'row " + to_string(i) + "')")
+                    .find("successfully inserted 1 row") == string::npos)
+            failures++;
+
+    if (failures == 0) {
+        vector<thread> clients;
+        for (int reader = 0; reader < READERS; reader++)
+            clients.push_back(thread([&server, &failures, reader] {
+                int connection = connect_to(server.get_port());
+                reply(connection);
+                for (int i = 0; i < QUERIES; i++) {
+                    int a = (reader + i) % ROWS;
+                    string got = request(connection, "select b from _test_server where a = " + to_string(a));
+                    if (got.find("\"row " + to_string(a) + "\"") == string::npos ||
+                        got.find("returned 1 rows") == string::npos)
+                        failures++;
+                }
+                request(connection, "quit");
+                close(connection);
+            }));
+        clients.push_back(thread([&server, &failures] {
+            int connection = connect_to(server.get_port());
+            reply(connection);
+            for (int i = ROWS; i < ROWS + QUERIES; i++)
+                if (request(connection, "insert into _test_server values (" + to_string(i) + ", 'new')")
+                            .find("successfully inserted 1 row") == string::npos)
+                    failures++;
+            request(connection, "quit");
+            close(connection);
+        }));
+        for (auto &client: clients)
+            client.join();
+        if (request(setup, "select count(*) from _test_server").find(to_string(ROWS + QUERIES)) == string::npos)
+            failures++;
+
+        // a session's prepared statements are its own
+        if (request(setup, "prepare _test_q as select b from _test_server where a = ?").find("prepared") ==
+            string::npos || request(setup, "execute _test_q (3)").find("\"row 3\"") == string::npos)
+            failures++;
+        int other = connect_to(server.get_port());
+        reply(other);
+        if (request(other, "execute _test_q (3)").find("no prepared statement _test_q") == string::npos)
+            failures++;
+        request(other, "quit");
+        close(other);
+    }
+
+    request(setup, "drop table _test_server");
+    bool shut_down = request(setup, "shutdown").find("shutting down") != string::npos;
+    server.stop();  // in case the shutdown didn't get through
+    serving.join();
+    close(setup);
+    if (failures > 0)
+        return assertion_failure("server replies", failures);
+    if (!shut_down)
+        return assertion_failure("shutdown");
+    return true;
+}
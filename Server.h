@@ -0,0 +1,211 @@
+/**
+ * @file Server.h - running statements for several clients at once
+ * ReadWriteLock
+ * Session
+ * Server
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * @class ServerError - exception for Server methods
+ */
+class ServerError : public std::runtime_error {
+public:
+    explicit ServerError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class ReadWriteLock - held by any number of readers at once, or else by one writer
+ *
+ *      Writers go first: once one is waiting, no more readers get in until it has had its turn, so a steady
+ *      stream of queries can't keep a change out forever.
+ */
+class ReadWriteLock {
+public:
+    ReadWriteLock() : latch(), changed(), readers(0), writers_waiting(0), writing(false) {}
+
+    virtual ~ReadWriteLock() {}
+
+    ReadWriteLock(const ReadWriteLock &other) = delete;
+
+    ReadWriteLock &operator=(const ReadWriteLock &other) = delete;
+
+    // Wait until there is no writer (or writer waiting), then hold the lock as one of its readers
+    virtual void lock_shared();
+
+    virtual void unlock_shared();
+
+    // Wait until there are no readers or other writer, then hold the lock alone
+    virtual void lock();
+
+    virtual void unlock();
+
+    /**
+     * @class Guard - holds a ReadWriteLock for as long as the scope lasts
+     */
+    class Guard {
+    public:
+        Guard(ReadWriteLock &lock, bool shared) : lock(lock), shared(shared) {
+            if (shared)
+                lock.lock_shared();
+            else
+                lock.lock();
+        }
+
+        virtual ~Guard() {
+            if (shared)
+                lock.unlock_shared();
+            else
+                lock.unlock();
+        }
+
+        Guard(const Guard &other) = delete;
+
+        Guard &operator=(const Guard &other) = delete;
+
+    protected:
+        ReadWriteLock &lock;
+        bool shared;
+    };
+
+protected:
+    std::mutex latch;
+    std::condition_variable changed;
+    uint readers;
+    uint writers_waiting;
+    bool writing;
+};
+
+/**
+ * @class Session - reads lines of SQL from a client and writes back what each one does, as the shell does
+ *
+ *      Each line holds the statement lock while it is executed: shared if it only reads (see
+ *      SQLExec::is_read_only), otherwise exclusive. So any number of sessions can be running queries at once, and a
+ *      change has the database to itself. The lock is shared by all the sessions in the process. What a line writes
+ *      out is held (up to REPLY_LIMIT bytes) until it lets go of the lock, so no client can hold up the others by
+ *      being slow to read its results. A change also waits for its commit to get to the disk (see
+ *      Transaction::wait_durable) before its results are written out, but only once it has let go of the lock. What
+ *      a session PREPAREs is its own, not to be EXECUTEd by the others.
+ */
+class Session {
+public:
+    static const size_t REPLY_LIMIT = 64 * 1024 * 1024;  // most bytes written out for one line
+
+    /**
+     * @param in   where the lines come from
+     * @param out  where the results go
+     */
+    Session(std::istream &in, std::ostream &out) : in(in), out(out), done(false) {}
+
+    virtual ~Session() {}
+
+    Session(const Session &other) = delete;
+
+    Session &operator=(const Session &other) = delete;
+
+    /**
+     * Prompt for, read and execute lines until one is "quit" (or the input runs out).
+     */
+    virtual void run();
+
+    /**
+     * Execute one line: one of our own statements or one with a cached plan, or else whatever the parser makes of
+     * it (each statement echoed back first), writing out the results or the error.
+     * @param query  the line
+     */
+    virtual void execute(const std::string &query);
+
+protected:
+    std::istream &in;
+    std::ostream &out;
+    bool done;
+
+    static ReadWriteLock statement_lock;
+
+    /**
+     * Handle a line that isn't SQL, e.g., "quit".
+     * @param query  the line
+     * @return       false if it is to be executed as SQL
+     */
+    virtual bool command(const std::string &query);
+
+    /**
+     * Execute one line, as execute() does, while holding the statement lock.
+     * @param query  the line
+     * @param out    where the results go
+     */
+    virtual void execute(const std::string &query, std::ostream &out);
+};
+
+/**
+ * @class Server - listens on a TCP port and runs a Session for each connection
+ *
+ *      Connections are handed to a fixed pool of worker threads, each running one session at a time until its
+ *      client quits or goes away, idle or not. So no more than that many clients are served at once: connections
+ *      that arrive while all the workers are busy get no service (a warning says so) until a session ends. A client
+ *      can stop the server with "shutdown" (as can stop(), e.g., from a signal handler).
+ */
+class Server {
+public:
+    static const uint DEFAULT_THREADS = 16;
+
+    /**
+     * Start listening (on all interfaces).
+     * @param port     TCP port (0 to have the system pick one, see get_port)
+     * @param threads  number of sessions run at once
+     * @throws ServerError  if the port can't be listened on
+     */
+    Server(uint16_t port, uint threads = DEFAULT_THREADS);
+
+    virtual ~Server();
+
+    Server(const Server &other) = delete;
+
+    Server &operator=(const Server &other) = delete;
+
+    uint16_t get_port() const { return port; }
+
+    /**
+     * Accept connections and run their sessions until stop() is called, then end the sessions still running and
+     * wait for them to finish.
+     */
+    virtual void serve();
+
+    /**
+     * Have serve() return (soon). Safe to call from any thread or from a signal handler.
+     */
+    void stop() { stopping = true; }
+
+protected:
+    static const int POLL_MS = 200;  // how often serve() checks for stop()
+
+    int listener;
+    uint16_t port;
+    uint thread_count;
+    std::atomic<bool> stopping;
+    std::mutex latch;  // for waiting and connected
+    std::condition_variable arrived;
+    std::deque<int> waiting;  // connections not yet picked up by a worker
+    std::set<int> connected;  // connections with a session running
+
+    virtual void work();
+
+    virtual void run_session(int connection);
+};
+
+bool test_server();
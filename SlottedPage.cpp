@@ -18,10 +18,14 @@ typedef uint16_t u16;
 SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(block, block_id, is_new) {
     if (is_new) {
         this->num_records = 0;
-        this->end_free = DbBlock::BLOCK_SZ - 1;
+        this->end_free = (u16) (get_block_size() - 1);
+        this->num_live = 0;
+        this->fragmented = 0;
+        this->counted = true;
         put_header();
     } else {
         get_header(this->num_records, this->end_free);
+        this->counted = false;  // not until something needs them (see count_records)
     }
 }
 
@@ -31,10 +35,14 @@ SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(bl
  * @return the new block's id
  */
 RecordID SlottedPage::add(const Dbt *data) {
-    if (!has_room((u16) data->get_size()))
+    count_records();
+    if (!has_room(data->get_size()))
         throw DbBlockNoRoomError("not enough room for new record");
-    u16 id = ++this->num_records;
     u16 size = (u16) data->get_size();
+    if (size + 4U > contiguous_bytes())
+        defragment();
+    u16 id = ++this->num_records;
+    this->num_live++;
     this->end_free -= size;
     u16 loc = this->end_free + 1U;
     put_header();
@@ -43,6 +51,37 @@ RecordID SlottedPage::add(const Dbt *data) {
     return id;
 }
 
+/**
+ * Add a new record at the given position, moving the records from there on up by one. This is for blocks that
+ * keep their records in order (e.g., B-tree leaves), since it changes the ids of the records that move; it assumes
+ * there are no deleted records from the position on.
+ * @param record_id  where the new record goes (from 1 up to one past the last record)
+ * @param data       the new record
+ * @return           record_id
+ * @throws DbBlockNoRoomError if it won't fit
+ */
+RecordID SlottedPage::insert(RecordID record_id, const Dbt *data) {
+    if (record_id == 0 || record_id > this->num_records + 1U)
+        throw DbRelationError("no such record position " + std::to_string(record_id));
+    count_records();
+    if (!has_room(data->get_size()))
+        throw DbBlockNoRoomError("not enough room for new record");
+    u16 size = (u16) data->get_size();
+    if (size + 4U > contiguous_bytes())
+        defragment();
+    // open up a header slot
+    u16 at = (u16) (HEADER_SZ + 4 * (record_id - 1));
+    memmove(this->address((u16) (at + 4)), this->address(at), 4U * (this->num_records - record_id + 1U));
+    this->num_records++;
+    this->num_live++;
+    this->end_free -= size;
+    u16 loc = this->end_free + 1U;
+    put_header();
+    put_header(record_id, size, loc);
+    memcpy(this->address(loc), data->get_data(), size);
+    return record_id;
+}
+
 /**
  * Get a record from the block.
  * @param record_id
@@ -56,43 +95,91 @@ Dbt *SlottedPage::get(RecordID record_id) const {
     return new Dbt(this->address(loc), size);
 }
 
+bool SlottedPage::get(RecordID record_id, Dbt &data) const {
+    u16 size, loc;
+    get_header(size, loc, record_id);
+    if (loc == 0)
+        return false;
+    data.set_data(this->address(loc));
+    data.set_size(size);
+    return true;
+}
+
 /**
  * Replace the record with the given data.
  * @param record_id   record to replace
- * @param data        new contents of record_id
+ * @param data        new contents of record_id (if enlarging, must not be in this block)
  * @throws DbBlockNoRoomError if it won't fit
  */
 void SlottedPage::put(RecordID record_id, const Dbt &data) {
+    count_records();
     u16 size, loc;
     get_header(size, loc, record_id);
+    if (data.get_size() > size && data.get_size() - size > unused_bytes())
+        throw DbBlockNoRoomError("not enough room for enlarged record");
     u16 new_size = (u16) data.get_size();
-    if (new_size > size) {
-        u16 extra = new_size - size;
-        if (!has_room(extra))
-            throw DbBlockNoRoomError("not enough room for enlarged record");
-        slide(loc, loc - extra);
-        memcpy(this->address(loc - extra), data.get_data(), new_size);
+    if (new_size <= size) {
+        // keep the record's last byte where it is, so the hole is on the free-space side
+        u16 new_loc = loc + size - new_size;
+        memmove(this->address(new_loc), data.get_data(), new_size);
+        if (loc == this->end_free + 1U)
+            this->end_free += size - new_size;
+        else
+            this->fragmented += size - new_size;
+        put_header(record_id, new_size, new_loc);
     } else {
-        memcpy(this->address(loc), data.get_data(), new_size);
-        slide(loc + new_size, loc + size);
+        // the old copy becomes a hole and the new one goes into the free space
+        if (loc == this->end_free + 1U)
+            this->end_free += size;
+        else
+            this->fragmented += size;
+        put_header(record_id, 0, 0);
+        if (new_size > contiguous_bytes())
+            defragment();
+        this->end_free -= new_size;
+        u16 new_loc = this->end_free + 1U;
+        memcpy(this->address(new_loc), data.get_data(), new_size);
+        put_header(record_id, new_size, new_loc);
     }
-    get_header(size, loc, record_id);
-    put_header(record_id, new_size, loc);
+    put_header();
 }
 
 /**
  * Delete a record from the page.
  *
- * Mark the given id as deleted by changing its size to zero and its location to 0.
- * Compact the rest of the data in the block. But keep the record ids the same for everyone.
+ * Mark the given id as deleted by changing its size to zero and its location to 0. Its data is left as a hole
+ * to be squeezed out later (see defragment). The record ids stay the same for everyone.
  *
  * @param record_id  record to delete
  */
 void SlottedPage::del(RecordID record_id) {
+    count_records();
     u16 size, loc;
     get_header(size, loc, record_id);
+    if (loc == 0)
+        return;  // already gone
     put_header(record_id, 0, 0);  // 0 is the tombstone sentinel
-    slide(loc, loc + size);
+    this->num_live--;
+    if (loc == this->end_free + 1U)
+        this->end_free += size;  // it was next to the free space, so no hole
+    else
+        this->fragmented += size;
+    put_header();
+}
+
+/**
+ * Delete a record and move the ones after it down by one, so no tombstone is left behind (the opposite of insert).
+ * As with insert, this is for blocks that keep their records in order and changes the ids of the records that move.
+ * @param record_id  record to remove
+ */
+void SlottedPage::remove(RecordID record_id) {
+    if (record_id == 0 || record_id > this->num_records)
+        throw DbRelationError("no such record " + std::to_string(record_id));
+    del(record_id);
+    u16 at = (u16) (HEADER_SZ + 4 * (record_id - 1));
+    memmove(this->address(at), this->address((u16) (at + 4)), 4U * (this->num_records - record_id));
+    this->num_records--;
+    put_header();
 }
 
 /**
@@ -101,6 +188,7 @@ void SlottedPage::del(RecordID record_id) {
  */
 RecordIDs *SlottedPage::ids(void) const {
     RecordIDs *vec = new RecordIDs();
+    vec->reserve(this->counted ? this->num_live : this->num_records);
     u16 size, loc;
     for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
         get_header(size, loc, record_id);
@@ -110,28 +198,59 @@ RecordIDs *SlottedPage::ids(void) const {
     return vec;
 }
 
+/**
+ * Next non-deleted record ID after the given one.
+ * @param record_id  record before the one wanted (0 to get the first)
+ * @return           the next record ID, or 0 if there are no more
+ */
+RecordID SlottedPage::next_id(RecordID record_id) const {
+    u16 size, loc;
+    while (++record_id <= this->num_records) {
+        get_header(size, loc, record_id);
+        if (loc != 0)
+            return record_id;
+    }
+    return 0;
+}
+
 /**
  * Erase all the records
  */
 void SlottedPage::clear() {
     this->num_records = 0;
-    this->end_free = DbBlock::BLOCK_SZ - 1;
+    this->end_free = (u16) (get_block_size() - 1);
+    this->num_live = 0;
+    this->fragmented = 0;
+    this->counted = true;
     put_header();
 }
 
 /**
- * Count of non-deleted records
- * @return number of current records
+ * Give back all the space deleted records are still holding on to: squeeze out the holes and drop the
+ * tombstones at the end (whose header slots can then be reused by later records).
  */
-u16 SlottedPage::size() const {
+void SlottedPage::compact() {
+    defragment();
     u16 size, loc;
-    u16 count = 0;
-    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
-        get_header(size, loc, record_id);
+    while (this->num_records > 0) {
+        get_header(size, loc, this->num_records);
         if (loc != 0)
-            count++;
+            break;
+        this->num_records--;
     }
-    return count;
+    put_header();
+}
+
+/**
+ * Count of non-deleted records
+ * @return number of current records
+ */
+u16 SlottedPage::size() const {
+    if (this->counted)
+        return this->num_live;
+    u16 live, fragmented;
+    tally(live, fragmented);
+    return live;
 }
 
 
@@ -142,8 +261,9 @@ u16 SlottedPage::size() const {
  * @param id    the id of the header to fetch
  */
 void SlottedPage::get_header(u_int16_t &size, u_int16_t &loc, RecordID id) const {
-    size = get_n((u16) 4 * id);
-    loc = get_n((u16) (4 * id + 2));
+    u16 offset = id == 0 ? 0 : (u16) (HEADER_SZ + 4 * (id - 1));
+    size = get_n(offset);
+    loc = get_n((u16) (offset + 2));
 }
 
 /**
@@ -154,29 +274,77 @@ void SlottedPage::get_header(u_int16_t &size, u_int16_t &loc, RecordID id) const
  */
 void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
     if (id == 0) { // called the put_header() version and using the default params
-        size = this->num_records;
-        loc = this->end_free;
+        put_n(0, this->num_records);
+        put_n(2, this->end_free);
+        return;
     }
-    put_n((u16) 4 * id, size);
-    put_n((u16) (4 * id + 2), loc);
+    u16 offset = (u16) (HEADER_SZ + 4 * (id - 1));
+    put_n(offset, size);
+    put_n((u16) (offset + 2), loc);
+}
+
+/**
+ * Work out the number of live records and of fragmented bytes from the record headers: whatever of the data
+ * region the live records don't take up is holes.
+ * @param live        set to the number of live records
+ * @param fragmented  set to the bytes in holes
+ */
+void SlottedPage::tally(u16 &live, u16 &fragmented) const {
+    uint data_bytes = get_block_size() - 1U - this->end_free;
+    uint live_bytes = 0;
+    u16 size, loc;
+    live = 0;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        get_header(size, loc, record_id);
+        if (loc == 0)
+            continue;
+        live++;
+        live_bytes += size;
+    }
+    fragmented = (u16) (data_bytes - live_bytes);
+}
+
+/**
+ * Keep the tallies from now on, before the block is changed (done once each time it is read in: it stays in its
+ * buffer-pool frame, and a scan that only reads its records never gets here). Until then, size() and
+ * unused_bytes() tally the headers without keeping anything, so that readers on other threads change nothing.
+ */
+void SlottedPage::count_records() {
+    if (this->counted)
+        return;
+    tally(this->num_live, this->fragmented);
+    this->counted = true;
 }
 
 /**
  * Calculate if we have room to store a record with given size. The size should include the 4 bytes
  * for the header, too, if this is an add.
  * @param size   size of the new record (not including the header space needed)
- * @return       true if there is enough room, false otherwise
+ * @return       true if there is enough room (possibly after defragmenting), false otherwise
  */
-bool SlottedPage::has_room(u16 size) const {
-    return size + (u16)4 <= this->unused_bytes();
+bool SlottedPage::has_room(u_int32_t size) const {
+    return size + 4U <= this->unused_bytes();
 }
 
 /**
- * Get the number of bytes not currently used to store data or for overhead.
+ * Get the number of bytes not currently used to store data or for overhead (including the holes left by
+ * deleted records, since they can be had by defragmenting).
  * @return number of bytes
  */
 u16 SlottedPage::unused_bytes() const {
-    u16 headers = (u16) (4 * (this->num_records + 1));
+    if (this->counted)
+        return contiguous_bytes() + this->fragmented;
+    u16 live, fragmented;
+    tally(live, fragmented);
+    return contiguous_bytes() + fragmented;
+}
+
+/**
+ * Get the number of bytes between the headers and the data, i.e., what can be used without defragmenting.
+ * @return number of bytes
+ */
+u16 SlottedPage::contiguous_bytes() const {
+    u16 headers = (u16) (HEADER_SZ + 4 * this->num_records);
     u16 unused;
     if (this->end_free <= headers)
         unused = 0;
@@ -186,40 +354,29 @@ u16 SlottedPage::unused_bytes() const {
 }
 
 /**
- * Slide the contents to compensate for a smaller/larger record.
- *
- * If start < end, then remove data from offset start up to but not including offset end by sliding data
- * that is to the left of start to the right. If start > end, then make room for extra data from end to start
- * by sliding data that is to the left of start to the left.
- * Also fix up any record headers whose data has slid. Assumes there is enough room if it is a left
- * shift (end < start).
- *
- * @param start  beginning of slide
- * @param end    end of slide
+ * Squeeze out the holes left by deleted and resized records so that all the unused bytes are together.
+ * Records keep their ids; only their offsets change.
  */
-void SlottedPage::slide(u_int16_t start, u_int16_t end) {
-    int shift = end - start;
-    if (shift == 0)
+void SlottedPage::defragment() {
+    count_records();
+    if (this->fragmented == 0)
         return;
-
-    // slide data
-    void *to = this->address((u16) (this->end_free + 1 + shift));
-    void *from = this->address((u16) (this->end_free + 1));
-    int bytes = start - (this->end_free + 1U);
-    memmove(to, from, bytes);
-
-    // fix up headers to the right
-    RecordIDs *record_ids = ids();
-    for (auto const &record_id : *record_ids) {
-        u16 size, loc;
+    uint block_size = get_block_size();
+    char *packed = new char[block_size];
+    uint to = block_size;  // can be 64K, one more than a u16 holds
+    u16 size, loc;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
         get_header(size, loc, record_id);
-        if (loc <= start) {
-            loc += shift;
-            put_header(record_id, size, loc);
-        }
+        if (loc == 0)
+            continue;
+        to -= size;
+        memcpy(packed + to, this->address(loc), size);
+        put_header(record_id, size, (u16) to);
     }
-    delete record_ids;
-    this->end_free += shift;
+    memcpy(this->address((u16) to), packed + to, block_size - to);
+    delete[] packed;
+    this->end_free = (u16) (to - 1U);
+    this->fragmented = 0;
     put_header();
 }
 
@@ -303,7 +460,7 @@ bool test_slotted_page() {
     if (expected != actual)
         return assertion_failure("get 2 back " + actual);
 
-    // test put with expansion (and slide and ids)
+    // test put with expansion (and ids)
     char rec1_rev[] = "something much bigger";
     rec1_dbt = Dbt(rec1_rev, sizeof(rec1_rev));
     slot.put(1, rec1_dbt);
@@ -321,7 +478,7 @@ bool test_slotted_page() {
     if (expected != actual)
         return assertion_failure("get 1 back after expanding put of 1 " + actual);
 
-    // test put with contraction (and slide and ids)
+    // test put with contraction (and ids)
     rec1_dbt = Dbt(rec1, sizeof(rec1));
     slot.put(1, rec1_dbt);
     // check both rec2 and rec1 after contracting put
@@ -348,6 +505,8 @@ bool test_slotted_page() {
     if (id_list->size() != 1 || id_list->at(0) != 2)
         return assertion_failure("ids() with 1 record remaining");
     delete id_list;
+    if (slot.next_id(0) != 2 || slot.next_id(2) != 0)
+        return assertion_failure("next_id() with 1 record remaining");
     get_dbt = slot.get(1);
     if (get_dbt != nullptr)
         return assertion_failure("get of deleted record was not null");
@@ -364,6 +523,68 @@ bool test_slotted_page() {
         return assertion_failure("wrong type thrown when add too big");
     }
 
+    // deleting leaves a hole, which gets squeezed out once an add needs the room
+    SlottedPage holes(block_dbt, 2, true);
+    char big[1500];
+    memset(big, 'a', 1000);
+    Dbt big_dbt(big, 1000);
+    holes.add(&big_dbt);
+    memset(big, 'b', 1000);
+    holes.add(&big_dbt);
+    memset(big, 'c', 1000);
+    holes.add(&big_dbt);
+    holes.del(2);
+    if (holes.size() != 2 || holes.fragmented != 1000)
+        return assertion_failure("del did not leave a hole", holes.size(), holes.fragmented);
+    SlottedPage reread(block_dbt, 2);
+    if (reread.counted || reread.size() != 2 || reread.unused_bytes() != holes.unused_bytes())
+        return assertion_failure("hole not counted when block read", reread.size(), reread.unused_bytes());
+    reread.count_records();  // as a change would
+    if (reread.num_live != 2 || reread.fragmented != 1000)
+        return assertion_failure("hole not kept when block read", reread.num_live, reread.fragmented);
+    memset(big, 'd', sizeof(big));
+    big_dbt = Dbt(big, sizeof(big));
+    if (holes.add(&big_dbt) != 4 || holes.fragmented != 0 || holes.size() != 3)
+        return assertion_failure("add did not defragment");
+    for (RecordID record_id = 1; record_id <= 4; record_id++) {
+        if (record_id == 2)
+            continue;
+        get_dbt = holes.get(record_id);
+        char expect = (char) ('a' + record_id - 1);
+        bool same = get_dbt->get_size() == (record_id == 4 ? sizeof(big) : 1000U);
+        for (uint i = 0; same && i < get_dbt->get_size(); i++)
+            same = ((char *) get_dbt->get_data())[i] == expect;
+        delete get_dbt;
+        if (!same)
+            return assertion_failure("record moved by defragment is wrong", record_id);
+    }
+
+    // inserting in the middle moves the later records up
+    SlottedPage ordered(block_dbt, 3, true);
+    char one_byte = 'a';
+    Dbt byte_dbt(&one_byte, 1);
+    ordered.add(&byte_dbt);
+    one_byte = 'c';
+    ordered.add(&byte_dbt);
+    one_byte = 'b';
+    ordered.insert(2, &byte_dbt);
+    one_byte = 'd';
+    ordered.insert(4, &byte_dbt);
+    for (RecordID record_id = 1; record_id <= 4; record_id++) {
+        get_dbt = ordered.get(record_id);
+        bool same = get_dbt->get_size() == 1 && *(char *) get_dbt->get_data() == (char) ('a' + record_id - 1);
+        delete get_dbt;
+        if (!same || ordered.size() != 4)
+            return assertion_failure("insert out of order", record_id);
+    }
+    ordered.remove(1);
+    ordered.remove(2);
+    get_dbt = ordered.get(2);
+    bool removed = ordered.size() == 2 && *(char *) get_dbt->get_data() == 'd';
+    delete get_dbt;
+    if (!removed)
+        return assertion_failure("remove did not close up the gap");
+
     // more volume
     string gettysburg = "Four score and seven years ago our fathers brought forth on this continent, a new nation, conceived in Liberty, and dedicated to the proposition that all men are created equal.";
     int32_t n = -1;
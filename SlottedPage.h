@@ -19,11 +19,19 @@
 
         Record id are handed out sequentially starting with 1 as records are added with add().
         Each record has a header which is a fixed offset from the beginning of the block:
-            Bytes 0x00 - Ox01: number of records
+            Bytes 0x00 - Ox01: number of records (including deleted ones)
             Bytes 0x02 - 0x03: offset to end of free space
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
+
+        Deleting or shrinking a record just leaves a hole (counted as fragmented). The holes are only
+        squeezed out when an add() or an enlarging put() needs the room. The number of live records and of
+        fragmented bytes aren't stored (so blocks written before there were holes read the same): they are
+        worked out from the record headers, and kept once the block is first changed after it is read in.
+
+        The block is as big as the Dbt it is given (the block size of its file). Two-byte offsets reach every
+        byte of even a DbBlock::MAX_BLOCK_SZ block, so the layout is the same whatever the size.
  *
  */
 class SlottedPage : public DbBlock {
@@ -35,32 +43,54 @@ public:
 
     virtual RecordID add(const Dbt *data);
 
+    virtual RecordID insert(RecordID record_id, const Dbt *data);
+
     virtual Dbt *get(RecordID record_id) const;
 
+    // Point data at the record's bytes in the block (nothing is allocated); false if the record has been deleted
+    virtual bool get(RecordID record_id, Dbt &data) const;
+
     virtual void put(RecordID record_id, const Dbt &data);
 
     virtual void del(RecordID record_id);
 
+    virtual void remove(RecordID record_id);
+
     virtual RecordIDs *ids(void) const;
 
+    virtual RecordID next_id(RecordID record_id) const;
+
     virtual void clear();
 
+    virtual void compact();
+
     virtual u_int16_t size() const;
 
     virtual u_int16_t unused_bytes() const;
 
 
 protected:
+    static const uint16_t HEADER_SZ = 4;  // bytes of block header before record 1's header
+
     uint16_t num_records;
     uint16_t end_free;
+    uint16_t num_live;    // not in the block (see count_records)
+    uint16_t fragmented;  // ditto
+    bool counted;         // whether they have been worked out since the block was read in
 
     void get_header(uint16_t &size, uint16_t &loc, RecordID id = 0) const;
 
     void put_header(RecordID id = 0, uint16_t size = 0, uint16_t loc = 0);
 
-    bool has_room(uint16_t size) const;
+    void tally(uint16_t &live, uint16_t &fragmented) const;
+
+    void count_records();
+
+    bool has_room(u_int32_t size) const;
+
+    uint16_t contiguous_bytes() const;
 
-    virtual void slide(uint16_t start, uint16_t end);
+    virtual void defragment();
 
     uint16_t get_n(uint16_t offset) const;
 
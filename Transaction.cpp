@@ -0,0 +1,215 @@
+/**
+ * @file Transaction.cpp - implementation of GroupCommit and Transaction
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "HeapFile.h"
+#include "Transaction.h"
+
+using namespace std;
+
+const uint GroupCommit::DEFAULT_DELAY_US;
+const uint GroupCommit::DEFAULT_BATCH;
+
+std::mutex GroupCommit::latch;
+std::condition_variable GroupCommit::arrived;
+std::condition_variable GroupCommit::flushed;
+u_long GroupCommit::issued = 0;
+u_long GroupCommit::durable = 0;
+bool GroupCommit::flushing = false;
+uint GroupCommit::delay_us = GroupCommit::DEFAULT_DELAY_US;
+uint GroupCommit::batch = GroupCommit::DEFAULT_BATCH;
+GroupCommitStats GroupCommit::stats;
+
+void GroupCommit::configure(uint delay_us, uint batch) {
+    lock_guard<mutex> guard(GroupCommit::latch);
+    GroupCommit::delay_us = delay_us;
+    GroupCommit::batch = batch == 0 ? 1 : batch;
+}
+
+u_long GroupCommit::committed() {
+    lock_guard<mutex> guard(GroupCommit::latch);
+    u_long ticket = ++GroupCommit::issued;
+    if (GroupCommit::flushing)
+        GroupCommit::arrived.notify_one();  // the batch being gathered may be full now
+    return ticket;
+}
+
+void GroupCommit::wait(u_long ticket) {
+    unique_lock<mutex> guard(GroupCommit::latch);
+    GroupCommit::stats.commits++;
+    while (GroupCommit::durable < ticket) {
+        if (GroupCommit::flushing) {
+            GroupCommit::flushed.wait(guard);
+            continue;
+        }
+
+        // lead the next flush, first giving other commits the window to join it
+        GroupCommit::flushing = true;
+        auto deadline = chrono::steady_clock::now() + chrono::microseconds(GroupCommit::delay_us);
+        GroupCommit::arrived.wait_until(guard, deadline, [] {
+            return GroupCommit::issued - GroupCommit::durable >= GroupCommit::batch;
+        });
+        u_long through = GroupCommit::issued;
+        guard.unlock();
+        try {
+            _DB_ENV->log_flush(nullptr);
+        } catch (...) {
+            guard.lock();
+            GroupCommit::flushing = false;  // someone else can try
+            GroupCommit::flushed.notify_all();
+            throw;
+        }
+        guard.lock();
+        GroupCommit::durable = through;
+        GroupCommit::flushing = false;
+        GroupCommit::stats.flushes++;
+        GroupCommit::flushed.notify_all();
+    }
+}
+
+GroupCommitStats GroupCommit::get_stats() {
+    lock_guard<mutex> guard(GroupCommit::latch);
+    return GroupCommit::stats;
+}
+
+DbTxn *Transaction::active = nullptr;
+thread_local bool Transaction::relaxed = false;
+thread_local u_long Transaction::pending = 0;
+
+Transaction::Transaction() : txn(nullptr) {
+    if (Transaction::active != nullptr)
+        throw DbRelationError("a transaction is already under way");
+    _DB_ENV->txn_begin(nullptr, &this->txn, 0);
+    Transaction::active = this->txn;
+}
+
+Transaction::~Transaction() {
+    if (this->txn == nullptr)
+        return;
+    try {
+        abort();
+    } catch (DbException &e) {
+        // nothing more to be done about it here
+    }
+}
+
+// Either way the transaction is over: Berkeley DB aborts one whose commit fails
+void Transaction::commit() {
+    if (this->txn == nullptr)
+        return;
+    DbTxn *txn = this->txn;
+    this->txn = nullptr;
+    Transaction::active = nullptr;
+    txn->commit(Transaction::relaxed ? DB_TXN_WRITE_NOSYNC : DB_TXN_NOSYNC);
+    if (!Transaction::relaxed)
+        Transaction::pending = GroupCommit::committed();
+}
+
+void Transaction::abort() {
+    if (this->txn == nullptr)
+        return;
+    DbTxn *txn = this->txn;
+    this->txn = nullptr;
+    Transaction::active = nullptr;
+    txn->abort();
+}
+
+void Transaction::wait_durable() {
+    u_long ticket = Transaction::pending;
+    Transaction::pending = 0;
+    if (ticket != 0)
+        GroupCommit::wait(ticket);
+}
+
+// Number of records in a block
+static uint count_records(SlottedPage *page) {
+    uint n = 0;
+    for (RecordID record_id = page->next_id(0); record_id != 0; record_id = page->next_id(record_id))
+        n++;
+    return n;
+}
+
+/**
+ * Testing function for Transaction and GroupCommit: an aborted change is taken back and a committed one kept, a
+ * relaxed commit isn't waited on, and waits that come together share a flush.
+ * @return true if testing succeeded, false otherwise
+ */
+bool test_transaction() {
+    char bytes[] = "hello";
+    Dbt record(bytes, sizeof(bytes));
+    HeapFile file("_test_transaction");
+    file.create();
+    SlottedPage *page = file.get(1);
+    page->add(&record);
+    file.put(page);
+    file.unpin(page);
+    file.flush();
+
+    bool ok = true;
+    for (bool commit: {false, true}) {
+        {
+            Transaction transaction;
+            page = file.get(1);
+            page->add(&record);
+            file.put(page);
+            file.unpin(page);
+            file.flush();
+            if (commit)
+                transaction.commit();
+            else
+                transaction.abort();
+        }
+        Transaction::wait_durable();
+        file.discard();
+        file.reload();  // what is on disk now
+        page = file.get(1);
+        uint n = count_records(page);
+        file.unpin(page);
+        if (n != (commit ? 2U : 1U))
+            ok = assertion_failure(commit ? "committed change kept" : "aborted change taken back", n);
+    }
+    {
+        Transaction transaction;
+        try {
+            Transaction another;
+            ok = assertion_failure("one transaction at a time");
+        } catch (DbRelationError &e) {
+            // expected
+        }
+    }
+    file.drop();
+    if (!ok)
+        return false;
+
+    GroupCommitStats before = GroupCommit::get_stats();
+    Transaction::set_relaxed(true);
+    {
+        Transaction transaction;
+        transaction.commit();
+    }
+    Transaction::wait_durable();
+    Transaction::set_relaxed(false);
+    if (GroupCommit::get_stats().commits != before.commits)
+        return assertion_failure("relaxed commit waited on");
+
+    // commits that come along while the first one waits out the window go in its flush
+    const int COMMITTERS = 8;
+    GroupCommit::configure(50000, COMMITTERS);
+    vector<thread> committers;
+    for (int i = 0; i < COMMITTERS; i++)
+        committers.push_back(thread([] { GroupCommit::wait(GroupCommit::committed()); }));
+    for (auto &committer: committers)
+        committer.join();
+    GroupCommit::configure(GroupCommit::DEFAULT_DELAY_US, GroupCommit::DEFAULT_BATCH);
+    GroupCommitStats after = GroupCommit::get_stats();
+    if (after.commits - before.commits != COMMITTERS)
+        return assertion_failure("commits", after.commits - before.commits);
+    if (after.flushes - before.flushes >= COMMITTERS)
+        return assertion_failure("flushes shared", after.flushes - before.flushes);
+    return true;
+}
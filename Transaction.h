@@ -0,0 +1,148 @@
+/**
+ * @file Transaction.h - making each statement's changes all at once, and durably
+ * GroupCommitStats
+ * GroupCommit
+ * Transaction
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include "storage_engine.h"
+
+/**
+ * @class GroupCommitStats - counters kept by GroupCommit (useful for sizing its window)
+ */
+class GroupCommitStats {
+public:
+    GroupCommitStats() : commits(0), flushes(0) {}
+
+    u_long commits;  // commits waited on
+    u_long flushes;  // log flushes it took to make them durable
+};
+
+/**
+ * @class GroupCommit - has one flush of the log make many commits durable at once
+ *
+ *      A transaction commits without waiting for its log records to get to the disk, and its statement lets go of
+ *      the statement lock; only then does its session wait here before saying that the statement is done. The first
+ *      one to wait flushes the log for every commit there has been by the time it does so: after waiting up to the
+ *      delay for more commits to join in (or until there are a batch of them). Whoever comes along while a flush is
+ *      under way waits for it to finish, then for the next flush if it was too late for this one. So under load each
+ *      fsync covers many commits, and with a delay of 0 (the default) a commit is never held up any longer than it
+ *      takes to finish the flush already going.
+ */
+class GroupCommit {
+public:
+    static const uint DEFAULT_DELAY_US = 0;
+    static const uint DEFAULT_BATCH = 64;
+
+    /**
+     * Size the window a flush waits in for more commits.
+     * @param delay_us  longest wait, in microseconds (0 to flush right away)
+     * @param batch     commits waiting that end the wait early
+     */
+    static void configure(uint delay_us, uint batch);
+
+    /**
+     * Note a commit, whose log records may not be on disk yet.
+     * @return  its ticket, for wait()
+     */
+    static u_long committed();
+
+    /**
+     * Wait until the log is on disk through the given commit, flushing it if no one else is doing so.
+     * @param ticket  from committed()
+     */
+    static void wait(u_long ticket);
+
+    static GroupCommitStats get_stats();
+
+protected:
+    static std::mutex latch;
+    static std::condition_variable arrived;  // another commit for the flush being gathered
+    static std::condition_variable flushed;  // a flush finished
+    static u_long issued;                    // last ticket given out
+    static u_long durable;                   // last ticket whose commit is on disk
+    static bool flushing;                    // someone is gathering or doing a flush
+    static uint delay_us;
+    static uint batch;
+    static GroupCommitStats stats;
+};
+
+/**
+ * @class Transaction - the Berkeley DB transaction that a statement's reads and changes are made in
+ *
+ *      There is at most one at a time, since a statement that can change anything has the statement lock to itself
+ *      (see Session). While there is one, the storage engine makes every Berkeley DB call in it (see current), so
+ *      aborting it takes back all the statement did to the heap files and their indices alike. Whoever aborts it has
+ *      to throw away anything cached in memory that may have seen those changes (see SQLExec::discard_cached).
+ *
+ *      Committing doesn't wait for the disk: that is up to wait_durable(), once the statement lock is let go, so
+ *      the waits of several sessions can be taken care of by the same flush (see GroupCommit). With relaxed
+ *      durability there is no wait: the commit gets to the operating system right away but to the disk only with a
+ *      later flush, so a crash of the machine (not just of the process) can lose the last few transactions -- whole,
+ *      never just part of one.
+ */
+class Transaction {
+public:
+    /**
+     * Begin a transaction and make it the current one.
+     * @throws DbRelationError  if there already is one
+     */
+    Transaction();
+
+    /**
+     * Abort the transaction if it is still going (e.g., an exception got in the way of committing it).
+     */
+    virtual ~Transaction();
+
+    Transaction(const Transaction &other) = delete;
+
+    Transaction &operator=(const Transaction &other) = delete;
+
+    /**
+     * Commit the transaction, without waiting for it to get to the disk (see wait_durable).
+     */
+    virtual void commit();
+
+    /**
+     * Take back everything done in the transaction.
+     */
+    virtual void abort();
+
+    bool is_active() const { return txn != nullptr; }
+
+    /**
+     * The transaction to make Berkeley DB calls in.
+     * @return  the current transaction, or nullptr if there isn't one (each call is then one by itself)
+     */
+    static DbTxn *current() { return active; }
+
+    /**
+     * Choose the durability of the transactions committed on this thread from now on (each session starts out with
+     * full durability).
+     * @param relaxed  true to not wait for their commits to get to the disk
+     */
+    static void set_relaxed(bool relaxed) { Transaction::relaxed = relaxed; }
+
+    static bool is_relaxed() { return relaxed; }
+
+    /**
+     * Wait until the transactions committed on this thread are on disk (nothing to wait for if there weren't any
+     * since the last time, or they were relaxed).
+     */
+    static void wait_durable();
+
+protected:
+    DbTxn *txn;  // or nullptr once committed or aborted
+
+    static DbTxn *active;
+    static thread_local bool relaxed;
+    static thread_local u_long pending;  // this thread's last commit not yet waited on (0 if none)
+};
+
+bool test_transaction();
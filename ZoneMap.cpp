@@ -0,0 +1,289 @@
+/**
+ * @file ZoneMap.cpp - implementation of ZoneMap
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <climits>
+#include <cstring>
+#include "ColumnStatistics.h"
+#include "ZoneMap.h"
+#include "Transaction.h"
+
+using namespace std;
+typedef uint16_t u16;
+
+/**
+ * Constructor
+ * @param name          name of the heap file this map is for
+ * @param column_types  data type of each column of the rows, in order
+ */
+ZoneMap::ZoneMap(string name, const vector<ColumnAttribute::DataType> &column_types)
+        : dbfilename(name + ".zone.db"), closed(true), in_memory(false), db(_DB_ENV, 0), column_types(column_types),
+          entry_size(0), entries(), dirty() {
+    for (auto data_type: this->column_types) {
+        if (data_type == ColumnAttribute::INT)
+            this->entry_size += 2 * sizeof(int32_t);
+        else if (data_type == ColumnAttribute::TEXT)
+            this->entry_size += BLOOM_BYTES;
+        else
+            this->entry_size += sizeof(uint8_t);
+    }
+    if (this->entry_size == 0)
+        this->entry_size = 1;  // Berkeley DB won't have empty records
+}
+
+/**
+ * A map file whose records aren't the size our entries need (made for different columns) is left alone: the map is
+ * rebuilt from the blocks each time it is opened and kept only in memory.
+ */
+BlockID ZoneMap::open(void) {
+    const u_int32_t record_size = this->entry_size * ENTRIES_PER_RECORD;
+    if (this->closed) {
+        this->db.set_re_len(record_size);
+        this->db.open(Transaction::current(), this->dbfilename.c_str(), nullptr, DB_RECNO, DB_CREATE | DB_THREAD, 0644);
+        u_int32_t re_len = record_size;
+        this->db.get_re_len(&re_len);
+        this->in_memory = re_len != record_size;
+        this->closed = false;
+    }
+    this->entries.clear();
+    this->dirty.clear();
+    if (this->in_memory)
+        return 0;
+    for (db_recno_t record = 1;; record++) {
+        this->entries.resize(record * record_size);
+        Dbt key(&record, sizeof(record));
+        Dbt data(&this->entries[(record - 1) * record_size], record_size);
+        data.set_ulen(record_size);
+        data.set_flags(DB_DBT_USERMEM);
+        if (this->db.get(Transaction::current(), &key, &data, 0) != 0) {
+            this->entries.resize((record - 1) * record_size);
+            break;
+        }
+        this->dirty.push_back(false);
+    }
+
+    // the open entries at the end of the last record aren't for any block written back (see flush)
+    vector<char> padding(this->entry_size);
+    open_entry(padding.data());
+    size_t mapped = this->entries.size() / this->entry_size;
+    size_t last_record = this->dirty.empty() ? 0 : (this->dirty.size() - 1) * ENTRIES_PER_RECORD;
+    while (mapped > last_record &&
+           memcmp(&this->entries[(mapped - 1) * this->entry_size], padding.data(), this->entry_size) == 0)
+        mapped--;
+    this->entries.resize(mapped * this->entry_size);
+    return (BlockID) mapped;
+}
+
+void ZoneMap::close(void) {
+    if (this->closed)
+        return;
+    flush();
+    this->db.close(0);
+    this->closed = true;
+}
+
+void ZoneMap::drop(void) {
+    this->entries.clear();
+    this->dirty.clear();
+    if (!this->closed) {
+        this->db.close(0);
+        this->closed = true;
+    }
+    try {
+        _DB_ENV->dbremove(Transaction::current(), this->dbfilename.c_str(), nullptr, 0);
+    } catch (DbException &e) {
+        // never got created
+    }
+}
+
+void ZoneMap::flush(void) {
+    if (this->closed || this->in_memory)
+        return;
+    const size_t record_size = this->entry_size * ENTRIES_PER_RECORD;
+    vector<char> buffer;
+    for (db_recno_t i = 0; i < this->dirty.size(); i++) {
+        if (!this->dirty[i])
+            continue;
+        size_t start = i * record_size;
+        size_t n = min(record_size, this->entries.size() - start);
+        buffer.assign(record_size, 0);
+        memcpy(buffer.data(), &this->entries[start], n);
+        for (size_t at = n; at < record_size; at += this->entry_size)
+            open_entry(&buffer[at]);  // no block yet: could have anything (and open() knows to look again)
+        db_recno_t record = i + 1;
+        Dbt key(&record, sizeof(record));
+        Dbt data(buffer.data(), (u_int32_t) record_size);
+        this->db.put(Transaction::current(), &key, &data, 0);
+        this->dirty[i] = false;
+    }
+}
+
+void ZoneMap::discard(void) {
+    this->dirty.assign(this->dirty.size(), false);
+}
+
+void ZoneMap::widen(BlockID block_id, const Dbt *data) {
+    widen(entry_for(block_id), data);
+}
+
+void ZoneMap::summarize(SlottedPage *block) {
+    char *entry = entry_for(block->get_block_id());
+    clear_entry(entry);
+    for (RecordID record_id = block->next_id(0); record_id != 0; record_id = block->next_id(record_id)) {
+        Dbt data;
+        block->get(record_id, data);
+        widen(entry, &data);
+    }
+}
+
+/**
+ * An INT has to be within the block's range, a TEXT has to have both its bits set in the block's bloom filter, and
+ * a BOOLEAN has to have been seen. A value of the wrong type can't match at all.
+ */
+bool ZoneMap::may_match(BlockID block_id, const vector<const Value *> &where_by_column) const {
+    if (block_id == 0 || (size_t) block_id * this->entry_size > this->entries.size())
+        return true;  // no entry
+    const char *entry = &this->entries[(block_id - 1) * this->entry_size];
+    uint offset = 0;
+    for (uint col_num = 0; col_num < this->column_types.size(); col_num++) {
+        const Value *want = col_num < where_by_column.size() ? where_by_column[col_num] : nullptr;
+        ColumnAttribute::DataType data_type = this->column_types[col_num];
+        if (want != nullptr && want->data_type != data_type)
+            return false;
+        if (data_type == ColumnAttribute::INT) {
+            if (want != nullptr && (want->n < *(int32_t *) (entry + offset) ||
+                                    want->n > *(int32_t *) (entry + offset + sizeof(int32_t))))
+                return false;
+            offset += 2 * sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::TEXT) {
+            if (want != nullptr) {
+                uint first, second;
+                bloom_bits(want->s.data(), (uint) want->s.size(), first, second);
+                const uint8_t *bloom = (const uint8_t *) (entry + offset);
+                if (!(bloom[first / 8] & (1U << (first % 8))) || !(bloom[second / 8] & (1U << (second % 8))))
+                    return false;
+            }
+            offset += BLOOM_BYTES;
+        } else {
+            if (want != nullptr && !(*(const uint8_t *) (entry + offset) & (want->n ? 2U : 1U)))
+                return false;
+            offset += sizeof(uint8_t);
+        }
+    }
+    return true;
+}
+
+void ZoneMap::truncate(BlockID last) {
+    const size_t record_size = this->entry_size * ENTRIES_PER_RECORD;
+    if ((size_t) last * this->entry_size >= this->entries.size())
+        return;
+    this->entries.resize((size_t) last * this->entry_size);
+    this->dirty.resize((this->entries.size() + record_size - 1) / record_size);
+    if (!this->dirty.empty())
+        this->dirty.back() = true;
+}
+
+// The entry of a block with no rows: empty INT ranges, empty bloom filters, no BOOLEANs seen
+void ZoneMap::clear_entry(char *entry) const {
+    uint offset = 0;
+    for (auto data_type: this->column_types) {
+        if (data_type == ColumnAttribute::INT) {
+            *(int32_t *) (entry + offset) = INT32_MAX;
+            *(int32_t *) (entry + offset + sizeof(int32_t)) = INT32_MIN;
+            offset += 2 * sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::TEXT) {
+            memset(entry + offset, 0, BLOOM_BYTES);
+            offset += BLOOM_BYTES;
+        } else {
+            *(uint8_t *) (entry + offset) = 0;
+            offset += sizeof(uint8_t);
+        }
+    }
+}
+
+// The entry of a block that could have anything, from the given column on
+static void open_columns(const vector<ColumnAttribute::DataType> &column_types, uint col_num, char *entry,
+                         uint offset) {
+    for (; col_num < column_types.size(); col_num++) {
+        if (column_types[col_num] == ColumnAttribute::INT) {
+            *(int32_t *) (entry + offset) = INT32_MIN;
+            *(int32_t *) (entry + offset + sizeof(int32_t)) = INT32_MAX;
+            offset += 2 * sizeof(int32_t);
+        } else if (column_types[col_num] == ColumnAttribute::TEXT) {
+            memset(entry + offset, 0xff, ZoneMap::BLOOM_BYTES);
+            offset += ZoneMap::BLOOM_BYTES;
+        } else {
+            *(uint8_t *) (entry + offset) = 3;
+            offset += sizeof(uint8_t);
+        }
+    }
+}
+
+void ZoneMap::open_entry(char *entry) const {
+    open_columns(this->column_types, 0, entry, 0);
+}
+
+/**
+ * Find a block's entry, making room for it if need be. Blocks the map didn't know about could have anything in
+ * them (a new block gets its entry cleared by summarize()).
+ */
+char *ZoneMap::entry_for(BlockID block_id) {
+    const size_t record_size = this->entry_size * ENTRIES_PER_RECORD;
+    size_t have = this->entries.size() / this->entry_size;
+    if (block_id > have) {
+        this->entries.resize((size_t) block_id * this->entry_size);
+        for (size_t i = have; i < block_id; i++)
+            open_entry(&this->entries[i * this->entry_size]);
+        this->dirty.resize((this->entries.size() + record_size - 1) / record_size, true);
+    }
+    this->dirty[(block_id - 1) / ENTRIES_PER_RECORD] = true;
+    return &this->entries[(block_id - 1) * this->entry_size];
+}
+
+void ZoneMap::widen(char *entry, const Dbt *data) const {
+    const char *bytes = (const char *) data->get_data();
+    const uint size = data->get_size();
+    uint offset = 0;  // into the record
+    uint at = 0;      // into the entry
+    for (uint col_num = 0; col_num < this->column_types.size(); col_num++) {
+        ColumnAttribute::DataType data_type = this->column_types[col_num];
+        if (data_type == ColumnAttribute::INT) {
+            if (offset + sizeof(int32_t) > size)
+                return open_columns(this->column_types, col_num, entry, at);
+            int32_t n = *(int32_t *) (bytes + offset);
+            int32_t *range = (int32_t *) (entry + at);
+            if (n < range[0])
+                range[0] = n;
+            if (n > range[1])
+                range[1] = n;
+            offset += sizeof(int32_t);
+            at += 2 * sizeof(int32_t);
+        } else if (data_type == ColumnAttribute::TEXT) {
+            if (offset + sizeof(u16) > size || offset + sizeof(u16) + *(u16 *) (bytes + offset) > size)
+                return open_columns(this->column_types, col_num, entry, at);
+            u16 length = *(u16 *) (bytes + offset);
+            uint first, second;
+            bloom_bits(bytes + offset + sizeof(u16), length, first, second);
+            uint8_t *bloom = (uint8_t *) (entry + at);
+            bloom[first / 8] |= (uint8_t) (1U << (first % 8));
+            bloom[second / 8] |= (uint8_t) (1U << (second % 8));
+            offset += sizeof(u16) + length;
+            at += BLOOM_BYTES;
+        } else {
+            if (offset + sizeof(uint8_t) > size)
+                return open_columns(this->column_types, col_num, entry, at);
+            *(uint8_t *) (entry + at) |= *(const uint8_t *) (bytes + offset) ? 2U : 1U;
+            offset += sizeof(uint8_t);
+            at += sizeof(uint8_t);
+        }
+    }
+}
+
+// Two bits of the bloom filter from the two halves of the value's hash
+void ZoneMap::bloom_bits(const char *s, uint size, uint &first, uint &second) {
+    uint64_t hash = HyperLogLog::hash(s, size);
+    first = (uint) (hash % (BLOOM_BYTES * 8));
+    second = (uint) ((hash >> 32) % (BLOOM_BYTES * 8));
+}
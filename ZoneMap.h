@@ -0,0 +1,113 @@
+/**
+ * @file ZoneMap.h - per-block synopsis of a heap file's rows, so that scans can pass over blocks without reading them
+ * ZoneMap
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#pragma once
+
+#include "SlottedPage.h"
+
+/**
+ * @class ZoneMap - for each block of a HeapFile, what values its rows could have
+ *
+ *      Each block's entry has, for each column in turn, the smallest and largest value of an INT column, a
+ *      BLOOM_BYTES bloom filter of the values of a TEXT column (two bits per value), or which of false and true
+ *      have been seen in a BOOLEAN column. The entries are only ever widened as rows are added (deleted rows leave
+ *      them as they were), so they can promise more than is there but never less; summarize() tightens one up
+ *      again from what is left in the block.
+ *
+ *      The rows are read in HeapTable's record format: the columns in table order, INTs as 4 bytes, TEXT as a
+ *      2-byte size and the characters, BOOLEANs as 1 byte. A record that ends early (from before a column was added)
+ *      leaves the rest of its columns' parts of the entry open to anything.
+ *
+ *      Kept in its own Berkeley DB RecNo file next to the heap file (<name>.zone.db), ENTRIES_PER_RECORD entries to
+ *      a record, and written back whenever the heap file is flushed. The rest of the last record is filled out with
+ *      entries open to anything, and open() takes a run of those at the end as blocks added since the map was
+ *      written back, to be summarized again.
+ */
+class ZoneMap {
+public:
+    static const uint BLOOM_BYTES = 64;
+    static const uint ENTRIES_PER_RECORD = 64;
+
+    /**
+     * @param name          name of the heap file this map is for
+     * @param column_types  data type of each column of the rows, in order
+     */
+    ZoneMap(std::string name, const std::vector<ColumnAttribute::DataType> &column_types);
+
+    virtual ~ZoneMap() {}
+
+    ZoneMap(const ZoneMap &other) = delete;
+
+    ZoneMap &operator=(const ZoneMap &other) = delete;
+
+    /**
+     * Open the map's file (creating it if need be) and read in the entries.
+     * @return  number of blocks the map has entries for (the heap file's blocks after those have to be summarized)
+     */
+    virtual BlockID open(void);
+
+    virtual void close(void);
+
+    virtual void drop(void);
+
+    /**
+     * Write any changed entries back to Berkeley DB.
+     */
+    virtual void flush(void);
+
+    /**
+     * Forget which entries have changed, so that they are never written back (open() reads them in again).
+     */
+    virtual void discard(void);
+
+    /**
+     * Widen a block's entry to take in another row.
+     * @param block_id  block the row went into
+     * @param data      the row's record
+     */
+    virtual void widen(BlockID block_id, const Dbt *data);
+
+    /**
+     * Work out a block's entry afresh from the rows in it.
+     * @param block  a pinned block of the heap file
+     */
+    virtual void summarize(SlottedPage *block);
+
+    /**
+     * Could the given block have a row that meets the predicates?
+     * @param block_id         block in question
+     * @param where_by_column  for each column number, the value it must equal (or nullptr if unconstrained)
+     * @return                 false only if none of the block's rows can meet them
+     */
+    virtual bool may_match(BlockID block_id, const std::vector<const Value *> &where_by_column) const;
+
+    /**
+     * Forget the entries for blocks after last.
+     * @param last  new final block id
+     */
+    virtual void truncate(BlockID last);
+
+protected:
+    std::string dbfilename;
+    bool closed;
+    bool in_memory;             // the file is unusable, so the entries aren't written back
+    Db db;
+    std::vector<ColumnAttribute::DataType> column_types;
+    uint entry_size;            // bytes in each block's entry
+    std::vector<char> entries;  // entry for block_id at (block_id - 1) * entry_size
+    std::vector<bool> dirty;    // by Berkeley DB record (zero-based)
+
+    virtual void clear_entry(char *entry) const;
+
+    virtual void open_entry(char *entry) const;
+
+    virtual char *entry_for(BlockID block_id);
+
+    virtual void widen(char *entry, const Dbt *data) const;
+
+    static void bloom_bits(const char *s, uint size, uint &first, uint &second);
+};
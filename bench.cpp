@@ -0,0 +1,465 @@
+/**
+ * @file bench.cpp - benchmarks for the storage, index, and executor hot paths
+ *
+ * Usage: sql5300_bench dbenvpath [--rows N] [--key int|text] [--width W] [--page-size B] [--suite NAME]
+ *
+ * Each benchmark writes one line of JSON to stdout, e.g.
+ *      {"bench": "btree.lookup", "ops": 10000, "rows_per_op": 1, "seconds": 0.0123, "ops_per_sec": 813008,
+ *       "p50_us": 1.1, "p99_us": 2.9, "blocks_read": 12}
+ * where blocks_read counts the buffer pool misses (reads from Berkeley DB) while it ran. The first line gives the
+ * settings. Suites are slotted_page, heap_table, btree, and sql (the default is all of them).
+ *
+ * @author Kevin Lundeen
+ * @see "Seattle University, CPSC5300, Spring 2022"
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include "db_cxx.h"
+#include "SQLParser.h"
+#include "SQLExec.h"
+#include "btree.h"
+
+using namespace std;
+using namespace hsql;
+
+DbEnv *_DB_ENV;
+
+/**
+ * @class BenchOptions - what a run of the benchmarks is to do
+ */
+class BenchOptions {
+public:
+    BenchOptions() : rows(10000), text_keys(false), width(16), page_size(DbBlock::BLOCK_SZ), suite("all") {}
+
+    uint rows;         // how many rows (or records) each benchmark works with
+    bool text_keys;    // whether the indexed column is TEXT (otherwise INT)
+    uint width;        // width of the TEXT columns
+    uint page_size;    // block size of the tables (and their indices) and of the slotted pages
+    std::string suite;
+
+    bool runs(const std::string &name) const { return suite == "all" || suite == name; }
+};
+
+/**
+ * @class Measurement - times a benchmark, one operation at a time, and reports on it
+ */
+class Measurement {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    Measurement(std::string name, u_long rows_per_op = 1) : name(name), rows_per_op(rows_per_op), samples(),
+                                                            began(), blocks_before(blocks_read()) {}
+
+    void start() { began = Clock::now(); }
+
+    void stop() { samples.push_back(std::chrono::duration<double>(Clock::now() - began).count()); }
+
+    /**
+     * Write out the results as a line of JSON.
+     */
+    void report() const {
+        std::vector<double> sorted(samples);
+        std::sort(sorted.begin(), sorted.end());
+        double seconds = 0.0;
+        for (auto sample: sorted)
+            seconds += sample;
+        cout << fixed << setprecision(6) << "{\"bench\": \"" << name << "\", \"ops\": " << sorted.size()
+             << ", \"rows_per_op\": " << rows_per_op << ", \"seconds\": " << seconds << setprecision(1)
+             << ", \"ops_per_sec\": " << (seconds > 0 ? sorted.size() / seconds : 0.0)
+             << ", \"p50_us\": " << percentile(sorted, 0.50) * 1e6 << ", \"p99_us\": " << percentile(sorted, 0.99) * 1e6
+             << ", \"blocks_read\": " << blocks_read() - blocks_before << "}" << endl;
+    }
+
+protected:
+    std::string name;
+    u_long rows_per_op;
+    std::vector<double> samples;  // seconds taken by each operation
+    Clock::time_point began;
+    u_long blocks_before;
+
+    static u_long blocks_read() { return HeapFile::get_total_pool_stats().misses; }
+
+    static double percentile(const std::vector<double> &sorted, double p) {
+        if (sorted.empty())
+            return 0.0;
+        size_t i = (size_t) (p * (sorted.size() - 1) + 0.5);
+        return sorted[i];
+    }
+};
+
+// A distinct TEXT value for each i, at least width wide (zero-padded so they sort the same as the numbers)
+static std::string text_key(uint i, uint width) {
+    std::string digits = to_string(i);
+    if (digits.size() < width)
+        digits.insert(0, width - digits.size(), '0');
+    return digits;
+}
+
+// Row i of the benchmark tables: a is i, b is its text key (or filler) of the given width
+static void bench_row(ValueDict &row, uint i, const BenchOptions &options) {
+    row["a"] = Value((int32_t) i);
+    row["b"] = Value(options.text_keys ? text_key(i, options.width) : std::string(options.width, 'x'));
+}
+
+// The numbers 0 to n-1, shuffled (the same way every run)
+static std::vector<uint> shuffled(uint n) {
+    std::vector<uint> order(n);
+    for (uint i = 0; i < n; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(5300));
+    return order;
+}
+
+// A throwaway two-column table (a INT, b TEXT), gotten rid of first if an earlier run left it behind
+static HeapTable *bench_table(const Identifier &name, const BenchOptions &options) {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable *table = new HeapTable(name, column_names, column_attributes);
+    try {
+        table->drop();
+    } catch (DbException &e) {
+        // wasn't there
+    }
+    table->set_block_size(options.page_size);
+    table->create();
+    return table;
+}
+
+/**
+ * SlottedPage add, get, put, and del on in-memory blocks (no files involved).
+ */
+static void bench_slotted_page(const BenchOptions &options) {
+    std::vector<char> record(options.width, 'x'), bigger(options.width + 4, 'y');
+    Dbt data(record.data(), (u_int32_t) record.size());
+    Dbt bigger_data(bigger.data(), (u_int32_t) bigger.size());
+    char *bytes = new char[options.page_size];
+    Measurement add("slotted_page.add"), get("slotted_page.get"), put("slotted_page.put"), del("slotted_page.del");
+    uint done = 0;
+    while (done < options.rows) {
+        memset(bytes, 0, options.page_size);
+        Dbt block(bytes, options.page_size);
+        SlottedPage page(block, 1, true);
+        RecordIDs ids;
+        while (done < options.rows) {
+            add.start();
+            try {
+                ids.push_back(page.add(&data));
+            } catch (DbBlockNoRoomError &e) {
+                break;  // on to a new block
+            }
+            add.stop();
+            done++;
+        }
+        if (ids.empty())
+            break;  // a record won't fit in an empty block
+        for (auto id: ids) {
+            get.start();
+            delete page.get(id);
+            get.stop();
+        }
+        for (auto id: ids) {
+            put.start();
+            try {
+                page.put(id, id % 2 == 0 ? bigger_data : data);
+            } catch (DbBlockNoRoomError &e) {
+                // full up
+            }
+            put.stop();
+        }
+        for (auto id: ids) {
+            del.start();
+            page.del(id);
+            del.stop();
+        }
+    }
+    delete[] bytes;
+    add.report();
+    get.report();
+    put.report();
+    del.report();
+}
+
+/**
+ * HeapTable insert, full scan, selective scan, and project by handle.
+ */
+static void bench_heap_table(const BenchOptions &options) {
+    HeapTable *table = bench_table("_bench_heap", options);
+    Handles handles;
+    {
+        Measurement insert("heap_table.insert");
+        ValueDict row;
+        for (uint i = 0; i < options.rows; i++) {
+            bench_row(row, i, options);
+            insert.start();
+            handles.push_back(table->insert(&row));
+            insert.stop();
+        }
+        insert.report();
+    }
+    {
+        Measurement scan("heap_table.scan", options.rows);
+        for (int pass = 0; pass < 5; pass++) {
+            scan.start();
+            DbCursor *cursor = table->cursor(nullptr);
+            Row row;
+            while (cursor->next())
+                cursor->project_row(nullptr, row);
+            delete cursor;
+            scan.stop();
+        }
+        scan.report();
+    }
+    {
+        Measurement select("heap_table.select_where", options.rows);
+        ValueDict where;
+        where["a"] = Value((int32_t) (options.rows / 2));
+        for (int pass = 0; pass < 5; pass++) {
+            select.start();
+            delete table->select(&where);
+            select.stop();
+        }
+        select.report();
+    }
+    {
+        Measurement project("heap_table.project");
+        for (auto i: shuffled((uint) handles.size())) {
+            project.start();
+            delete table->project(handles[i]);
+            project.stop();
+        }
+        project.report();
+    }
+    table->drop();
+    delete table;
+}
+
+/**
+ * BTreeIndex bulk load, lookup, and insert (on a or b, depending on the key type).
+ */
+static void bench_btree(const BenchOptions &options) {
+    HeapTable *table = bench_table("_bench_btree", options);
+    std::vector<uint> order = shuffled(options.rows + options.rows / 10);
+    ValueDict row;
+    for (uint i = 0; i < options.rows; i++) {
+        bench_row(row, order[i], options);
+        table->insert(&row);
+    }
+    ColumnNames key_columns;
+    key_columns.push_back(options.text_keys ? "b" : "a");
+    BTreeIndex *index = new BTreeIndex(*table, "_bench_btree_ix", key_columns, true);
+    try {
+        index->drop();
+    } catch (DbException &e) {
+        // wasn't there
+    }
+    {
+        Measurement create("btree.create", options.rows);
+        create.start();
+        index->create();
+        create.stop();
+        create.report();
+    }
+    {
+        Measurement lookup("btree.lookup");
+        for (auto i: shuffled(options.rows)) {
+            bench_row(row, order[i], options);
+            ValueDict key;
+            key[key_columns[0]] = row[key_columns[0]];
+            lookup.start();
+            delete index->lookup(&key);
+            lookup.stop();
+        }
+        lookup.report();
+    }
+    {
+        Measurement insert("btree.insert");
+        for (uint i = options.rows; i < order.size(); i++) {
+            bench_row(row, order[i], options);
+            Handle handle = table->insert(&row);
+            insert.start();
+            index->insert(handle);
+            insert.stop();
+        }
+        insert.report();
+    }
+    index->drop();
+    delete index;
+    table->drop();
+    delete table;
+}
+
+// Pull all of a result's rows (as printing it would, without the formatting) and free it
+static void drain(QueryResult *result) {
+    Row row;
+    while (result->next(row))
+        continue;
+    delete result;
+}
+
+// Run a statement as the shell does (our own statements and cached plans first, then the parser)
+static void run(const std::string &query) {
+    QueryResult *result = SQLExec::execute_extended(query);
+    if (result == nullptr) {
+        SQLParserResult *parse = SQLParser::parseSQLString(query);
+        if (!parse->isValid()) {
+            delete parse;
+            throw SQLExecError("invalid SQL: " + query);
+        }
+        for (uint i = 0; i < parse->size(); i++)
+            drain(SQLExec::execute(parse->getStatement(i)));
+        delete parse;
+        return;
+    }
+    drain(result);
+}
+
+// A literal for row i's b column
+static std::string b_literal(uint i, const BenchOptions &options) {
+    return "'" + (options.text_keys ? text_key(i, options.width) : std::string(options.width, 'x')) + "'";
+}
+
+/**
+ * End-to-end SQL statements through SQLExec: single-row INSERT, indexed point SELECT, non-indexed SELECT (a scan),
+ * and point DELETE.
+ */
+static void bench_sql(const BenchOptions &options) {
+    initialize_schema_tables();
+    try {
+        run("drop table bench_sql");
+    } catch (SQLExecError &e) {
+        // wasn't there
+    }
+    run("create table bench_sql (a int, b text) with (page_size=" + std::to_string(options.page_size) + ")");
+    run(std::string("create index bench_sql_ix on bench_sql (") + (options.text_keys ? "b" : "a") + ")");
+    std::vector<uint> order = shuffled(options.rows);
+    {
+        Measurement insert("sql.insert");
+        for (auto i: order) {
+            std::string query = "insert into bench_sql values (" + to_string(i) + ", " + b_literal(i, options) + ")";
+            insert.start();
+            run(query);
+            insert.stop();
+        }
+        insert.report();
+    }
+    {
+        Measurement select("sql.select_point");
+        for (auto i: shuffled(options.rows)) {
+            std::string query = "select a, b from bench_sql where " +
+                                (options.text_keys ? "b = " + b_literal(i, options) : "a = " + to_string(i));
+            select.start();
+            run(query);
+            select.stop();
+        }
+        select.report();
+    }
+    {
+        Measurement scan("sql.select_scan", options.rows);
+        std::string query = "select a from bench_sql where " +
+                            (options.text_keys ? "a = " + to_string(options.rows / 2) : "b = 'none'");
+        for (int pass = 0; pass < 5; pass++) {
+            scan.start();
+            run(query);
+            scan.stop();
+        }
+        scan.report();
+    }
+    {
+        Measurement del("sql.delete_point");
+        for (uint n = 0; n < options.rows / 10; n++) {
+            uint i = order[n];
+            std::string query = "delete from bench_sql where " +
+                                (options.text_keys ? "b = " + b_literal(i, options) : "a = " + to_string(i));
+            del.start();
+            run(query);
+            del.stop();
+        }
+        del.report();
+    }
+    run("drop table bench_sql");
+}
+
+/**
+ * Read the options following the environment path.
+ * @return false if they don't make sense
+ */
+static bool parse_options(int argc, char *argv[], BenchOptions &options) {
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        std::string value = argv[++i];
+        if (option == "--rows")
+            options.rows = (uint) atoi(value.c_str());
+        else if (option == "--key" && (value == "int" || value == "text"))
+            options.text_keys = value == "text";
+        else if (option == "--width")
+            options.width = (uint) atoi(value.c_str());
+        else if (option == "--page-size")
+            options.page_size = (uint) atoi(value.c_str());
+        else if (option == "--suite" && (value == "all" || value == "slotted_page" || value == "heap_table" ||
+                                         value == "btree" || value == "sql"))
+            options.suite = value;
+        else
+            return false;
+    }
+    uint page_size = options.page_size;
+    return options.rows > 0 && options.width > 0 && page_size >= DbBlock::BLOCK_SZ &&
+           page_size <= DbBlock::MAX_BLOCK_SZ && (page_size & (page_size - 1)) == 0;
+}
+
+/**
+ * Main entry point of the sql5300_bench program
+ * @args dbenvpath  the path to the BerkeleyDB database environment (an empty directory is best)
+ */
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    if (argc < 2 || !parse_options(argc, argv, options)) {
+        cerr << "Usage: sql5300_bench dbenvpath [--rows N] [--key int|text] [--width W] [--page-size B] "
+                "[--suite all|slotted_page|heap_table|btree|sql]" << endl;
+        return EXIT_FAILURE;
+    }
+    DbEnv *env = new DbEnv(0U);
+    env->set_message_stream(&cerr);
+    env->set_error_stream(&cerr);
+    try {
+        // the same environment as sql5300's (see initialize_environment), so the SQL suite measures its commits
+        env->set_flags(DB_AUTO_COMMIT, 1);
+        env->set_flags(DB_TXN_WRITE_NOSYNC, 1);
+        env->set_lk_detect(DB_LOCK_DEFAULT);
+        env->open(argv[1], DB_CREATE | DB_INIT_MPOOL | DB_INIT_TXN | DB_INIT_LOCK | DB_INIT_LOG | DB_RECOVER |
+                           DB_THREAD, 0);
+    } catch (DbException &exc) {
+        cerr << "(sql5300_bench: " << exc.what() << ")" << endl;
+        return EXIT_FAILURE;
+    }
+    _DB_ENV = env;
+
+    cout << "{\"config\": {\"rows\": " << options.rows << ", \"key\": \"" << (options.text_keys ? "text" : "int")
+         << "\", \"width\": " << options.width << ", \"page_size\": " << options.page_size << ", \"suite\": \"" << options.suite << "\"}}" << endl;
+    try {
+        if (options.runs("slotted_page"))
+            bench_slotted_page(options);
+        if (options.runs("heap_table"))
+            bench_heap_table(options);
+        if (options.runs("btree"))
+            bench_btree(options);
+        if (options.runs("sql"))
+            bench_sql(options);
+    } catch (std::exception &e) {
+        cerr << "(sql5300_bench: " << e.what() << ")" << endl;
+        return EXIT_FAILURE;
+    }
+    HeapFile::flush_all();
+    return EXIT_SUCCESS;
+}
@@ -3,20 +3,27 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include "btree.h"
 
+const double BTreeIndex::DEFAULT_FILL_FACTOR = 0.9;
+const double BTreeIndex::COLUMN_SELECTIVITY = 0.1;
+const double BTreeIndex::MERGE_THRESHOLD = 0.25;
+
 BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
                                                                                                               name,
                                                                                                               key_columns,
                                                                                                               unique),
                                                                                                       closed(true),
+                                                                                                      fill_factor(DEFAULT_FILL_FACTOR),
                                                                                                       stat(nullptr),
                                                                                                       root(nullptr),
                                                                                                       file(relation.get_table_name() +
                                                                                                            "-" + name),
                                                                                                       key_profile() {
-    if (!unique)
-        throw DbRelationError("BTree index must have unique key");
+    file.set_counters(ExecStats::for_table(relation.get_table_name()));
     build_key_profile();
 }
 
@@ -25,44 +32,210 @@ BTreeIndex::~BTreeIndex() {
     delete root;
 }
 
-// Create the index.
+// Create the index (with blocks the size of the relation's), loading it from the rows already in the relation.
 void BTreeIndex::create() {
+    file.set_block_size(relation.get_block_size());
     file.create();
     stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
-    root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
     closed = false;
-    Handles *table_rows = relation.select();
-    for (auto const &row: *table_rows)
-        insert(row);
-    delete table_rows;
+    KeyEntries *entries = scan_keys();
+    try {
+        bulk_load(entries);
+    } catch (...) {
+        delete entries;
+        throw;
+    }
+    delete entries;
+}
+
+// How full create() packs each node, from just over 0.0 to 1.0 (leaving the rest for later inserts).
+void BTreeIndex::set_fill_factor(double fill_factor) {
+    if (fill_factor <= 0.0 || fill_factor > 1.0)
+        throw DbRelationError("fill factor must be greater than 0 and at most 1");
+    this->fill_factor = fill_factor;
+}
+
+// Pull the key and handle of every row out of the relation in one pass over its blocks.
+KeyEntries *BTreeIndex::scan_keys() const {
+    KeyEntries *entries = new KeyEntries();
+    DbCursor *cursor = relation.cursor(nullptr);
+    try {
+        Row row;
+        KeyValue key(key_columns.size());
+        while (cursor->next()) {
+            cursor->project_row(&key_columns, row);
+            for (uint i = 0; i < row.size(); i++)
+                key[i] = row.get_value(i);
+            entries->push_back(std::make_pair(key, cursor->get_handle()));
+            add_handle(entries->back().first, cursor->get_handle());
+        }
+    } catch (...) {
+        delete cursor;
+        delete entries;
+        throw;
+    }
+    delete cursor;
+    return entries;
+}
+
+/**
+ * Build the tree bottom-up from the given entries: sort them, pack them into leaves (linked left to right) up to
+ * the fill factor, then pack each level of interior nodes over the one below until there's just a root.
+ * @param entries  key and handle of every row (sorted in place)
+ */
+void BTreeIndex::bulk_load(KeyEntries *entries) {
+    std::sort(entries->begin(), entries->end());
+    for (size_t i = 1; i < entries->size(); i++)
+        if ((*entries)[i - 1].first == (*entries)[i].first)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+
+    const uint budget = (uint) (this->fill_factor * (this->file.get_block_size() - NODE_OVERHEAD));
+    const uint handle_size = sizeof(BlockID) + sizeof(RecordID);
+    const uint pointer_size = RECORD_OVERHEAD + sizeof(BlockID);
+
+    // leaves
+    std::vector<std::pair<BlockID, KeyValue>> level;  // each node's block and lowest key
+    BTreeLeaf *leaf = new BTreeLeaf(file, 0, key_profile, true);
+    level.push_back(std::make_pair(leaf->get_id(), entries->empty() ? KeyValue() : entries->front().first));
+    uint used = 0;
+    for (auto const &entry: *entries) {
+        uint entry_size = RECORD_OVERHEAD + handle_size + key_size(&entry.first);
+        if (used + entry_size > budget && leaf->size() > 0) {
+            BTreeLeaf *next = new BTreeLeaf(file, 0, key_profile, true);
+            leaf->set_next_leaf(next->get_id());
+            leaf->save();
+            delete leaf;
+            leaf = next;
+            level.push_back(std::make_pair(leaf->get_id(), entry.first));
+            used = 0;
+        }
+        leaf->append(entry.first, entry.second);
+        used += entry_size;
+    }
+    leaf->save();
+    delete leaf;
+
+    // interior levels
+    uint height = 1;
+    while (level.size() > 1) {
+        std::vector<size_t> starts;  // where each node's children start in level
+        for (size_t i = 0; i < level.size(); i++) {
+            uint entry_size = RECORD_OVERHEAD + key_size(&level[i].second) + pointer_size;
+            if (starts.empty() || (used + entry_size > budget && i - starts.back() > 2)) {
+                starts.push_back(i);
+                used = 0;
+            } else {
+                used += entry_size;
+            }
+        }
+        if (starts.size() > 1 && starts.back() == level.size() - 1)
+            starts.back()--;  // don't leave the last node with no boundaries
+
+        std::vector<std::pair<BlockID, KeyValue>> parents;
+        for (size_t j = 0; j < starts.size(); j++) {
+            size_t end = j + 1 < starts.size() ? starts[j + 1] : level.size();
+            auto *interior = new BTreeInterior(file, 0, key_profile, true);
+            interior->set_first(level[starts[j]].first);
+            for (size_t i = starts[j] + 1; i < end; i++)
+                interior->append(&level[i].second, level[i].first);
+            interior->save();
+            parents.push_back(std::make_pair(interior->get_id(), level[starts[j]].second));
+            delete interior;
+        }
+        level.swap(parents);
+        height++;
+    }
+
+    stat->set_root_id(level[0].first);
+    stat->set_height(height);
+    stat->save();
+    routing_cache.clear();
+    delete root;
+    if (height == 1)
+        root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
+    else
+        root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
+}
+
+// Number of bytes the given key takes up when marshaled into a node.
+uint BTreeIndex::key_size(const KeyValue *key) const {
+    uint size = 0;
+    uint col_num = 0;
+    for (auto const &data_type: key_profile) {
+        if (data_type == ColumnAttribute::DataType::INT)
+            size += sizeof(int32_t);
+        else if (data_type == ColumnAttribute::DataType::TEXT)
+            size += sizeof(uint16_t) + (uint) (*key)[col_num].s.length();
+        else
+            size += sizeof(uint8_t);
+        col_num++;
+    }
+    return size;
 }
 
 // Drop the index.
 void BTreeIndex::drop() {
+    close();
     file.drop();
+    routing_cache.clear();
 }
 
 // Open existing index. Enables: lookup, range, insert, delete, update.
 void BTreeIndex::open() {
+    std::lock_guard<std::mutex> guard(this->latch);
     if (closed) {
         file.open();
         stat = new BTreeStat(file, STAT, key_profile);
+        closed = false;
+        if (stat->get_layout() != BTreeStat::LAYOUT_VERSION) {
+            rebuild();
+            return;
+        }
         if (stat->get_height() == 1)
             root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
         else
             root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-        closed = true;
+    }
+}
+
+/**
+ * Build the index over again from the rows of the relation, in the same file: for an index whose nodes have a
+ * layout we no longer read. All but the stat block are given back first.
+ * @throws DbRelationError  naming the index, if it can't be rebuilt (e.g., there are now duplicates in a unique one)
+ */
+void BTreeIndex::rebuild() {
+    delete stat;  // unpin the stat block
+    stat = nullptr;
+    delete root;
+    root = nullptr;
+    routing_cache.clear();
+    try {
+        file.truncate(STAT);
+        stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
+        KeyEntries *entries = scan_keys();
+        try {
+            bulk_load(entries);
+        } catch (...) {
+            delete entries;
+            throw;
+        }
+        delete entries;
+    } catch (DbRelationError &e) {
+        throw DbRelationError("can't rebuild index " + name + " on " + relation.get_table_name() +
+                              " (from an older layout): " + e.what());
     }
 }
 
 // Closes the index. Disables: lookup, range, insert, delete, update.
 void BTreeIndex::close() {
+    std::lock_guard<std::mutex> guard(this->latch);
     if (!closed) {
-        file.close();
-        delete stat;
+        delete stat;  // unpin the nodes' blocks before the file goes away
         stat = nullptr;
         delete root;
         root = nullptr;
+        file.close();
+        routing_cache.clear();
         closed = true;
     }
 }
@@ -70,71 +243,312 @@ void BTreeIndex::close() {
 // Find all the rows whose columns are equal to key. Assumes key is a dictionary whose keys are the column
 // names in the index. Returns a list of row handles.
 Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
-    return _lookup(this->root, stat->get_height(), this->tkey(key_dict));
+    if (!unique)
+        return range(key_dict, key_dict);  // all the entries starting with key
+    KeyValue *key = this->tkey(key_dict);
+    Handles *handles = new Handles;
+    BlockID leaf_id = find_leaf(key);
+    BTreeLeaf *leaf = leaf_id == root->get_id() ? static_cast<BTreeLeaf *>(root)
+                                                : new BTreeLeaf(file, leaf_id, key_profile, false);
+    try {
+        handles->push_back(leaf->find_eq(key));
+    } catch (std::out_of_range &e) {
+        // not there
+    }
+    if (leaf != root)
+        delete leaf;  // unpin its block
+    delete key;
+    return handles;
 }
 
-Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const KeyValue *key) const {
-    Handles* handles = new Handles;
-    
-    if (dynamic_cast<BTreeLeaf*>(node)) {
-        try 
-        { 
-            handles->push_back(((BTreeLeaf*)node)->find_eq(key)); 
-        }
-        catch (...) 
-        {
-            std::cout << "Unknown Key" << std::endl;
-        }
-        return handles;
+/**
+ * Which child of the given interior node the key belongs under. Interior nodes other than the root are decoded once
+ * and then kept in routing_cache (without their blocks pinned) until they change.
+ * @param interior_id  block of the interior node
+ * @param key          key to look for
+ * @return             block of the child
+ */
+BlockID BTreeIndex::child(BlockID interior_id, const KeyValue *key) const {
+    if (interior_id == root->get_id())
+        return static_cast<BTreeInterior *>(root)->get_routing().child(key);
+    {
+        std::lock_guard<std::mutex> guard(this->latch);
+        auto found = routing_cache.find(interior_id);
+        if (found != routing_cache.end())
+            return found->second.child(key);
     }
-    
-    return _lookup(dynamic_cast<const BTreeInterior*>(node)->find(key, height), height - 1, key);
+    BTreeInterior interior(file, interior_id, key_profile, false);
+    std::lock_guard<std::mutex> guard(this->latch);
+    if (routing_cache.size() < ROUTING_CACHE_SIZE)
+        routing_cache[interior_id] = interior.get_routing();
+    return interior.get_routing().child(key);
 }
 
-Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key) const {
-    throw DbRelationError("Don't know how to do a range query on Btree index yet");
-    // FIXME
+/**
+ * Descend from the root to the leaf where the key belongs.
+ * @param key   key to look for
+ * @param path  if given, filled in with the interior nodes on the way down, root first
+ * @return      block of the leaf (the root's if the tree is just one leaf)
+ */
+BlockID BTreeIndex::find_leaf(const KeyValue *key, BlockPointers *path) const {
+    ExecStats::count(file.get_counters(), &ExecCounters::index_descents);
+    BlockID block_id = root->get_id();
+    for (uint height = stat->get_height(); height > 1; height--) {
+        if (path != nullptr)
+            path->push_back(block_id);
+        block_id = child(block_id, key);
+    }
+    return block_id;
+}
+
+// Descend once to the leaf where the lower bound would be; the cursor takes it from there.
+DbIndexCursor *BTreeIndex::range_cursor(const KeyBound &min, const KeyBound &max) const {
+    KeyValue min_key = prefix_key(min.key);
+    KeyValue max_key = prefix_key(max.key);
+    BlockID leaf_id = find_leaf(&min_key);
+    if (leaf_id == root->get_id())
+        return new BTreeRangeCursor(static_cast<BTreeLeaf *>(root), false, min_key, min.inclusive, max_key,
+                                    max.inclusive);
+    return new BTreeRangeCursor(new BTreeLeaf(file, leaf_id, key_profile, false), true, min_key, min.inclusive,
+                                max_key, max.inclusive);
 }
 
 // Insert a row with the given handle. Row must exist in relation already.
 void BTreeIndex::insert(Handle handle) {
     open();
-    ValueDict *key = relation.project(handle);
+    ValueDict *key = relation.project(handle, &key_columns);
     KeyValue *tkey = this->tkey(key);
-    Insertion insertion = _insert(root, stat->get_height(), tkey, handle);
+    add_handle(*tkey, handle);
+    insert(tkey, handle);
+    delete key;
+    delete tkey;
+}
+
+// Insert many rows, in key order so that one descent after another goes down the same path.
+void BTreeIndex::insert_batch(const Handles *handles) {
+    open();
+    KeyEntries *entries = key_entries(handles);
+    try {
+        for (auto const &entry: *entries)
+            insert(&entry.first, entry.second);
+    } catch (...) {
+        delete entries;
+        throw;
+    }
+    delete entries;
+}
+
+// The key of each of the given rows, sorted by key (freed by caller).
+KeyEntries *BTreeIndex::key_entries(const Handles *handles) const {
+    KeyEntries *entries = new KeyEntries();
+    entries->reserve(handles->size());
+    for (auto const &handle: *handles) {
+        ValueDict *key = relation.project(handle, &key_columns);
+        KeyValue *tkey = this->tkey(key);
+        add_handle(*tkey, handle);
+        entries->push_back(std::make_pair(std::move(*tkey), handle));
+        delete key;
+        delete tkey;
+    }
+    std::sort(entries->begin(), entries->end());
+    return entries;
+}
+
+// Insert the given key for the row with the given handle. Only the interior nodes that a split reaches are read in
+// (and dropped from the routing cache); a new root is grown if the old one splits.
+void BTreeIndex::insert(const KeyValue *tkey, Handle handle) {
+    BlockPointers path;
+    BlockID leaf_id = find_leaf(tkey, &path);
+    Insertion insertion;
+    if (leaf_id == root->get_id()) {
+        insertion = static_cast<BTreeLeaf *>(root)->insert(tkey, handle, *stat);
+    } else {
+        BTreeLeaf leaf(file, leaf_id, key_profile, false);
+        insertion = leaf.insert(tkey, handle, *stat);
+    }
+    for (auto it = path.rbegin(); it != path.rend() && !BTreeNode::insertion_is_none(insertion); ++it) {
+        if (*it == root->get_id()) {
+            insertion = static_cast<BTreeInterior *>(root)->insert(&insertion.second, insertion.first, *stat);
+        } else {
+            routing_cache.erase(*it);
+            BTreeInterior interior(file, *it, key_profile, false);
+            insertion = interior.insert(&insertion.second, insertion.first, *stat);
+        }
+    }
     if (!BTreeNode::insertion_is_none(insertion)) {
-        auto *new_root = new BTreeInterior(file, 0, key_profile, true);
+        auto *new_root = new BTreeInterior(file, stat->reuse_block(), key_profile, true);
         new_root->set_first(root->get_id());
-        new_root->insert(&insertion.second, insertion.first);
+        new_root->insert(&insertion.second, insertion.first, *stat);
         new_root->save();
         stat->set_root_id(new_root->get_id());
         stat->set_height(stat->get_height() + 1);
         stat->save();
         delete root;
         root = new_root;
-        std::cout << "new root: " << *new_root << std::endl;
     }
-    delete key;
-    delete tkey;
 }
 
-// Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
-Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle) {
-    if (height == 1) {
-        auto *leaf = dynamic_cast<BTreeLeaf *>(node);
-        return leaf->insert(key, handle);
-    } else {
-        auto *interior = dynamic_cast<BTreeInterior *>(node);
-        Insertion insertion = _insert(interior->find(key, height), height - 1, key, handle);
-        if (!BTreeNode::insertion_is_none(insertion))
-            insertion = interior->insert(&insertion.second, insertion.first);
-        return insertion;
-    }
+// One read per level below the (pinned) root, then one block of the relation per row found.
+double BTreeIndex::lookup_cost(uint prefix_size, uint32_t table_blocks, double matching_rows) {
+    open();
+    double descent = stat->get_height() - 1;
+    if (unique && prefix_size == key_columns.size())
+        return descent + 1;
+    double rows = matching_rows >= 0 ? matching_rows : table_blocks * pow(COLUMN_SELECTIVITY, prefix_size);
+    return descent + (rows < 1 ? 1 : rows);
 }
 
+// Delete the entry for a row, which must still be in the relation. Nothing happens if it isn't in the index.
 void BTreeIndex::del(Handle handle) {
-    throw DbRelationError("Don't know how to delete from a BTree index yet");
-    // FIXME
+    Handles handles(1, handle);
+    del_batch(&handles);
+}
+
+// Delete the entries for many rows (which must still be in the relation) in one pass along the leaves.
+void BTreeIndex::del_batch(const Handles *handles) {
+    open();
+    KeyEntries *entries = key_entries(handles);
+    try {
+        update_entries(entries, nullptr);
+    } catch (...) {
+        delete entries;
+        throw;
+    }
+    delete entries;
+}
+
+// Point the entries for moved rows at where they are now (their keys are found through the new handles).
+void BTreeIndex::relocate(const Relocations *moves) {
+    open();
+    KeyEntries entries;
+    std::map<Handle, Handle> moved_to;
+    for (auto const &move: *moves) {
+        ValueDict *key = relation.project(move.second, &key_columns);
+        KeyValue *tkey = this->tkey(key);
+        add_handle(*tkey, move.first);
+        entries.push_back(std::make_pair(std::move(*tkey), move.first));
+        moved_to[move.first] = move.second;
+        delete key;
+        delete tkey;
+    }
+    std::sort(entries.begin(), entries.end());
+    if (unique) {
+        update_entries(&entries, &moved_to);
+        return;
+    }
+
+    // the old handle is part of the key, so the entries have to be taken out and put back in under the new one
+    update_entries(&entries, nullptr);
+    for (auto &entry: entries) {
+        entry.second = moved_to[entry.second];
+        entry.first.resize(key_columns.size());
+        add_handle(entry.first, entry.second);
+    }
+    std::sort(entries.begin(), entries.end());
+    for (auto const &entry: entries)
+        insert(&entry.first, entry.second);
+}
+
+/**
+ * Find each of the given entries in a single pass along the leaves, left to right, and either delete them or point
+ * them at a new handle. There is one descent per leaf visited (through the pinned root and the routing cache);
+ * entries that aren't there are skipped. A leaf left under MERGE_THRESHOLD full is merged with, or evened out
+ * with, a sibling; interior nodes are left as they are except that a root with one child is dropped.
+ * @param entries   keys and current handles, sorted
+ * @param moved_to  if not null, the new handle for each current one (instead of deleting)
+ */
+void BTreeIndex::update_entries(const KeyEntries *entries, const std::map<Handle, Handle> *moved_to) {
+    const double underfull = (1.0 - MERGE_THRESHOLD) * (this->file.get_block_size() - NODE_OVERHEAD);
+    size_t i = 0;
+    while (i < entries->size()) {
+        BlockPointers path;
+        BlockID leaf_id = find_leaf(&(*entries)[i].first, &path);
+        BTreeLeaf *leaf = leaf_id == root->get_id() ? static_cast<BTreeLeaf *>(root)
+                                                    : new BTreeLeaf(file, leaf_id, key_profile, false);
+        // everything up to this leaf's last key is in this leaf
+        do {
+            const KeyEntries::value_type &entry = (*entries)[i++];
+            size_t at = leaf->lower_bound(&entry.first);
+            if (at == leaf->size() || leaf->compare_entry(at, &entry.first) != 0 ||
+                leaf->get_entry_handle(at) != entry.second)
+                continue;
+            if (moved_to == nullptr)
+                leaf->del(at);
+            else
+                leaf->set_entry_handle(at, moved_to->at(entry.second));
+        } while (i < entries->size() && leaf->size() > 0 &&
+                 leaf->compare_entry(leaf->size() - 1, &(*entries)[i].first) >= 0);
+        leaf->save();
+        if (leaf != root) {
+            if (moved_to == nullptr && leaf->unused_bytes() > underfull)
+                rebalance(leaf, path.back());
+            delete leaf;
+        }
+    }
+    shrink_root();
+}
+
+// Merge the leaf with a sibling under the same parent, or even them out, and fix up the parent to match.
+void BTreeIndex::rebalance(BTreeLeaf *leaf, BlockID parent_id) {
+    routing_cache.erase(parent_id);
+    BTreeInterior *parent = parent_id == root->get_id() ? static_cast<BTreeInterior *>(root)
+                                                        : new BTreeInterior(file, parent_id, key_profile, false);
+    const BTreeRouting &routing = parent->get_routing();
+    if (!routing.pointers.empty()) {
+        // the leaf and its right sibling, or else its left one if it's the last child
+        BlockID left_id = leaf->get_id();
+        BlockID right_id;
+        if (routing.first == left_id) {
+            right_id = routing.pointers[0];
+        } else {
+            right_id = left_id;
+            auto at = std::find(routing.pointers.begin(), routing.pointers.end(), right_id);
+            left_id = at == routing.pointers.begin() ? routing.first : *(at - 1);
+        }
+        BTreeLeaf *left = left_id == leaf->get_id() ? leaf : new BTreeLeaf(file, left_id, key_profile, false);
+        BTreeLeaf *right = right_id == leaf->get_id() ? leaf : new BTreeLeaf(file, right_id, key_profile, false);
+        KeyValue boundary;
+        bool merged = left->rebalance(*right, boundary);
+        if (merged)
+            parent->remove(right_id);
+        else
+            parent->set_boundary(right_id, boundary);
+        parent->save();
+        if (left != leaf)
+            delete left;
+        if (right != leaf)
+            delete right;
+        if (merged)
+            stat->free_block(right_id);  // its entries went to the left, so new nodes can have it
+    }
+    if (parent != root)
+        delete parent;
+}
+
+// While the root is an interior node with just one child, make that child the root.
+void BTreeIndex::shrink_root() {
+    while (stat->get_height() > 1 && static_cast<BTreeInterior *>(root)->get_routing().pointers.empty()) {
+        BlockID child_id = static_cast<BTreeInterior *>(root)->get_first();
+        stat->set_root_id(child_id);
+        stat->set_height(stat->get_height() - 1);
+        stat->save();
+        routing_cache.erase(child_id);
+        BlockID old_root_id = root->get_id();
+        delete root;
+        stat->free_block(old_root_id);
+        if (stat->get_height() == 1)
+            root = new BTreeLeaf(file, child_id, key_profile, false);
+        else
+            root = new BTreeInterior(file, child_id, key_profile, false);
+    }
+}
+
+// For a non-unique index, put the handle on the end of the key so that every entry is still distinct.
+void BTreeIndex::add_handle(KeyValue &key, Handle handle) const {
+    if (!unique) {
+        key.push_back(Value((int32_t) handle.first));
+        key.push_back(Value((int32_t) handle.second));
+    }
 }
 
 KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
@@ -144,6 +558,22 @@ KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
     return key_value;
 }
 
+// Pull out the values for the leading key columns. The columns given must be a prefix of the key columns.
+KeyValue BTreeIndex::prefix_key(const ValueDict &key) const {
+    KeyValue prefix;
+    for (auto const &column_name: key_columns) {
+        auto found = key.find(column_name);
+        if (found == key.end())
+            break;
+        if (found->second.data_type != key_profile[prefix.size()])
+            throw DbRelationError("wrong type of value for index column " + column_name);
+        prefix.push_back(found->second);
+    }
+    if (prefix.size() != key.size())
+        throw DbRelationError("range bounds must be on leading columns of the index key");
+    return prefix;
+}
+
 // Figure out the data types of each key component and encode them in key_profile, a list of int/str classes.
 void BTreeIndex::build_key_profile() {
     std::map<const Identifier, ColumnAttribute::DataType> types_by_colname;
@@ -155,6 +585,86 @@ void BTreeIndex::build_key_profile() {
     }
     for (auto const &column_name: key_columns)
         key_profile.push_back(types_by_colname[column_name]);
+    if (!unique) {
+        key_profile.push_back(ColumnAttribute::INT);  // handle's block id
+        key_profile.push_back(ColumnAttribute::INT);  // and record id
+    }
+}
+
+/********************
+ * BTreeRangeCursor *
+ ********************/
+
+BTreeRangeCursor::BTreeRangeCursor(BTreeLeaf *leaf, bool owned, const KeyValue &min, bool min_inclusive,
+                                   const KeyValue &max, bool max_inclusive) : leaf(leaf), owned(owned), pos(0),
+                                                                              min(min),
+                                                                              min_inclusive(min_inclusive),
+                                                                              past_min(false), max(max),
+                                                                              max_inclusive(max_inclusive),
+                                                                              handle() {
+    this->pos = leaf->lower_bound(&this->min);
+}
+
+BTreeRangeCursor::~BTreeRangeCursor() {
+    release();
+}
+
+// Next entry along the leaves, until one is past the upper bound
+bool BTreeRangeCursor::next() {
+    while (this->leaf != nullptr) {
+        if (this->pos == this->leaf->size()) {
+            BTreeLeaf *next_leaf = this->leaf->next();
+            release();
+            this->leaf = next_leaf;
+            this->owned = true;
+            this->pos = 0;
+            continue;
+        }
+        if (!this->max.empty()) {
+            int cmp = this->leaf->compare_entry(this->pos, &this->max);
+            if (cmp > 0 || (cmp == 0 && !this->max_inclusive)) {
+                release();
+                return false;
+            }
+        }
+        size_t at = this->pos++;
+        if (!this->past_min) {
+            // only the first few can be under the bound (equal on the prefix, or just past an exclusive one)
+            int cmp = this->leaf->compare_entry(at, &this->min);
+            if (cmp < 0 || (cmp == 0 && !this->min_inclusive))
+                continue;
+            this->past_min = true;
+        }
+        this->handle = this->leaf->get_entry_handle(at);
+        return true;
+    }
+    return false;
+}
+
+// Let go of the current leaf (unpinning it unless it's the root, which the index holds on to).
+void BTreeRangeCursor::release() {
+    if (this->owned)
+        delete this->leaf;
+    this->leaf = nullptr;
+}
+
+// Test helper. Count the entries a range cursor finds, checking they come in order of column a.
+static long test_range_count(DbRelation &table, DbIndexCursor *cursor) {
+    long count = 0;
+    int32_t last = INT32_MIN;
+    while (cursor->next()) {
+        ValueDict *row = table.project(cursor->get_handle());
+        int32_t a = (*row)["a"].n;
+        delete row;
+        if (a <= last && count > 0) {
+            delete cursor;
+            return -1;
+        }
+        last = a;
+        count++;
+    }
+    delete cursor;
+    return count;
 }
 
 bool test_btree() {
@@ -184,6 +694,33 @@ bool test_btree() {
     BTreeIndex index(table, "fooindex", column_names, true);
     index.create();
 
+    // bulk load leaves every key in order along the chain of leaves
+    BlockID leaf_id = index.root->get_id();
+    for (uint height = index.stat->get_height(); height > 1; height--) {
+        BTreeInterior interior(index.file, leaf_id, index.key_profile, false);
+        leaf_id = interior.get_first();
+    }
+    size_t num_keys = 0;
+    KeyValue last_key;
+    while (leaf_id != 0) {
+        BTreeLeaf leaf(index.file, leaf_id, index.key_profile, false);
+        for (size_t i = 0; i < leaf.size(); i++) {
+            KeyValue *key = leaf.get_entry_key(i);
+            bool in_order = num_keys++ == 0 || last_key < *key;
+            last_key = *key;
+            delete key;
+            if (!in_order || leaf.compare_entry(i, &last_key) != 0) {
+                std::cout << "leaf chain out of order" << std::endl;
+                return false;
+            }
+        }
+        leaf_id = leaf.get_next_leaf();
+    }
+    if (num_keys != 50002 || index.stat->get_height() < 2) {
+        std::cout << "bulk load failed " << num_keys << std::endl;
+        return false;
+    }
+
     ValueDict lookup;
     lookup["a"] = 12;
     Handles *handles = index.lookup(&lookup);
@@ -225,6 +762,214 @@ bool test_btree() {
             delete handles;
             delete result;
         }
+    if (index.stat->get_height() > 2 && index.routing_cache.empty()) {
+        std::cout << "interior nodes not cached" << std::endl;
+        return false;
+    }
+
+    // ranges, inclusive and exclusive and open-ended
+    ValueDict low, high;
+    low["a"] = 100;
+    high["a"] = 199;
+    long count = test_range_count(table, index.range_cursor(KeyBound(&low), KeyBound(&high)));
+    long exclusive_count = test_range_count(table, index.range_cursor(KeyBound(&low, false), KeyBound(&high, false)));
+    long below_count = test_range_count(table, index.range_cursor(KeyBound(), KeyBound(&high)));
+    if (count != 100 || exclusive_count != 98 || below_count != 102) {
+        std::cout << "range failed " << count << " " << exclusive_count << " " << below_count << std::endl;
+        return false;
+    }
+    low["a"] = 50000;
+    handles = index.range(&low, nullptr);
+    count = (long) handles->size();
+    delete handles;
+    if (count != 100) {
+        std::cout << "range to end failed " << count << std::endl;
+        return false;
+    }
+
+    // ranges on a prefix of a composite key
+    ColumnNames b_a;
+    b_a.push_back("b");
+    b_a.push_back("a");
+    BTreeIndex b_a_index(table, "barindex", b_a, true);
+    b_a_index.create();
+    ValueDict b_low, b_high;
+    b_low["b"] = -10;
+    b_high["b"] = -5;
+    handles = b_a_index.range(&b_low, &b_high);
+    count = (long) handles->size();
+    delete handles;
+    DbIndexCursor *cursor = b_a_index.range_cursor(KeyBound(&b_low, false), KeyBound(&b_high, false));
+    exclusive_count = 0;
+    while (cursor->next())
+        exclusive_count++;
+    delete cursor;
+    b_low["a"] = 110;  // the whole key of the row with b = -10
+    handles = b_a_index.lookup(&b_low);
+    bool found = handles->size() == 1;
+    delete handles;
+    if (count != 6 || exclusive_count != 4 || !found) {
+        b_a_index.drop();
+        std::cout << "prefix range failed " << count << " " << exclusive_count << std::endl;
+        return false;
+    }
+
+    // an index whose stat block has no layout (i.e., from before it was recorded) is rebuilt when opened
+    b_a_index.close();
+    b_a_index.file.open();
+    SlottedPage *stat_block = b_a_index.file.get(BTreeIndex::STAT);
+    while (stat_block->size() > BTreeStat::HEIGHT)
+        stat_block->remove(stat_block->size());
+    b_a_index.file.put(stat_block);
+    b_a_index.file.unpin(stat_block);
+    b_a_index.file.close();
+    b_a_index.open();
+    handles = b_a_index.lookup(&b_low);
+    found = handles->size() == 1;
+    delete handles;
+    bool rebuilt = b_a_index.stat->get_layout() == BTreeStat::LAYOUT_VERSION;
+    b_a_index.drop();
+    if (!found || !rebuilt) {
+        std::cout << "rebuild of older index failed" << std::endl;
+        return false;
+    }
+
+    // inserts into the loaded (mostly full) leaves split them
+    for (int i = 0; i < 2000; i++) {
+        ValueDict row;
+        row["a"] = Value(-i);
+        row["b"] = Value(i);
+        index.insert(table.insert(&row));
+    }
+    for (int i = 0; i < 2000; i += 7) {
+        lookup["a"] = -i;
+        handles = index.lookup(&lookup);
+        if (handles->size() != 1) {
+            std::cout << "lookup after insert failed " << i << std::endl;
+            return false;
+        }
+        result = table.project(handles->back());
+        if ((*result)["b"].n != i) {
+            std::cout << "lookup after insert failed " << i << std::endl;
+            return false;
+        }
+        delete handles;
+        delete result;
+    }
+
+    // deleting a range in one batch leaves everything else findable
+    low["a"] = 100;
+    high["a"] = 40099;
+    handles = index.range(&low, &high);
+    index.del_batch(handles);
+    for (auto const &handle: *handles)
+        table.del(handle);
+    count = (long) handles->size();
+    delete handles;
+    handles = index.range(&low, &high);
+    bool gone = handles->empty();
+    delete handles;
+    lookup["a"] = 40100;
+    handles = index.lookup(&lookup);
+    found = handles->size() == 1;
+    delete handles;
+    if (count != 40000 || !gone || !found) {
+        std::cout << "range delete failed " << count << std::endl;
+        return false;
+    }
+
+    // the blocks those merges emptied are taken for the new nodes of later inserts, so the file doesn't grow
+    BlockIDs *block_ids = index.file.block_ids();
+    size_t blocks = block_ids->size();
+    delete block_ids;
+    bool freed = index.stat->get_free_head() != 0;
+    handles = new Handles();
+    for (int i = 100; i < 5100; i++) {
+        ValueDict row;
+        row["a"] = Value(i);
+        row["b"] = Value(100 - i);
+        Handle handle = table.insert(&row);
+        index.insert(handle);
+        handles->push_back(handle);
+    }
+    block_ids = index.file.block_ids();
+    bool reused = block_ids->size() == blocks;
+    delete block_ids;
+    lookup["a"] = 2100;
+    Handles *found_handles = index.lookup(&lookup);
+    found = found_handles->size() == 1;
+    delete found_handles;
+    index.del_batch(handles);
+    for (auto const &handle: *handles)
+        table.del(handle);
+    delete handles;
+    if (!freed || !reused || !found) {
+        std::cout << "reuse of freed index blocks failed " << blocks << std::endl;
+        return false;
+    }
+    lookup["a"] = 12;
+    handles = index.lookup(&lookup);
+    index.del(handles->back());
+    table.del(handles->back());
+    delete handles;
+    handles = index.lookup(&lookup);
+    gone = handles->empty();
+    delete handles;
+    if (!gone) {
+        std::cout << "delete failed" << std::endl;
+        return false;
+    }
+
+    // rows moved by vacuum can still be found through the index
+    Relocations *moves = table.vacuum(true);
+    index.relocate(moves);
+    bool moved = !moves->empty();
+    delete moves;
+    for (int i = 40100; i < 50100; i += 97) {
+        lookup["a"] = i;
+        handles = index.lookup(&lookup);
+        found = handles->size() == 1;
+        if (found) {
+            result = table.project(handles->back());
+            found = (*result)["b"].n == 100 - i;
+            delete result;
+        }
+        delete handles;
+        if (!moved || !found) {
+            std::cout << "lookup after vacuum failed " << i << std::endl;
+            return false;
+        }
+    }
+
+    // a non-unique index finds every row with the key, before and after more are added
+    ColumnNames b;
+    b.push_back("b");
+    BTreeIndex b_index(table, "bfooindex", b, false);
+    b_index.create();
+    for (int i = 0; i < 3000; i++) {
+        ValueDict row;
+        row["a"] = Value(60000 + i);
+        row["b"] = Value(i % 3);  // 0 and 1 are already there once each
+        b_index.insert(table.insert(&row));
+    }
+    lookup.clear();
+    lookup["b"] = 1;
+    handles = b_index.lookup(&lookup);
+    count = (long) handles->size();
+    b_index.del(handles->back());
+    delete handles;
+    handles = b_index.lookup(&lookup);
+    long after_del = (long) handles->size();
+    delete handles;
+    lookup["b"] = 0;
+    handles = b_index.lookup(&lookup);
+    long zeros = (long) handles->size();
+    delete handles;
+    b_index.drop();
+    if (count != 1001 || after_del != 1000 || zeros != 1001) {
+        std::cout << "non-unique lookup failed " << count << " " << after_del << " " << zeros << std::endl;
+        return false;
+    }
 
     index.drop();
     table.drop();
@@ -6,10 +6,21 @@
  */
 #pragma once
 
+#include <mutex>
+#include <unordered_map>
 #include "BTreeNode.h"
 
+/**
+ * @class BTreeIndex - B+tree index on a relation. In a non-unique index the row's handle is kept on the end of each
+ * key, so entries are still distinct and a lookup is a range over the leading columns.
+ */
 class BTreeIndex : public DbIndex {
 public:
+    static const double DEFAULT_FILL_FACTOR;  // how full create() packs each node
+    static const double COLUMN_SELECTIVITY;  // guess at the fraction of rows matching one key column's value
+    static const double MERGE_THRESHOLD;  // a leaf left less full than this by a delete is merged or evened out
+    static const size_t ROUTING_CACHE_SIZE = 4096;  // most interior nodes kept decoded in memory
+
     BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
 
     virtual ~BTreeIndex();
@@ -24,27 +35,97 @@ public:
 
     virtual Handles *lookup(ValueDict *key) const;
 
-    virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
+    virtual DbIndexCursor *range_cursor(const KeyBound &min, const KeyBound &max) const;
 
     virtual void insert(Handle handle);
 
+    virtual void insert_batch(const Handles *handles);
+
     virtual void del(Handle handle);
 
+    virtual void del_batch(const Handles *handles);
+
+    virtual void relocate(const Relocations *moves);
+
+    virtual double lookup_cost(uint prefix_size, uint32_t table_blocks, double matching_rows);
+
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
 
+    void add_handle(KeyValue &key, Handle handle) const;  // the handle is part of the key if it isn't unique
+
+    KeyValue prefix_key(const ValueDict &key) const;  // the same, for just the leading columns given
+
+    double get_fill_factor() const { return this->fill_factor; }
+
+    void set_fill_factor(double fill_factor);
+
 protected:
     static const BlockID STAT = 1;
+    static const uint RECORD_OVERHEAD = 4;  // slotted-page header bytes for each record
+    static const uint NODE_OVERHEAD = 4 + RECORD_OVERHEAD + sizeof(BlockID);  // block header plus first/next pointer
     bool closed;
+    double fill_factor;
     BTreeStat *stat;
     BTreeNode *root;
-    HeapFile file;
+    mutable HeapFile file;  // lookups pin blocks
     KeyProfile key_profile;
+    mutable std::unordered_map<BlockID, BTreeRouting> routing_cache;  // interior nodes below the root, by block id
+    mutable std::mutex latch;  // held while opening, closing, or using routing_cache (lookups may run at once)
 
     void build_key_profile();
 
-    Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key) const;
+    KeyEntries *scan_keys() const;
+
+    void bulk_load(KeyEntries *entries);
+
+    void rebuild();
+
+    uint key_size(const KeyValue *key) const;
+
+    BlockID child(BlockID interior_id, const KeyValue *key) const;
+
+    BlockID find_leaf(const KeyValue *key, BlockPointers *path = nullptr) const;
 
-    Insertion _insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle);
+    void insert(const KeyValue *key, Handle handle);
+
+    KeyEntries *key_entries(const Handles *handles) const;
+
+    void update_entries(const KeyEntries *entries, const std::map<Handle, Handle> *moved_to);
+
+    void rebalance(BTreeLeaf *leaf, BlockID parent_id);
+
+    void shrink_root();
+
+    friend bool test_btree();
+};
+
+/**
+ * @class BTreeRangeCursor - walks the chain of leaves of a BTreeIndex from the lower bound of a range to the upper
+ * bound, one leaf pinned at a time
+ */
+class BTreeRangeCursor : public DbIndexCursor {
+public:
+    BTreeRangeCursor(BTreeLeaf *leaf, bool owned, const KeyValue &min, bool min_inclusive, const KeyValue &max,
+                     bool max_inclusive);
+
+    virtual ~BTreeRangeCursor();
+
+    virtual bool next();
+
+    virtual Handle get_handle() const { return this->handle; }
+
+protected:
+    BTreeLeaf *leaf;
+    bool owned;  // false if leaf is the index's root
+    size_t pos;  // next entry in leaf
+    KeyValue min;
+    bool min_inclusive;
+    bool past_min;
+    KeyValue max;
+    bool max_inclusive;
+    Handle handle;
+
+    void release();
 };
 
 bool test_btree();
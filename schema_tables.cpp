@@ -3,22 +3,31 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
+#include <algorithm>
 #include "schema_tables.h"
 #include "ParseTreeToString.h"
+#include "ColumnTable.h"
 #include "btree.h"
+#include "HashIndex.h"
 
 
 void initialize_schema_tables() {
     Tables tables;
     tables.create_if_not_exists();
-    tables.close();
     Columns columns;
     columns.create_if_not_exists();
-    columns.close();
     Indices indices;
     indices.create_if_not_exists();
+    Catalog::load(tables, columns, indices);
+    tables.add_storage_column(columns);
+    Statistics &statistics = Tables::get_statistics_table();
+    statistics.create_if_not_exists();
+    if (!Catalog::has_table(Statistics::TABLE_NAME))
+        statistics.add_to_schema(tables, columns);
+    tables.close();
+    columns.close();
     indices.close();
-
+    statistics.close();
 }
 
 // Not terribly useful since the parser weeds most of these out
@@ -48,14 +57,20 @@ bool is_acceptable_data_type(std::string dt) {
  * ***************************
  */
 const Identifier Tables::TABLE_NAME = "_tables";
+const std::string Tables::HEAP_STORAGE = "HEAP";
+const std::string Tables::COLUMN_STORAGE = "COLUMN";
 Columns *Tables::columns_table = nullptr;
+Statistics *Tables::statistics_table = nullptr;
 std::map<Identifier, DbRelation *> Tables::table_cache;
+std::recursive_mutex Tables::cache_latch;
 
 // get the column name for _tables column
 ColumnNames &Tables::COLUMN_NAMES() {
     static ColumnNames cn;
-    if (cn.empty())
+    if (cn.empty()) {
         cn.push_back("table_name");
+        cn.push_back("storage");
+    }
     return cn;
 }
 
@@ -64,17 +79,21 @@ ColumnAttributes &Tables::COLUMN_ATTRIBUTES() {
     static ColumnAttributes cas;
     if (cas.empty()) {
         ColumnAttribute ca(ColumnAttribute::TEXT);
-        cas.push_back(ca);
+        cas.push_back(ca);  // table_name
+        cas.push_back(ca);  // storage
     }
     return cas;
 }
 
-// ctor - we have a fixed table structure of just one column: table_name
+// ctor - we have a fixed table structure: table_name, storage
 Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
     Tables::table_cache[TABLE_NAME] = this;
     if (Tables::columns_table == nullptr)
         columns_table = new Columns();
     Tables::table_cache[columns_table->TABLE_NAME] = columns_table;
+    if (Tables::statistics_table == nullptr)
+        statistics_table = new Statistics();
+    Tables::table_cache[statistics_table->TABLE_NAME] = statistics_table;
 }
 
 // Create the file and also, manually add schema tables.
@@ -89,15 +108,20 @@ void Tables::create() {
     insert(&row);
 }
 
-// Manually check that table_name is unique.
+// Manually check that table_name is unique (and that storage, which is HEAP if not given, is one we have).
 Handle Tables::insert(const ValueDict *row) {
-    // Try SELECT * FROM _tables WHERE table_name = row["table_name"] and it should return nothing
-    Handles *handles = select(row);
-    bool unique = handles->empty();
-    delete handles;
-    if (!unique)
-        throw DbRelationError(row->at("table_name").s + " already exists");
-    return HeapTable::insert(row);
+    Identifier table_name = row->at("table_name").s;
+    if (Catalog::has_table(table_name))
+        throw DbRelationError(table_name + " already exists");
+    ValueDict full_row = *row;
+    if (full_row.find("storage") == full_row.end())
+        full_row["storage"] = Value(HEAP_STORAGE);
+    std::string storage = full_row.at("storage").s;
+    if (storage != HEAP_STORAGE && storage != COLUMN_STORAGE)
+        throw DbRelationError("unknown storage '" + storage + "'");
+    Handle handle = HeapTable::insert(&full_row);
+    Catalog::add_table(table_name, handle, storage);
+    return handle;
 }
 
 // Remove a row, but first remove from table cache if there
@@ -114,56 +138,102 @@ void Tables::del(Handle handle) {
     }
 
     HeapTable::del(handle);
+    Catalog::remove_table(table_name);
+}
+
+void Tables::add_storage_column(Columns &columns) {
+    for (auto const &column: Catalog::get_columns(TABLE_NAME))
+        if (column.column_name == "storage")
+            return;
+    ValueDict row;
+    row["table_name"] = Value(TABLE_NAME);
+    row["column_name"] = Value("storage");
+    row["data_type"] = Value("TEXT");
+    columns.insert(&row);
+}
+
+// A row from before there was a storage column is just the table_name (2-byte size and characters)
+bool Tables::is_old_row(const Dbt *data) {
+    return data->get_size() == sizeof(u_int16_t) + *(const u_int16_t *) data->get_data();
+}
+
+// Old rows are heap tables
+void Tables::unmarshal(const Dbt *data, Row &row) const {
+    if (!is_old_row(data)) {
+        HeapTable::unmarshal(data, row);
+        return;
+    }
+    const char *bytes = (const char *) data->get_data();
+    row.clear();
+    row.append_text_view(bytes + sizeof(u_int16_t), *(const u_int16_t *) bytes);
+    row.append_text(HEAP_STORAGE.data(), (u_int16_t) HEAP_STORAGE.size());
+}
+
+bool Tables::matches(const Dbt *data, const std::vector<const Value *> &where_by_column) const {
+    if (!is_old_row(data))
+        return HeapTable::matches(data, where_by_column);
+    std::vector<char> bytes((const char *) data->get_data(), (const char *) data->get_data() + data->get_size());
+    u_int16_t size = (u_int16_t) HEAP_STORAGE.size();
+    bytes.insert(bytes.end(), (char *) &size, (char *) &size + sizeof(size));
+    bytes.insert(bytes.end(), HEAP_STORAGE.begin(), HEAP_STORAGE.end());
+    Dbt padded(&bytes[0], (u_int32_t) bytes.size());
+    return HeapTable::matches(&padded, where_by_column);
 }
 
 // Return a list of column names and column attributes for given table.
 void Tables::get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes) {
-    // SELECT * FROM _columns WHERE table_name = <table_name>
-    ValueDict where;
-    where["table_name"] = table_name;
-    Handles *handles = Tables::columns_table->select(&where);
-
+    // the catalog's copy of SELECT * FROM _columns WHERE table_name = <table_name>
     ColumnAttribute column_attribute;
-    for (auto const &handle: *handles) {
-        ValueDict *row = Tables::columns_table->project(
-                handle);  // get the row's values: {'column_name': <name>, 'data_type': <type>}
-
-        Identifier column_name = (*row)["column_name"].s;
-        column_names.push_back(column_name);
+    for (auto const &row: Catalog::get_columns(table_name)) {
+        column_names.push_back(row.column_name);
 
         ColumnAttribute::DataType data_type;
-        if ((*row)["data_type"].s == "INT")
+        if (row.data_type == "INT")
             data_type = ColumnAttribute::INT;
-        else if ((*row)["data_type"].s == "TEXT")
+        else if (row.data_type == "TEXT")
             data_type = ColumnAttribute::TEXT;
-        else if ((*row)["data_type"].s == "BOOLEAN")
+        else if (row.data_type == "BOOLEAN")
             data_type = ColumnAttribute::BOOLEAN;
         else
             throw DbRelationError("Unknown data type");
         column_attribute.set_data_type(data_type);
 
         column_attributes.push_back(column_attribute);
-
-        delete row;
     }
-    delete handles;
 }
 
 // Return a table for given table_name.
 DbRelation &Tables::get_table(Identifier table_name) {
+    std::lock_guard<std::recursive_mutex> guard(Tables::cache_latch);
     // if they are asking about a table we've once constructed, then just return that one
     if (Tables::table_cache.find(table_name) != Tables::table_cache.end())
         return *Tables::table_cache[table_name];
 
-    // otherwise assume it is a HeapTable (for now)
+    // otherwise make one of whichever kind its row in _tables says
     ColumnNames column_names;
     ColumnAttributes column_attributes;
     get_columns(table_name, column_names, column_attributes);
-    DbRelation *table = new HeapTable(table_name, column_names, column_attributes);
+    DbRelation *table;
+    if (Catalog::get_table_storage(table_name) == COLUMN_STORAGE)
+        table = new ColumnTable(table_name, column_names, column_attributes);
+    else
+        table = new HeapTable(table_name, column_names, column_attributes);
     Tables::table_cache[table_name] = table;
     return *table;
 }
 
+void Tables::discard_cache() {
+    std::lock_guard<std::recursive_mutex> guard(Tables::cache_latch);
+    for (auto it = Tables::table_cache.begin(); it != Tables::table_cache.end();) {
+        if (it->first == TABLE_NAME || it->first == Columns::TABLE_NAME || it->first == Statistics::TABLE_NAME) {
+            it++;
+        } else {
+            delete it->second;
+            it = Tables::table_cache.erase(it);
+        }
+    }
+}
+
 
 /*
  * ****************************
@@ -207,6 +277,8 @@ void Columns::create() {
     row["table_name"] = Value("_tables");
     row["column_name"] = Value("table_name");
     insert(&row);
+    row["column_name"] = Value("storage");
+    insert(&row);
     row["table_name"] = Value("_columns");
     row["column_name"] = Value("table_name");
     insert(&row);
@@ -242,18 +314,24 @@ Handle Columns::insert(const ValueDict *row) {
     if (!is_acceptable_data_type(row->at("data_type").s))
         throw DbRelationError("unacceptable data type '" + row->at("data_type").s + "'");
 
-    // Try SELECT * FROM _columns WHERE table_name = row["table_name"] AND column_name = column_name["column_name"]
-    // and it should return nothing
-    ValueDict where;
-    where["table_name"] = row->at("table_name");
-    where["column_name"] = row->at("column_name");
-    Handles *handles = select(&where);
-    bool unique = handles->empty();
-    delete handles;
-    if (!unique)
-        throw DbRelationError("duplicate column " + row->at("table_name").s + "." + row->at("column_name").s);
+    // There should be no row yet with this table_name and column_name
+    Identifier table_name = row->at("table_name").s;
+    for (auto const &column: Catalog::get_columns(table_name))
+        if (column.column_name == row->at("column_name").s)
+            throw DbRelationError("duplicate column " + table_name + "." + column.column_name);
 
-    return HeapTable::insert(row);
+    Handle handle = HeapTable::insert(row);
+    Catalog::add_column(table_name, Catalog::column_row(handle, row));
+    return handle;
+}
+
+// Remove a row from the catalog, too
+void Columns::del(Handle handle) {
+    ValueDict *row = project(handle);
+    Identifier table_name = row->at("table_name").s;
+    delete row;
+    HeapTable::del(handle);
+    Catalog::remove_column(table_name, handle);
 }
 
 
@@ -264,6 +342,7 @@ Handle Columns::insert(const ValueDict *row) {
  */
 const Identifier Indices::TABLE_NAME = "_indices";
 std::map<std::pair<Identifier, Identifier>, DbIndex *> Indices::index_cache;
+std::recursive_mutex Indices::cache_latch;
 
 // get the column name for _indices column
 ColumnNames &Indices::COLUMN_NAMES() {
@@ -307,20 +386,18 @@ Handle Indices::insert(const ValueDict *row) {
     if (!is_acceptable_identifier(row->at("index_name").s))
         throw DbRelationError("unacceptable index name '" + row->at("index_name").s + "'");
 
-    // Try SELECT * FROM _indices WHERE table_name = row["table_name"] AND index_name = row["index_name"]
-    //     AND column_name = column_name["column_name"]
-    // and it should return nothing
-    ValueDict where;
-    where["table_name"] = row->at("table_name");
-    where["index_name"] = row->at("index_name");
-    if (row->at("seq_in_index").n > 1)
-        where["column_name"] = row->at("column_name");  // check for duplicate columns on the same index
-    Handles *handles = select(&where);
-    bool unique = handles->empty();
-    delete handles;
-    if (!unique)
-        throw DbRelationError("duplicate index " + row->at("table_name").s + " " + row->at("index_name").s);
-    return HeapTable::insert(row);
+    // There should be no row yet with this table_name and index_name (and, for the index's later columns,
+    // column_name -- to check for duplicate columns on the same index)
+    Identifier table_name = row->at("table_name").s;
+    Identifier index_name = row->at("index_name").s;
+    bool later_column = row->at("seq_in_index").n > 1;
+    for (auto const &index_column: Catalog::get_indices(table_name))
+        if (index_column.index_name == index_name
+            && (!later_column || index_column.column_name == row->at("column_name").s))
+            throw DbRelationError("duplicate index " + table_name + " " + index_name);
+    Handle handle = HeapTable::insert(row);
+    Catalog::add_index_column(table_name, Catalog::index_row(handle, row));
+    return handle;
 }
 
 // Remove a row, but first remove from index cache if there
@@ -338,72 +415,45 @@ void Indices::del(Handle handle) {
         delete index;
     }
     HeapTable::del(handle);
+    Catalog::remove_index_column(table_name, handle);
 }
 
 // Return a list of column names and column attributes for given table.
 void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
                           bool &is_unique) {
-    // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
-    ValueDict where;
-    where["table_name"] = table_name;
-    where["index_name"] = index_name;
-    Handles *handles = select(&where);
-
+    // the catalog's copy of SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     Identifier colnames[DbIndex::MAX_COMPOSITE];
     uint size = 0;
-    for (auto const &handle: *handles) {
-        ValueDict *row = project(handle);
-
-        Identifier column_name = (*row)["column_name"].s;
-        uint which = (uint) (*row)["seq_in_index"].n;
-        colnames[which - 1] = column_name;  // seq_in_index is 1-based
+    for (auto const &row: Catalog::get_indices(table_name)) {
+        if (row.index_name != index_name)
+            continue;
+        uint which = (uint) row.seq_in_index;
+        colnames[which - 1] = row.column_name;  // seq_in_index is 1-based
         if (which > size)
             size = which;
-        is_unique = (*row)["is_unique"].n != 0;
-        is_hash = (*row)["index_type"].s == "HASH";
-        delete row;
+        is_unique = row.is_unique;
+        is_hash = row.index_type == "HASH";
     }
     for (uint i = 0; i < size; i++)
         column_names.push_back(colnames[i]);
-    delete handles;
 }
 
-// FIXME - use this for now until we have BTreeIndex and HashIndex
-class DummyIndex : public DbIndex {
-public:
-    DummyIndex(DbRelation &rel, Identifier idx, ColumnNames key, bool unq) : DbIndex(rel, idx, key, unq) {}
-
-    void create() {}
-
-    void drop() {}
-
-    void open() {}
-
-    void close() {}
-
-    Handles *lookup(ValueDict *key_values) const { return nullptr; }
-
-    void insert(Handle handle) {}
-
-    void del(Handle handle) {}
-};
-
-
 // Return a table for given table_name.
 DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
+    std::lock_guard<std::recursive_mutex> guard(Indices::cache_latch);
     // if they are asking about an index we've once constructed, then just return that one
     std::pair<Identifier, Identifier> cache_key(table_name, index_name);
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
         return *Indices::index_cache[cache_key];
 
-    // otherwise assume it is a DummyIndex (for now)
+    // otherwise make it from its rows in _indices
     ColumnNames column_names;
     bool is_hash, is_unique;
     get_columns(table_name, index_name, column_names, is_hash, is_unique);
     DbRelation &table = Tables::get_table(table_name);
     DbIndex *index;
     if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
+        index = new HashIndex(table, index_name, column_names, is_unique);
     } else {
         index = new BTreeIndex(table, index_name, column_names, is_unique);
     }
@@ -411,18 +461,394 @@ DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
     return *index;
 }
 
+// A Berkeley DB handle can't be opened again once it is closed, so the new index is a new DbIndex.
+DbIndex &Indices::rebuild_index(Identifier table_name, Identifier index_name) {
+    std::pair<Identifier, Identifier> cache_key(table_name, index_name);
+    DbIndex *old = &get_index(table_name, index_name);
+    Indices::index_cache.erase(cache_key);
+    Catalog::index_rebuilt(table_name);
+    try {
+        old->drop();
+    } catch (...) {
+        delete old;
+        throw;
+    }
+    delete old;
+    DbIndex &index = get_index(table_name, index_name);
+    index.create();
+    return index;
+}
+
+void Indices::discard_cache() {
+    std::lock_guard<std::recursive_mutex> guard(Indices::cache_latch);
+    for (auto const &entry: Indices::index_cache)
+        delete entry.second;
+    Indices::index_cache.clear();
+}
+
 IndexNames Indices::get_index_names(Identifier table_name) {
     IndexNames ret;
+    for (auto const &row: Catalog::get_indices(table_name))
+        if (row.seq_in_index == 1)  // only the row for the first column if composite index
+            ret.push_back(row.index_name);
+    return ret;
+}
+
+
+/*
+ * *******************************
+ * Statistics class implementation
+ * *******************************
+ */
+const Identifier Statistics::TABLE_NAME = "_statistics";
+std::map<Identifier, TableStatistics *> Statistics::cache;
+std::recursive_mutex Statistics::cache_latch;
+
+// get the column names for _statistics
+ColumnNames &Statistics::COLUMN_NAMES() {
+    static ColumnNames cn;
+    if (cn.empty()) {
+        cn.push_back("table_name");
+        cn.push_back("column_name");
+        cn.push_back("data_type");
+        cn.push_back("row_count");
+        cn.push_back("sampled_blocks");
+        cn.push_back("distinct_count");
+        cn.push_back("min_value");
+        cn.push_back("max_value");
+        cn.push_back("histogram");
+    }
+    return cn;
+}
+
+// get the column attributes for _statistics
+ColumnAttributes &Statistics::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes cas;
+    if (cas.empty()) {
+        ColumnAttribute ca(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // table_name
+        cas.push_back(ca);  // column_name
+        cas.push_back(ca);  // data_type
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // row_count
+        cas.push_back(ca);  // sampled_blocks
+        cas.push_back(ca);  // distinct_count
+        ca.set_data_type(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // min_value
+        cas.push_back(ca);  // max_value
+        cas.push_back(ca);  // histogram
+    }
+    return cas;
+}
+
+// ctor - we have a fixed table structure
+Statistics::Statistics() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+}
+
+static std::string data_type_name(ColumnAttribute::DataType data_type) {
+    switch (data_type) {
+        case ColumnAttribute::INT:
+            return "INT";
+        case ColumnAttribute::BOOLEAN:
+            return "BOOLEAN";
+        default:
+            return "TEXT";
+    }
+}
+
+static ColumnAttribute::DataType data_type_named(const std::string &name) {
+    if (name == "INT")
+        return ColumnAttribute::INT;
+    if (name == "BOOLEAN")
+        return ColumnAttribute::BOOLEAN;
+    return ColumnAttribute::TEXT;
+}
+
+void Statistics::add_to_schema(Tables &tables, Columns &columns) {
+    ValueDict row;
+    row["table_name"] = Value(TABLE_NAME);
+    tables.insert(&row);
+    for (uint i = 0; i < COLUMN_NAMES().size(); i++) {
+        row["column_name"] = Value(COLUMN_NAMES()[i]);
+        row["data_type"] = Value(data_type_name(COLUMN_ATTRIBUTES()[i].get_data_type()));
+        columns.insert(&row);
+    }
+}
+
+void Statistics::put(const Identifier &table_name, const TableStatistics &statistics) {
+    remove(table_name);
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    row["row_count"] = Value((int32_t) (statistics.row_count + 0.5));
+    row["sampled_blocks"] = Value((int32_t) statistics.sampled_blocks);
+    for (auto const &item: statistics.columns) {
+        const ColumnStatistics &column = item.second;
+        row["column_name"] = Value(item.first);
+        row["data_type"] = Value(data_type_name(column.data_type));
+        row["distinct_count"] = Value((int32_t) (column.distinct + 0.5));
+        row["min_value"] = Value(column.encode(column.min));
+        row["max_value"] = Value(column.encode(column.max));
+        row["histogram"] = Value(column.encode_histogram());
+        insert(&row);
+    }
+    Statistics::cache[table_name] = new TableStatistics(statistics);
+    Catalog::statistics_changed(table_name);
+}
+
+const TableStatistics *Statistics::get(const Identifier &table_name) {
+    std::lock_guard<std::recursive_mutex> guard(Statistics::cache_latch);
+    auto cached = Statistics::cache.find(table_name);
+    if (cached != Statistics::cache.end())
+        return cached->second;
+
     ValueDict where;
     where["table_name"] = Value(table_name);
-    where["seq_in_index"] = Value(1);  // only get the row for the first column if composite index
     Handles *handles = select(&where);
+    TableStatistics *statistics = nullptr;
     for (auto const &handle: *handles) {
         ValueDict *row = project(handle);
-        ret.push_back((*row)["index_name"].s);
+        if (statistics == nullptr) {
+            statistics = new TableStatistics();
+            statistics->row_count = row->at("row_count").n;
+            statistics->sampled_blocks = (uint) row->at("sampled_blocks").n;
+        }
+        ColumnStatistics &column = statistics->columns[row->at("column_name").s];
+        column.data_type = data_type_named(row->at("data_type").s);
+        column.distinct = row->at("distinct_count").n;
+        column.min = column.decode(row->at("min_value").s);
+        column.max = column.decode(row->at("max_value").s);
+        column.decode_histogram(row->at("histogram").s);
         delete row;
     }
     delete handles;
-    return ret;
+    Statistics::cache[table_name] = statistics;
+    return statistics;
+}
+
+void Statistics::discard_cache() {
+    std::lock_guard<std::recursive_mutex> guard(Statistics::cache_latch);
+    for (auto const &entry: Statistics::cache)
+        delete entry.second;
+    Statistics::cache.clear();
+}
+
+void Statistics::remove(const Identifier &table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = select(&where);
+    for (auto const &handle: *handles)
+        del(handle);
+    bool had_rows = !handles->empty();
+    delete handles;
+    auto cached = Statistics::cache.find(table_name);
+    if (cached != Statistics::cache.end()) {
+        delete cached->second;
+        Statistics::cache.erase(cached);
+    }
+    if (had_rows)
+        Catalog::statistics_changed(table_name);
+}
+
+
+/*
+ * ****************************
+ * Catalog class implementation
+ * ****************************
+ */
+u_long Catalog::version = 0;
+u_long Catalog::loaded_version = 0;
+std::unordered_map<Identifier, Handle> Catalog::tables;
+std::unordered_map<Identifier, std::string> Catalog::storage;
+std::unordered_map<Identifier, Catalog::ColumnRows> Catalog::columns;
+std::unordered_map<Identifier, Catalog::IndexRows> Catalog::indices;
+std::unordered_map<Identifier, u_long> Catalog::table_versions;
+
+// Put a row into its place in handle order
+template<typename Entry>
+static void insert_by_handle(std::vector<Entry> &rows, const Entry &row) {
+    auto spot = std::upper_bound(rows.begin(), rows.end(), row,
+                                 [](const Entry &a, const Entry &b) { return a.handle < b.handle; });
+    rows.insert(spot, row);
+}
+
+// Take out the row with the given handle (if it is there)
+template<typename Entry>
+static void erase_by_handle(std::vector<Entry> &rows, Handle handle) {
+    rows.erase(std::remove_if(rows.begin(), rows.end(), [&handle](const Entry &row) { return row.handle == handle; }),
+               rows.end());
+}
+
+// Give each moved row its new handle and put the rows back in handle order
+template<typename Entry>
+static void relocate_rows(std::vector<Entry> &rows, const std::map<Handle, Handle> &moved_to) {
+    bool moved = false;
+    for (auto &row: rows) {
+        auto found = moved_to.find(row.handle);
+        if (found != moved_to.end()) {
+            row.handle = found->second;
+            moved = true;
+        }
+    }
+    if (moved)
+        std::stable_sort(rows.begin(), rows.end(), [](const Entry &a, const Entry &b) { return a.handle < b.handle; });
+}
+
+void Catalog::load(DbRelation &tables, DbRelation &columns, DbRelation &indices) {
+    Catalog::tables.clear();
+    Catalog::storage.clear();
+    Catalog::columns.clear();
+    Catalog::indices.clear();
+
+    // scans go in handle order, so just append
+    DbCursor *cursor = tables.cursor(nullptr);
+    while (cursor->next()) {
+        ValueDict *row = cursor->project(nullptr);
+        Catalog::tables[row->at("table_name").s] = cursor->get_handle();
+        Catalog::storage[row->at("table_name").s] = row->at("storage").s;
+        delete row;
+    }
+    delete cursor;
+
+    cursor = columns.cursor(nullptr);
+    while (cursor->next()) {
+        ValueDict *row = cursor->project(nullptr);
+        Catalog::columns[row->at("table_name").s].push_back(column_row(cursor->get_handle(), row));
+        delete row;
+    }
+    delete cursor;
+
+    cursor = indices.cursor(nullptr);
+    while (cursor->next()) {
+        ValueDict *row = cursor->project(nullptr);
+        Catalog::indices[row->at("table_name").s].push_back(index_row(cursor->get_handle(), row));
+        delete row;
+    }
+    delete cursor;
+    Catalog::table_versions.clear();
+    Catalog::loaded_version = ++Catalog::version;
+}
+
+u_long Catalog::get_table_version(const Identifier &table_name) {
+    auto found = Catalog::table_versions.find(table_name);
+    return found == Catalog::table_versions.end() ? Catalog::loaded_version : found->second;
+}
+
+// Note a change to a table's rows
+void Catalog::changed(const Identifier &table_name) {
+    Catalog::table_versions[table_name] = ++Catalog::version;
+}
+
+Handle Catalog::get_table_handle(const Identifier &table_name) {
+    auto found = Catalog::tables.find(table_name);
+    if (found == Catalog::tables.end())
+        throw DbRelationError("no such table " + table_name);
+    return found->second;
+}
+
+ColumnNames Catalog::get_table_names() {
+    std::vector<std::pair<Handle, Identifier>> by_handle;
+    for (auto const &table: Catalog::tables)
+        by_handle.push_back(std::make_pair(table.second, table.first));
+    std::sort(by_handle.begin(), by_handle.end());
+    ColumnNames table_names;
+    for (auto const &table: by_handle)
+        table_names.push_back(table.second);
+    return table_names;
+}
+
+const Catalog::ColumnRows &Catalog::get_columns(const Identifier &table_name) {
+    static const ColumnRows none;
+    auto found = Catalog::columns.find(table_name);
+    return found == Catalog::columns.end() ? none : found->second;
+}
+
+const Catalog::IndexRows &Catalog::get_indices(const Identifier &table_name) {
+    static const IndexRows none;
+    auto found = Catalog::indices.find(table_name);
+    return found == Catalog::indices.end() ? none : found->second;
+}
+
+std::string Catalog::get_table_storage(const Identifier &table_name) {
+    auto found = Catalog::storage.find(table_name);
+    return found == Catalog::storage.end() ? Tables::HEAP_STORAGE : found->second;
+}
+
+void Catalog::add_table(const Identifier &table_name, Handle handle, const std::string &storage) {
+    Catalog::tables[table_name] = handle;
+    Catalog::storage[table_name] = storage;
+    changed(table_name);
+}
+
+void Catalog::remove_table(const Identifier &table_name) {
+    Catalog::tables.erase(table_name);
+    Catalog::storage.erase(table_name);
+    changed(table_name);
+}
+
+void Catalog::add_column(const Identifier &table_name, const ColumnRow &row) {
+    insert_by_handle(Catalog::columns[table_name], row);
+    changed(table_name);
+}
+
+void Catalog::remove_column(const Identifier &table_name, Handle handle) {
+    auto found = Catalog::columns.find(table_name);
+    if (found != Catalog::columns.end()) {
+        erase_by_handle(found->second, handle);
+        if (found->second.empty())
+            Catalog::columns.erase(found);
+    }
+    changed(table_name);
+}
+
+void Catalog::add_index_column(const Identifier &table_name, const IndexRow &row) {
+    insert_by_handle(Catalog::indices[table_name], row);
+    changed(table_name);
+}
+
+void Catalog::remove_index_column(const Identifier &table_name, Handle handle) {
+    auto found = Catalog::indices.find(table_name);
+    if (found != Catalog::indices.end()) {
+        erase_by_handle(found->second, handle);
+        if (found->second.empty())
+            Catalog::indices.erase(found);
+    }
+    changed(table_name);
+}
+
+void Catalog::relocate(const Identifier &schema_table, const Relocations *moves) {
+    std::map<Handle, Handle> moved_to(moves->begin(), moves->end());
+    if (schema_table == Tables::TABLE_NAME) {
+        for (auto &table: Catalog::tables) {
+            auto found = moved_to.find(table.second);
+            if (found != moved_to.end())
+                table.second = found->second;
+        }
+    } else if (schema_table == Columns::TABLE_NAME) {
+        for (auto &table: Catalog::columns)
+            relocate_rows(table.second, moved_to);
+    } else if (schema_table == Indices::TABLE_NAME) {
+        for (auto &table: Catalog::indices)
+            relocate_rows(table.second, moved_to);
+    }
+    Catalog::version++;
+}
+
+Catalog::ColumnRow Catalog::column_row(Handle handle, const ValueDict *row) {
+    ColumnRow column;
+    column.handle = handle;
+    column.column_name = row->at("column_name").s;
+    column.data_type = row->at("data_type").s;
+    return column;
+}
+
+Catalog::IndexRow Catalog::index_row(Handle handle, const ValueDict *row) {
+    IndexRow index_column;
+    index_column.handle = handle;
+    index_column.index_name = row->at("index_name").s;
+    index_column.seq_in_index = row->at("seq_in_index").n;
+    index_column.column_name = row->at("column_name").s;
+    index_column.index_type = row->at("index_type").s;
+    index_column.is_unique = row->at("is_unique").n != 0;
+    return index_column;
 }
 
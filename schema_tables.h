@@ -2,15 +2,21 @@
  * @file schema_tables.h - schema table classes:
  * 		Columns
  * 		Tables
+ * 		Indices
+ * 		Statistics
+ * 		Catalog
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
 #pragma once
 
+#include <mutex>
+#include <unordered_map>
 #include "heap_storage.h"
+#include "ColumnStatistics.h"
 
 /**
- * Initialize access to the schema tables.
+ * Initialize access to the schema tables (and load the Catalog from them).
  * Must be called before anything else is done with any of the schema
  * data structures.
  */
@@ -18,11 +24,11 @@ void initialize_schema_tables();
 
 
 class Columns; // forward declare
+class Statistics;
 
 /**
  * @class Tables - The singleton table that stores the metadata for all other tables.
- * For now, we are not indexing anything, so a query requires sequential scan
- * of the table.
+ * Lookups are answered from the Catalog rather than by scanning the schema tables.
  */
 class Tables : public HeapTable {
 public:
@@ -31,6 +37,12 @@ public:
      */
     static const Identifier TABLE_NAME;
 
+    /**
+     * Values of the storage column: a HeapTable, or a ColumnTable (CREATE TABLE ... WITH (storage=column))
+     */
+    static const std::string HEAP_STORAGE;
+    static const std::string COLUMN_STORAGE;
+
     // ctor/dtor
     Tables();
 
@@ -43,6 +55,13 @@ public:
 
     virtual void del(Handle handle);
 
+    /**
+     * Give a _tables from before there was a storage column its row in _columns (its old rows are still read,
+     * as heap tables).
+     * @param columns  the _columns table
+     */
+    void add_storage_column(Columns &columns);
+
     /**
      * Get the columns and their attributes for a given table.
      * @param table_name         table to get column info for
@@ -60,6 +79,18 @@ public:
      */
     static DbRelation &get_table(Identifier table_name);
 
+    /**
+     * Get the _statistics table (the one instance, so its cached statistics stay current).
+     * @returns  the statistics table
+     */
+    static Statistics &get_statistics_table() { return *statistics_table; }
+
+    /**
+     * Throw away the tables instantiated so far, other than the schema tables themselves (e.g., after a transaction
+     * aborts, since they may have seen changes that never happened). Discard the indices' first: they refer to them.
+     */
+    static void discard_cache();
+
 protected:
     // hard-coded columns for _tables table
     static ColumnNames &COLUMN_NAMES();
@@ -69,9 +100,20 @@ protected:
     // keep a reference to the columns table (for get_columns method)
     static Columns *columns_table;
 
+    static Statistics *statistics_table;
+
+    virtual void unmarshal(const Dbt *data, Row &row) const;
+
+    using HeapTable::unmarshal;
+
+    virtual bool matches(const Dbt *data, const std::vector<const Value *> &where_by_column) const;
+
+    static bool is_old_row(const Dbt *data);
+
 private:
     // keep a cache of all the tables we've instantiated so far
     static std::map<Identifier, DbRelation *> table_cache;
+    static std::recursive_mutex cache_latch;  // so statements that only read can fill it in at the same time
 };
 
 
@@ -95,6 +137,8 @@ public:
 
     virtual Handle insert(const ValueDict *row);
 
+    virtual void del(Handle handle);
+
 protected:
     // hard-coded columns for the _columns table
     static ColumnNames &COLUMN_NAMES();
@@ -144,6 +188,19 @@ public:
      */
     virtual IndexNames get_index_names(Identifier table_name);
 
+    /**
+     * Build an index over again from the rows now in its table, with its bulk loader.
+     * @param table_name  what table the index is on
+     * @param index_name  name of index
+     * @returns           the new DbIndex for it
+     */
+    virtual DbIndex &rebuild_index(Identifier table_name, Identifier index_name);
+
+    /**
+     * Throw away all the indices instantiated so far (see Tables::discard_cache).
+     */
+    static void discard_cache();
+
     // overrides
     virtual Handle insert(const ValueDict *row);
 
@@ -156,5 +213,218 @@ protected:
 
 private:
     static std::map<std::pair<Identifier, Identifier>, DbIndex *> index_cache;
+    static std::recursive_mutex cache_latch;
 };
 
+
+/**
+ * @class Statistics - The singleton table that stores what ANALYZE found out about each table, a row per column.
+ * A table's statistics are read in the first time they are asked for, and kept in memory from then on.
+ */
+class Statistics : public HeapTable {
+public:
+    /**
+     * Name of the statistics table ("_statistics")
+     */
+    static const Identifier TABLE_NAME;
+
+    // ctor/dtor
+    Statistics();
+
+    virtual ~Statistics() {}
+
+    /**
+     * Add rows for this table to _tables and _columns (it came along later than the other schema tables, so
+     * a database may have been made without it).
+     * @param tables   the _tables table
+     * @param columns  the _columns table
+     */
+    virtual void add_to_schema(Tables &tables, Columns &columns);
+
+    /**
+     * Replace a table's statistics.
+     * @param table_name  the table
+     * @param statistics  its new statistics
+     */
+    virtual void put(const Identifier &table_name, const TableStatistics &statistics);
+
+    /**
+     * Get a table's statistics.
+     * @param table_name  the table
+     * @returns           its statistics (good until they are next put or removed), or nullptr if it hasn't been
+     *                    analyzed
+     */
+    virtual const TableStatistics *get(const Identifier &table_name);
+
+    /**
+     * Forget a table's statistics (e.g., when it is dropped).
+     * @param table_name  the table
+     */
+    virtual void remove(const Identifier &table_name);
+
+    /**
+     * Forget all the statistics read in so far (see Tables::discard_cache).
+     */
+    static void discard_cache();
+
+protected:
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+
+private:
+    // statistics read in (or put) so far, with nullptr for tables known to have none
+    static std::map<Identifier, TableStatistics *> cache;
+    static std::recursive_mutex cache_latch;
+};
+
+
+/**
+ * @class Catalog - in-memory copy of the rows of _tables, _columns, and _indices
+ *
+ *      Loaded once by initialize_schema_tables() and from then on kept up to date by the schema tables' own
+ *      insert() and del(), so that finding a table's columns or indices is a hash lookup instead of a scan. A
+ *      table's rows are kept in handle order, which is the order a scan of the schema table finds them in.
+ *
+ *      The version goes up with every change, so anything worked out from the catalog (e.g., a query plan) can
+ *      tell when it may be out of date. Each table also keeps the version of the last change to its own rows (in
+ *      any of the schema tables), for things that only depend on the one table.
+ */
+class Catalog {
+public:
+    /**
+     * A row of _columns.
+     */
+    class ColumnRow {
+    public:
+        Handle handle;
+        Identifier column_name;
+        std::string data_type;
+    };
+
+    /**
+     * A row of _indices.
+     */
+    class IndexRow {
+    public:
+        Handle handle;
+        Identifier index_name;
+        int seq_in_index;
+        Identifier column_name;
+        std::string index_type;
+        bool is_unique;
+    };
+
+    typedef std::vector<ColumnRow> ColumnRows;
+    typedef std::vector<IndexRow> IndexRows;
+
+    /**
+     * Read in all the rows of the schema tables (forgetting anything from before).
+     * @param tables   the _tables table
+     * @param columns  the _columns table
+     * @param indices  the _indices table
+     */
+    static void load(DbRelation &tables, DbRelation &columns, DbRelation &indices);
+
+    /**
+     * Accessor for the version, which goes up with every change to the catalog.
+     * @returns  current version
+     */
+    static u_long get_version() { return version; }
+
+    /**
+     * The version as of the last change to a table's rows in _tables, _columns, or _indices.
+     * @param table_name  table to look up
+     * @returns           version of its last change (or of the last load(), if it hasn't changed since)
+     */
+    static u_long get_table_version(const Identifier &table_name);
+
+    /**
+     * Whether there is a row in _tables for a table.
+     * @param table_name  table to look for
+     * @returns           true if there is
+     */
+    static bool has_table(const Identifier &table_name) { return tables.find(table_name) != tables.end(); }
+
+    /**
+     * Where a table's row in _tables is.
+     * @param table_name  table to look up
+     * @returns           handle of its row
+     * @throws DbRelationError if there is no such table
+     */
+    static Handle get_table_handle(const Identifier &table_name);
+
+    /**
+     * All the tables, schema tables included.
+     * @returns  table names, in the order of their rows in _tables
+     */
+    static ColumnNames get_table_names();
+
+    /**
+     * A table's rows in _columns.
+     * @param table_name  table to look up
+     * @returns           its rows (empty if there are none), good until the next change to the catalog
+     */
+    static const ColumnRows &get_columns(const Identifier &table_name);
+
+    /**
+     * A table's rows in _indices, for all of its indices.
+     * @param table_name  table to look up
+     * @returns           its rows (empty if there are none), good until the next change to the catalog
+     */
+    static const IndexRows &get_indices(const Identifier &table_name);
+
+    /**
+     * How a table is stored.
+     * @param table_name  table to look up
+     * @returns           its storage in _tables, e.g., Tables::COLUMN_STORAGE (HEAP_STORAGE if there's no such table)
+     */
+    static std::string get_table_storage(const Identifier &table_name);
+
+    // changes (made by the schema tables as their rows change)
+    static void add_table(const Identifier &table_name, Handle handle, const std::string &storage);
+
+    static void remove_table(const Identifier &table_name);
+
+    static void add_column(const Identifier &table_name, const ColumnRow &row);
+
+    static void remove_column(const Identifier &table_name, Handle handle);
+
+    static void add_index_column(const Identifier &table_name, const IndexRow &row);
+
+    static void remove_index_column(const Identifier &table_name, Handle handle);
+
+    /**
+     * Follow the rows of a schema table that were moved (by a vacuum).
+     * @param schema_table  which schema table the rows were moved in
+     * @param moves         old and new handle of each moved row
+     */
+    static void relocate(const Identifier &schema_table, const Relocations *moves);
+
+    /**
+     * Note that a table's statistics changed (which may change the best plans for it).
+     * @param table_name  the table
+     */
+    static void statistics_changed(const Identifier &table_name) { changed(table_name); }
+
+    /**
+     * Note that one of a table's indices was built over again (so the plans using the old one are out of date).
+     * @param table_name  the table
+     */
+    static void index_rebuilt(const Identifier &table_name) { changed(table_name); }
+
+    static ColumnRow column_row(Handle handle, const ValueDict *row);
+
+    static IndexRow index_row(Handle handle, const ValueDict *row);
+
+protected:
+    static u_long version;
+    static u_long loaded_version;  // version as of the last load()
+    static std::unordered_map<Identifier, Handle> tables;
+    static std::unordered_map<Identifier, std::string> storage;
+    static std::unordered_map<Identifier, ColumnRows> columns;
+    static std::unordered_map<Identifier, IndexRows> indices;
+    static std::unordered_map<Identifier, u_long> table_versions;  // changed since load() (kept even if dropped)
+
+    static void changed(const Identifier &table_name);
+};
@@ -3,6 +3,8 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
+#include <climits>
+#include <csignal>
 #include <cstdlib>
 #include <iostream>
 #include <string>
@@ -11,6 +13,10 @@
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
 #include "btree.h"
+#include "HashIndex.h"
+#include "ColumnTable.h"
+#include "Server.h"
+#include "Transaction.h"
 
 using namespace std;
 using namespace hsql;
@@ -20,59 +26,100 @@ using namespace hsql;
  */
 void initialize_environment(char *envHome);
 
-
 /**
- * Main entry point of the sql5300 program
- * @args dbenvpath  the path to the BerkeleyDB database environment
+ * @class ShellSession - the session on standard input and output, which also runs the tests
  */
-int main(int argc, char *argv[]) {
+class ShellSession : public Session {
+public:
+    ShellSession() : Session(cin, cout) {}
 
-    // Open/create the db environment
-    if (argc != 2) {
-        cerr << "Usage: cpsc5300: dbenvpath" << endl;
-        return EXIT_FAILURE;
-    }
-    initialize_environment(argv[1]);
-
-    // Enter the SQL shell loop
-    while (true) {
-        cout << "SQL> ";
-        string query;
-        getline(cin, query);
-        if (query.length() == 0)
-            continue;  // blank line -- just skip
-        if (query == "quit")
-            break;  // only way to get out
+protected:
+    virtual bool command(const string &query) {
         if (query == "test") {
             cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
             cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
-            continue;
+            cout << "test_hash_index: " << (test_hash_index() ? "ok" : "failed") << endl;
+            cout << "test_column_table: " << (test_column_table() ? "ok" : "failed") << endl;
+            cout << "test_parallel_scan: " << (test_parallel_scan() ? "ok" : "failed") << endl;
+            cout << "test_group_table: " << (test_group_table() ? "ok" : "failed") << endl;
+            cout << "test_hash_join: " << (test_hash_join() ? "ok" : "failed") << endl;
+            cout << "test_arena: " << (test_arena() ? "ok" : "failed") << endl;
+            cout << "test_server: " << (test_server() ? "ok" : "failed") << endl;
+            cout << "test_transaction: " << (test_transaction() ? "ok" : "failed") << endl;
+            return true;
         }
         if (query == "test2" || query == "test queries") {
             cout << "Test for Milestone 5:\n" << (test_queries() ? "Tests passed" :  "Tests failed") << endl;
-            continue;
+            return true;
         }
+        return Session::command(query);
+    }
+};
+
+static Server *server = nullptr;
+
+// SIGINT or SIGTERM: stop serving (and so write everything back) rather than just dying
+static void stop_server(int) {
+    if (server != nullptr)
+        server->stop();
+}
 
-        // parse and execute
-        SQLParserResult *parse = SQLParser::parseSQLString(query);
-        if (!parse->isValid()) {
-            cout << "invalid SQL: " << query << endl;
-            cout << parse->errorMsg() << endl;
+/**
+ * Main entry point of the sql5300 program
+ * @args dbenvpath  the path to the BerkeleyDB database environment
+ * @args --port     to serve clients on a TCP port rather than run the shell on standard input
+ * @args --threads  how many clients are served at once (default Server::DEFAULT_THREADS)
+ * @args --commit-delay  microseconds a log flush waits for more commits to join it (default 0)
+ * @args --commit-batch  commits that start a log flush without waiting out the delay (default 64)
+ */
+int main(int argc, char *argv[]) {
+    bool serving = false, usage = argc < 2 || argc % 2 != 0;
+    long port = 0, threads = Server::DEFAULT_THREADS;
+    long delay_us = GroupCommit::DEFAULT_DELAY_US, batch = GroupCommit::DEFAULT_BATCH;
+    for (int i = 2; !usage && i < argc; i += 2) {
+        if (string(argv[i]) == "--port") {
+            serving = true;
+            port = strtol(argv[i + 1], nullptr, 10);
+        } else if (string(argv[i]) == "--threads") {
+            threads = strtol(argv[i + 1], nullptr, 10);
+        } else if (string(argv[i]) == "--commit-delay") {
+            delay_us = strtol(argv[i + 1], nullptr, 10);
+        } else if (string(argv[i]) == "--commit-batch") {
+            batch = strtol(argv[i + 1], nullptr, 10);
         } else {
-            for (uint i = 0; i < parse->size(); ++i) {
-                const SQLStatement *statement = parse->getStatement(i);
-                try {
-                    cout << ParseTreeToString::statement(statement) << endl;
-                    QueryResult *result = SQLExec::execute(statement);
-                    cout << *result << endl;
-                    delete result;
-                } catch (SQLExecError &e) {
-                    cout << "Error: " << e.what() << endl;
-                }
-            }
+            usage = true;
+        }
+    }
+    if (usage || port < 0 || port > UINT16_MAX || threads <= 0 || delay_us < 0 || delay_us > UINT_MAX || batch <= 0 ||
+        batch > UINT_MAX) {
+        cerr << "Usage: cpsc5300: dbenvpath [--port port [--threads threads]] [--commit-delay microseconds] "
+                "[--commit-batch commits]" << endl;
+        return EXIT_FAILURE;
+    }
+    GroupCommit::configure((uint) delay_us, (uint) batch);
+
+    // Open/create the db environment
+    initialize_environment(argv[1]);
+
+    if (!serving) {
+        // Enter the SQL shell loop
+        ShellSession().run();
+    } else {
+        try {
+            Server listening((uint16_t) port, (uint) threads);
+            cout << "(sql5300: serving on port " << listening.get_port() << ", " << threads << " at a time)" << endl;
+            server = &listening;
+            signal(SIGINT, stop_server);
+            signal(SIGTERM, stop_server);
+            listening.serve();
+            server = nullptr;
+        } catch (ServerError &e) {
+            cerr << "(sql5300: " << e.what() << ")" << endl;
+            return EXIT_FAILURE;
         }
-        delete parse;
     }
+    HeapFile::flush_all();
+    _DB_ENV->txn_checkpoint(0, 0, 0);  // so that recovery next time has little of the log to go through
     return EXIT_SUCCESS;
 }
 
@@ -85,7 +132,14 @@ void initialize_environment(char *envHome) {
     env->set_message_stream(&cout);
     env->set_error_stream(&cerr);
     try {
-        env->open(envHome, DB_CREATE | DB_INIT_MPOOL, 0);
+        // DB_THREAD since a server's sessions share the handles. Each statement that changes anything does so in a
+        // transaction (see Transaction), logged ahead and recovered after a crash; commits don't flush the log,
+        // since GroupCommit does that for many at once; calls made outside a transaction are each one by themselves
+        env->set_flags(DB_AUTO_COMMIT, 1);
+        env->set_flags(DB_TXN_WRITE_NOSYNC, 1);
+        env->set_lk_detect(DB_LOCK_DEFAULT);
+        env->open(envHome, DB_CREATE | DB_INIT_MPOOL | DB_INIT_TXN | DB_INIT_LOCK | DB_INIT_LOG | DB_RECOVER |
+                           DB_THREAD, 0);
     } catch (DbException &exc) {
         cerr << "(sql5300: " << exc.what() << ")" << endl;
         exit(1);
@@ -4,14 +4,15 @@
  * @see "Seattle University, CPSC5300, Spring 2022"
  */
 #include <algorithm>
+#include <cstring>
 #include "storage_engine.h"
 
 bool Value::operator==(const Value &other) const {
     if (this->data_type != other.data_type)
         return false;
-    if (this->data_type == ColumnAttribute::INT)
-        return this->n == other.n;
-    return this->s == other.s;
+    if (this->data_type == ColumnAttribute::TEXT)
+        return this->s == other.s;
+    return this->n == other.n;  // INT or BOOLEAN
 }
 
 bool Value::operator!=(const Value &other) const {
@@ -49,6 +50,155 @@ std::ostream &operator<<(std::ostream &out, const Value &value) {
 }
 
 
+Row::Row(const Row &other) : fields(), text() {
+    copy(other);
+}
+
+Row &Row::operator=(const Row &other) {
+    if (this != &other)
+        copy(other);
+    return *this;
+}
+
+// Take other's fields, copying all the TEXT bytes into our own buffer
+void Row::copy(const Row &other) {
+    this->fields = other.fields;
+    this->text.clear();
+    size_t total = 0;
+    for (auto const &field: other.fields)
+        if (field.data_type == ColumnAttribute::TEXT)
+            total += field.size;
+    this->text.reserve(total);
+    for (uint i = 0; i < this->fields.size(); i++) {
+        Field &field = this->fields[i];
+        if (field.data_type != ColumnAttribute::TEXT)
+            continue;
+        const char *s = other.get_s(i);
+        field.view = nullptr;
+        field.offset = (u_int32_t) this->text.size();
+        this->text.insert(this->text.end(), s, s + field.size);
+    }
+}
+
+void Row::append_int(int32_t n) {
+    Field field = {ColumnAttribute::INT, n, nullptr, 0, 0};
+    this->fields.push_back(field);
+}
+
+void Row::append_boolean(int32_t n) {
+    Field field = {ColumnAttribute::BOOLEAN, n, nullptr, 0, 0};
+    this->fields.push_back(field);
+}
+
+void Row::append_text(const char *s, u_int16_t size) {
+    Field field = {ColumnAttribute::TEXT, 0, nullptr, (u_int32_t) this->text.size(), size};
+    this->text.insert(this->text.end(), s, s + size);
+    this->fields.push_back(field);
+}
+
+void Row::append_text_view(const char *s, u_int16_t size) {
+    Field field = {ColumnAttribute::TEXT, 0, s, 0, size};
+    this->fields.push_back(field);
+}
+
+void Row::append(const Value &value) {
+    if (value.data_type == ColumnAttribute::TEXT) {
+        if (value.s.length() > UINT16_MAX)
+            throw DbRelationError("text field too long");
+        append_text(value.s.data(), (u_int16_t) value.s.length());
+    } else if (value.data_type == ColumnAttribute::BOOLEAN) {
+        append_boolean(value.n);
+    } else {
+        append_int(value.n);
+    }
+}
+
+void Row::append(const Row &other, uint i) {
+    const Field &field = other.fields[i];
+    if (field.data_type == ColumnAttribute::TEXT && field.view == nullptr)
+        append_text(other.get_s(i), field.size);
+    else
+        this->fields.push_back(field);
+}
+
+Value Row::get_value(uint i) const {
+    const Field &field = this->fields[i];
+    Value value;
+    value.data_type = field.data_type;
+    if (field.data_type == ColumnAttribute::TEXT)
+        value.s.assign(get_s(i), field.size);
+    else
+        value.n = field.n;
+    return value;
+}
+
+bool Row::equals(uint i, const Value &value) const {
+    const Field &field = this->fields[i];
+    if (field.data_type != value.data_type)
+        return false;
+    if (field.data_type == ColumnAttribute::TEXT)
+        return value.s.length() == field.size && memcmp(value.s.data(), get_s(i), field.size) == 0;
+    return value.n == field.n;
+}
+
+ValueDict *Row::to_dict(const ColumnNames &column_names) const {
+    ValueDict *dict = new ValueDict();
+    for (uint i = 0; i < this->fields.size() && i < column_names.size(); i++)
+        (*dict)[column_names[i]] = get_value(i);
+    return dict;
+}
+
+void Row::assign(const ValueDict &dict, const ColumnNames &column_names) {
+    clear();
+    reserve((uint) column_names.size());
+    for (auto const &column_name: column_names) {
+        auto column = dict.find(column_name);
+        if (column == dict.end())
+            throw DbRelationError("unknown column " + column_name);
+        append(column->second);
+    }
+}
+
+
+/**
+ * Figure out which column numbers a projection wants.
+ * @param column_names  columns to project (nullptr or empty for all)
+ * @return              column number of each of column_names, in order (empty for all)
+ * @throws              DbRelationError if column_names has a column we don't have
+ */
+std::vector<uint> DbRelation::bind_columns(const ColumnNames *column_names) const {
+    std::vector<uint> positions;
+    if (column_names == nullptr || column_names->empty())
+        return positions;
+    positions.reserve(column_names->size());
+    for (auto const &column_name: *column_names) {
+        auto it = std::find(this->column_names.begin(), this->column_names.end(), column_name);
+        if (it == this->column_names.end())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        positions.push_back((uint) (it - this->column_names.begin()));
+    }
+    return positions;
+}
+
+/**
+ * Figure out where each of our columns is in rows laid out by the given column names.
+ * @param column_names  which column each position of the rows is for
+ * @return              for each of our columns, its position in the rows
+ * @throws              DbRelationError if a column is missing or unknown
+ */
+std::vector<uint> DbRelation::bind_row(const ColumnNames *column_names) const {
+    bind_columns(column_names);  // check for unknown columns
+    std::vector<uint> positions;
+    positions.reserve(this->column_names.size());
+    for (auto const &column_name: this->column_names) {
+        auto it = std::find(column_names->begin(), column_names->end(), column_name);
+        if (it == column_names->end())
+            throw DbRelationError("don't know how to handle NULLs, defaults, etc. yet");
+        positions.push_back((uint) (it - column_names->begin()));
+    }
+    return positions;
+}
+
 // Get only selected column attributes
 ColumnAttributes *DbRelation::get_column_attributes(const ColumnNames &select_column_names) const {
     ColumnAttributes *ret = new ColumnAttributes();
@@ -98,3 +248,110 @@ ValueDicts *DbRelation::project(Handles *handles, const ValueDict *where) {
         ret->push_back(project(handle, &t));
     return ret;
 }
+
+// Two passes: get the handles, then project each of them
+ValueDicts *DbRelation::select_project(const ValueDict *where, const ColumnNames *column_names) {
+    Handles *handles = select(where);
+    ValueDicts *ret = column_names == nullptr ? project(handles) : project(handles, column_names);
+    delete handles;
+    return ret;
+}
+
+
+/**
+ * @class HandlesCursor - DbCursor over an already materialized list of handles
+ */
+class HandlesCursor : public DbCursor {
+public:
+    HandlesCursor(DbRelation &relation, Handles *handles) : relation(relation), handles(handles), i(0) {}
+
+    virtual ~HandlesCursor() { delete handles; }
+
+    virtual bool next() { return ++i <= handles->size(); }
+
+    virtual Handle get_handle() const { return (*handles)[i - 1]; }
+
+    virtual ValueDict *project(const ColumnNames *column_names) {
+        if (column_names == nullptr)
+            return relation.project(get_handle());
+        return relation.project(get_handle(), column_names);
+    }
+
+    virtual void project_row(const ColumnNames *column_names, Row &row) {
+        ValueDict *dict = project(column_names);
+        row.assign(*dict, column_names == nullptr ? relation.get_column_names() : *column_names);
+        delete dict;
+    }
+
+protected:
+    DbRelation &relation;
+    Handles *handles;
+    size_t i;
+};
+
+// Fall back on the materialized select
+DbCursor *DbRelation::cursor(const ValueDict *where) {
+    return new HandlesCursor(*this, select(where));
+}
+
+// Only relations that know about their blocks can be scanned a part at a time
+DbCursor *DbRelation::cursor(const ValueDict *where, BlockID first, BlockID last) {
+    throw DbRelationError("Not implemented: scanning part of " + this->table_name);
+}
+
+// One at a time, through the ValueDict interface
+Handles *DbRelation::insert_batch(const ColumnNames *column_names, const Rows *rows) {
+    Handles *handles = new Handles();
+    for (auto const &row: *rows) {
+        ValueDict *dict = row.to_dict(*column_names);
+        handles->push_back(insert(dict));
+        delete dict;
+    }
+    return handles;
+}
+
+// Everything the range cursor finds
+Handles *DbIndex::range(ValueDict *min_key, ValueDict *max_key) const {
+    DbIndexCursor *cursor = range_cursor(KeyBound(min_key), KeyBound(max_key));
+    Handles *handles = new Handles();
+    try {
+        while (cursor->next())
+            handles->push_back(cursor->get_handle());
+    } catch (...) {
+        delete cursor;
+        delete handles;
+        throw;
+    }
+    delete cursor;
+    return handles;
+}
+
+void DbIndex::insert_batch(const Handles *records) {
+    for (auto const &record: *records)
+        insert(record);
+}
+
+void DbIndex::del_batch(const Handles *records) {
+    for (auto const &record: *records)
+        del(record);
+}
+
+// Go through the rows without projecting any of them
+u_long DbRelation::count() {
+    DbCursor *rows = cursor(nullptr);
+    u_long n = 0;
+    try {
+        while (rows->next())
+            n++;
+    } catch (...) {
+        delete rows;
+        throw;
+    }
+    delete rows;
+    return n;
+}
+
+// Nothing to give back unless the storage engine knows how
+Relocations *DbRelation::vacuum(bool relocate) {
+    return new Relocations();
+}
@@ -38,6 +38,7 @@ typedef std::length_error DbBlockNoRoomError;
  * 	put(record_id, data)
  * 	del(record_id)
  * 	ids()
+ * 	next_id(record_id)
  * Accessors:
  * 	get_block()
  * 	get_data()
@@ -46,9 +47,11 @@ typedef std::length_error DbBlockNoRoomError;
 class DbBlock {
 public:
     /**
-     * our blocks are 4kB
+     * our blocks are 4kB unless their file was created with bigger ones (up to 64kB, so that every offset within
+     * a block still fits in the two bytes a SlottedPage gives it)
      */
     static const uint BLOCK_SZ = 4096;
+    static const uint MAX_BLOCK_SZ = 65536;
 
     /**
      * ctor/dtor (subclasses should handle the big-5)
@@ -93,6 +96,13 @@ public:
      */
     virtual RecordIDs *ids() const = 0;
 
+    /**
+     * Get the next record id in this block (excluding deleted ones) without building a list.
+     * @param record_id  the record before the one wanted (0 to get the first)
+     * @returns          the next record id, or 0 if there are no more
+     */
+    virtual RecordID next_id(RecordID record_id) const = 0;
+
     /**
      * Delete all the records from this block.
      */
@@ -122,11 +132,17 @@ public:
      */
     virtual void *get_data() { return block.get_data(); }
 
+    /**
+     * Get the size of this block, which is the block size of the file it belongs to.
+     * @returns  number of bytes in the block
+     */
+    virtual uint get_block_size() const { return block.get_size(); }
+
     /**
      * Get this block's BlockID within its DbFile.
      * @returns this block's id
      */
-    virtual BlockID get_block_id() { return block_id; }
+    virtual BlockID get_block_id() const { return block_id; }
 
 protected:
     Dbt block;
@@ -134,7 +150,7 @@ protected:
 };
 
 // convenience type alias
-typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<BlockID> BlockIDs;  // for streaming, see BlockCursor in HeapFile.h
 
 /**
  * @class DbFile - abstract base class which represents a disk-based collection of DbBlocks
@@ -145,6 +161,7 @@ typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an
  * 	get_new()
  *	get(block_id)
  *	put(block)
+ *	unpin(block)
  *	block_ids()
  */
 class DbFile {
@@ -176,23 +193,29 @@ public:
 
     /**
      * Add a new block for this file.
-     * @returns  the newly appended block
+     * @returns  the newly appended block (pinned, caller must unpin)
      */
     virtual DbBlock *get_new() = 0;
 
     /**
      * Get a specific block in this file.
      * @param block_id  which block to get
-     * @returns         pointer to the DbBlock (freed by caller)
+     * @returns         pointer to the DbBlock (pinned, caller must unpin)
      */
     virtual DbBlock *get(BlockID block_id) = 0;
 
     /**
      * Write a block to this file (the block knows its BlockID)
-     * @param block  block to write (overwrites existing block on disk)
+     * @param block  block to write (overwrites existing block on disk, possibly deferred)
      */
     virtual void put(DbBlock *block) = 0;
 
+    /**
+     * Release a block gotten from get() or get_new(). The block must not be used afterwards.
+     * @param block  block to release
+     */
+    virtual void unpin(DbBlock *block) = 0;
+
     /**
      * Get a list of all the valid BlockID's in the file
      * FIXME - not a good long-term approach, but we'll do this until we put in iterators
@@ -220,7 +243,7 @@ public:
 
     virtual ~ColumnAttribute() {}
 
-    virtual DataType get_data_type() { return data_type; }
+    virtual DataType get_data_type() const { return data_type; }
 
     virtual void set_data_type(DataType data_type) { this->data_type = data_type; }
 
@@ -258,7 +281,8 @@ typedef std::string Identifier;
 typedef std::vector<Identifier> ColumnNames;
 typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
-typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<Handle> Handles;  // for streaming, see DbCursor below
+typedef std::vector<std::pair<Handle, Handle>> Relocations;  // old handle, new handle
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict *> ValueDicts;
 
@@ -272,6 +296,142 @@ public:
 };
 
 
+/**
+ * @class Row - the values of a row laid out by column position (rather than in a ValueDict by name).
+ * Each field is a tagged value. TEXT fields are either views of bytes held elsewhere (e.g., in a pinned
+ * block, good only as long as that is) or copies kept in the row's own buffer. Copying a Row always
+ * copies the TEXT bytes, so a copy never refers to anything else.
+ */
+class Row {
+public:
+    Row() : fields(), text() {}
+
+    virtual ~Row() {}
+
+    Row(const Row &other);
+
+    Row(Row &&temp) = default;
+
+    Row &operator=(const Row &other);
+
+    Row &operator=(Row &&temp) = default;
+
+    uint size() const { return (uint) fields.size(); }
+
+    void clear() {
+        fields.clear();
+        text.clear();
+    }
+
+    void reserve(uint n) { fields.reserve(n); }
+
+    // Roughly how many bytes of memory the row takes up (not counting the bytes of any views)
+    size_t footprint() const { return sizeof(Row) + fields.capacity() * sizeof(Field) + text.capacity(); }
+
+    void append_int(int32_t n);
+
+    void append_boolean(int32_t n);
+
+    void append_text(const char *s, u_int16_t size);  // copied into this row
+
+    void append_text_view(const char *s, u_int16_t size);  // must outlive this row's use of it
+
+    void append(const Value &value);
+
+    void append(const Row &other, uint i);  // copy other's field i (views stay views)
+
+    ColumnAttribute::DataType get_data_type(uint i) const { return fields[i].data_type; }
+
+    int32_t get_n(uint i) const { return fields[i].n; }
+
+    const char *get_s(uint i) const { return fields[i].view != nullptr ? fields[i].view : text.data() + fields[i].offset; }
+
+    u_int16_t get_size(uint i) const { return fields[i].size; }
+
+    std::string get_string(uint i) const { return std::string(get_s(i), get_size(i)); }
+
+    Value get_value(uint i) const;
+
+    /**
+     * Compare a field to a Value (same semantics as Value::operator==).
+     */
+    bool equals(uint i, const Value &value) const;
+
+    /**
+     * Compatibility adapter: make a ValueDict out of this row.
+     * @param column_names  name of each field, in order
+     * @returns             dictionary of the values (freed by caller)
+     */
+    ValueDict *to_dict(const ColumnNames &column_names) const;
+
+    /**
+     * Compatibility adapter: replace this row's contents with values from a ValueDict.
+     * @param dict          values keyed by column name
+     * @param column_names  which values to take, in order
+     */
+    void assign(const ValueDict &dict, const ColumnNames &column_names);
+
+protected:
+    class Field {
+    public:
+        ColumnAttribute::DataType data_type;
+        int32_t n;         // INT or BOOLEAN value
+        const char *view;  // TEXT bytes held elsewhere, or nullptr if they are in text
+        u_int32_t offset;  // where the TEXT bytes are in text (when view is nullptr)
+        u_int16_t size;    // TEXT length
+    };
+
+    std::vector<Field> fields;
+    std::vector<char> text;
+
+    void copy(const Row &other);
+};
+
+typedef std::vector<Row> Rows;
+
+
+/**
+ * @class DbCursor - pull-based iteration over the selected rows of a DbRelation
+ * (returned by DbRelation::cursor)
+ *
+ * Methods:
+ * 	next()
+ * 	get_handle()
+ * 	project(column_names)
+ * 	project_row(column_names, row)
+ */
+class DbCursor {
+public:
+    virtual ~DbCursor() {}
+
+    /**
+     * Advance to the next selected row.
+     * @returns  false if there are no more rows
+     */
+    virtual bool next() = 0;
+
+    /**
+     * Handle of the current row (only valid after next() has returned true).
+     * @returns  handle to the current row
+     */
+    virtual Handle get_handle() const = 0;
+
+    /**
+     * Values of the current row (only valid after next() has returned true).
+     * @param column_names  list of column names to project (nullptr for all columns)
+     * @returns             dictionary of values from the current row (freed by caller)
+     */
+    virtual ValueDict *project(const ColumnNames *column_names) = 0;
+
+    /**
+     * Values of the current row by position (only valid after next() has returned true).
+     * @param column_names  list of column names to project, in order (nullptr for all columns)
+     * @param row           filled in with the values (any TEXT views are good until the next call to next())
+     */
+    virtual void project_row(const ColumnNames *column_names, Row &row) = 0;
+};
+
+
 /**
  * @class DbRelation - top-level object handling a physical database relation
  * 
@@ -284,12 +444,20 @@ public:
  * 	close()
  * 	
  *	insert(row)
+ *	insert_batch(column_names, rows)
  *	update(handle, new_values)
  *	del(handle)
  *	select()
  *	select(where)
  *	project(handle)
  *	project(handle, column_names)
+ *	select_project(where, column_names)
+ *	cursor(where)
+ *	count()
+ *	vacuum(relocate)
+ *	get_block_count()
+ *	set_block_size(block_size)
+ *	get_block_size()
  */
 class DbRelation {
 public:
@@ -335,6 +503,15 @@ public:
      */
     virtual Handle insert(const ValueDict *row) = 0;
 
+    /**
+     * Execute: INSERT INTO <table_name> (<column_names>) VALUES (<row>), (<row>), ...
+     * The default just inserts the rows one at a time; subclasses can do better.
+     * @param column_names  which column each position of the rows is for
+     * @param rows          values for the new rows
+     * @returns             handle of each inserted row, in order (freed by caller)
+     */
+    virtual Handles *insert_batch(const ColumnNames *column_names, const Rows *rows);
+
     /**
      * Conceptually, execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
      * where handle is sufficient to identify one specific record (e.g., returned
@@ -406,6 +583,76 @@ public:
 
     virtual ValueDicts *project(Handles *handles, const ValueDict *column_names);
 
+    /**
+     * Conceptually, execute: SELECT <column_names> FROM <table_name> WHERE <where>
+     * This is the same as project(select(where), column_names), but subclasses can do it
+     * in a single pass (e.g., reading each block once).
+     * @param where         where-clause predicates (nullptr for all rows)
+     * @param column_names  list of column names to project (nullptr for all columns)
+     * @returns             pointer to a list of projected rows (freed by caller)
+     */
+    virtual ValueDicts *select_project(const ValueDict *where, const ColumnNames *column_names);
+
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+     * but deliver the qualifying rows one at a time. The default materializes select(where);
+     * subclasses should stream.
+     * @param where  where-clause predicates (nullptr for all rows)
+     * @returns      a cursor positioned before the first qualifying row (freed by caller)
+     */
+    virtual DbCursor *cursor(const ValueDict *where);
+
+    /**
+     * Like cursor(where), but only over the rows stored in blocks first through last. Cursors over different
+     * blocks may be used at the same time from different threads (as long as nothing is changing the
+     * relation), which is how a scan gets split up among workers.
+     * @param where  where-clause predicates (nullptr for all rows)
+     * @param first  first block to scan
+     * @param last   last block to scan
+     * @returns      a cursor positioned before the first qualifying row in those blocks (freed by caller)
+     * @throws DbRelationError if the relation can't be scanned a part at a time (the default)
+     */
+    virtual DbCursor *cursor(const ValueDict *where, BlockID first, BlockID last);
+
+    /**
+     * Execute: SELECT COUNT(*) FROM <table_name>
+     * The default runs a cursor over the whole relation; subclasses may know without looking at the rows.
+     * @returns  number of rows
+     */
+    virtual u_long count();
+
+    /**
+     * Execute: VACUUM <table_name>
+     * Give back the space left behind by deleted rows.
+     * @param relocate  whether rows may be moved to other blocks (which changes their handles, so any
+     *                  indices have to be told)
+     * @returns         old and new handle of each row that was moved (freed by caller)
+     */
+    virtual Relocations *vacuum(bool relocate);
+
+    /**
+     * Rough size of the relation, for costing evaluation plans.
+     * @returns  number of blocks a scan of the relation reads
+     */
+    virtual uint32_t get_block_count() { return 1; }
+
+    /**
+     * Choose the size of the blocks of the relation's files (and of its indices' files), before create(). Existing
+     * files keep the block size they were created with.
+     * @param block_size  a power of two from DbBlock::BLOCK_SZ to DbBlock::MAX_BLOCK_SZ
+     * @throws DbRelationError if the relation doesn't support other block sizes or block_size isn't one
+     */
+    virtual void set_block_size(uint block_size) {
+        if (block_size != DbBlock::BLOCK_SZ)
+            throw DbRelationError(table_name + " only has " + std::to_string(DbBlock::BLOCK_SZ) + "-byte blocks");
+    }
+
+    /**
+     * Size of the blocks of the relation's files.
+     * @returns  number of bytes in each block
+     */
+    virtual uint get_block_size() { return DbBlock::BLOCK_SZ; }
+
     /**
      * Accessor for column_names.
      * @returns column_names   list of column names for this relation, in order
@@ -443,6 +690,57 @@ protected:
     Identifier table_name;
     ColumnNames column_names;
     ColumnAttributes column_attributes;
+
+    virtual std::vector<uint> bind_columns(const ColumnNames *column_names) const;
+
+    virtual std::vector<uint> bind_row(const ColumnNames *column_names) const;
+};
+
+
+/**
+ * @class KeyBound - one end of a range of index keys
+ *
+ * The key gives values for the leading columns of the index key (all of them, or just a prefix); keys are
+ * compared on just those columns. An empty key means the range is unbounded at this end.
+ */
+class KeyBound {
+public:
+    ValueDict key;
+    bool inclusive;  // whether keys equal to the bound are in the range
+
+    KeyBound() : key(), inclusive(true) {}
+
+    KeyBound(const ValueDict *key, bool inclusive = true) : key(), inclusive(inclusive) {
+        if (key != nullptr)
+            this->key = *key;
+    }
+
+    bool is_unbounded() const { return key.empty(); }
+};
+
+/**
+ * @class DbIndexCursor - pull-based iteration over the entries of an index, in key order
+ * (returned by DbIndex::range_cursor)
+ *
+ * Methods:
+ * 	next()
+ * 	get_handle()
+ */
+class DbIndexCursor {
+public:
+    virtual ~DbIndexCursor() {}
+
+    /**
+     * Advance to the next entry in the range.
+     * @returns  false if there are no more entries
+     */
+    virtual bool next() = 0;
+
+    /**
+     * Handle of the current entry's record (only valid after next() has returned true).
+     * @returns  handle (into relation) to the record
+     */
+    virtual Handle get_handle() const = 0;
 };
 
 
@@ -490,11 +788,19 @@ public:
 
     /**
      * Lookup a range of search keys.
-     * @param min_key  dictionary of min (inclusive) search key
-     * @param max_key  dictionary of max (inclusive) search key
-     * @returns        list of DbFile handles for records in range
+     * @param min_key  dictionary of min (inclusive) search key (nullptr for no minimum)
+     * @param max_key  dictionary of max (inclusive) search key (nullptr for no maximum)
+     * @returns        list of DbFile handles for records in range, in key order (freed by caller)
      */
-    virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const {
+    virtual Handles *range(ValueDict *min_key, ValueDict *max_key) const;
+
+    /**
+     * Walk through a range of search keys.
+     * @param min  lower end of the range
+     * @param max  upper end of the range
+     * @returns    a cursor positioned before the first entry in range (freed by caller)
+     */
+    virtual DbIndexCursor *range_cursor(const KeyBound &min, const KeyBound &max) const {
         throw DbRelationError("range index query not supported");
     }
 
@@ -505,6 +811,12 @@ public:
      */
     virtual void insert(Handle record) = 0;
 
+    /**
+     * Insert the index entries for many records. The default inserts them one at a time.
+     * @param records  handles (into relation) to the records to insert (must be in the relation)
+     */
+    virtual void insert_batch(const Handles *records);
+
     /**
      * Delete the index entry for the given record.
      * @param record  handle (into relation) to the record to remove
@@ -512,6 +824,49 @@ public:
      */
     virtual void del(Handle record) = 0;
 
+    /**
+     * Delete the index entries for many records. The default deletes them one at a time.
+     * @param records  handles (into relation) to the records to remove (must still be in the relation)
+     */
+    virtual void del_batch(const Handles *records);
+
+    /**
+     * Point the index entries for records that have moved (e.g., by vacuum) at their new handles.
+     * @param moves  old and new handle of each record (the records must be in the relation at the new handles)
+     */
+    virtual void relocate(const Relocations *moves) {
+        throw DbRelationError("index can't follow records that move");
+    }
+
+    /**
+     * Rough number of block reads to find the records whose leading key columns have given values, for costing
+     * evaluation plans.
+     * @param prefix_size    how many of the leading key columns have values (all of them for a lookup)
+     * @param table_blocks   size of the relation (see DbRelation::get_block_count)
+     * @param matching_rows  estimated number of records with those values (from ANALYZE), or negative if there
+     *                       is no estimate
+     * @returns              estimated cost, or a negative number if this index can't find records that way
+     */
+    virtual double lookup_cost(uint prefix_size, uint32_t table_blocks, double matching_rows) { return -1.0; }
+
+    /**
+     * Accessor for name.
+     * @returns  name of the index (unique by relation)
+     */
+    virtual Identifier get_name() const { return name; }
+
+    /**
+     * Accessor for key_columns.
+     * @returns  column names in the search key, in order
+     */
+    virtual const ColumnNames &get_key_columns() const { return key_columns; }
+
+    /**
+     * Accessor for unique.
+     * @returns  whether the search key is a key for the relation
+     */
+    virtual bool is_unique() const { return unique; }
+
 protected:
     DbRelation &relation;
     Identifier name;